@@ -21,6 +21,9 @@
 #include <string>
 #include <list>
 #include <map>
+#include <time.h>
+#include <glib.h>
+#include <json.h>
 #include <luna-service2/lunaservice.h>
 
 struct LSHandle;
@@ -56,9 +59,32 @@ private:
 
 	PrefsDb *	m_p_backupDb;
 
-	void copyKeysToBackupDb();
+	std::list<std::string>	m_backupKeys;			///< s_backupKeylistFilename, parsed
+	bool	m_backupKeysLoaded;
+	time_t	m_backupKeysMtime;						///< of s_backupKeylistFilename when m_backupKeys was read
+	gint64	m_backupJournalId;						///< PrefsDb journal position the last preBackup covered up to
+	gint64	m_backupGeneration;
+	bool	m_backupUnchanged;						///< nothing backed up changed since the incrementalKey of the last preBackup
+
+	const std::list<std::string>& backupKeys();
+	bool isIncrementalFrom(json_object* incrementalKey, gint64& r_generation);
+	void copyKeysToBackupDb(json_object* incrementalKey);
 	void initFilesForBackup(bool filenamesOnly);
 
+	// a postRestore whose backup dbs are being merged a step at a time; replied to when the last is in
+	struct Restore {
+		LSHandle* lshandle;
+		LSMessage* message;
+		std::list<std::string> dbFiles;
+		std::map<std::string,std::string> preRestorePrefs;
+	};
+	Restore*	m_restore;
+
+	void restoreNext();
+	void finishRestore();
+	static void cbRestoreProgress(int merged, int total, void* data);
+	static void cbRestoreMerged(bool ok, int merged, void* data);
+
 	static bool preBackupCallback( LSHandle* lshandle, LSMessage *message, void *user_data);
 	static bool postRestoreCallback( LSHandle* lshandle, LSMessage *message, void *user_data);
 
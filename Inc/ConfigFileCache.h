@@ -0,0 +1,79 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+
+#ifndef CONFIGFILECACHE_H
+#define CONFIGFILECACHE_H
+
+#include <string>
+#include <map>
+
+#include <sys/types.h>
+#include <json.h>
+
+/*
+ * The static config files (default prefs, locale and region lists, the customization info, ...) get read by
+ * several handlers, some of them more than once during startup. This keeps the contents of each, and the
+ * parsed json, for as long as a stat() of the file says it hasn't been replaced or modified.
+ */
+class ConfigFileCache
+{
+public:
+
+	static ConfigFileCache* instance();
+
+	// false if the file can't be read or is empty
+	bool readable(const std::string& path) { return lookup(path) != 0; }
+	bool text(const std::string& path, std::string& r_text);
+
+	// the contents parsed as json, or 0 if the file can't be read or parsed. Returns a reference of its own,
+	// json_object_put() it when done. It is shared with other callers, so it must not be modified
+	json_object* json(const std::string& path);
+
+	void invalidate(const std::string& path);
+
+private:
+
+	struct Entry {
+		dev_t dev;
+		ino_t ino;
+		off_t size;
+		time_t mtime;
+		long mtimeNsec;
+		std::string text;
+		bool parsed;
+		json_object* json;
+	};
+	typedef std::map<std::string, Entry> EntryMap;
+
+	ConfigFileCache();
+	~ConfigFileCache();
+
+	// the up to date entry for path, 0 if the file can't be read
+	Entry* lookup(const std::string& path);
+	static void clear(Entry& entry);
+
+	EntryMap m_entries;
+
+	static ConfigFileCache* s_instance;
+};
+
+#endif /* CONFIGFILECACHE_H */
@@ -18,31 +18,31 @@
 #define DEVICEINFORMATIONSERVICE_H
 
 #include <string>
-#include <map>
 
-#include <nyx/nyx_client.h>
 #include <luna-service2/lunaservice.h>
 
+#include "NyxInfoQuery.h"
+
 class DeviceInfoService
 {
 public:
-	typedef std::map<std::string, nyx_device_info_type_t> command_map_t;
-
 	static DeviceInfoService* instance();
 	void setServiceHandle(LSPalmService* service);
 	LSPalmService* serviceHandle() const;
 
 	static bool cbGetDeviceInformation(LSHandle* lshandle, LSMessage *message, void *user_data);
 
+	NyxInfoQuery* query() { return &m_query; }
+
 private:
 	DeviceInfoService();
 	~DeviceInfoService();
 
-	static void initCommandMap();
+	static nyx_error_t queryDeviceInfo(nyx_device_handle_t device, int item, const char** r_value);
 
 private:
 	LSPalmService* m_service;
-	static command_map_t s_commandMap;
+	NyxInfoQuery m_query;
 };
 
 #endif
@@ -0,0 +1,82 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef DIRECTORYWATCHER_H
+#define DIRECTORYWATCHER_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+/*
+ * inotify on the media partition dirs (wallpapers, ringtones), read on the main loop.
+ * Events for a dir are gathered for a moment before its callback runs, so a file being copied in or a
+ * temp file renamed over another shows up once, with whatever state it settled in.
+ */
+class DirectoryWatcher
+{
+public:
+
+	// name is a file in dir that appeared (present) or went away. An empty name means the watch was
+	// (re)established and anything in dir may have changed, e.g. after the media partition came back
+	typedef void (*Callback)(const std::string& name, bool present, void* data);
+
+	static DirectoryWatcher* instance();
+
+	bool watch(const std::string& dir, Callback callback, void* data);
+	bool isWatching(const std::string& dir) const;
+
+	// re-adds watches that were dropped (dir deleted, partition unmounted); their callbacks get an empty name.
+	// false if some dir still can't be watched
+	bool rearm();
+
+private:
+
+	struct Watch {
+		std::string dir;
+		Callback callback;
+		void* data;
+		int wd;
+		std::set<std::string> pending;
+	};
+
+	DirectoryWatcher();
+	~DirectoryWatcher();
+
+	bool open();
+	bool addWatch(Watch& watch);
+	void readEvents();
+	void flush();
+
+	static gboolean cbReadable(GIOChannel* channel, GIOCondition condition, gpointer data);
+	static gboolean cbSettled(gpointer data);
+
+	int m_fd;
+	guint m_ioSource;
+	guint m_settleSource;
+	std::vector<Watch> m_watches;
+
+	static DirectoryWatcher* s_instance;
+};
+
+#endif /* DIRECTORYWATCHER_H */
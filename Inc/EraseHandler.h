@@ -21,8 +21,10 @@
 #include <string>
 #include <list>
 #include <map>
+#include <glib.h>
 #include <luna-service2/lunaservice.h>
 #include <nyx/nyx_client.h>
+#include <nyx/client/nyx_system.h>
 
 struct LSHandle;
 struct LSMessage;
@@ -51,6 +53,24 @@ private:
     EraseHandler    ();
     ~EraseHandler   ();
 
+    // the erase in progress; nyx runs it on an Executor thread, everything else is on the main loop
+    struct Job
+    {
+        EraseType_t             type;
+        nyx_system_erase_type_t nyxType;
+        LSHandle*               handle;
+        LSMessage*              message;
+        bool                    subscribed;
+        gint64                  started;        // g_get_monotonic_time()
+        nyx_error_t             result;
+    };
+
+    static void     cbEraseWork(void* data);
+    static void     cbEraseDone(void* data);
+    static gboolean cbEraseProgress(gpointer data);
+    void            finishErase(Job* job);
+    void            replyProgress(Job* job, const char* state);
+
 
     static LSMethod    s_EraseServerMethods[];
     static EraseHandler* s_instance;
@@ -59,6 +79,9 @@ private:
 
     LSPalmService* m_service;
     LSHandle* m_serviceHandlePrivate;
+
+    Job* m_job;
+    guint m_progressSource;
 };
 
 
@@ -0,0 +1,82 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <glib.h>
+
+/*
+ * The shared pool of worker threads for anything that would otherwise block the main loop (file copies,
+ * sqlite maintenance, directory scans, nyx queries...). Work runs on one of a bounded number of threads,
+ * highest priority first and in submission order within a priority; its done callback then runs on the
+ * main loop. Without threads (workerThreads=0, or the pool couldn't start) work runs right in submit(),
+ * but done is still called from the main loop, so callers see the same order of events either way.
+ */
+class Executor
+{
+public:
+
+	enum Priority {
+		PriorityLow = 0,		// background upkeep nobody is waiting on
+		PriorityNormal,
+		PriorityHigh			// a bus reply is waiting on it
+	};
+
+	// work runs on a worker thread and must not touch main loop state; done runs on the main loop
+	typedef void (*Work)(void* data);
+	typedef void (*Done)(void* data);
+
+	static Executor* instance();
+
+	// any thread. done may be 0
+	void submit(Work work, Done done, void* data, Priority priority = PriorityNormal);
+
+	// submitted and not yet done (including done callbacks still to run)
+	int pending() const { return g_atomic_int_get(&m_pending); }
+
+	int threads() const;
+
+private:
+
+	struct Task {
+		Work work;
+		Done done;
+		void* data;
+		Priority priority;
+		guint seq;
+	};
+
+	Executor();
+	~Executor();
+
+	static void cbWorkerRun(gpointer data, gpointer user_data);
+	static gint cbCompareTasks(gconstpointer a, gconstpointer b, gpointer user_data);
+	static gboolean cbTaskDone(gpointer data);
+
+	GThreadPool* m_workers;
+	volatile gint m_seq;
+	volatile gint m_pending;
+
+	static Executor* s_instance;
+};
+
+#endif /* EXECUTOR_H */
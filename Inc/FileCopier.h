@@ -0,0 +1,67 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef FILECOPIER_H
+#define FILECOPIER_H
+
+#include <string>
+
+/*
+ * File copies run on the Executor's worker threads, so restoring the default ringtone and wallpaper (and
+ * whatever else goes to the media partition) doesn't hold up startup. The kernel does the copying where it
+ * can: a reflink, then copy_file_range(), then sendfile(), then plain read/write. The copy goes to a uniquely named hidden temp
+ * file next to the destination which is renamed over it at the end, so nobody sees half a file.
+ */
+class FileCopier
+{
+public:
+
+	// called on the main loop once the copy is done
+	typedef void (*Callback)(const std::string& src, const std::string& dest, bool ok, void* data);
+
+	static FileCopier* instance();
+
+	// callback may be 0
+	void copy(const std::string& src, const std::string& dest, Callback callback, void* data);
+
+	// the same copy, done right here
+	static bool copyFile(const std::string& src, const std::string& dest);
+
+private:
+
+	struct Job {
+		std::string src;
+		std::string dest;
+		Callback callback;
+		void* data;
+		bool ok;
+	};
+
+	FileCopier();
+	~FileCopier();
+
+	static void cbWorkerCopy(void* data);
+	static void cbCopyDone(void* data);
+
+	static FileCopier* s_instance;
+};
+
+#endif /* FILECOPIER_H */
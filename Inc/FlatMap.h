@@ -0,0 +1,92 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef FLATMAP_H
+#define FLATMAP_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+/*
+ * A map kept as one sorted vector, for tables that are built once and then only looked up (the zone indexes):
+ * no allocation per entry, and a lookup is a binary search over contiguous memory. Inserting anywhere but at
+ * the end moves the entries after it, so it isn't for tables that keep changing. Iterators are those of the
+ * vector and are invalidated by any insert.
+ */
+template <typename Key, typename Value>
+class FlatMap
+{
+public:
+
+	typedef std::pair<Key, Value> value_type;
+	typedef typename std::vector<value_type>::iterator iterator;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+	iterator begin()				{ return m_entries.begin(); }
+	iterator end()					{ return m_entries.end(); }
+	const_iterator begin() const	{ return m_entries.begin(); }
+	const_iterator end() const		{ return m_entries.end(); }
+
+	size_t size() const				{ return m_entries.size(); }
+	bool empty() const				{ return m_entries.empty(); }
+	void clear()					{ m_entries.clear(); }
+	void reserve(size_t n)			{ m_entries.reserve(n); }
+
+	iterator find(const Key& key) {
+		iterator it = lowerBound(key);
+		return (it != m_entries.end() && !(key < it->first)) ? it : m_entries.end();
+	}
+
+	const_iterator find(const Key& key) const {
+		const_iterator it = std::lower_bound(m_entries.begin(), m_entries.end(), key, KeyLess());
+		return (it != m_entries.end() && !(key < it->first)) ? it : m_entries.end();
+	}
+
+	// like std::map, an existing entry is left alone
+	std::pair<iterator, bool> insert(const value_type& entry) {
+		iterator it = lowerBound(entry.first);
+		if (it != m_entries.end() && !(entry.first < it->first))
+			return std::make_pair(it, false);
+		return std::make_pair(m_entries.insert(it, entry), true);
+	}
+
+	Value& operator[](const Key& key) {
+		return insert(value_type(key, Value())).first->second;
+	}
+
+private:
+
+	struct KeyLess {
+		bool operator()(const value_type& entry, const Key& key) const { return entry.first < key; }
+	};
+
+	iterator lowerBound(const Key& key) {
+		//appending in key order, the common way these get built, skips the search
+		if (m_entries.empty() || m_entries.back().first < key)
+			return m_entries.end();
+		return std::lower_bound(m_entries.begin(), m_entries.end(), key, KeyLess());
+	}
+
+	std::vector<value_type> m_entries;
+};
+
+#endif /* FLATMAP_H */
@@ -17,6 +17,23 @@
 #include <QtGui/QImageReader>
 #include <QtGui/QImage>
 
+// the factor readImageWithPrescale() decodes an image of size at
+double prescaleFactorFor(const QSize& size);
+
 bool readImageWithPrescale(QImageReader& reader, QImage& image, double& prescaleFactor);
 
+// true if all of reader's image, decoded, would take more than thresholdBytes. Only picks the path: over it,
+// readScaledRegion() decodes just the part needed at its final size, so what is held follows the output size,
+// not the threshold
+bool exceedsClippedDecodeSize(QImageReader& reader, size_t thresholdBytes);
+
+// decodes just region, given in the coordinates of the source scaled to scaledSize, in one pass of a single
+// reader, so the full image is never held (with handlers that clip in scaled coordinates, like jpeg, nothing
+// much beyond r_image is). The whole region comes out of one read, so memory goes with its size; there is no
+// cap on it. Whatever part of region lies outside the image stays black. False if the format's
+// handler can't decode a clipped part (the caller has to decode it the usual way, r_error is empty) or the
+// decode fails
+bool readScaledRegion(const QString& path, const QSize& scaledSize, const QRect& region,
+                      QImage& r_image, QString& r_error);
+
 
@@ -0,0 +1,47 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef IMAGEKERNELS_H
+#define IMAGEKERNELS_H
+
+#include <QtGui/QImage>
+
+/*
+ * Scaling and cropping for the wallpaper paths, working on the scanlines of the formats the decoders hand
+ * back (RGB32, ARGB32, RGB888) instead of going through QPainter. Halving uses NEON when the build targets
+ * it and the cpu has it, plain C otherwise.
+ */
+namespace ImageKernels
+{
+
+bool hasNeon();
+
+// smooth resize: 2x2 box averaging while the image is at least twice the size wanted, then one bilinear
+// pass. Other formats go through QImage::scaled(). The result has the format of image
+QImage scaled(const QImage& image, int width, int height);
+
+// width x height of image starting at (left, top), which may reach outside image; what does is black.
+// Only for opaque formats (a null image otherwise, so the caller can paint instead)
+QImage crop(const QImage& image, int width, int height, int left, int top);
+
+}
+
+#endif /* IMAGEKERNELS_H */
@@ -18,18 +18,38 @@
 #ifndef IMAGESERVICES_H
 #define IMAGESERVICES_H
 
+#include <map>
+#include <string>
+#include <vector>
 #include <luna-service2/lunaservice.h>
+#include <json.h>
 #include "MainLoopProvider.h"
+
+class QImageReader;
 class ImageServices
 {
 
 public:
+	// what imageInfo reports for one file
+	struct ImageInfo {
+		ImageInfo() : width(0), height(0), bpp(0), orientation(0) {}
+
+		std::string src;
+		int width;
+		int height;
+		int bpp;
+		std::string type;
+		int orientation;			// exif style, 1-8; 0 if the reader can't tell
+		std::string errorText;
+	};
+
 	static ImageServices * 	instance(MainLoopProvider * p = NULL);
 	bool 					isValid() { return m_valid;}
 	
 	static bool lsConvertImage(LSHandle* lsHandle, LSMessage* message,void* user_data);
 	static bool lsImageInfo(LSHandle* lsHandle, LSMessage* message,void* user_data);
 	static bool lsEzResize(LSHandle* lsHandle, LSMessage* message,void* user_data);
+	static bool lsCancel(LSHandle* lsHandle, LSMessage* message,void* user_data);
     bool ezResize(const std::string& pathToSourceFile,
                   const std::string& pathToDestFile, const char* destType,
                   uint32_t widthFinal,uint32_t heightFinal,
@@ -43,6 +63,24 @@ private:
                       double focusX, double focusY, double scale,
                       uint32_t widthFinal, uint32_t heightFinal,
                       std::string& r_errorText);
+    bool convertImageInDecoder(QImageReader& reader,
+                               const std::string& pathToDestFile, const char* destType,
+                               double focusX, double focusY, double scale,
+                               uint32_t widthFinal, uint32_t heightFinal,
+                               std::string& r_errorText);
+    bool imageInfo(const std::string& pathToSourceFile, bool headerOnly, ImageInfo& r_info);
+
+	// one request, from its parsed payload to its reply; everything but running it happens on the main loop
+	struct Job;
+
+	static void parseJobOptions(json_object* root, Job& job);
+	bool dispatchJob(Job* job, LSMessage* message, std::string& r_errorText);
+	void runJob(Job* job);
+	void finishJob(Job* job);
+	static void replyToJob(Job* job);
+	static void cbWorkerRunJob(gpointer data, gpointer user_data);
+	static gboolean cbJobDone(gpointer data);
+	static gint cbCompareJobs(gconstpointer a, gconstpointer b, gpointer user_data);
 	
 	ImageServices();
 	ImageServices(const ImageServices& c) {}
@@ -57,6 +95,12 @@ private:
 	LSPalmService* m_service;
 	LSHandle* m_serviceHandlePublic;
 	LSHandle* m_serviceHandlePrivate;
+
+	GThreadPool* m_workers;					// NULL: jobs run on the main loop
+	GAsyncQueue* m_doneJobs;				// run by a worker, waiting for their reply from the main loop
+	volatile gint m_stopping;				// set on teardown; workers then skip what's still queued
+	std::map<std::string, Job*> m_jobsById;	// outstanding jobs that were given a jobId
+	guint64 m_jobSeq;
 };
 
 #endif
@@ -61,6 +61,8 @@ extern const char * STANDARD_JSON_SUCCESS;
 #define SCHEMA_6(p1, p2, p3, p4, p5, p6)        "{\"type\":\"object\",\"properties\":{" p1 "," p2 "," p3 "," p4 "," p5 "," p6 "," SYSTEM_PARAMETERS "},\"additionalProperties\":false}"
 #define SCHEMA_7(p1, p2, p3, p4, p5, p6, p7)    "{\"type\":\"object\",\"properties\":{" p1 "," p2 "," p3 "," p4 "," p5 "," p6 "," p7 "," SYSTEM_PARAMETERS "},\"additionalProperties\":false}"
 #define SCHEMA_8(p1, p2, p3, p4, p5, p6, p7, p8)"{\"type\":\"object\",\"properties\":{" p1 "," p2 "," p3 "," p4 "," p5 "," p6 "," p7 "," p8 "," SYSTEM_PARAMETERS "},\"additionalProperties\":false}"
+#define SCHEMA_9(p1, p2, p3, p4, p5, p6, p7, p8, p9) "{\"type\":\"object\",\"properties\":{" p1 "," p2 "," p3 "," p4 "," p5 "," p6 "," p7 "," p8 "," p9 "," SYSTEM_PARAMETERS "},\"additionalProperties\":false}"
+#define SCHEMA_10(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10) "{\"type\":\"object\",\"properties\":{" p1 "," p2 "," p3 "," p4 "," p5 "," p6 "," p7 "," p8 "," p9 "," p10 "," SYSTEM_PARAMETERS "},\"additionalProperties\":false}"
 
 #define SCHEMA_15(p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15) "{\"type\":\"object\",\"properties\":{" p1 "," p2 "," p3 "," p4 "," p5 "," p6 "," p7 "," p8 ","  p9 "," p10 "," p11 "," p12 "," p13 "," p14 "," p15 "," SYSTEM_PARAMETERS "},\"additionalProperties\":false}"
 
@@ -171,6 +173,20 @@ struct CLSError : public LSError
     }
 };
 
+/*
+ * A schema converted to v4 and compiled. compileSchema() makes one per distinct schema text and keeps it for
+ * the life of the process
+ */
+struct CompiledSchema
+{
+    CompiledSchema(const std::string & v4) : text(v4), schema(v4) {}
+
+    std::string                 text;       // for the error messages
+    pbnjson::JSchemaFragment    schema;
+};
+
+const CompiledSchema & compileSchema(const char * schema_v2);
+
 /*
  * Helper class to parse json messages coming from an LS service using pbnjson
  */
@@ -180,6 +196,11 @@ public:
     // Default using any specific schema. Will simply validate that the message is a valid json message.
     LSMessageJsonParser(LSMessage * message, const char * schema);
     LSMessageJsonParser(LSMessage * message, const pbnjson::JSchema &schema);
+    LSMessageJsonParser(LSMessage * message, const CompiledSchema &schema);
+
+    // have parse() build the dom even when validation is switched off (EIgnore), for callers that read the
+    // payload through get()
+    void                    keepDom() { mKeepDom = true; }
 
     /*!
       * \brief Parse the message using the schema passed in constructor.
@@ -215,6 +236,7 @@ private:
     const char *                mSchemaText;
     pbnjson::JSchema            mSchema;
     pbnjson::JDomParser         mParser;
+    bool                        mKeepDom;
 };
 
 /**
@@ -230,19 +252,16 @@ private:
   jvalue_ref convert_schema_v2_to_v4(const char *schema_v2);
 
   
+  // the schema is converted and compiled the first time each call site runs, so it has to be the same every
+  // time through there (it always is a literal built with the macros above)
   #define VALIDATE_SCHEMA_AND_RETURN_OPTION(lsHandle, message, schema, schErrOption) {\
-                                                                                        jvalue_ref schema_v4 = convert_schema_v2_to_v4(schema);                                                 \
-                                                                                        LSMessageJsonParser jsonParser(message, jvalue_tostring_simple(schema_v4));                             \
+                                                                                        static const CompiledSchema & s_compiledSchema = compileSchema(schema);                                \
+                                                                                        LSMessageJsonParser jsonParser(message, s_compiledSchema);                                              \
                                                                                                                                                                                                 \
                                                                                         if (EDefault == schErrOption)                                                                           \
                                                                                             schErrOption = static_cast<ESchemaErrorOptions>(Settings::settings()->schemaValidationOption);      \
                                                                                                                                                                                                 \
-                                                                                        int res = jsonParser.parse(__FUNCTION__, lsHandle, schErrOption);                                       \
-											                                                                                                        \
-                                                                                        if (!jis_null(schema_v4))                                                                               \
-                                                                                            j_release(&schema_v4);                                                                              \
-											                                                                                                        \
-											if (!res)                                                                                               \
+                                                                                        if (!jsonParser.parse(__FUNCTION__, lsHandle, schErrOption))                                            \
                                                                                             return true;                                                                                        \
                                                                                     }
 
@@ -251,6 +270,18 @@ private:
                                                                     VALIDATE_SCHEMA_AND_RETURN_OPTION(lsHandle, message, schema, schErrOption); \
                                                                  }
 
+/**
+  * Same as VALIDATE_SCHEMA_AND_RETURN, but declares the parser as 'parser' in the enclosing scope, so the handler
+  * can go on reading the payload from parser.get() rather than parsing it a second time. The dom is null if the
+  * payload isn't json
+  */
+#define VALIDATE_SCHEMA_PARSE_AND_RETURN(lsHandle, message, schema, parser)                                                     \
+    static const CompiledSchema & parser##CompiledSchema = compileSchema(schema);                                              \
+    LSMessageJsonParser parser(message, parser##CompiledSchema);                                                                \
+    parser.keepDom();                                                                                                           \
+    if (!parser.parse(__FUNCTION__, lsHandle, static_cast<ESchemaErrorOptions>(Settings::settings()->schemaValidationOption)))  \
+        return true;
+
 /**
   * Subscribe Schema : {"subscribe":boolean}
   */
@@ -270,4 +301,43 @@ std::string createJsonReplyString(bool returnValue = true, int errorCode = 0, co
 // serialize a reply
 std::string jsonToString(pbnjson::JValue & reply, const char * schema = SCHEMA_ANY);
 
+// appends str to out as a quoted json string
+void appendJsonString(std::string & out, const std::string & str);
+void appendJsonString(std::string & out, const char * str, size_t len);
+
+/*
+ * Writes a json object straight into one string, member by member, for the replies that are a handful of flat
+ * fields. There is no tree of json_object or JValue nodes to allocate and free, and the buffer is reserved up
+ * front, so a reply normally costs a single allocation
+ */
+class JsonReplyBuilder
+{
+public:
+    explicit JsonReplyBuilder(size_t reserve = 128);
+
+    JsonReplyBuilder &      put(const char * name, const std::string & value);
+    JsonReplyBuilder &      put(const char * name, const char * value);
+    JsonReplyBuilder &      put(const char * name, bool value);
+    JsonReplyBuilder &      put(const char * name, int value);
+    // value is serialized json already, it is copied in as it is
+    JsonReplyBuilder &      putRaw(const char * name, const std::string & json);
+    JsonReplyBuilder &      putRaw(const std::string & name, const std::string & json);
+    // copies in the members of object, a serialized json object (e.g. a handler's cached reply); false and
+    // nothing added if it isn't one
+    bool                    putMembers(const std::string & object);
+
+    // true until something is put
+    bool                    empty() const   { return mOut.size() == 1; }
+
+    // closes the object, nothing can be put after that
+    const std::string &     str();
+    const char *            c_str()     { return str().c_str(); }
+
+private:
+    void                    key(const char * name, size_t len);
+
+    std::string             mOut;
+    bool                    mClosed;
+};
+
 #endif // JSONUTILS_H
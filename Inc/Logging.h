@@ -42,12 +42,17 @@ inline void sysServiceFmtMsg(char *logMsg, const char *fmt, ...)
 }
 extern void sysServiceLogInfo(const char * fileName, guint32 lineNbr,const char* funcName, const char *logMsg);
 
+// true if messages of that level get anywhere, so the caller can skip building them
+#define sysServiceLogEnabled(level)  PmLogIsEnabled(sysServiceLogContext(), (level))
+
 //  __qMessage() is a simpler version of a logging function which should exist in QDEBUG, but doesn't
 
 #define __qMessage(...)  do { \
+    if (sysServiceLogEnabled(kPmLogLevel_Info)) { \
       char logMsg[SYSSERVICELOG_MESSAGE_MAX+1]; \
       sysServiceFmtMsg(logMsg, __VA_ARGS__); \
       sysServiceLogInfo(__FILE__, __LINE__, __func__, logMsg); \
+    } \
 } while(0)
 
 #else // !defined(USE_PMLOG)
@@ -56,11 +61,41 @@ extern void sysServiceLogInfo(const char * fileName, guint32 lineNbr,const char*
 // Probably we should drop possibility to build without USE_PMLOG or we shouldn't use
 // PMLOG_TRACES without appropriate guard.
 
+#define sysServiceLogEnabled(level)  (1)
 #define __qMessage(...)  do { g_message(__VA_ARGS__); } while (0)
 #define PMLOG_TRACE(...) __qMessage(__VA_ARGS__)
 
 #endif // USE_PMLOG
 
+// printf-style qDebug() and qWarning() that evaluate their arguments and format the message only when the level
+// is enabled, for log lines on busy paths. With NO_LOGGING the debug ones are compiled out (the arguments are
+// still type checked)
+#if defined(NO_LOGGING)
+#define SYSSERVICE_DEBUG(...)    do { if (0) qDebug(__VA_ARGS__); } while (0)
+#else
+#define SYSSERVICE_DEBUG(...)    do { if (sysServiceLogEnabled(kPmLogLevel_Debug)) qDebug(__VA_ARGS__); } while (0)
+#endif
+#define SYSSERVICE_WARNING(...)  do { if (sysServiceLogEnabled(kPmLogLevel_Warning)) qWarning(__VA_ARGS__); } while (0)
+
+// at most one message every interval seconds from each place this is used. The next one that gets through
+// is preceded by a count of the ones that were dropped
+typedef struct {
+    volatile gint last;         // monotonic seconds, plus one so that 0 means never
+    volatile gint dropped;
+} SysServiceLogRateLimit;
+
+int sysServiceLogRateLimit(SysServiceLogRateLimit* limit, int interval, unsigned int* r_dropped);
+
+#define SYSSERVICE_WARNING_RATELIMITED(interval, ...)  do { \
+    static SysServiceLogRateLimit _limit = { 0, 0 }; \
+    unsigned int _dropped = 0; \
+    if (sysServiceLogRateLimit(&_limit, (interval), &_dropped)) { \
+        if (_dropped) \
+            SYSSERVICE_WARNING("(%u similar messages suppressed)", _dropped); \
+        SYSSERVICE_WARNING(__VA_ARGS__); \
+    } \
+} while (0)
+
 // Qt handler for logging
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
 void outputQtMessages(QtMsgType type,
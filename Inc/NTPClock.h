@@ -25,9 +25,12 @@
 #ifndef __NTPCLOCK_H
 #define __NTPCLOCK_H
 
+#include <deque>
 #include <string>
 #include <vector>
 
+#include <glib.h>
+
 #include "LSUtils.h"
 
 #include "SignalSlot.h"
@@ -43,23 +46,91 @@ struct NTPClock
 
 	NTPClock(TimePrefsHandler &th) :
 		timePrefsHandler(th),
-		sntpPid(-1)
+		resolving(false),
+		resolver(0),
+		resolveJob(0),
+		timeoutSource(0)
 	{}
 
-	~NTPClock()
+	~NTPClock();
+
+	/**
+	 * Servers asked at once; the NTPServer preference may name several (separated by commas or spaces), each
+	 * of which may resolve to several addresses
+	 */
+	static const size_t maxQueries = 4;
+
+	/**
+	 * One SNTP exchange with one server address over its own connected, non-blocking UDP socket
+	 */
+	struct Query
+	{
+		NTPClock *ntpClock;
+		std::string address;
+		int fd;
+		guint watch;
+		unsigned char originate[8];     // our transmit timestamp, which the reply has to echo
+		double sent;                    // T1, unix seconds
+		bool answered;
+		double offset;                  // ((T2 - T1) + (T3 - T4)) / 2
+		double delay;                   // (T4 - T1) - (T3 - T2)
+		double distance;                // half the delay plus the server's own root delay/2 and dispersion
+	};
+	typedef std::vector<Query *> Queries;
+
+	/**
+	 * Queries in flight; empty while idle
+	 */
+	Queries queries;
+
+	/**
+	 * Host names being looked up on the resolver thread
+	 */
+	bool resolving;
+	GThreadPool *resolver;
+
+	/**
+	 * The lookup in flight, owned here until cbResolved takes it back on the main loop
+	 */
+	struct ResolveJob;
+	ResolveJob *resolveJob;
+
+	guint timeoutSource;
+	unsigned int timeoutSeconds;
+
+	/**
+	 * The winner of one round of queries. The system clock may be set between rounds (from these very
+	 * samples), so what is kept is NTP time minus the monotonic clock, which setting the time doesn't move
+	 */
+	struct Sample
 	{
-		if (sntpPid != -1) g_spawn_close_pid(sntpPid);
-	}
+		gint64 monotonic;               // microseconds, when it was taken
+		double ntpMinusMonotonic;       // seconds
+		double delay;
+	};
+	typedef std::deque<Sample> Samples;
+
+	/**
+	 * The last [Time] ntpFilterSamples rounds, oldest first
+	 */
+	Samples samples;
+
+	/**
+	 * Clock filter: offset of the system clock from the minimum delay sample still recent enough
+	 * @return false if there is none
+	 */
+	bool filteredOffset(double &r_offset) const;
 
 	/**
-	 * PID of "sntp" process we are waiting for or -1 if we are in idle
+	 * Whether the newest sample is within the [Time] ntpCacheTime window, so a request can be answered from it
 	 */
-	GPid sntpPid;
+	bool cacheIsFresh() const;
 
 	/**
-	 * stdout contents of "sntp" process
+	 * Clock select (RFC 5905 section 11.2.1, intersection of the correctness intervals): the answered
+	 * queries agreeing with the majority of them
 	 */
-	std::string sntpOutput;
+	static Queries truechimers(const Queries &answered);
 
 	/**
 	 * Request for NTP time update.
@@ -85,14 +156,36 @@ struct NTPClock
 	RequestMessages requestMessages;
 
 	/**
-	 * Callback for "sntp" child process change state
+	 * Send a request to each looked up address; false if none could be sent
+	 */
+	bool startQueries(const std::vector<std::string> &addresses);
+
+	/**
+	 * All queries answered or timed out: post the sample with the smallest round trip delay
+	 */
+	void finishQueries();
+
+	void cancelQueries();
+
+	/**
+	 * Resolver thread: host names to numeric addresses (getaddrinfo blocks)
+	 */
+	static void cbResolve(gpointer data, gpointer userData);
+
+	/**
+	 * Back on the main loop with the looked up addresses
+	 */
+	static gboolean cbResolved(gpointer data);
+
+	/**
+	 * Callback for a reply on a query's socket
 	 */
-	static void cbChild(GPid pid, gint status, NTPClock *ntpClock);
+	static gboolean cbReply(GIOChannel *channel, GIOCondition cond, Query *query);
 
 	/**
-	 * Callback for "sntp" stdout data flow
+	 * Callback for servers that didn't answer in time
 	 */
-	static gboolean cbStdout(GIOChannel *channel, GIOCondition cond, NTPClock *ntpClock);
+	static gboolean cbTimeout(NTPClock *ntpClock);
 };
 
 #endif
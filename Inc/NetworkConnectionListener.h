@@ -18,7 +18,9 @@
 #ifndef NETWORKCONNECTIONLISTENER_H
 #define NETWORKCONNECTIONLISTENER_H
 
+#include <string>
 #include <glib.h>
+#include <json.h>
 #include <luna-service2/lunaservice.h>
 
 #include "SignalSlot.h"
@@ -29,8 +31,17 @@ public:
 
 	static NetworkConnectionListener* instance();
 
+	// the settled state: connectionmanager has to report a change for networkSettleTime seconds before it
+	// shows up here (and in signalConnectionStateChanged), so a flapping link reads as one state
 	bool isInternetConnectionAvailable() const { return m_isInternetConnectionAvailable; }
 
+	// for things a reconnect kicks off (time sync): true at most once per networkSyncHoldoff seconds, however
+	// often the link comes back in between
+	bool takeReconnectSync();
+
+	// status updates, raw and settled state changes and the flaps and syncs that were held back
+	json_object* statsToJson() const;
+
 public:
 
 	Signal<bool> signalConnectionStateChanged;
@@ -48,9 +59,29 @@ private:
 	bool connectionManagerConnectCallback(LSHandle *sh, LSMessage *message);
 	bool connectionManagerGetStatusCallback(LSHandle *sh, LSMessage *message);
 
+	void setRawState(bool available);
+	void reportState();
+	static gboolean cbSettle(gpointer data);
+
 private:
 
+	struct Stats {
+		unsigned long statusUpdates;
+		unsigned long duplicateUpdates;
+		unsigned long rawChanges;
+		unsigned long reportedChanges;
+		unsigned long flapsSuppressed;
+		unsigned long syncsAllowed;
+		unsigned long syncsHeldOff;
+	};
+
 	bool m_isInternetConnectionAvailable;
+	bool m_rawAvailable;
+	bool m_haveStatus;
+	guint m_settleSource;
+	gint64 m_lastReconnectSync;
+	std::string m_lastStatusPayload;
+	Stats m_stats;
 };
 
 #endif /* NETWORKCONNECTIONLISTENER_H */
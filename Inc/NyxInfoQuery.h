@@ -0,0 +1,90 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+
+#ifndef NYXINFOQUERY_H
+#define NYXINFOQUERY_H
+
+#include <string>
+#include <map>
+#include <vector>
+
+#include <glib.h>
+#include <nyx/nyx_client.h>
+
+/*
+ * The query engine behind osInfo/query and deviceInfo/query. Each instance owns one nyx device (opened on
+ * first use and kept open) and a table of the items it can answer for. Answers are kept as ready-made
+ * "name": "value" fragments of the reply, for as long as the item's cache policy allows, so a repeated query
+ * is a couple of map lookups and string appends.
+ */
+class NyxInfoQuery
+{
+public:
+
+	enum CachePolicy {
+		CacheForever = 0,	// can't change at runtime, asked once
+		CacheTtl,			// asked again once it is older than the ttl
+		CacheNever			// asked every time
+	};
+
+	// wraps nyx_os_info_query(), nyx_device_info_query() and the like, which only differ in the item type
+	typedef nyx_error_t (*QueryFunction)(nyx_device_handle_t device, int item, const char** r_value);
+
+	// what names the kind of item in error texts ("os", "device"). unsupported is reported as the value of
+	// items nyx can't answer; if it is 0 those fail the whole query instead
+	NyxInfoQuery(nyx_device_type_t type, QueryFunction query, const char* what, const char* unsupported);
+	~NyxInfoQuery();
+
+	void addItem(const std::string& name, int item, CachePolicy policy = CacheForever, int ttlSeconds = 0);
+	bool hasItem(const std::string& name) const;
+
+	// the reply to a {"parameters": [string array]} payload. Each parameter is looked up in the engines in
+	// turn, so one call can ask for items from several of them; without parameters it is everything
+	// engines[0] has
+	static std::string reply(const char* payload, const std::vector<NyxInfoQuery*>& engines);
+
+private:
+
+	struct Item {
+		int id;
+		CachePolicy policy;
+		gint64 ttl;
+		bool cached;
+		gint64 queried;			// g_get_monotonic_time()
+		std::string fragment;	// "name": "value"
+	};
+	typedef std::map<std::string, Item> ItemMap;
+
+	nyx_device_handle_t device();
+	// appends the item's fragment to r_reply; false with r_error set if it can't be had
+	bool append(const std::string& name, Item& item, std::string& r_reply, std::string& r_error);
+
+	nyx_device_type_t m_type;
+	QueryFunction m_query;
+	std::string m_what;
+	const char* m_unsupported;
+	bool m_nyxInitialized;
+	nyx_device_handle_t m_device;
+	ItemMap m_items;
+};
+
+#endif /* NYXINFOQUERY_H */
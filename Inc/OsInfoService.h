@@ -18,31 +18,32 @@
 #define OSINFORMATIONSERVICE_H
 
 #include <string>
-#include <map>
 
-#include <nyx/nyx_client.h>
 #include <luna-service2/lunaservice.h>
 
+#include "NyxInfoQuery.h"
+
 class OsInfoService
 {
 public:
-	typedef std::map<std::string, nyx_os_info_query_t> command_map_t;
-
 	static OsInfoService* instance();
 	void setServiceHandle(LSPalmService* service);
 	LSPalmService* serviceHandle() const;
 
 	static bool cbGetOsInformation(LSHandle* lshandle, LSMessage *message, void *user_data);
 
+	// the items osInfo/query answers for; deviceInfo/query can be asked for them too
+	NyxInfoQuery* query() { return &m_query; }
+
 private:
 	OsInfoService();
 	~OsInfoService();
 
-	static void initCommandMap();
+	static nyx_error_t queryOsInfo(nyx_device_handle_t device, int item, const char** r_value);
 
 private:
 	LSPalmService* m_service;
-	static command_map_t s_commandMap;
+	NyxInfoQuery m_query;
 };
 
 #endif
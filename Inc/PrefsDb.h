@@ -21,7 +21,10 @@
 #include <string>
 #include <map>
 #include <list>
+#include <unordered_map>
+#include <unordered_set>
 
+#include <glib.h>
 #include <sqlite3.h>
 
 class BackupManager;
@@ -34,23 +37,59 @@ public:
 	static PrefsDb* createStandalone(const std::string& dbFilename,bool deleteExisting=true);
 
 	bool setPref(const std::string& key, const std::string& value);
+	// writes all the pairs in a single transaction; either all of them are stored or none are
+	bool setPrefs(const std::map<std::string, std::string>& keyValues);
 
 	std::string getPref(const std::string& key);
 	bool getPref(const std::string& key,std::string& r_val);
 
 	std::map<std::string, std::string> getPrefs(const std::list<std::string>& keys);	
+	// same as getPrefs(), but values that aren't valid json (checked once, when written or loaded) are left
+	// out of the result and their keys go into r_invalidKeys instead. Lets callers splice the stored text
+	// straight into a reply
+	std::map<std::string, std::string> getJsonPrefs(const std::list<std::string>& keys,std::list<std::string>& r_invalidKeys);
 	std::map<std::string,std::string> getAllPrefs();
 
 	int merge(PrefsDb * p_sourceDb,bool overwriteSameKeys=true);
 	int merge(const std::string& sourceDbFilename,bool overwriteSameKeys=true);
 
+	// merge() a batch of rows at a time, each batch in its own transaction and run from an idle callback, so
+	// the main loop goes on serving requests during a big restore. progress gets the rows merged so far and the
+	// total after every batch; done is called once at the end (also when starting fails it returns false
+	// without calling either). Only one at a time
+	typedef void (*MergeProgress)(int merged, int total, void* data);
+	typedef void (*MergeDone)(bool ok, int merged, void* data);
+	bool mergeInSteps(const std::string& sourceDbFilename, MergeProgress progress, MergeDone done, void* data);
+	bool isMerging() const { return m_mergeInSteps != 0; }
+
+	// one INSERT ... SELECT from p_sourceDb's file ATTACHed to this db, in a single transaction
 	int copyKeys(PrefsDb * p_sourceDb,const std::list<std::string>& keys,bool overwriteSame=true);
 
+	// the change journal (main db only): every write to a key stamps it with a new, higher generation.
+	// journalId() changes whenever the journal starts over (the db was recreated), which makes generations
+	// handed out before that meaningless. 0 for both if there is no journal
+	gint64 journalId();
+	gint64 journalGeneration();
+	// keys written or deleted after generation (not including it)
+	std::list<std::string> keysChangedSince(gint64 generation);
+
 	std::string databaseFile() const
 	{ return m_dbFilename; }
 
 	void setDatabaseFileDeleteOnDestruction(bool deleteAtDestructor=true);
 
+	// PRAGMA quick_check (integrity_check if full) on the open db. A failed check recreates the db like opening
+	// does (and then returns false); r_result is what sqlite had to say
+	bool checkIntegrity(bool full, std::string& r_result);
+
+	// sysservice is exiting normally: closes the db and removes the marker that makes the next open run a full
+	// integrity check
+	void shutdown();
+
+	// drops the in-memory copy of the Preferences table and reloads it from the db. Anything that modifies
+	// the db behind PrefsDb's back (raw sql, restores) must call this afterwards
+	void refreshCache();
+
 	//keeping all this in one place so that all of system service has one place to look it up in, rather than all over the other source files
 	static const char* s_defaultPrefsFile;
 	static const char* s_defaultPlatformPrefsFile;
@@ -85,7 +124,26 @@ private:
 	void closePrefsDb();
 
 	bool checkTableConsistency();
-	bool integrityCheckDb();
+	bool createJournal();
+	gint64 queryInt64(const char* query);
+
+	int copyKeysRowByRow(PrefsDb * p_sourceDb,const std::list<std::string>& keys,bool overwriteSame);
+
+	struct MergeInSteps {
+		MergeProgress progress;
+		MergeDone done;
+		void* data;
+		sqlite3_int64 lastRowid;
+		int merged;
+		int total;
+		guint source;
+	};
+	bool mergeStep();
+	void finishMergeInSteps(bool ok);
+	static gboolean cbMergeStep(gpointer data);
+	bool integrityCheckDb(bool full);
+	bool runIntegrityCheck(bool full, std::string& r_result);
+	bool needsFullIntegrityCheck();
 	void loadDefaultPrefs();
 	void loadDefaultPlatformPrefs();
 	void backupDefaultPrefs();
@@ -101,13 +159,53 @@ private:
 	// (___Command is the same except does an sql exec)
 	bool runSqlCommand(const std::string& cmdStr);
 
+	// the fixed queries used on the get/set paths. These are prepared once per connection and reused
+	enum CachedStatement {
+		StatementSelectByKey = 0,
+		StatementUpsert,
+		StatementSelectAll,
+		StatementCount
+	};
+
+	// do NOT finalize the return value; call sqlite3_reset(x) when done with it so the connection isn't left
+	// holding a read transaction
+	sqlite3_stmt* cachedStatement(CachedStatement which);
+	void finalizeCachedStatements();
+
+	void loadCache();
+	void invalidateCache();
+	void cachePref(const std::string& key,const std::string& value);
+	bool getPrefFromDb(const std::string& key,std::string& r_val);
+
+	// journal mode and tuning from Settings; wal is only used for the main db, standalone dbs get shipped
+	// around as single files by the backup service
+	void applyConnectionPragmas();
+	void scheduleCheckpoint();
+	void cancelCheckpoint();
+	static gboolean cbCheckpoint(gpointer data);
+
 private:
 
+	typedef std::unordered_map<std::string, std::string> PrefsCache;
+
 	static PrefsDb* s_instance;
 	sqlite3* m_prefsDb;
 	bool m_standalone;
 	std::string m_dbFilename;
 	bool m_deleteOnDestroy;
+	sqlite3_stmt* m_cachedStatements[StatementCount];
+
+	// write-through copy of the Preferences table; only consulted while m_cacheValid is set, otherwise
+	// reads fall through to sqlite
+	PrefsCache m_cache;
+	std::unordered_set<std::string> m_nonJsonKeys;
+	bool m_cacheValid;
+
+	bool m_walMode;
+	guint m_checkpointSource;
+	MergeInSteps* m_mergeInSteps;
+
+	bool m_forceFullCheck;
 };
 
 #endif /* PREFSDB_H */
@@ -20,9 +20,15 @@
 
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
 
+#include <glib.h>
+#include <json.h>
 #include <luna-service2/lunaservice.h>
 
+#include "PrefsSubscriptions.h"
+
 class PrefsHandler;
 
 class PrefsFactory
@@ -34,13 +40,36 @@ public:
 	LSPalmService* serviceHandle() const;
 
 	PrefsHandler* getPrefsHandler(const std::string& key) const;
+	PrefsHandler* getPrefsHandler(const char* key) const;
+
+	// lookup counts per handler: { "handlers": [ { "keys": [...], "hits": n }, ... ], "misses": n }
+	json_object* dispatchStats() const;
+
+	// getPreferences subscribers; postPrefChange() delivers to these
+	PrefsSubscriptions& subscriptions() { return m_subscriptions; }
 	
+	// queued; every key changed within one main loop iteration goes out as a single reply per subscriber
 	void postPrefChange(const std::string& key,const std::string& value);
 	void postPrefChangeValueIsCompleteString(const std::string& key,const std::string& json_string);
 	void runConsistencyChecksOnAllHandlers();
+	// for a handler whose files just changed on disk: check it again now, restoring defaults if needed
+	void recheckPrefConsistency(PrefsHandler* handler);
+	// sends valuesForKey(key) again to getPreferenceValues subscribers, for handlers whose set of values changed
+	void postPrefValues(const std::string& key);
+
+	// isPrefConsistent() on a handler can hit the filesystem, so a passing result is remembered until
+	// something that could break it happens: a write to one of the handler's keys, a media partition
+	// remount or an erase. invalidatePrefConsistency(0) forgets every handler
+	bool isPrefConsistent(PrefsHandler* handler);
+	void invalidatePrefConsistency(PrefsHandler* handler);
 	
 	void refreshAllKeys();		//useful for when the database is completely restored to another version
 								//at some point after sysservice startup (see BackupManager)
+	// same, but only for keys whose value differs from the snapshot (taken with getAllPrefs() before the db
+	// was replaced), so an unchanged wallpaper or time zone isn't re-applied
+	void refreshChangedKeys(const std::map<std::string,std::string>& snapshot);
+	// tells the handlers and subscribers about keys written to the db behind their back
+	void refreshKeys(const std::map<std::string,std::string>& keyValues);
 private:
 
 	PrefsFactory();
@@ -48,16 +77,40 @@ private:
 
 	void init();
 	void registerPrefHandler(PrefsHandler* handler);
+
+	void flushPrefChanges();
+	static gboolean cbFlushPrefChanges(gpointer data);
+	static bool cbSubscriptionCancel(LSHandle* lsHandle, LSMessage* message, void* user_data);
 	
 private:
 
-	typedef std::map<std::string, PrefsHandler*> PrefsHandlerMap;
+	// sorted by key and frozen once setServiceHandle() has registered the handlers, so lookups are a
+	// binary search over keys owned by the table without building any strings
+	struct DispatchEntry
+	{
+		std::string key;
+		PrefsHandler* handler;
+		mutable unsigned long hits;
+	};
+	typedef std::vector<DispatchEntry> DispatchTable;
 	
 	LSPalmService* m_service;
 	LSHandle* m_serviceHandlePublic;
 	LSHandle* m_serviceHandlePrivate;
 		
-	PrefsHandlerMap m_handlersMaps;
+	DispatchTable m_dispatchTable;
+	bool m_dispatchFrozen;
+	mutable unsigned long m_dispatchMisses;
+	std::set<PrefsHandler*> m_consistentHandlers;
+
+	std::map<std::string,std::string> m_pendingPrefChanges;
+	guint m_flushSource;
+	PrefsSubscriptions m_subscriptions;
+
+public:
+
+	// subscription key prefix for getPreferenceValues subscribers
+	static const char* s_valuesSubscriptionPrefix;
 
 };
 
@@ -29,7 +29,8 @@ class PrefsHandler
 {
 public:
 
-	PrefsHandler(LSPalmService* service) : m_service(service) , m_serviceHandlePublic(0) , m_serviceHandlePrivate(0) {}
+	PrefsHandler(LSPalmService* service) : m_service(service) , m_serviceHandlePublic(0) , m_serviceHandlePrivate(0)
+		, m_valuesCacheEnabled(false) , m_valuesVersion(0) {}
 	virtual ~PrefsHandler() {}
 
 	virtual std::list<std::string> keys() const = 0;
@@ -52,19 +53,67 @@ public:
 		json_object_put(jo);
 	}
 	virtual json_object* valuesForKey(const std::string& key) = 0;
+	// the same values already serialized as a json object, for handlers that keep them ready; 0 means
+	// getPreferenceValues should go through valuesForKey() instead
+	virtual const std::string* serializedValuesForKey(const std::string& key) { return 0; }
+	// what getPreferenceValues replies with: serializedValuesForKey() if the handler has it, else valuesForKey()
+	// serialized, which a handler that called enableValuesCache() keeps until its next bumpValuesVersion().
+	// 0 means the caller has to go through valuesForKey() itself
+	const std::string* cachedValuesForKey(const std::string& key)
+	{
+		const std::string* serialized = serializedValuesForKey(key);
+		if (serialized || !m_valuesCacheEnabled)
+			return serialized;
+
+		CachedValues& cached = m_valuesCache[key];
+		if (cached.json.empty() || cached.version != m_valuesVersion) {
+			json_object* values = valuesForKey(key);
+			if (!values) {
+				m_valuesCache.erase(key);
+				return 0;
+			}
+			cached.json = json_object_to_json_string(values);
+			cached.version = m_valuesVersion;
+			json_object_put(values);
+		}
+		return &cached.json;
+	}
 	// FIXME: We very likely need a windowed version the above function
 	virtual bool isPrefConsistent() { return true; }
 	virtual void restoreToDefault() {}
-	virtual bool shouldRefreshKeys(std::map<std::string,std::string>& keyvalues) { return false;}
+	// called with all of this handler's keys that changed at once (e.g. by a restore), so a handler whose
+	// keys depend on each other can apply them together. The default just feeds them to valueChanged()
+	virtual void valuesChanged(const std::map<std::string,std::string>& keyValues)
+	{
+		for (std::map<std::string,std::string>::const_iterator it = keyValues.begin(); it != keyValues.end(); ++it)
+			valueChanged(it->first,it->second);
+	}
 	
 	LSHandle * getPrivateHandle() { return m_serviceHandlePrivate;}
 	LSHandle * getPublicHandle() { return m_serviceHandlePublic;}
 	
 protected:
 
+	// for handlers whose valuesForKey() only changes when they say so: they promise to bumpValuesVersion()
+	// whenever anything it returns changes
+	void enableValuesCache() { m_valuesCacheEnabled = true; }
+	void bumpValuesVersion() { ++m_valuesVersion; }
+
 	LSPalmService*	m_service;
 	LSHandle* m_serviceHandlePublic;
 	LSHandle* m_serviceHandlePrivate;
+
+private:
+
+	struct CachedValues {
+		CachedValues() : version(0) {}
+		unsigned int version;
+		std::string json;
+	};
+
+	bool m_valuesCacheEnabled;
+	unsigned int m_valuesVersion;
+	std::map<std::string, CachedValues> m_valuesCache;
 };
 
 #endif /* PREFSHANDLER_H */
@@ -0,0 +1,88 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef PREFSSUBSCRIPTIONS_H
+#define PREFSSUBSCRIPTIONS_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <json.h>
+#include <luna-service2/lunaservice.h>
+
+/*
+ * Who is subscribed to which preference keys (getPreferences with "subscribe":true), indexed both ways: a
+ * change only visits the subscribers of the keys that changed, a key nobody watches costs one hash lookup,
+ * and dropping a subscriber touches only its own keys. Messages are ref'd while registered. Each is also
+ * added to the luna-service catalog once, under s_cancelKey, just so the handle's cancel function reports
+ * when its client goes away; PrefsFactory passes that on to remove().
+ */
+class PrefsSubscriptions
+{
+public:
+
+	enum Delivery {
+		Merged = 0,			// one reply per subscriber with every key changed in the batch
+		PerKey				// one reply per changed key (mergeNotifications:false)
+	};
+
+	struct Subscriber
+	{
+		LSHandle* handle;
+		LSMessage* message;
+		Delivery delivery;
+		std::vector<std::string> keys;
+	};
+
+	typedef std::unordered_set<Subscriber*> SubscriberSet;
+
+	static const char* s_cancelKey;
+
+	PrefsSubscriptions();
+	~PrefsSubscriptions();
+
+	// false (and nothing registered) if luna-service won't track the message
+	bool add(LSHandle* handle, LSMessage* message, const std::list<std::string>& keys, Delivery delivery);
+	// O(keys of that subscriber); unknown messages (other methods' subscriptions) are ignored
+	void remove(LSMessage* message);
+
+	// 0 if nobody is subscribed to key
+	const SubscriberSet* subscribers(const std::string& key) const;
+
+	// { "subscribers": n, "keys": { key: subscribers, ... } }
+	json_object* toJson() const;
+
+private:
+
+	PrefsSubscriptions(const PrefsSubscriptions&);
+	PrefsSubscriptions& operator=(const PrefsSubscriptions&);
+
+	typedef std::unordered_map<LSMessage*, Subscriber*> SubscriberMap;
+	typedef std::unordered_map<std::string, SubscriberSet> KeyIndex;
+
+	SubscriberMap m_subscribers;
+	KeyIndex m_byKey;
+};
+
+#endif /* PREFSSUBSCRIPTIONS_H */
@@ -19,6 +19,8 @@
 #define RINGTONEPREFSHANDLER_H
 
 #include "PrefsHandler.h"
+
+#include <set>
  
 class RingtonePrefsHandler : public PrefsHandler 
 {
@@ -34,6 +36,15 @@ public:
 	virtual json_object* valuesForKey(const std::string& key);
 	virtual bool isPrefConsistent();
 	virtual void restoreToDefault();
+
+private:
+
+	void scanRingtones();
+	void ringtoneFileChanged(const std::string& name, bool present);
+	static void cbRingtoneDirChanged(const std::string& name, bool present, void* data);
+
+	std::string m_ringtoneDir;
+	std::set<std::string> m_ringtones;		// file names in m_ringtoneDir, kept current by a DirectoryWatcher
 };	
  
 #endif
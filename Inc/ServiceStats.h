@@ -0,0 +1,141 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+#ifndef SERVICESTATS_H
+#define SERVICESTATS_H
+
+#include <string>
+#include <map>
+
+#include <glib.h>
+#include <json.h>
+
+/*
+ * Counters and latency histograms for the hot bus methods (preferences, time zones, image resizes), so
+ * regressions show up on real devices on /getServiceStats or in the log. Everything is a no-op unless
+ * [Stats] enabled=true in sysservice.conf; the checks below are a single flag test in that case.
+ */
+class ServiceStats
+{
+public:
+
+	enum Method {
+		MethodSetPreferences = 0,
+		MethodGetPreferences,
+		MethodGetPreferenceValues,
+		MethodGetTimeZoneRules,
+		MethodConvertDate,
+		MethodEzResize,					// queued to replied, as the caller sees it
+		MethodCount
+	};
+
+	// where the time inside the methods goes
+	enum Phase {
+		PhaseSqlite = 0,
+		PhaseHandler,
+		PhaseCount
+	};
+
+	static ServiceStats* instance();
+
+	bool enabled() const { return m_enabled; }
+
+	// microseconds, monotonic
+	static gint64 now() { return g_get_monotonic_time(); }
+
+	void recordMethod(Method method, gint64 usecs);
+	void recordPhase(Phase phase, gint64 usecs);
+	void recordFanout(unsigned int subscribers);
+
+	void countKeyRead(const std::string& key)	{ if (m_enabled) countKey(key, true); }
+	void countKeyWrite(const std::string& key)	{ if (m_enabled) countKey(key, false); }
+
+	json_object* toJson() const;
+	void reset();
+
+	// times the enclosing scope as one call of a method
+	class MethodTimer
+	{
+	public:
+		MethodTimer(Method method)
+			: m_method(method), m_start(ServiceStats::instance()->enabled() ? now() : 0) {}
+		~MethodTimer() { if (m_start) ServiceStats::instance()->recordMethod(m_method, now() - m_start); }
+	private:
+		Method m_method;
+		gint64 m_start;
+	};
+
+	// times the enclosing scope as part of a phase
+	class PhaseTimer
+	{
+	public:
+		PhaseTimer(Phase phase)
+			: m_phase(phase), m_start(ServiceStats::instance()->enabled() ? now() : 0) {}
+		~PhaseTimer() { if (m_start) ServiceStats::instance()->recordPhase(m_phase, now() - m_start); }
+	private:
+		Phase m_phase;
+		gint64 m_start;
+	};
+
+private:
+
+	// bucket i counts samples in [2^i, 2^(i+1)); the last one is everything above
+	struct Histogram
+	{
+		enum { BucketCount = 24 };
+
+		Histogram() { clear(); }
+		void clear();
+		void add(gint64 value);
+		// estimate from the buckets: the top of the one the p-th percentile sample falls in, never above max
+		gint64 percentile(int p) const;
+		json_object* toJson() const;
+
+		unsigned long buckets[BucketCount];
+		unsigned long count;
+		gint64 total;
+		gint64 max;
+	};
+
+	struct KeyCounters
+	{
+		KeyCounters() : reads(0), writes(0) {}
+		unsigned long reads;
+		unsigned long writes;
+	};
+
+	ServiceStats();
+	~ServiceStats();
+
+	void countKey(const std::string& key, bool read);
+	void dumpToLog() const;
+	static gboolean cbDump(gpointer data);
+
+	static ServiceStats* s_instance;
+
+	bool m_enabled;
+	Histogram m_methods[MethodCount];
+	Histogram m_phases[PhaseCount];
+	Histogram m_fanout;
+	std::map<std::string, KeyCounters> m_keys;
+	KeyCounters m_otherKeys;
+};
+
+#endif /* SERVICESTATS_H */
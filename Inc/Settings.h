@@ -34,6 +34,8 @@ public:
 	}
 
 	bool	m_turnNovacomOnAtStartup;
+	bool	m_stagedStartup;				// get on the bus first, run the startup consistency check from the main loop
+	int		m_workerThreads;				// Executor threads for blocking work; 0 runs it where it's submitted
 	bool	m_saveLastBackedUpTempDb;
 	bool	m_saveLastRestoredTempDb;
 	std::string m_logLevel;
@@ -41,8 +43,35 @@ public:
 	bool	m_useComPalmImage2;
 	bool	m_image2svcAvailable;
 	std::string m_comPalmImage2BinaryFile;
+	std::string m_wallpaperImportBackend;	// "lowMem", "pipeline" (in process) or "image2" (spawns m_comPalmImage2BinaryFile)
+	int		m_imageWorkerThreads;			// threads running com.palm.image jobs; 0 runs them on the main loop
+	int		m_imageClippedDecodeSize;		// kilobytes of decoded source; bigger ones are decoded clipped and scaled, 0 never
 
-    int schemaValidationOption;
+	int		schemaValidationOption;
+
+	int		m_wallpaperCacheSize;			// kilobytes of imported wallpapers kept for re-imports; 0 disables
+	std::string m_wallpaperVariants;		// "WxH,WxH,..." renditions made besides the screen sized one at import
+
+	int		m_ntpCacheTime;					// seconds an NTP result answers requests without asking again; 0 = never
+	int		m_ntpFilterSamples;				// rounds of NTP samples the clock filter picks from
+	int		m_timeSlewThreshold;			// seconds; smaller corrections from time sources are slewed, 0 always steps
+	int		m_zoneListBudget;				// kilobytes the serialized zone list may keep resident; 0 never keeps it
+	int		m_networkSettleTime;			// seconds a connectivity change has to last before it's acted on; 0 = none
+	int		m_networkSyncHoldoff;			// seconds between time syncs started by the network coming back
+
+	// systemprefs.db connection tuning ([PrefsDb] section)
+	bool	m_prefsDbWalMode;
+	std::string m_prefsDbSynchronous;
+	int		m_prefsDbCacheSize;				// sqlite cache_size; 0 leaves sqlite's default
+	int		m_prefsDbMmapSize;				// bytes; 0 disables memory mapped i/o
+	int		m_prefsDbWalAutoCheckpoint;		// wal pages before sqlite checkpoints inline; 0 disables
+	int		m_prefsDbCheckpointInterval;	// seconds after a write to checkpoint; 0 = when idle, <0 = never
+	std::string m_prefsDbIntegrityCheck;	// "quick" (quick_check on open, full one when due) or "full" (every open)
+	int		m_prefsDbFullCheckInterval;		// days between full integrity checks in quick mode; 0 = only after a crash
+
+	// method latency / key access statistics ([Stats] section), see ServiceStats
+	bool	m_serviceStatsEnabled;
+	int		m_serviceStatsDumpInterval;		// seconds between summaries in the log; 0 = never
 
 private:
 	Settings();
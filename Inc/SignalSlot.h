@@ -18,435 +18,312 @@
 #ifndef SIGNALSLOT_H
 #define SIGNALSLOT_H
 
-#include <set>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
+
+#include <glib.h>
 
 class Trackable;
+class SignalCore;
 
-class Sender
+// one receiver connected to one signal. It is threaded onto both the signal's list and the receiver's, so
+// either end can drop it in O(1) without searching. The member function is kept inline in function[] and
+// called through invoke, a plain function pointer the owning Signal casts back to its own type; firing
+// neither allocates nor goes through a vtable
+struct Connection
 {
-public:
-	
-	virtual void disconnectTrackable(Trackable* recv) = 0;
+	Connection* prevInSignal;
+	Connection* nextInSignal;
+	Connection* prevInReceiver;
+	Connection* nextInReceiver;
+
+	SignalCore* signal;
+	Trackable* receiver;		// 0 once disconnected (the node may linger until the signal is done firing)
+	void* object;				// the receiver as its own type
+	void (*invoke)();
+
+	// big enough for any pointer to member function (two words on the Itanium ABI, which is what we build for)
+	unsigned char function[2 * sizeof(void*)];
 };
 
 class Trackable {
 public:
 
-	virtual ~Trackable() {
-		for (std::set<Sender*>::iterator it = m_senders.begin();
-			 it != m_senders.end(); ++it) {
-			(*it)->disconnectTrackable(this);
-		}
-	}
+	Trackable() : m_connections(0) {}
 
-	void connected(Sender* sender) {
-		m_senders.insert(sender);
-	}
+	// connections belong to the object, not its value
+	Trackable(const Trackable&) : m_connections(0) {}
+	Trackable& operator=(const Trackable&) { return *this; }
 
-	void disconnected(Sender* sender) {
-		m_senders.erase(sender);
-	}
+	inline virtual ~Trackable();
 
 private:
 
-	std::set<Sender*> m_senders;
-};
-
-
-template <class Function>
-class FunctionWrapper
-{
-public:
-
-	inline Trackable* receiver() const {
-		return m_receiver;
-	}
-	
-protected:
-
-	Trackable* m_receiver;
-	Function m_function;
-};
-
-
-template <class Arg0=void, class Arg1=void, class Arg2=void, class Arg3=void, class Arg4=void>
-class SlotBase
-{
-public:
-
-	virtual void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3, Arg4 arg4) = 0;
-};
-
-template <>
-class SlotBase<void, void, void, void, void>
-{
-public:
-	
-	virtual void fire() = 0;
-};
-
-template <class Arg0>
-class SlotBase<Arg0, void, void, void, void>
-{
-public:
-	
-	virtual void fire(Arg0 arg0) = 0;
-};
-
-template <class Arg0, class Arg1>
-class SlotBase<Arg0, Arg1, void, void, void>
-{
-public:
-	
-	virtual void fire(Arg0 arg0, Arg1 arg1) = 0;
-};
-
-template <class Arg0, class Arg1, class Arg2>
-class SlotBase<Arg0, Arg1, Arg2, void, void>
-{
-public:
-	
-	virtual void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2) = 0;
-};
-
-template <class Arg0, class Arg1, class Arg2, class Arg3>
-class SlotBase<Arg0, Arg1, Arg2, Arg3, void>
-{
-public:
-	
-	virtual void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3) = 0;
-};
-
+	Connection* m_connections;
 
-template <class Receiver,
-          typename Result = void,
-          typename Arg0 = void,
-          typename Arg1 = void,
-          typename Arg2 = void,
-          typename Arg3 = void,
-          typename Arg4 = void>
-class VoidSlot;
-
-template <class Receiver, class Arg0=void, class Arg1=void, class Arg2=void, class Arg3=void, class Arg4=void>
-class Slot : public SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>,
-			 public FunctionWrapper<void (*)()>
-{
-public:
-
-	typedef void (Receiver::*Function)(Arg0, Arg1, Arg2, Arg3, Arg4);
-	
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
-	}
-
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3, Arg4 arg4) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1, arg2, arg3, arg4);
-	}	
+	friend class SignalCore;
 };
 
-template <class Receiver>
-class Slot<Receiver, void, void, void, void, void> : public SlotBase<>,
-													 public FunctionWrapper<void (Receiver::*)()>
+// the part of a signal that doesn't depend on the argument types: the connection list and its upkeep.
+// Connecting, disconnecting and firing are main thread only (see QueuedSignal for other threads)
+class SignalCore
 {
 public:
 
-	typedef void (Receiver::*Function)();
+	SignalCore() : m_first(0), m_last(0), m_firing(0), m_dead(0) {}
 
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
+	~SignalCore() {
+		while (m_first) {
+			Connection* c = m_first;
+			if (c->receiver)
+				unlinkFromReceiver(c);
+			unlinkFromSignal(c);
+			delete c;
+		}
 	}
 
-	void fire() {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))();
+	// drops every connection of recv. Walks recv's own connections, which are usually one or two, not ours
+	void disconnect(Trackable* recv) {
+		Connection* c = recv->m_connections;
+		while (c) {
+			Connection* next = c->nextInReceiver;
+			if (c->signal == this)
+				disconnect(c);
+			c = next;
+		}
 	}
-};
 
-template <class Receiver, class Arg0>
-class Slot<Receiver, Arg0, void, void, void, void> : public SlotBase<Arg0>,
-													 public FunctionWrapper<void (Receiver::*)(Arg0)>
+	// O(1); c is what connect() returned. Safe to call from a slot while this signal is firing
+	void disconnect(Connection* c) {
+		if (!c->receiver)
+			return;
 
-{
-public:
-
-	typedef void (Receiver::*Function)(Arg0);
-	
-	Slot(Receiver* rec, Function func) {
-		Trackable* t = rec;
-		this->m_receiver = t;
-		this->m_function = func;
-	}
+		unlinkFromReceiver(c);
+		c->receiver = 0;
+		if (m_firing) {
+			// the fire loop may be standing on c; leave the node in place and sweep it afterwards
+			m_dead++;
+			return;
+		}
 
-	void fire(Arg0 arg) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg);
+		unlinkFromSignal(c);
+		delete c;
 	}
-};
 
-template <class Receiver, class Arg0, class Arg1>
-class Slot<Receiver, Arg0, Arg1, void, void, void> : public SlotBase<Arg0, Arg1>,
-													 public FunctionWrapper<void (Receiver::*)(Arg0,Arg1)>
-{
-public:
+protected:
 
-	typedef void (Receiver::*Function)(Arg0, Arg1);
-	
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
+	// connecting is the only place a signal allocates
+	Connection* attach(Trackable* recv, void* object, void (*invoke)()) {
+		Connection* c = new Connection;
+		c->signal = this;
+		c->receiver = recv;
+		c->object = object;
+		c->invoke = invoke;
+
+		c->nextInSignal = 0;
+		c->prevInSignal = m_last;
+		if (m_last)
+			m_last->nextInSignal = c;
+		else
+			m_first = c;
+		m_last = c;
+
+		c->prevInReceiver = 0;
+		c->nextInReceiver = recv->m_connections;
+		if (recv->m_connections)
+			recv->m_connections->prevInReceiver = c;
+		recv->m_connections = c;
+		return c;
+	}
+
+	void beginFire() {
+		m_firing++;
+	}
+
+	void endFire() {
+		if (--m_firing || !m_dead)
+			return;
+
+		Connection* c = m_first;
+		while (c) {
+			Connection* next = c->nextInSignal;
+			if (!c->receiver) {
+				unlinkFromSignal(c);
+				delete c;
+			}
+			c = next;
+		}
+		m_dead = 0;
 	}
 
-	void fire(Arg0 arg0, Arg1 arg1) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1);
-	}	
-};
+	Connection* m_first;
+	Connection* m_last;
 
-template <class Receiver, typename Result, typename Arg0, typename Arg1>
-class VoidSlot<Receiver, Result, Arg0, Arg1, void, void, void> :
-	public SlotBase<Arg0, Arg1>,
-	public FunctionWrapper<Result (Receiver::*)(Arg0,Arg1)>
-{
-public:
+private:
 
-	typedef Result (Receiver::*Function)(Arg0, Arg1);
+	SignalCore(const SignalCore&);
+	SignalCore& operator=(const SignalCore&);
 
-	VoidSlot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
+	void unlinkFromSignal(Connection* c) {
+		if (c->prevInSignal)
+			c->prevInSignal->nextInSignal = c->nextInSignal;
+		else
+			m_first = c->nextInSignal;
+		if (c->nextInSignal)
+			c->nextInSignal->prevInSignal = c->prevInSignal;
+		else
+			m_last = c->prevInSignal;
 	}
 
-	void fire(Arg0 arg0, Arg1 arg1) {
-		(void)(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1);
+	static void unlinkFromReceiver(Connection* c) {
+		if (c->prevInReceiver)
+			c->prevInReceiver->nextInReceiver = c->nextInReceiver;
+		else
+			c->receiver->m_connections = c->nextInReceiver;
+		if (c->nextInReceiver)
+			c->nextInReceiver->prevInReceiver = c->prevInReceiver;
 	}
-};
 
-template <class Receiver, typename Result, typename Arg0, typename Arg1, typename Arg2>
-class VoidSlot<Receiver, Result, Arg0, Arg1, Arg2, void, void> :
-	public SlotBase<Arg0, Arg1, Arg2>,
-	public FunctionWrapper<Result (Receiver::*)(Arg0,Arg1,Arg2)>
-{
-public:
-
-	typedef Result (Receiver::*Function)(Arg0, Arg1, Arg2);
-
-	VoidSlot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
-	}
-
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2) {
-		(void)(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1, arg2);
-	}
+	int m_firing;
+	int m_dead;
 };
 
-template <class Receiver, class Arg0, class Arg1, class Arg2>
-class Slot<Receiver, Arg0, Arg1, Arg2, void, void> : public SlotBase<Arg0, Arg1, Arg2>,
-													 public FunctionWrapper<void (Receiver::*)(Arg0,Arg1,Arg2)>
+Trackable::~Trackable()
 {
-public:
-
-	typedef void (Receiver::*Function)(Arg0, Arg1, Arg2);
-	
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
-	}
-
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1, arg2);
-	}	
-};
+	while (m_connections)
+		m_connections->signal->disconnect(m_connections);
+}
 
-template <class Receiver, class Arg0, class Arg1, class Arg2, class Arg3>
-class Slot<Receiver, Arg0, Arg1, Arg2, Arg3, void> : public SlotBase<Arg0, Arg1, Arg2, Arg3>,
-													 public FunctionWrapper<void (Receiver::*)(Arg0,Arg1,Arg2,Arg3)>
+template <class... Args>
+class Signal : public SignalCore
 {
 public:
 
-	typedef void (Receiver::*Function)(Arg0, Arg1, Arg2, Arg3);
-	
-	Slot(Receiver* rec, Function func) {
-		this->m_receiver = rec;
-		this->m_function = func;
+	template <class Receiver>
+	Connection* connect(Receiver* rec, void (Receiver::*func)(Args...)) {
+		return bind<Receiver, void>(rec, func);
 	}
 
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3) {
-		(static_cast<Receiver*>(this->m_receiver)->*(this->m_function))(arg0, arg1, arg2, arg3);
-	}	
-};
-
-
-
-
-
-template <class Arg0=void, class Arg1=void, class Arg2=void, class Arg3=void, class Arg4=void>
-class SignalBase : public Sender
-{
-public:
-
-	typedef Slot<Trackable, Arg0, Arg1, Arg2, Arg3, Arg4> Sl;
-	
-	virtual ~SignalBase() {
-		for (typename SlotSet::const_iterator it = this->m_slots.begin();
-			 it != this->m_slots.end(); ++it) {
-			Sl* s = static_cast<Sl*>(*it);
-			s->receiver()->disconnected(this);
-			delete (*it);
-		}
+	// for slots whose return value is of no interest to the signal
+	template <class Receiver, typename Result>
+	Connection* connectVoid(Receiver* rec, Result (Receiver::*func)(Args...)) {
+		return bind<Receiver, Result>(rec, func);
 	}
 
-	void connect(SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>* slot) {
-		m_slots.insert(slot);
+	// slots connected while firing are called too; slots disconnected while firing aren't, if they haven't
+	// been already
+	void fire(Args... args) {
+		beginFire();
+		for (Connection* c = m_first; c; c = c->nextInSignal) {
+			if (c->receiver)
+				(reinterpret_cast<Invoker>(c->invoke))(c, args...);
+		}
+		endFire();
 	}
 
-	void connect(Trackable* recv, SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>* slot) {
-		m_slots.insert(slot);
-		recv->connected(this);
-	}
+private:
 
-	void disconnect(Trackable* recv) {
-		typename SlotSet::iterator it = this->m_slots.begin();
-		typename SlotSet::iterator itEnd = this->m_slots.end();
-		while (it != itEnd) {
-			Sl* s = static_cast<Sl*>(*it);
-			if (s->receiver() == recv) {
-				delete (*it);
-				this->m_slots.erase(it++);
-				continue;
-			}
+	typedef void (*Invoker)(Connection*, Args...);
 
-			++it;
-		}
+	template <class Receiver, typename Result>
+	static void invoke(Connection* c, Args... args) {
+		Result (Receiver::*func)(Args...);
+		memcpy(&func, c->function, sizeof(func));
+		(void)(static_cast<Receiver*>(c->object)->*func)(args...);
 	}
 
-	virtual void disconnectTrackable(Trackable* recv) {
-		disconnect(recv);
-	}
-	
-protected:
+	template <class Receiver, typename Result>
+	Connection* bind(Receiver* rec, Result (Receiver::*func)(Args...)) {
+		static_assert(sizeof(func) <= sizeof(((Connection*)0)->function),
+		              "member function pointer doesn't fit in Connection::function");
 
-	typedef std::set<SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>* > SlotSet;
-	SlotSet m_slots;
+		Trackable* t = rec;
+		Invoker invoker = &Signal::invoke<Receiver, Result>;
+		Connection* c = attach(t, rec, reinterpret_cast<void (*)()>(invoker));
+		memcpy(c->function, &func, sizeof(func));
+		return c;
+	}
 };
 
-template <class Arg0=void, class Arg1=void, class Arg2=void, class Arg3=void, class Arg4=void>
-class Signal : public SignalBase<Arg0, Arg1, Arg2, Arg3, Arg4>
-{
-public:
+template <size_t... I>
+struct SignalArgIndices {};
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0, Arg1, Arg2, Arg3, Arg4)) {
-		SignalBase<Arg0>::connect(rec, new Slot<Receiver, Arg0, Arg1, Arg2, Arg3, Arg4>(rec, func));
-	}
-
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3, Arg4 arg4) {
-		typename std::set<SlotBase<Arg0, Arg1, Arg2, Arg3, Arg4>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0, arg1, arg2, arg3, arg4);
-		}
-	}
-};
+template <size_t N, size_t... I>
+struct MakeSignalArgIndices : MakeSignalArgIndices<N - 1, N - 1, I...> {};
 
-	
-template <>
-class Signal<void, void, void, void, void> : public SignalBase<>
+template <size_t... I>
+struct MakeSignalArgIndices<0, I...>
 {
-public:
-
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)()) {
-		SignalBase<>::connect(rec, new Slot<Receiver>(rec, func));
-	}
-		
-	void fire() {
-		std::set<SlotBase<>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire();
-		}
-	}
+	typedef SignalArgIndices<I...> Type;
 };
 
-template <class Arg0>
-class Signal<Arg0, void, void, void, void> : public SignalBase<Arg0>
+// a Signal that may also be posted from other threads (image jobs, file copies): post() copies the arguments
+// and the slots run from an idle on the default main context, in posting order. Connecting, disconnecting
+// and fire() stay main thread only. Posts still pending when the signal goes away are dropped
+template <class... Args>
+class QueuedSignal : public Signal<Args...>
 {
 public:
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0)) {
-		SignalBase<Arg0>::connect(rec, new Slot<Receiver, Arg0>(rec, func));
+	QueuedSignal() : m_queue(new Queue) {
+		m_queue->refs = 1;
+		m_queue->owner = this;
 	}
 
-	void fire(Arg0 arg0) {
-		typename std::set<SlotBase<Arg0>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0);
-		}
+	~QueuedSignal() {
+		m_queue->owner = 0;
+		unref(m_queue);
 	}
-};
-
-template <class Arg0, class Arg1>
-class Signal<Arg0, Arg1, void, void, void> : public SignalBase<Arg0, Arg1>
-{
-public:
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0, Arg1)) {
-		SignalBase<Arg0, Arg1>::connect(rec, new Slot<Receiver, Arg0, Arg1>(rec, func));
+	// any thread. One allocation for the copied arguments; nothing is locked beyond what g_idle_add does
+	void post(Args... args) {
+		Event* e = new Event(m_queue, args...);
+		g_atomic_int_inc(&m_queue->refs);
+		g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, &QueuedSignal::cbDeliver, e, &QueuedSignal::destroyEvent);
 	}
 
-	template <class Receiver, typename Result>
-	void connectVoid(Receiver* rec, Result (Receiver::*func)(Arg0, Arg1)) {
-		SignalBase<Arg0, Arg1>::connect(rec, new VoidSlot<Receiver, Result, Arg0, Arg1>(rec, func));
-	}
+private:
 
-	void fire(Arg0 arg0, Arg1 arg1) {
-		typename std::set<SlotBase<Arg0, Arg1>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0, arg1);
-		}
-	}
-};
+	// outlives the signal for as long as posts to it are in flight
+	struct Queue {
+		volatile gint refs;
+		QueuedSignal* owner;		// only touched on the main thread
+	};
 
-template <class Arg0, class Arg1, class Arg2>
-class Signal<Arg0, Arg1, Arg2, void, void> : public SignalBase<Arg0, Arg1, Arg2>
-{
-public:
+	struct Event {
+		Event(Queue* q, Args... values) : queue(q), args(values...) {}
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0, Arg1, Arg2)) {
-		SignalBase<Arg0, Arg1, Arg2>::connect(rec, new Slot<Receiver, Arg0, Arg1, Arg2>(rec, func));
-	}
+		Queue* queue;
+		std::tuple<typename std::decay<Args>::type...> args;
+	};
 
-	template <class Receiver, typename Result>
-	void connectVoid(Receiver* rec, Result (Receiver::*func)(Arg0, Arg1, Arg2)) {
-		SignalBase<Arg0, Arg1, Arg2>::connect(rec, new VoidSlot<Receiver, Result, Arg0, Arg1, Arg2>(rec, func));
+	template <size_t... I>
+	static void deliver(QueuedSignal* owner, Event* e, SignalArgIndices<I...>) {
+		owner->fire(std::get<I>(e->args)...);
 	}
 
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2) {
-		typename std::set<SlotBase<Arg0, Arg1, Arg2>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0, arg1, arg2);
-		}
+	static gboolean cbDeliver(gpointer data) {
+		Event* e = static_cast<Event*>(data);
+		if (e->queue->owner)
+			deliver(e->queue->owner, e, typename MakeSignalArgIndices<sizeof...(Args)>::Type());
+		return FALSE;
 	}
-};
-
-template <class Arg0, class Arg1, class Arg2, class Arg3>
-class Signal<Arg0, Arg1, Arg2, Arg3, void> : public SignalBase<Arg0, Arg1, Arg2, Arg3>
-{
-public:
 
-	template <class Receiver>
-	void connect(Receiver* rec, void (Receiver::*func)(Arg0, Arg1, Arg2, Arg3)) {
-		SignalBase<Arg0, Arg1, Arg2, Arg3>::connect(rec, new Slot<Receiver, Arg0, Arg1, Arg2, Arg3>(rec, func));
+	static void destroyEvent(gpointer data) {
+		Event* e = static_cast<Event*>(data);
+		unref(e->queue);
+		delete e;
 	}
 
-	void fire(Arg0 arg0, Arg1 arg1, Arg2 arg2, Arg3 arg3) {
-		typename std::set<SlotBase<Arg0, Arg1, Arg2, Arg3>* >::iterator it = this->m_slots.begin();
-		while (it != this->m_slots.end()) {
-			(*it++)->fire(arg0, arg1, arg2, arg3);
-		}
+	static void unref(Queue* q) {
+		if (g_atomic_int_dec_and_test(&q->refs))
+			delete q;
 	}
+
+	Queue* m_queue;
 };
 
 /*
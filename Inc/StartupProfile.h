@@ -0,0 +1,84 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef STARTUPPROFILE_H
+#define STARTUPPROFILE_H
+
+#include <vector>
+
+#include <glib.h>
+#include <json.h>
+
+/*
+ * Where startup time goes. Each init step is timed with a StartupProfile::Phase in its scope; a finished
+ * phase is logged as a STARTUP_PHASE PmLog event and kept for the private getStartupProfile method.
+ * Times are microseconds from the start of main() (monotonic). Phases nest, so "depth" tells the steps of
+ * a bigger one apart from it. Once markReady() has run, phases are no-ops: the same scopes also run per
+ * request later on, which is not startup; a phase still open at that point keeps a duration of -1.
+ */
+class StartupProfile
+{
+public:
+
+	static StartupProfile* instance();
+
+	// the main loop is about to run (or has run its first iteration); logged once as STARTUP_DONE, and
+	// nothing is recorded after it
+	void markReady();
+
+	json_object* toJson() const;
+
+	// name has to outlive the profile (a literal)
+	class Phase
+	{
+	public:
+		Phase(const char* name) : m_index(StartupProfile::instance()->begin(name)) {}
+		~Phase() { StartupProfile::instance()->end(m_index); }
+	private:
+		int m_index;
+	};
+
+private:
+
+	struct Entry
+	{
+		const char* name;
+		int depth;
+		gint64 start;
+		gint64 duration;		// -1 while running
+	};
+
+	StartupProfile();
+
+	gint64 elapsed() const { return g_get_monotonic_time() - m_start; }
+
+	int begin(const char* name);
+	void end(int index);
+
+	static StartupProfile* s_instance;
+
+	gint64 m_start;
+	gint64 m_ready;			// -1 until markReady()
+	int m_depth;
+	std::vector<Entry> m_entries;
+};
+
+#endif /* STARTUPPROFILE_H */
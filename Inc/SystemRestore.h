@@ -18,6 +18,9 @@
 #ifndef SYSTEMRESTORE_H
 #define SYSTEMRESTORE_H
 
+#include <set>
+#include <vector>
+
 #include "PrefsDb.h"
 #include <luna-service2/lunaservice.h>
 
@@ -37,6 +40,13 @@ public:
 	static SystemRestore * instance();
 	
 	static int startupConsistencyCheck();
+	// staged startup: startupConsistencyCheck() runs from the main loop, once the service is registered
+	static void scheduleStartupConsistencyCheck();
+	// true once startupConsistencyCheck() has finished and the media files it restores are in place
+	static bool isReady();
+	// for methods that need the media partition restored: if it isn't yet, holds on to message and calls
+	// method with it again once it is (and returns true; the caller just returns true too)
+	static bool deferUntilReady(LSHandle* lsHandle, LSMessage* message, LSMethodFunction method, void* data);
 	static int runtimeConsistencyCheck();
 	static int createSpecialDirectories();
 	
@@ -74,6 +84,23 @@ protected:
 
 	int restoreDefaultRingtoneToMediaPartition();
 	int restoreDefaultWallpaperToMediaPartition();
+
+	//media partition copies run in the background (FileCopier); the system token and the pref naming the
+	//restored file (prefKey, set to prefValue) wait for them. A failed copy leaves the pref as it was.
+	//A restore asked for again while its copy is still going (a handler stays inconsistent until then)
+	//doesn't queue another one
+	struct PendingCopy {
+		SystemRestore* self;
+		std::string dest;
+		std::string prefKey;
+		std::string prefValue;
+	};
+	void queueCopy(const std::string& src, const std::string& dest, const std::string& prefKey, const std::string& prefValue);
+	static void cbCopied(const std::string& src, const std::string& dest, bool ok, void* data);
+	static void writeSystemToken();
+
+	static gboolean cbStartupConsistencyCheck(gpointer data);
+	void runDeferredCalls();
 	
 	bool msmAvail(LSMessage* message);
 	bool msmProgress(LSMessage* message);
@@ -82,5 +109,21 @@ protected:
 	bool msmPartitionAvailable(LSMessage* message);
 	
 	MSMState m_msmState;
+
+	int m_pendingCopies;
+	std::set<std::string> m_copiesInFlight;
+	bool m_copyFailed;
+	bool m_writeTokenAfterCopies;
+
+	struct DeferredCall {
+		LSHandle* lsHandle;
+		LSMessage* message;
+		LSMethodFunction method;
+		void* data;
+	};
+
+	bool m_ready;
+	bool m_readyAfterCopies;
+	std::vector<DeferredCall> m_deferredCalls;
 };
 #endif
@@ -20,10 +20,14 @@
 
 #include <map>
 #include <list>
+#include <set>
 #include <vector>
+#include <bitset>
+#include <unordered_map>
 
 #include <glib.h>
 
+#include "FlatMap.h"
 #include "PrefsHandler.h"
 #include "SignalSlot.h"
 #include "BroadcastTime.h"
@@ -81,14 +85,20 @@ public:
 	virtual bool validate(const std::string& key, json_object* value);
 	virtual void valueChanged(const std::string& key, json_object* value);
 	virtual json_object* valuesForKey(const std::string& key);
+	virtual const std::string* serializedValuesForKey(const std::string& key);
 
 	static TimePrefsHandler *instance() { return s_inst; }
+	// parsed from the zone file on each call, nothing of it is kept; json_object_put() it when done
 	json_object * timeZoneListAsJson();
+	// timeZoneListAsJson() serialized: kept if it fits in [Time] zoneListBudget, otherwise built again for
+	// each caller and dropped once back in the main loop. Empty if there's no zone list
+	const std::string& timeZoneListAsJsonString();
 	bool isValidTimeZoneName(const std::string& tzName);
 	
 	void postSystemTimeChange();
     void postBroadcastEffectiveTimeChange();
 	void postNitzValidityStatus();
+	// coalesced: changes within s_timeChangeLaunchDelay of the first one make one wave of launches
 	void launchAppsOnTimeChange();
 	
 	const TimeZoneInfo* currentTimeZone() const { return m_cpCurrentTimeZone; }
@@ -112,7 +122,8 @@ public:
 
 	const TimeSources &timeSources() const { return m_timeSources; }
 
-	std::list<std::string> getTimeZonesForOffset(int offset);
+	// built on first use per offset and kept until the zone data is rescanned
+	const std::list<std::string>& getTimeZonesForOffset(int offset);
 
 	/**
 	 * Signal emmited when system-wide time changed with time delta (positive
@@ -181,6 +192,9 @@ public:
 	
 	static bool cbConvertDate(LSHandle* lsHandle, LSMessage *message,
 								void *user_data);
+
+	static bool cbDstTransition(LSHandle* lsHandle, LSMessage *message,
+								void *user_data);
 	
 	static bool cbServiceStateTracker(LSHandle* lsHandle, LSMessage *message,
 								void *user_data);
@@ -222,6 +236,8 @@ private:
 	void systemSetTimeZone(const std::string &tzFileActual,
 	                       const TimeZoneInfo &zoneInfo);   //this one does the OS work to set the timezone
 	bool systemSetTime(time_t deltaTime, const std::string &source);
+	// what is left of the last slew, which a step or a new slew cancels; microseconds
+	static long pendingSlewUsecs();
 
     /**
      * Ask system time to be set from one of available time sources
@@ -230,10 +246,10 @@ private:
     void updateSystemTime();
 
 	/**
-	 * Attach system-time information to json object.
-	 * Useful for building getSystemTime response
+	 * getSystemTime response for the current time. extra ("\"key\":value,...") goes in at the end
 	 */
-	void attachSystemTime(json_object *json);
+	std::string systemTimeReply(const std::string &extra = std::string());
+	std::string buildSystemTimeTail(struct tm &localTm, const std::string &nitzValidity);
 
 	static bool jsonUtil_ZoneFromJson(json_object * json,TimeZoneInfo& r_zoneInfo);
 	
@@ -244,6 +260,7 @@ private:
 #define NITZHANDLER_FLAGBIT_GZONEFORCE		(1 << 3)
 #define NITZHANDLER_FLAGBIT_SKIP_DST_SELECT	(1 << 4)
 #define NITZHANDLER_FLAGBIT_IGNORE_TIL_SET	(1 << 5)
+#define NITZHANDLER_FLAGBIT_REPEAT			(1 << 6)		//same report as the last applied one; only the clock is touched
 
 #define NITZHANDLER_RETURN_ERROR			-1
 #define NITZHANDLER_RETURN_SUCCESS			1
@@ -255,6 +272,9 @@ private:
 	
 	void  nitzHandlerSpecialCaseOffsetValue(NitzParameters& nitz,int& flags,std::string& r_statusMsg);
 
+	bool isRepeatedNitzReport(const NitzParameters& nitz,int flags) const;
+	void rememberNitzReport(const NitzParameters& nitz,int flags);
+
 #define TIMEOUTFN_RESETCYCLE		1
 #define TIMEOUTFN_ENDCYCLE			2
 	int timeoutFunc();
@@ -272,6 +292,21 @@ private:
 	void setPeriodicTimeSetWakeup();
 	bool isNTPAllowed();
 
+	void scheduleNextDstTransition();
+	void setDstTransitionWakeup();
+	void dstTransitionReached();
+	static gboolean cbDstTransitionTimeout(gpointer userData);
+	static bool cbSetDstTransitionPowerDResponse(LSHandle* lsHandle, LSMessage *message,
+								void *user_data);
+
+	static gboolean cbTimeChangeLaunchDelay(gpointer userData);
+	void queueTimeChangeLaunches();
+	void startTimeChangeLaunches();
+	static bool cbTimeChangeLaunchResponse(LSHandle* lsHandle, LSMessage *message,
+								void *user_data);
+	static gboolean cbTimeChangeLaunchTimeout(gpointer userData);
+	void finishTimeChangeLaunch(LSMessageToken token, bool timedOut);
+
     /**
      * Amount of seconds that increases during whole up-time
      */
@@ -291,28 +326,56 @@ private:
 
 	static TimePrefsHandler * s_inst;			///not a true instance handle. Just points to the first one created
 	
-	typedef std::list<TimeZoneInfo*> TimeZoneInfoList;
-	typedef std::list<TimeZoneInfo*>::iterator TimeZoneInfoListIterator;
-	typedef std::list<TimeZoneInfo*>::const_iterator TimeZoneInfoListConstIterator;
+	typedef std::vector<TimeZoneInfo*> TimeZoneInfoList;
+	typedef std::vector<TimeZoneInfo*>::iterator TimeZoneInfoListIterator;
+	typedef std::vector<TimeZoneInfo*>::const_iterator TimeZoneInfoListConstIterator;
 	
-	typedef std::map<int,TimeZoneInfo*> TimeZoneMap;
-	typedef std::map<int,TimeZoneInfo*>::iterator TimeZoneMapIterator;
-	typedef std::map<int,TimeZoneInfo*>::const_iterator TimeZoneMapConstIterator;
+	typedef FlatMap<int,TimeZoneInfo*> TimeZoneMap;
+	typedef TimeZoneMap::iterator TimeZoneMapIterator;
+	typedef TimeZoneMap::const_iterator TimeZoneMapConstIterator;
+
+	typedef std::unordered_map<std::string,const TimeZoneInfo*> TimeZoneNameMap;
+	typedef std::unordered_map<int,TimeZoneInfoList> TimeZoneOffsetMap;
+
+	struct OffsetCountryKey {
+		int offset;
+		std::string countryCode;
+		bool operator==(const OffsetCountryKey& c) const {
+			return offset == c.offset && countryCode == c.countryCode;
+		}
+	};
+	struct OffsetCountryKeyHash {
+		size_t operator()(const OffsetCountryKey& k) const {
+			return std::hash<std::string>()(k.countryCode) * 31 + k.offset;
+		}
+	};
+	typedef std::unordered_map<OffsetCountryKey,TimeZoneInfoList,OffsetCountryKeyHash> TimeZoneOffsetCountryMap;
 
-	typedef std::pair<int,TimeZoneInfo*> TimeZonePair;
-	typedef std::multimap<int,TimeZoneInfo*> TimeZoneMultiMap;
-	typedef std::multimap<int,TimeZoneInfo*>::iterator TimeZoneMultiMapIterator;
-	typedef std::multimap<int,TimeZoneInfo*>::const_iterator TimeZoneMultiMapConstIterator;
+	// two letter, upper case country codes only; -1 for anything else (those use howManyZonesForCountry)
+	static int countryCodeIndex(const std::string& countryCode);
 	
 	std::list<std::string> m_keyList;
 	
+	// every zone scanTimeZoneJson() builds lives in this one block; the containers below point into it
+	TimeZoneInfo* m_zoneStore;
+	size_t m_zoneStoreSize;
+
 	TimeZoneInfoList m_zoneList;
 	TimeZoneInfoList m_syszoneList;
 	
 	TimeZoneMap m_mccZoneInfoMap;
 	TimeZoneMap m_preferredTimeZoneMapDST;
 	TimeZoneMap m_preferredTimeZoneMapNoDST;
-	TimeZoneMultiMap m_offsetZoneMultiMap;
+
+	// the lookup indexes; lists keep zone list order, and where names repeat the first zone wins as it
+	// would in a scan
+	TimeZoneNameMap m_zoneByName;					// m_zoneList, then m_syszoneList
+	TimeZoneOffsetMap m_zonesByOffset;				// m_zoneList
+	TimeZoneOffsetCountryMap m_zonesByOffsetAndCountry;
+	FlatMap<int,const TimeZoneInfo*> m_sysZoneByOffset;
+	std::bitset<26*26> m_multiZoneCountries;		// countries whose zones span more than one offset
+
+	std::map<int,std::list<std::string> > m_timeZonesForOffsetCache;
 	
 	static const TimeZoneInfo s_failsafeDefaultZone;
 	const TimeZoneInfo * 	m_cpCurrentTimeZone;
@@ -324,8 +387,15 @@ private:
     
     NitzParameters	*	m_p_lastNitzParameter;
     int					m_lastNitzFlags;
-    
-    static json_object * s_timeZonesJson;
+
+    //the last report the chain applied, as it came in (before the handlers adjusted it), with the entry flags,
+    //NITZ settings and resulting zone it was applied under. Reports matching it skip zone selection and db writes
+    NitzParameters		m_lastNitzReport;
+    int					m_lastNitzReportFlags;
+    int					m_lastNitzReportSetting;
+    std::string			m_lastNitzReportZone;
+    time_t				m_lastNitzReportStamp;		//currentStamp() when it came in
+    bool				m_lastNitzReportApplied;
     
     GSource *	m_gsource_periodic;
     guint		m_gsource_periodic_id;
@@ -333,6 +403,17 @@ private:
     
     bool		m_sendWakeupSetToPowerD;
 
+    time_t		m_nextDstTransition;		//utc time of the current zone's next offset change, 0 if none is known
+    guint		m_dstTransitionSourceId;
+    bool		m_sendDstAlarmToPowerD;
+
+	// timeChangeLaunch apps still to be launched (appId, launch payload), at most one entry per app, and
+	// the launches waiting on applicationManager (call token -> the timeout that gives up on it)
+	guint		m_timeChangeLaunchSourceId;
+	std::list<std::pair<std::string, std::string> > m_timeChangeLaunchQueue;
+	std::set<std::string> m_timeChangeLaunchQueued;
+	std::map<LSMessageToken, guint> m_timeChangeLaunchesInFlight;
+
 	time_t m_lastNtpUpdate;
 
     bool        m_nitzTimeZoneAvailable;
@@ -345,6 +426,25 @@ private:
 	std::string m_systemTimeSourceTag;
 
 	NTPClock    m_ntpClock;
+
+	/**
+	 * Everything in a getSystemTime response except utc and localtime, as json text. It only changes with the
+	 * zone, its DST state, the system time source or NITZ validity, which are kept to tell when it has to be
+	 * built again
+	 */
+	struct SystemTimeTemplate
+	{
+		SystemTimeTemplate() : zone(0), gmtOffset(0), isDst(-1), valid(false) {}
+
+		const TimeZoneInfo *zone;
+		long gmtOffset;
+		int isDst;
+		std::string source;
+		std::string nitzValidity;
+		bool valid;
+		std::string tail;
+	};
+	SystemTimeTemplate m_systemTimeTemplate;
 };
 
 #endif /* TIMEPREFSHANDLER_H */
@@ -22,8 +22,15 @@
 #include <stdint.h>
 #include <json.h>
 
+#include <time.h>
+
 #include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
+class TzZone;
 
 class TimeZoneService
 {
@@ -71,13 +78,42 @@ private:
 	typedef std::list<TimeZoneEntry> TimeZoneEntryList;
 	typedef std::list<TimeZoneResult> TimeZoneResultList;
 
+	// a zone's dst transitions for one year, as the local wall clock times EAS describes them with
+	struct EasRuleKey {
+		int offset;					// standard offset in minutes, as in the zone list
+		time_t dstStartLocal;		// in standard time
+		time_t dstEndLocal;			// in daylight time
+
+		bool operator<(const EasRuleKey& other) const {
+			if (offset != other.offset)
+				return offset < other.offset;
+			if (dstStartLocal != other.dstStartLocal)
+				return dstStartLocal < other.dstStartLocal;
+			return dstEndLocal < other.dstEndLocal;
+		}
+	};
+
+	struct EasCandidate {
+		std::string tz;
+		int64_t dstOffset;
+	};
+
+	typedef std::vector<EasCandidate> EasCandidateList;
+	typedef std::map<EasRuleKey, EasCandidateList> EasRuleIndex;
+
 private:
 
 	TimeZoneService();
 	~TimeZoneService();
 
-	std::string getTimeZoneRules(const TimeZoneEntryList& entries);
+	// compact: one array of numbers per year, grouped by tz
+	std::string getTimeZoneRules(const TimeZoneEntryList& entries, bool compact);
 	TimeZoneResultList getTimeZoneRuleOne(const TimeZoneEntry& entry);
+	static bool getTimeZoneRule(const TzZone& zone, const std::string& tz, int year, TimeZoneResult& r_result);
+	// zones (in zone list order) with the given offset and transitions this year, 0 if none
+	const EasCandidateList* easCandidates(int offset, const std::list<std::string>& timeZones,
+										  int year, time_t dstStartLocal, time_t dstEndLocal);
+	static time_t easLocalTime(const EasSystemTime& time, int year);
 	static void readEasDate(json_object* obj, EasSystemTime& time);
 	static void updateEasDateDayOfMonth(EasSystemTime& time, int year);
 
@@ -86,6 +122,11 @@ private:
 	LSPalmService* m_service;
 	LSHandle* m_serviceHandlePublic;
 	LSHandle* m_serviceHandlePrivate;
+
+	// built lazily, one offset at a time, and thrown away when the year changes
+	EasRuleIndex m_easIndex;
+	std::set<int> m_easIndexedOffsets;
+	int m_easIndexYear;
 };	
 
 
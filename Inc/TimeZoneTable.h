@@ -0,0 +1,80 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef TIMEZONETABLE_H
+#define TIMEZONETABLE_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <json.h>
+
+/*
+ * The parts of the zone json (ext-timezones.json) that TimePrefsHandler works with, pulled out of it once.
+ * Parsing that file is slow, so the table is also kept as a binary snapshot tied to the file's size and
+ * content checksum; as long as the json is unchanged the snapshot is mapped and read instead.
+ */
+class TimeZoneTable
+{
+public:
+
+	struct Zone {
+		Zone() : offsetFromUTC(0), supportsDST(0), mcc(0), preferred(false), complete(false) {}
+
+		std::string zoneId;
+		std::string countryCode;
+		std::string json;			// the entry, as json_object_to_json_string() writes it
+		int offsetFromUTC;
+		int supportsDST;
+		int mcc;
+		bool preferred;
+		bool complete;				// has every field its array needs to be used as a zone; incomplete ones are left out of the handler entirely
+	};
+
+	typedef std::vector<Zone> ZoneList;
+
+	TimeZoneTable();
+
+	// uses the snapshot if it was made from the current contents of jsonPath, otherwise parses jsonPath and
+	// rewrites the snapshot. If parsing was needed and r_json is non-null it gets the parsed tree (caller owns it)
+	bool load(const char* jsonPath, const char* snapshotPath, json_object** r_json);
+
+	bool loadFromJson(json_object* root);
+
+	ZoneList zones;					// "timeZone", entries with a ZoneID
+	ZoneList sysZones;				// "syszones", entries with a ZoneID
+	ZoneList mccZones;				// "mccInfo", complete entries only
+
+	// index into zones of the first entry marked "default", if that entry is usable; -1 otherwise
+	int defaultZone;
+	// the default entry's "countryCode" (lower case c, unlike the other entries)
+	std::string defaultCountryCode;
+
+private:
+
+	void clear();
+	bool loadSnapshot(const char* snapshotPath, off_t sourceSize, guint64 sourceHash);
+	bool saveSnapshot(const char* snapshotPath, off_t sourceSize, guint64 sourceHash) const;
+};
+
+#endif /* TIMEZONETABLE_H */
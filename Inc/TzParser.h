@@ -18,7 +18,8 @@
 #ifndef TZPARSER_H
 #define TZPARSER_H
 
-#include <list>
+#include <vector>
+#include <memory>
 #include <time.h>
 
 #define TZ_ABBR_MAX_LEN	16
@@ -32,8 +33,89 @@ struct TzTransition
 	char   abbrName[TZ_ABBR_MAX_LEN];
 };
 
-typedef std::list<TzTransition> TzTransitionList;
+typedef std::vector<TzTransition> TzTransitionList;
+
+// one end of a POSIX TZ rule's daylight period
+struct TzRuleDate
+{
+	char kind;		// 'J' (Jn, 1-365 never counting Feb 29), 'D' (n, 0-365), 'M' (Mm.w.d)
+	int  day;		// Jn/n day, or weekday (0 is Sunday) for M
+	int  week;		// M only, 1-5 where 5 is the last one in the month
+	int  month;		// M only, 1-12
+	long time;		// local seconds after midnight the change happens, may be negative or past 24h
+};
+
+// the POSIX TZ rule string from the footer of a version 2+ file: local time after the last transition
+struct TzRule
+{
+	bool       valid;
+	bool       hasDst;
+	time_t     stdOffset;	// seconds east of utc, like TzTransition::utcOffset
+	time_t     dstOffset;
+	char       stdAbbr[TZ_ABBR_MAX_LEN];
+	char       dstAbbr[TZ_ABBR_MAX_LEN];
+	TzRuleDate start;		// into dst, given in standard time
+	TzRuleDate end;			// out of dst, given in dst
+};
+
+// A parsed zone: its transitions in time order plus an index of where each year's transitions start,
+// so per-year lookups don't have to scan. Files that stop listing transitions early (slim zoneinfo) have
+// the table filled out from their footer rule up to 2037 as zic's fat output would be; past that the rule
+// itself answers the offset lookups
+class TzZone
+{
+public:
+
+	TzZone(const TzTransitionList& transitions, const TzRule& rule);
+
+	const TzTransitionList& transitions() const { return m_transitions; }
+
+	// sets [r_first, r_last) to the transitions within year; false if there are none
+	bool transitionsForYear(int year, const TzTransition*& r_first, const TzTransition*& r_last) const;
+	// the latest transition in year or before it, 0 if the zone has none that early
+	const TzTransition* lastTransitionUpToYear(int year) const;
+
+	// the utc offset in effect at t. False if t is before the first transition, or after the last one in a
+	// file without a footer rule
+	bool utcOffsetAt(time_t t, time_t& r_offset) const;
+	// the utc time of a local wall clock time, given as seconds since the epoch as if it were utc. A local
+	// time skipped by a transition maps to the instant just after it, as with mktime()
+	bool utcFromLocal(time_t local, time_t& r_utc) const;
+	// the first transition after t that changes the utc offset (not just the abbreviation), from the table
+	// or else the footer rule. False if neither has one
+	bool nextOffsetChangeAfter(time_t t, TzTransition& r_next) const;
+
+private:
+
+	TzTransitionList m_transitions;
+	int m_firstYear;
+	// the file has no transitions at all, just one local time type (the UTC/Etc zones)
+	bool m_fixedOffset;
+	// m_yearStart[y - m_firstYear] is the index of the first transition in year y or later; one extra slot
+	// at the end. Empty if the years weren't monotonic (then lookups fall back to scanning)
+	std::vector<unsigned int> m_yearStart;
+	TzRule m_rule;
+};
+
+typedef std::shared_ptr<const TzZone> TzZonePtr;
+
+// cached per process; the zoneinfo file is re-validated on every call. Null if the zone can't be loaded
+TzZonePtr loadTimeZone(const char* tzName);
 
 TzTransitionList parseTimeZone(const char* tzName);
 
+// what loadTimeZone() has been up to since the last reset, for /getServiceStats. Main thread only, like the
+// cache itself
+struct TzParserStats
+{
+	unsigned long loads;			// calls that found a zone file
+	unsigned long cacheHits;
+	unsigned long decodes;			// files read and decoded (misses and files that changed)
+	unsigned long transitions;		// transitions decoded, over all decodes
+	long long decodeUsecs;			// wall time spent mapping and decoding, CLOCK_MONOTONIC
+};
+
+const TzParserStats& tzParserStats();
+void resetTzParserStats();
+
 #endif /* TZPARSER_H */
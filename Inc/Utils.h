@@ -75,6 +75,19 @@ int splitFileAndExtension(const std::string& srcFileAndExt,std::string& filePart
 int splitStringOnKey(std::vector<std::string>& returnSplitSubstrings,const std::string& baseStr,const std::string& delims);
 int splitStringOnKey(std::list<std::string>& returnSplitSubstrings,const std::string& baseStr,const std::string& delims);
 
+// allocation-free variants of the above for parsing loops: they work on the len chars at str (which need not be
+// terminated) and hand back substrings as offsets into it instead of copies
+struct Substring {
+	size_t start;
+	size_t length;
+};
+
+// narrows r_range (a range of str) to drop leading and trailing chars in drop; false if nothing is left
+bool trimWhitespace(const char* str,Substring& r_range,const char* drop = "\r\n\t ");
+bool getNthSubstring(unsigned int n,Substring& r_target,const char* str,size_t len,const char* delims = " \t\n\r");
+// stores the first maxSplits substrings in r_splits and returns how many there are in all, which can be more
+int splitStringOnKey(Substring* r_splits,int maxSplits,const char* str,size_t len,const char* delims);
+
 bool doesExistOnFilesystem(const char * pathAndFile);
 int fileCopy(const char * srcFileAndPath,const char * dstFileAndPath);
 
@@ -86,6 +99,12 @@ int urlEncodeFilename(std::string& encodedName,const std::string& decodedName);
 unsigned int getRNG_UInt();
 std::string base64_encode(unsigned char const* , unsigned int len);
 std::string base64_decode(std::string const& s);
+// the same codec into caller buffers: r_out needs base64_encoded_size(len) (resp. base64_decoded_size(len))
+// bytes; no terminator is written. Both return the number of bytes written
+inline size_t base64_encoded_size(size_t len) { return ((len + 2) / 3) * 4; }
+inline size_t base64_decoded_size(size_t len) { return (len / 4) * 3 + 2; }
+size_t base64_encode(char* r_out,const unsigned char* bytes,size_t len);
+size_t base64_decode(unsigned char* r_out,const char* encoded,size_t len);
 
 bool extractFromJson(const std::string& jsonString,const std::string& key,std::string& r_value);
 bool extractFromJson(struct json_object * root,const std::string& key,std::string& r_value);
@@ -103,6 +122,9 @@ std::string string_printf(const char *format, ...) G_GNUC_PRINTF(1, 2);
 // Append a printf-style string to an existing std::string
 std::string & append_format(std::string & str, const char * format, ...) G_GNUC_PRINTF(2, 3);
 
+// Replace the contents of str with a printf-style string, reusing its buffer
+std::string & assign_format(std::string & str, const char * format, ...) G_GNUC_PRINTF(2, 3);
+
 void string_to_lower(std::string& str);
 
 }
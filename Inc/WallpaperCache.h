@@ -0,0 +1,83 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef WALLPAPERCACHE_H
+#define WALLPAPERCACHE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Screen sized wallpapers and thumbnails made by earlier imports, so importing the same picture again
+ * (after a restore, or picking it from the gallery twice) doesn't decode and scale it again.
+ * Entries are keyed by a checksum of the source file's contents plus whatever else went into producing
+ * them (screen size, focus, scale...); the least recently used ones are dropped once the total goes over
+ * the configured size.
+ */
+class WallpaperCache
+{
+public:
+
+	WallpaperCache();
+
+	// maxBytes <= 0 disables the cache
+	void init(const std::string& cacheDir, off_t maxBytes);
+
+	bool enabled() const { return m_maxSize > 0 && !m_dir.empty(); }
+
+	// empty if the source can't be read
+	std::string keyFor(const std::string& sourcePathAndFile, const std::string& parameters) const;
+
+	// puts the cached wallpaper and thumbnail at the given paths; false on a miss
+	bool fetch(const std::string& key, const std::string& destPathAndFile, const std::string& destThumbPathAndFile);
+	void store(const std::string& key, const std::string& wallpaperPathAndFile, const std::string& thumbPathAndFile);
+
+	// the other renditions made along with an entry (wallpaper variants), by tag. They are kept and dropped
+	// with the entry; storing the wallpaper again keeps them, since the key already says they still match
+	bool fetchVariant(const std::string& key, const std::string& tag, const std::string& destPathAndFile);
+	void storeVariant(const std::string& key, const std::string& tag, const std::string& pathAndFile);
+
+private:
+
+	struct Entry {
+		Entry() : size(0), lastUsed(0) {}
+		off_t size;
+		time_t lastUsed;
+		std::set<std::string> variants;
+	};
+
+	void scan();
+	void evict();
+	void removeEntry(const std::string& key);
+	std::string wallpaperPath(const std::string& key) const;
+	std::string thumbPath(const std::string& key) const;
+	std::string variantPath(const std::string& key, const std::string& tag) const;
+
+	std::map<std::string, Entry> m_entries;
+	std::string m_dir;
+	off_t m_maxSize;
+	off_t m_totalSize;
+};
+
+#endif /* WALLPAPERCACHE_H */
@@ -19,10 +19,16 @@
 #define WALLPAPERPREFSHANDLER_H
 
 #include "PrefsHandler.h"
+#include "WallpaperCache.h"
 
+#include <map>
+#include <vector>
+#include <time.h>
 #include <json.h>
 #include <QtGui/QImage>
 
+class QImageReader;
+
 class WallpaperPrefsHandler : public PrefsHandler {
 	
 public:
@@ -40,7 +46,8 @@ public:
 	virtual bool isPrefConsistent();
 	virtual void restoreToDefault();
 	
-	bool importWallpaperViaImage2(const std::string& imageSourceUrl,double centerX,double centerY,double scaleFactor,json_object ** r_p_responseObject);
+	bool importWallpaperViaImage2(std::string& ret_wallpaperName,const std::string& imageSourceUrl,double centerX,double centerY,double scaleFactor,json_object ** r_p_responseObject);
+	bool importWallpaperInProcess(std::string& ret_wallpaperName,const std::string& imageSourceUrl,double centerX,double centerY,double scaleFactor,std::string& errorText);
 
 	bool importWallpaper(std::string& ret_wallpaperName,const std::string& sourcePathAndFile,
 							bool toScreenSize,
@@ -68,23 +75,84 @@ public:
 	
 	const std::list<std::string>& scanForWallpapers(bool rebuild=false); 
 	const std::list<std::string>& buildIndexFromExisting(int * nInvalid=NULL);
+	// the wallpapers in the index; without a watch on the dir, rescanned first if it was changed by someone other than us
+	const std::list<std::string>& refreshWallpapers();
 	
 	static bool makeLocalUrlsFromWallpaperName(std::string& wallpaperUrl,std::string& wallpaperThumbUrl,const std::string& wallpaperName);
 	static bool makeLocalPathnamesFromWallpaperName(std::string& wallpaperUrl,std::string& wallpaperThumbUrl,const std::string& wallpaperName);
 	
 	bool getWallpaperSpecFromName(const std::string& wallpaperName,std::string& wallpaperFile,std::string& wallpaperThumbFile);
 	bool getWallpaperSpecFromFilename(std::string& wallpaperName,std::string& wallpaperFile,std::string& wallpaperThumbFile);
+
+	// adds "variants" [{width, height, wallpaperFile}] for the renditions of wallpaperName that exist
+	static void addVariantsToJson(json_object* wallpaper, const std::string& wallpaperName);
 	
 private:
     QImage clipImageToScreenSizeWithFocus(QImage& image, int focus_x,int focus_y);
+    QImage clipImageToSizeWithFocus(QImage& image, int width, int height, int focus_x, int focus_y);
     QImage clipImageToScreenSize(QImage& image, bool center);
     int resizeImage(const std::string& sourceFile, const std::string& destFile, int destImgW, int destImgH, const char* format);
+    bool readWallpaperClipped(const std::string& sourceFile, QImageReader& reader, bool justScale,
+                              double centerX, double centerY, double scale,
+                              const std::string& destFile, std::string& r_errorText, const char* format = 0);
 	void getScreenDimensions();
+	void parseVariants(const std::string& spec);
+	// both leave alone variants already in place and put what they render into the cache under cacheKey
+	void writeVariants(const QImage& image, double centerX, double centerY, double scale, const std::string& wallpaperName,
+					   const std::string& cacheKey);
+	void renderVariants(const std::string& sourcePathAndFile, double centerX, double centerY, double scale,
+						const std::string& wallpaperName, const std::string& cacheKey);
+	static void removeVariants(const std::string& wallpaperName);
+	std::string cacheKeyFor(const std::string& sourcePathAndFile, const char* method,
+							bool toScreenSize, double centerX, double centerY, double scale) const;
 	
+	struct IndexEntry {
+		IndexEntry() : mtime(0), width(0), height(0) {}
+		time_t mtime;
+		int width;
+		int height;
+	};
+
+	// what a dir looked like when the index was saved. Whole seconds alone miss a file added in the same second
+	// (and vfat has no finer times at all), so the entry count is part of it too
+	struct DirStamp {
+		DirStamp() : sec(0), nsec(0), entries(-1) {}
+		bool operator==(const DirStamp& other) const
+		{ return sec == other.sec && nsec == other.nsec && entries == other.entries; }
+		time_t sec;
+		long nsec;
+		int entries;
+	};
+	static DirStamp dirStamp(const std::string& path);
+	static void putDirStamp(json_object* root, const char* name, const DirStamp& stamp);
+	static DirStamp getDirStamp(json_object* root, const char* name);
+
+	bool loadIndex();
+	void saveIndex();
+	void syncIndex();
+	bool indexIsCurrent() const;
+	void indexWallpaper(const std::string& wallpaperName);
+	void addToIndex(const std::string& wallpaperName);
+	void wallpaperFileChanged(const std::string& name, bool present);
+	static void cbWallpaperDirChanged(const std::string& name, bool present, void* data);
+
+	// a size wallpapers are rendered at besides the screen's, kept in dir (under the thumbs dir) by wallpaper name
+	struct Variant {
+		int width;
+		int height;
+		std::string dir;
+	};
+
 	std::list<std::string> m_wallpapers;
+	std::map<std::string, IndexEntry> m_index;		// persisted, with the dir stamps it matches, in s_wallpaperIndexFile
+	DirStamp m_indexWallpaperDir;
+	DirStamp m_indexThumbsDir;
+	WallpaperCache m_cache;
 	std::string m_currentWallpaperName;
 	static std::string s_wallpaperDir;
 	static std::string s_wallpaperThumbsDir;
+	static std::string s_wallpaperIndexFile;
+	static std::vector<Variant> s_variants;
 	
 };
 
@@ -20,13 +20,16 @@
 
 //for basename()...
 #include <string.h>
+#include <sys/stat.h>
 #include <map>
+#include <set>
 #include "BackupManager.h"
 #include <json.h>
 #include "PrefsDb.h"
 #include "PrefsFactory.h"
 
 #include "Logging.h"
+#include "SystemRestore.h"
 #include "Utils.h"
 #include "Settings.h"
 #include "JSONUtils.h"
@@ -62,6 +65,12 @@ BackupManager::BackupManager()
 : m_doBackupFiles(true)
 , m_service(0)
 , m_p_backupDb(0)
+, m_backupKeysLoaded(false)
+, m_backupKeysMtime(0)
+, m_backupJournalId(0)
+, m_backupGeneration(0)
+, m_backupUnchanged(false)
+, m_restore(0)
 {
 }
 
@@ -99,21 +108,35 @@ BackupManager::~BackupManager()
 	}
 }
 
-void BackupManager::copyKeysToBackupDb()
+//reread only when the file changes; the list hardly ever does
+const std::list<std::string>& BackupManager::backupKeys()
 {
-	if (!m_p_backupDb)
-		return;
+	struct stat stBuf;
+	if (stat(s_backupKeylistFilename.c_str(), &stBuf) != 0)
+	{
+		qWarning() << "can't stat the backup key list [" << s_backupKeylistFilename.c_str() << "]";
+		m_backupKeys.clear();
+		m_backupKeysLoaded = false;
+		return m_backupKeys;
+	}
+	if (m_backupKeysLoaded && stBuf.st_mtime == m_backupKeysMtime)
+		return m_backupKeys;
+
+	m_backupKeys.clear();
+	m_backupKeysLoaded = true;
+	m_backupKeysMtime = stBuf.st_mtime;
+
 	//open the backup keys list to figure out what to copy
 	json_object * backupKeysJson = json_object_from_file((char *)(BackupManager::s_backupKeylistFilename.c_str()));
 	if (!backupKeysJson)
-		return;
+		return m_backupKeys;
 	//iterate over all the keys
-	std::list<std::string> keylist;
 	array_list* fileArray = json_object_get_array(backupKeysJson);
 	if (!fileArray)
 	{
         qWarning () << "file does not contain an array of string keys";
-		return;
+		json_object_put(backupKeysJson);
+		return m_backupKeys;
 	}
 
 
@@ -140,11 +163,73 @@ void BackupManager::copyKeysToBackupDb()
             qWarning() << "array object [" << index << "] is a key that is empty (skipping)";
 			continue;
 		}
-		keylist.push_back(key);
+		m_backupKeys.push_back(key);
 	}
-	m_p_backupDb->copyKeys(PrefsDb::instance(),keylist);
 	json_object_put(backupKeysJson);
+	return m_backupKeys;
+}
+
+//the incrementalKey the backup service hands back is the one sent with its last successful backup. It only
+//counts if it is from the same journal and the same key list as now
+bool BackupManager::isIncrementalFrom(json_object* incrementalKey, gint64& r_generation)
+{
+	if (!incrementalKey || json_object_get_type(incrementalKey) != json_type_object)
+		return false;
+
+	json_object* journalLabel = json_object_object_get(incrementalKey, "journalId");
+	json_object* generationLabel = json_object_object_get(incrementalKey, "generation");
+	json_object* keylistLabel = json_object_object_get(incrementalKey, "keylist");
+	if (!journalLabel || !generationLabel || !keylistLabel)
+		return false;
+
+	const char* journalId = json_object_get_string(journalLabel);
+	const char* generation = json_object_get_string(generationLabel);
+	if (!journalId || !generation)
+		return false;
+
+	if (g_ascii_strtoll(journalId, 0, 10) != PrefsDb::instance()->journalId()
+		|| json_object_get_int(keylistLabel) != (int) m_backupKeysMtime)
+		return false;
+
+	r_generation = g_ascii_strtoll(generation, 0, 10);
+	return r_generation > 0 && r_generation <= PrefsDb::instance()->journalGeneration();
+}
+
+//the file handed to the backup service is restored on its own, so it always gets every backed up key. The
+//journal only tells whether there is anything new to back up: m_backupUnchanged is set if nothing (written or
+//deleted) changed since incrementalKey
+void BackupManager::copyKeysToBackupDb(json_object* incrementalKey)
+{
+	m_backupUnchanged = false;
+	if (!m_p_backupDb)
+		return;
+
+	PrefsDb* prefsDb = PrefsDb::instance();
+	const std::list<std::string>& keylist = backupKeys();
+
+	m_backupJournalId = prefsDb->journalId();
+	m_backupGeneration = prefsDb->journalGeneration();
+	if (keylist.empty())
+		return;
+
+	gint64 since = 0;
+	if (m_backupJournalId && isIncrementalFrom(incrementalKey, since))
+	{
+		std::list<std::string> changed = prefsDb->keysChangedSince(since);
+		std::set<std::string> backedUp(keylist.begin(), keylist.end());
+		bool anyChanged = false;
+		for (std::list<std::string>::const_iterator it = changed.begin(); it != changed.end() && !anyChanged; ++it)
+			anyChanged = (backedUp.find(*it) != backedUp.end());
 
+		if (!anyChanged)
+		{
+			qDebug("no backed up key changed since generation %lld", (long long) since);
+			m_backupUnchanged = true;
+		}
+	}
+
+	qDebug("backup of %zu keys", keylist.size());
+	m_p_backupDb->copyKeys(prefsDb,keylist);
 }
 
 void BackupManager::initFilesForBackup(bool useFilenameWithoutPath)
@@ -205,7 +290,7 @@ Make a backup of LunaSysService preferences.
 }
 \endcode
 
-\param incrementalKey This is used primarily for mojodb, backup service will handle other incremental backups.
+\param incrementalKey The incrementalKey returned by the last successful preBackup. If it still applies and none of the backed up keys were written or deleted since then, the reply says so with "unchanged"; all the keys are backed up either way.
 \param maxTempBytes The allowed size of upload, currently 10MB (more than enough for our backups).
 \param tempDir Directory to store temporarily generated files.
 
@@ -214,13 +299,17 @@ Make a backup of LunaSysService preferences.
 {
     "description": string,
     "version": string,
-    "files": string array
+    "files": string array,
+    "incrementalKey": object,
+    "unchanged": boolean
 }
 \endcode
 
 \param description Describes the backup.
 \param version Version of the backup.
 \param files List of files included in the backup.
+\param incrementalKey Where in the preferences change journal this backup got to; pass it back with the next preBackup.
+\param unchanged Present (true) if nothing in the backup changed since the incrementalKey passed in; the previous backup may be kept instead of this one.
 
 \subsection com_palm_systemservice_pre_backup_examples Examples:
 \code
@@ -244,6 +333,9 @@ Example response for a succesful call:
  */
 bool BackupManager::preBackupCallback( LSHandle* lshandle, LSMessage *message, void *user_data)
 {
+    if (SystemRestore::deferUntilReady(lshandle, message, BackupManager::preBackupCallback, user_data))
+        return true;
+
     PMLOG_TRACE("%s:starting",__FUNCTION__);
     if (LSMessageIsHubErrorMessage(message)) {  // returns false if message is NULL
         qWarning("The message received is an error message from the hub");
@@ -312,11 +404,17 @@ bool BackupManager::preBackupCallback( LSHandle* lshandle, LSMessage *message, v
     {
     	//failed to create temp db
         qWarning() << "unable to create a temporary backup db at [" << dbfile.c_str() << "]...aborting!";
+    	json_object_put(root);
     	return pThis->sendPreBackupResponse(lshandle,message,std::list<std::string>());
     }
+    //the backup service is done with it by the next preBackup, which replaces it (or by shutdown)
+    pThis->m_p_backupDb->setDatabaseFileDeleteOnDestruction();
+
+    // copy relevant keys into the temporary backup database; every time, even if nothing changed, so the
+    // backup service always has a complete file to take (the reply says whether it may keep its last one)
+    pThis->copyKeysToBackupDb(json_object_object_get(root, "incrementalKey"));
+    json_object_put(root);
 
-    // Attempt to copy relevant keys into the temporary backup database
-    pThis->copyKeysToBackupDb();
 	// adding the files for backup at the time of request.
 	pThis->initFilesForBackup(myTmp);
 
@@ -373,6 +471,9 @@ Example response for a succesful call:
 */
 bool BackupManager::postRestoreCallback( LSHandle* lshandle, LSMessage *message, void *user_data)
 {
+        if (SystemRestore::deferUntilReady(lshandle, message, BackupManager::postRestoreCallback, user_data))
+                return true;
+
         LSError lserror;
         LSErrorInit(&lserror);
 
@@ -485,6 +586,27 @@ bool BackupManager::postRestoreCallback( LSHandle* lshandle, LSMessage *message,
 
     qDebug("fileArrayLength = %d", fileArrayLength);
 
+    if (pThis->m_restore)
+    {
+        qWarning () << "postRestore while another restore is still being merged";
+        json_object_object_add (response, "returnValue", json_object_new_boolean(false));
+        json_object_object_add (response, "errorText", json_object_new_string("Restore already in progress"));
+
+        if (!LSMessageReply (lshandle, message, json_object_to_json_string(response), &lserror )) {
+                qWarning() << "Can't send reply to postRestoreCallback error:" << lserror.message;
+                LSErrorFree (&lserror);
+        }
+
+        json_object_put (response);
+        return true;
+    }
+
+    Restore* restore = new Restore;
+    restore->lshandle = lshandle;
+    restore->message = message;
+    //what the handlers currently see; only keys the restore actually changes get refreshed afterwards
+    restore->preRestorePrefs = PrefsDb::instance()->getAllPrefs();
+
     for (index = 0; index < fileArrayLength; ++index)
     {
     	json_object* obj = (json_object*) array_list_get_idx (fileArray, index);
@@ -523,22 +645,63 @@ bool BackupManager::postRestoreCallback( LSHandle* lshandle, LSMessage *message,
     					(std::string(PrefsDb::s_mediaPartitionPath)+std::string(PrefsDb::s_sysserviceDir)+std::string("/lastRestoredTempDb.db")).c_str());
     		}
 
-    		//run a merge
-    		int rc = PrefsDb::instance()->merge(path);
-    		if (rc == 0)
-    		{
-                qWarning() << "merge() from [" << path.c_str() << "] didn't merge anything...could be an error or just an empty backup db";
-    		}
+    		restore->dbFiles.push_back(path);
     	}
     }
 	json_object_put (response);
 
+    //merged in steps from the main loop; the reply goes out once the last one is in
+    LSMessageRef(message);
+    pThis->m_restore = restore;
+    pThis->restoreNext();
+    return true;
+}
+
+void BackupManager::restoreNext()
+{
+	while (!m_restore->dbFiles.empty())
+	{
+		std::string path = m_restore->dbFiles.front();
+		m_restore->dbFiles.pop_front();
+
+		if (PrefsDb::instance()->mergeInSteps(path, cbRestoreProgress, cbRestoreMerged, this))
+			return;
+        qWarning() << "merge() from [" << path.c_str() << "] couldn't be started";
+	}
+
+	finishRestore();
+}
+
+void BackupManager::finishRestore()
+{
+	Restore* restore = m_restore;
+	m_restore = 0;
+
     // if for whatever reason the main db got closed, reopen it (the function will act ok if already open)
     PrefsDb::instance()->openPrefsDb();
-    //now refresh all the keys
-    PrefsFactory::instance()->refreshAllKeys();
+    // the restore wrote to the db directly, so don't trust what's in memory
+    PrefsDb::instance()->refreshCache();
+    //now refresh the keys that changed
+    PrefsFactory::instance()->refreshChangedKeys(restore->preRestorePrefs);
+
+    (void) sendPostRestoreResponse(restore->lshandle,restore->message);
+    LSMessageUnref(restore->message);
+    delete restore;
+}
 
-    return pThis->sendPostRestoreResponse(lshandle,message);
+void BackupManager::cbRestoreProgress(int merged, int total, void* data)
+{
+	qDebug("restore: %d of %d rows merged", merged, total);
+}
+
+void BackupManager::cbRestoreMerged(bool ok, int merged, void* data)
+{
+	BackupManager* pThis = static_cast<BackupManager*>(data);
+	if (!ok || merged == 0)
+	{
+        qWarning() << "merge() didn't merge anything...could be an error or just an empty backup db";
+	}
+	pThis->restoreNext();
 }
 
 bool BackupManager::sendPreBackupResponse(LSHandle* lshandle, LSMessage *message,const std::list<std::string> fileList)
@@ -579,6 +742,24 @@ bool BackupManager::sendPreBackupResponse(LSHandle* lshandle, LSMessage *message
 
 	json_object_object_add (response, "files", files);
 
+	//the files are complete either way; this only lets the backup service keep its last copy instead
+	if (m_doBackupFiles && m_backupUnchanged)
+		json_object_object_add (response, "unchanged", json_object_new_boolean(true));
+
+	//handed back in the next preBackup once this one went through; strings since generations are 64 bit
+	if (m_doBackupFiles && m_backupJournalId)
+	{
+		json_object* incrementalKey = json_object_new_object();
+		gchar* journalId = g_strdup_printf("%lld", (long long) m_backupJournalId);
+		gchar* generation = g_strdup_printf("%lld", (long long) m_backupGeneration);
+		json_object_object_add (incrementalKey, "journalId", json_object_new_string(journalId));
+		json_object_object_add (incrementalKey, "generation", json_object_new_string(generation));
+		json_object_object_add (incrementalKey, "keylist", json_object_new_int((int) m_backupKeysMtime));
+		json_object_object_add (response, "incrementalKey", incrementalKey);
+		g_free(journalId);
+		g_free(generation);
+	}
+
 	LSError lserror;
 	LSErrorInit(&lserror);
 
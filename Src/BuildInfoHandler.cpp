@@ -31,6 +31,7 @@
 #include "PrefsDb.h"
 #include "Logging.h"
 #include "Utils.h"
+#include "ConfigFileCache.h"
 
 #include <json_util.h>
 
@@ -96,35 +97,33 @@ void BuildInfoHandler::init()
  */
 int BuildInfoHandler::readBuildInfoFile(std::map<std::string,std::string>& KVpairs) {
 	
-	FILE * fp = fopen(BUILDINFO_FILE,"r");
-	if (fp == NULL)
+	std::string text;
+	if (!ConfigFileCache::instance()->text(BUILDINFO_FILE,text))
 		return 0;
 	
-	char lineb[2048];
 	int lc=0;
 	int n=0;
-	std::string key;
-	std::string value;
+	size_t start = 0;
 	
-	while (!feof(fp)) 
+	while (start < text.size()) 
 	{
 		++lc;	//count lines...helps debug efforts
-		char *lp = fgets(lineb,2048,fp);
-		if (lp == NULL)
+		size_t end = text.find('\n',start);
+		if (end == std::string::npos)
+			end = text.size();
+		Utils::Substring line = { start, end-start };
+		start = end+1;
+		if (!Utils::trimWhitespace(text.c_str(),line))
 			continue;
-		std::string line(lp);
-		Utils::trimWhitespace_inplace(line);
-		std::list<std::string> splits;
-		if (Utils::splitStringOnKey(splits,line,std::string("=")) < 2)
+		//only the first two parts count, the way this has always been read
+		Utils::Substring splits[2];
+		const char* lineText = text.c_str() + line.start;
+		if (Utils::splitStringOnKey(splits,2,lineText,line.length,"=") < 2)
 			continue;
-		std::list<std::string>::iterator it = splits.begin();
-		key = *it;
-		++it;
-		value = *it;
-		KVpairs[key] = value;
+		KVpairs[std::string(lineText + splits[0].start,splits[0].length)]
+			.assign(lineText + splits[1].start,splits[1].length);
 		++n;
 	}
-	fclose(fp);
 	return n;
 }
 
@@ -0,0 +1,156 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "ConfigFileCache.h"
+#include "Logging.h"
+
+ConfigFileCache* ConfigFileCache::s_instance = 0;
+
+ConfigFileCache* ConfigFileCache::instance()
+{
+	if (G_UNLIKELY(s_instance == 0))
+		s_instance = new ConfigFileCache;
+
+	return s_instance;
+}
+
+ConfigFileCache::ConfigFileCache()
+{
+}
+
+ConfigFileCache::~ConfigFileCache()
+{
+	for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+		clear(it->second);
+}
+
+void ConfigFileCache::clear(Entry& entry)
+{
+	if (entry.json)
+		json_object_put(entry.json);
+	entry.json = 0;
+	entry.parsed = false;
+	entry.text.clear();
+}
+
+void ConfigFileCache::invalidate(const std::string& path)
+{
+	EntryMap::iterator it = m_entries.find(path);
+	if (it == m_entries.end())
+		return;
+
+	clear(it->second);
+	m_entries.erase(it);
+}
+
+ConfigFileCache::Entry* ConfigFileCache::lookup(const std::string& path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		invalidate(path);
+		return 0;
+	}
+
+	EntryMap::iterator it = m_entries.find(path);
+	if (it != m_entries.end()) {
+		Entry& entry = it->second;
+		if (entry.dev == st.st_dev && entry.ino == st.st_ino && entry.size == st.st_size &&
+			entry.mtime == st.st_mtim.tv_sec && entry.mtimeNsec == st.st_mtim.tv_nsec)
+			return &entry;
+
+		invalidate(path);
+	}
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	// fstat the file actually opened, in case it got replaced since the stat() above
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return 0;
+	}
+
+	std::string text;
+	text.resize(st.st_size);
+	size_t done = 0;
+	while (done < text.size()) {
+		ssize_t n = read(fd, &text[done], text.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	close(fd);
+
+	if (done == 0) {
+		qWarning() << "Failed to read" << path.c_str();
+		return 0;
+	}
+	text.resize(done);
+
+	Entry& entry = m_entries[path];
+	entry.dev = st.st_dev;
+	entry.ino = st.st_ino;
+	entry.size = st.st_size;
+	entry.mtime = st.st_mtim.tv_sec;
+	entry.mtimeNsec = st.st_mtim.tv_nsec;
+	entry.text.swap(text);
+	entry.parsed = false;
+	entry.json = 0;
+
+	return &entry;
+}
+
+bool ConfigFileCache::text(const std::string& path, std::string& r_text)
+{
+	Entry* entry = lookup(path);
+	if (!entry)
+		return false;
+
+	r_text = entry->text;
+	return true;
+}
+
+json_object* ConfigFileCache::json(const std::string& path)
+{
+	Entry* entry = lookup(path);
+	if (!entry)
+		return 0;
+
+	if (!entry->parsed) {
+		entry->parsed = true;
+		entry->json = json_tokener_parse(entry->text.c_str());
+	}
+
+	if (!entry->json)
+		return 0;
+
+	return json_object_get(entry->json);
+}
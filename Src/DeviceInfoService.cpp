@@ -14,13 +14,12 @@
  *  limitations under the License.
  */
 
-#include <json.h>
+#include <vector>
 
 #include "DeviceInfoService.h"
+#include "OsInfoService.h"
 #include "Logging.h"
 
-DeviceInfoService::command_map_t DeviceInfoService::s_commandMap;
-
 LSMethod s_device_methods[]  = {
 	{ "query",  DeviceInfoService::cbGetDeviceInformation },
 	{ 0, 0 },
@@ -36,15 +35,37 @@ DeviceInfoService* DeviceInfoService::instance()
 	static DeviceInfoService* s_instance = 0;
 	if (G_UNLIKELY(s_instance == 0))
 	{
-		DeviceInfoService::initCommandMap();
 		s_instance = new DeviceInfoService;
 	}
 
 	return s_instance;
 }
 
-DeviceInfoService::DeviceInfoService(): m_service(0)
+DeviceInfoService::DeviceInfoService()
+	: m_service(0)
+	, m_query(NYX_DEVICE_DEVICE_INFO, DeviceInfoService::queryDeviceInfo, "device", "not supported")
 {
+	// everything is fixed for the lifetime of the device (or at least of this boot), except the free space
+	// and the battery challenge/response, which is a fresh pair every time
+	m_query.addItem("board_type", NYX_DEVICE_INFO_BOARD_TYPE); // Return board type
+	m_query.addItem("bt_addr", NYX_DEVICE_INFO_BT_ADDR); // Return Bluetooth address
+	m_query.addItem("device_name", NYX_DEVICE_INFO_DEVICE_NAME); // Return device name
+	m_query.addItem("hardware_id", NYX_DEVICE_INFO_HARDWARE_ID); // Return hardware ID
+	m_query.addItem("hardware_revision", NYX_DEVICE_INFO_HARDWARE_REVISION); // Return hardware revision
+	m_query.addItem("installer", NYX_DEVICE_INFO_INSTALLER); // Return installer
+	m_query.addItem("keyboard_type", NYX_DEVICE_INFO_KEYBOARD_TYPE); // Return keyboard type
+	m_query.addItem("modem_present", NYX_DEVICE_INFO_MODEM_PRESENT); // Return modem availability
+	m_query.addItem("nduid", NYX_DEVICE_INFO_NDUID); // Return NDUID
+	m_query.addItem("product_id", NYX_DEVICE_INFO_PRODUCT_ID); // Return product ID
+	m_query.addItem("radio_type", NYX_DEVICE_INFO_RADIO_TYPE); // Return radio type
+	m_query.addItem("ram_size", NYX_DEVICE_INFO_RAM_SIZE); // Return RAM size
+	m_query.addItem("serial_number", NYX_DEVICE_INFO_SERIAL_NUMBER); // Return serial number
+	m_query.addItem("storage_free", NYX_DEVICE_INFO_STORAGE_FREE, NyxInfoQuery::CacheTtl, 5); // Return free storage size
+	m_query.addItem("storage_size", NYX_DEVICE_INFO_STORAGE_SIZE); // Return storage size
+	m_query.addItem("wifi_addr", NYX_DEVICE_INFO_WIFI_ADDR); // Return WiFi MAC address
+	m_query.addItem("last_reset_type", NYX_DEVICE_INFO_LAST_RESET_TYPE); // Reason code for last reboot (may come from /proc/cmdline)
+	m_query.addItem("battery_challenge", NYX_DEVICE_INFO_BATT_CH, NyxInfoQuery::CacheNever); // Battery challenge
+	m_query.addItem("battery_response", NYX_DEVICE_INFO_BATT_RSP, NyxInfoQuery::CacheNever); // Battery response
 }
 
 DeviceInfoService::~DeviceInfoService()
@@ -52,27 +73,9 @@ DeviceInfoService::~DeviceInfoService()
     // NO-OP
 }
 
-void DeviceInfoService::initCommandMap()
+nyx_error_t DeviceInfoService::queryDeviceInfo(nyx_device_handle_t device, int item, const char** r_value)
 {
-	s_commandMap["board_type"] = NYX_DEVICE_INFO_BOARD_TYPE; // Return board type
-	s_commandMap["bt_addr"] = NYX_DEVICE_INFO_BT_ADDR; // Return Bluetooth address
-	s_commandMap["device_name"] = NYX_DEVICE_INFO_DEVICE_NAME; // Return device name
-	s_commandMap["hardware_id"] = NYX_DEVICE_INFO_HARDWARE_ID; // Return hardware ID
-	s_commandMap["hardware_revision"] = NYX_DEVICE_INFO_HARDWARE_REVISION; // Return hardware revision
-	s_commandMap["installer"] = NYX_DEVICE_INFO_INSTALLER; // Return installer
-	s_commandMap["keyboard_type"] = NYX_DEVICE_INFO_KEYBOARD_TYPE; // Return keyboard type
-	s_commandMap["modem_present"] = NYX_DEVICE_INFO_MODEM_PRESENT; // Return modem availability
-	s_commandMap["nduid"] = NYX_DEVICE_INFO_NDUID; // Return NDUID
-	s_commandMap["product_id"] = NYX_DEVICE_INFO_PRODUCT_ID; // Return product ID
-	s_commandMap["radio_type"] = NYX_DEVICE_INFO_RADIO_TYPE; // Return radio type
-	s_commandMap["ram_size"] = NYX_DEVICE_INFO_RAM_SIZE; // Return RAM size
-	s_commandMap["serial_number"] = NYX_DEVICE_INFO_SERIAL_NUMBER; // Return serial number
-	s_commandMap["storage_free"] = NYX_DEVICE_INFO_STORAGE_FREE; // Return free storage size
-	s_commandMap["storage_size"] = NYX_DEVICE_INFO_STORAGE_SIZE; // Return storage size
-	s_commandMap["wifi_addr"] = NYX_DEVICE_INFO_WIFI_ADDR; // Return WiFi MAC address
-	s_commandMap["last_reset_type"] = NYX_DEVICE_INFO_LAST_RESET_TYPE; // Reason code for last reboot (may come from /proc/cmdline)
-	s_commandMap["battery_challenge"] = NYX_DEVICE_INFO_BATT_CH; // Battery challenge
-	s_commandMap["battery_response"] = NYX_DEVICE_INFO_BATT_RSP; // Battery response
+	return nyx_device_info_query(device, (nyx_device_info_type_t)item, r_value);
 }
 
 void DeviceInfoService::setServiceHandle(LSPalmService* service)
@@ -114,6 +117,7 @@ com.palm.systemservice/deviceInfo/query
 \endcode
 
 \param parameters List of requested parameters. If not specified, all available parameters wiil be returned. 
+Any of the \ref os_info_query parameters can be asked for here as well, to get both in one call.
 
 \subsection os_info_query_return Returns:
 \code
@@ -190,115 +194,18 @@ Example response for a failed call:
 */
 bool DeviceInfoService::cbGetDeviceInformation(LSHandle* lsHandle, LSMessage *message, void *user_data)
 {
-	std::string reply;
-	std::string parameter;
-
-	const char *nyx_result = NULL;
-	bool is_parameters_verified = false; // Becomes `true` if we've formed parameter ourself.
 	LSError lsError;
-
-	json_object *payload = NULL;
-	json_object *payloadParameterList = NULL;
-	json_object *jsonResult = json_object_new_object();
-
 	LSErrorInit(&lsError);
 
-	nyx_error_t error = NYX_ERROR_GENERIC;
-	nyx_device_handle_t device = NULL;
-
-	const char *payload_data = LSMessageGetPayload(message);
-	if (!payload_data) {
-	    reply = "{\"returnValue\": false, "
-			" \"errorText\": \"No payload specifed for message\"}";
-		goto Done;
-	}
-
-	payload = json_tokener_parse(payload_data);
-	if (!payload || !json_object_is_type(payload, json_type_object)) {
-		reply = "{\"returnValue\": false, "
-		        " \"errorText\": \"Cannot parse/validate json payload\"}";
-		goto Done;
-	}
-
-	if (json_object_object_get_ex(payload, "parameters", &payloadParameterList))
-	{
-		if (!payloadParameterList || !json_object_is_type(payloadParameterList, json_type_array)) {
-			reply = "{\"returnValue\": false, "
-				" \"errorText\": \"`parameters` needs to be an array\"}";
-			goto Done;
-		}
-	}
-	else
-	{
-		// No parameters. Fill array with all available parameters from the s_commandMap.
-		is_parameters_verified = true;
-		payloadParameterList = json_object_new_array();
-		for (command_map_t::iterator it = s_commandMap.begin(); it != s_commandMap.end(); ++it)
-		{
-			json_object_array_add(payloadParameterList, json_object_new_string(it->first.c_str()));
-		}
-	}
-
-	error = nyx_init();
-	if (NYX_ERROR_NONE != error)
-	{
-		qCritical() << "Failed to inititalize nyx library: " << error;
-		reply = "{\"returnValue\": false, "
-			" \"errorText\": \"Can not initialize nyx\"}";
-		goto Done;
-	}
+	std::vector<NyxInfoQuery*> engines;
+	engines.push_back(DeviceInfoService::instance()->query());
+	engines.push_back(OsInfoService::instance()->query());
 
-	error = nyx_device_open(NYX_DEVICE_DEVICE_INFO, "Main", &device);
-	if ((NYX_ERROR_NONE != error) || (NULL == device))
-	{
-		qCritical() << "Failed to open `Main` nyx device: " << error;
-		reply = "{\"returnValue\": false, "
-			" \"errorText\": \"Internal error. Can't open nyx device\"}";
-		goto Done;
-	}
-
-	for (int i = 0; i < json_object_array_length(payloadParameterList); i++)
-	{
-		parameter = json_object_get_string(json_object_array_get_idx(payloadParameterList, i));
-		command_map_t::iterator query = s_commandMap.find(parameter);
+	std::string reply = NyxInfoQuery::reply(LSMessageGetPayload(message), engines);
 
-		if (!is_parameters_verified && query == s_commandMap.end())
-		{
-			reply = "{\"returnValue\": false, "
-				" \"errorText\": \"Invalid parameter: " + parameter + "\"}";
-			goto Done;
-		}
-
-	    // Some device don't have all available parameters. We will just ignore them.
-		error = nyx_device_info_query(device, query->second, &nyx_result);
-		if (NYX_ERROR_NONE == error)
-		{
-			json_object_object_add(jsonResult, parameter.c_str(), json_object_new_string(nyx_result));
-		}
-		else
-		{
-			json_object_object_add(jsonResult, parameter.c_str(), json_object_new_string("not supported"));
-		}
-	}
-
-	json_object_object_add(jsonResult, "returnValue", json_object_new_boolean(true));
-	reply = json_object_to_json_string(jsonResult);
-
-Done:
 	bool ret = LSMessageReply(lsHandle, message, reply.c_str(), &lsError);
 	if (!ret)
 		LSErrorFree(&lsError);
 
-	if (NULL != device)
-		nyx_device_close(device);
-	nyx_deinit();
-
-	if (payload)
-		json_object_put(payload);
-	if (payloadParameterList)
-		json_object_put(payloadParameterList);
-	if (jsonResult)
-		json_object_put(jsonResult);
-
 	return true;
 }
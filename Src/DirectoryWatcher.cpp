@@ -0,0 +1,228 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "DirectoryWatcher.h"
+#include "Logging.h"
+
+//long enough for a copy in progress to finish writing, short enough that a picker sees the file right away
+static const guint s_settleMillis = 500;
+
+static const uint32_t s_watchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+
+DirectoryWatcher* DirectoryWatcher::s_instance = 0;
+
+DirectoryWatcher* DirectoryWatcher::instance()
+{
+	if (G_UNLIKELY(!s_instance))
+		s_instance = new DirectoryWatcher();
+
+	return s_instance;
+}
+
+DirectoryWatcher::DirectoryWatcher()
+	: m_fd(-1)
+	, m_ioSource(0)
+	, m_settleSource(0)
+{
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+	if (m_settleSource)
+		g_source_remove(m_settleSource);
+	if (m_ioSource)
+		g_source_remove(m_ioSource);
+	if (m_fd >= 0)
+		close(m_fd);
+	s_instance = 0;
+}
+
+bool DirectoryWatcher::open()
+{
+	if (m_fd >= 0)
+		return true;
+
+	m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_fd < 0) {
+		qWarning("inotify_init1 failed: %s", strerror(errno));
+		return false;
+	}
+
+	GIOChannel* channel = g_io_channel_unix_new(m_fd);
+	m_ioSource = g_io_add_watch(channel, (GIOCondition) (G_IO_IN | G_IO_HUP | G_IO_ERR), cbReadable, this);
+	g_io_channel_unref(channel);
+	return true;
+}
+
+bool DirectoryWatcher::watch(const std::string& dir, Callback callback, void* data)
+{
+	if (!open())
+		return false;
+
+	for (std::vector<Watch>::iterator it = m_watches.begin(); it != m_watches.end(); ++it) {
+		if (it->dir == dir)
+			return it->wd >= 0;
+	}
+
+	Watch watch;
+	watch.dir = dir;
+	watch.callback = callback;
+	watch.data = data;
+	watch.wd = -1;
+	m_watches.push_back(watch);
+	return addWatch(m_watches.back());
+}
+
+bool DirectoryWatcher::isWatching(const std::string& dir) const
+{
+	for (std::vector<Watch>::const_iterator it = m_watches.begin(); it != m_watches.end(); ++it) {
+		if (it->dir == dir)
+			return it->wd >= 0;
+	}
+	return false;
+}
+
+bool DirectoryWatcher::addWatch(Watch& watch)
+{
+	watch.wd = inotify_add_watch(m_fd, watch.dir.c_str(), s_watchMask);
+	if (watch.wd < 0) {
+		qWarning("can't watch %s: %s", watch.dir.c_str(), strerror(errno));
+		return false;
+	}
+
+	qDebug("watching %s", watch.dir.c_str());
+	return true;
+}
+
+bool DirectoryWatcher::rearm()
+{
+	if (!open())
+		return false;
+
+	bool all = true;
+	for (size_t i = 0; i < m_watches.size(); ++i) {
+		if (m_watches[i].wd >= 0)
+			continue;
+		if (!addWatch(m_watches[i])) {
+			all = false;
+			continue;
+		}
+
+		// whatever happened while it was gone went unseen
+		m_watches[i].pending.clear();
+		m_watches[i].callback(std::string(), true, m_watches[i].data);
+	}
+	return all;
+}
+
+void DirectoryWatcher::readEvents()
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool queued = false;
+
+	for (;;) {
+		ssize_t len = read(m_fd, buffer, sizeof(buffer));
+		if (len <= 0)
+			break;
+
+		for (char* p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len) {
+			const struct inotify_event* event = (const struct inotify_event*) p;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				// lost track; have everyone look again
+				for (size_t i = 0; i < m_watches.size(); ++i)
+					m_watches[i].pending.insert(std::string());
+				queued = true;
+				continue;
+			}
+
+			for (size_t i = 0; i < m_watches.size(); ++i) {
+				Watch& watch = m_watches[i];
+				if (watch.wd != event->wd)
+					continue;
+
+				if (event->mask & IN_IGNORED) {
+					// dir removed or its filesystem unmounted; rearm() brings it back
+					qDebug("lost watch on %s", watch.dir.c_str());
+					watch.wd = -1;
+				}
+				else if (event->len && event->name[0] != '.' && !(event->mask & IN_ISDIR)) {
+					watch.pending.insert(event->name);
+					queued = true;
+				}
+				break;
+			}
+		}
+	}
+
+	if (queued && !m_settleSource)
+		m_settleSource = g_timeout_add(s_settleMillis, cbSettled, this);
+}
+
+void DirectoryWatcher::flush()
+{
+	for (size_t i = 0; i < m_watches.size(); ++i) {
+		std::set<std::string> pending;
+		pending.swap(m_watches[i].pending);
+		if (pending.empty())
+			continue;
+
+		// copied, so a callback that adds a watch doesn't pull these out from under us
+		Callback callback = m_watches[i].callback;
+		void* data = m_watches[i].data;
+		std::string dir = m_watches[i].dir;
+
+		if (pending.find(std::string()) != pending.end()) {
+			callback(std::string(), true, data);
+			continue;
+		}
+
+		for (std::set<std::string>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+			bool present = access((dir + "/" + (*it)).c_str(), F_OK) == 0;
+			callback(*it, present, data);
+		}
+	}
+}
+
+gboolean DirectoryWatcher::cbReadable(GIOChannel* channel, GIOCondition condition, gpointer data)
+{
+	DirectoryWatcher* watcher = static_cast<DirectoryWatcher*>(data);
+	if (condition & (G_IO_HUP | G_IO_ERR)) {
+		qWarning("inotify descriptor failed, no longer watching");
+		watcher->m_ioSource = 0;
+		return FALSE;
+	}
+
+	watcher->readEvents();
+	return TRUE;
+}
+
+gboolean DirectoryWatcher::cbSettled(gpointer data)
+{
+	DirectoryWatcher* watcher = static_cast<DirectoryWatcher*>(data);
+	watcher->m_settleSource = 0;
+	watcher->flush();
+	return FALSE;
+}
@@ -25,9 +25,11 @@
 
 #include "EraseHandler.h"
 #include "Logging.h"
+#include "SystemRestore.h"
+#include "PrefsFactory.h"
 #include "Utils.h"
 #include "JSONUtils.h"
-#include <nyx/client/nyx_system.h>
+#include "Executor.h"
 
 static bool    cbEraseAll(LSHandle* pHandle, LSMessage* pMessage, void* pUserData);
 static bool    cbEraseDeveloper(LSHandle* pHandle, LSMessage* pMessage, void* pUserData);
@@ -50,6 +52,12 @@ nyx_device_handle_t EraseHandler::nyxSystem = NULL;
  * - \ref com_palm_systemservice_EraseVar
  * - \ref com_palm_systemservice_EraseDeveloper
  * - \ref com_palm_systemservice_Wipe
+ *
+ * The erase runs off the main loop and only one runs at a time; a call while one is
+ * running fails with "an erase is already running". The reply comes when it's done.
+ * With "subscribe":true the caller gets {"state":"started"} right away, then
+ * {"state":"running","elapsed":seconds} every few seconds, then the final reply with
+ * "state":"done". nyx reports no progress of its own, so elapsed time is all there is.
  */
 
 /**
@@ -65,8 +73,14 @@ static LSMethod s_methods[]  = {
 };
 
 
+//seconds between "running" updates to subscribers
+static const guint s_progressInterval = 5;
+
 EraseHandler::EraseHandler()
 : m_service(0)
+, m_serviceHandlePrivate(0)
+, m_job(0)
+, m_progressSource(0)
 {
 }
 
@@ -129,6 +143,8 @@ void EraseHandler::setServiceHandle(LSPalmService* service)
 
 EraseHandler::~EraseHandler()
 {
+    if (m_progressSource)
+        g_source_remove(m_progressSource);
 }
 
 /**
@@ -155,7 +171,6 @@ bool EraseHandler::Erase(LSHandle* pHandle, LSMessage* pMessage, EraseType_t typ
     }
     LSError lserror;
     char *error_text=NULL;
-    char* return_msg = NULL;
     nyx_system_erase_type_t nyx_type;
 
     // write flag file used by mountall.sh
@@ -193,28 +208,114 @@ bool EraseHandler::Erase(LSHandle* pHandle, LSMessage* pMessage, EraseType_t typ
             break;
     }
 
-    if (!error_text) {
-        nyx_error_t ret = nyx_system_erase_partition(nyxSystem, nyx_type/*, error_text*/);
-        if (ret != NYX_ERROR_NONE) {
-            qCritical("Failed to execute nyx_system_erase_partition, ret : %d",ret);
-            error_text = g_strdup_printf("Failed to execute NYX erase API");
-        }
-    }
+    if (!error_text && m_job)
+        error_text = g_strdup_printf("an erase is already running");
 
     if (error_text) {
         qWarning() << error_text;
-        return_msg = g_strdup_printf("{\"returnValue\":false, \"errorText\":\"%s\"}", error_text);
+        JsonReplyBuilder reply;
+        reply.put("returnValue", false).put("errorText", error_text);
         g_free(error_text);
-    } else {
-        return_msg = g_strdup_printf("{\"returnValue\":true}");
+
+        LSErrorInit(&lserror);
+        if (!LSMessageReply(pHandle, pMessage, reply.c_str(), &lserror)) {
+            LSREPORT( lserror );
+            LSErrorFree(&lserror);
+        }
+        return true;
     }
 
+    Job* job = new Job;
+    job->type = type;
+    job->nyxType = nyx_type;
+    job->handle = pHandle;
+    job->message = pMessage;
+    job->subscribed = LSMessageIsSubscription(pMessage);
+    job->started = g_get_monotonic_time();
+    job->result = NYX_ERROR_NONE;
+    LSMessageRef(pMessage);
+    m_job = job;
+
+    if (job->subscribed) {
+        replyProgress(job, "started");
+        m_progressSource = g_timeout_add_seconds(s_progressInterval, cbEraseProgress, this);
+    }
+
+    //a wipe takes minutes; the main loop has time, prefs and MSM to answer meanwhile
+    Executor::instance()->submit(cbEraseWork, cbEraseDone, job, Executor::PriorityHigh);
+    return true;
+}
+
+void EraseHandler::cbEraseWork(void* data)
+{
+    Job* job = static_cast<Job*>(data);
+    job->result = nyx_system_erase_partition(nyxSystem, job->nyxType/*, error_text*/);
+}
+
+void EraseHandler::cbEraseDone(void* data)
+{
+    instance()->finishErase(static_cast<Job*>(data));
+}
+
+gboolean EraseHandler::cbEraseProgress(gpointer data)
+{
+    EraseHandler* handler = static_cast<EraseHandler*>(data);
+    if (!handler->m_job) {
+        handler->m_progressSource = 0;
+        return FALSE;
+    }
+
+    handler->replyProgress(handler->m_job, "running");
+    return TRUE;
+}
+
+void EraseHandler::replyProgress(Job* job, const char* state)
+{
+    LSError lserror;
+    JsonReplyBuilder reply;
+    reply.put("returnValue", true).put("subscribed", true).put("state", state)
+         .put("elapsed", (int) ((g_get_monotonic_time() - job->started) / G_USEC_PER_SEC));
+
     LSErrorInit(&lserror);
-    if (!LSMessageReply(pHandle, pMessage, return_msg, &lserror))
+    if (!LSMessageReply(job->handle, job->message, reply.c_str(), &lserror)) {
         LSREPORT( lserror );
-    g_free(return_msg);
-    LSErrorFree(&lserror);
-    return true;
+        LSErrorFree(&lserror);
+    }
+}
+
+void EraseHandler::finishErase(Job* job)
+{
+    LSError lserror;
+
+    if (m_progressSource) {
+        g_source_remove(m_progressSource);
+        m_progressSource = 0;
+    }
+    m_job = 0;
+
+    //files the prefs point at may be gone now
+    PrefsFactory::instance()->invalidatePrefConsistency(0);
+
+    JsonReplyBuilder reply;
+    if (job->result != NYX_ERROR_NONE) {
+        qCritical("Failed to execute nyx_system_erase_partition, ret : %d",job->result);
+        reply.put("returnValue", false).put("errorText", "Failed to execute NYX erase API");
+    }
+    else {
+        qDebug("System erase of type %d done", job->type);
+        reply.put("returnValue", true);
+    }
+    if (job->subscribed)
+        reply.put("subscribed", false).put("state", "done");
+
+    LSErrorInit(&lserror);
+    if (!LSMessageReply(job->handle, job->message, reply.c_str(), &lserror)) {
+        LSREPORT( lserror );
+        LSErrorFree(&lserror);
+    }
+
+    LSMessageUnref(job->message);
+    delete job;
 }
 
 /**
@@ -247,6 +348,9 @@ bool cbEraseVar(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
  */
 bool cbEraseAll(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
 {
+    if (SystemRestore::deferUntilReady(pHandle, pMessage, cbEraseAll, pUserData))
+        return true;
+
     PMLOG_TRACE("%s:starting",__FUNCTION__);
     if (LSMessageIsHubErrorMessage(pMessage)) {  // returns false if message is NULL
         qWarning("The message received is an error message from the hub");
@@ -266,6 +370,9 @@ bool cbEraseAll(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
  */
 bool cbEraseMedia(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
 {
+    if (SystemRestore::deferUntilReady(pHandle, pMessage, cbEraseMedia, pUserData))
+        return true;
+
     PMLOG_TRACE("%s:starting",__FUNCTION__);
     if (LSMessageIsHubErrorMessage(pMessage)) {  // returns false if message is NULL
         qWarning("The message received is an error message from the hub");
@@ -304,6 +411,9 @@ bool cbEraseDeveloper(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
  */
 bool cbSecureWipe(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
 {
+    if (SystemRestore::deferUntilReady(pHandle, pMessage, cbSecureWipe, pUserData))
+        return true;
+
     PMLOG_TRACE("%s:starting",__FUNCTION__);
     if (LSMessageIsHubErrorMessage(pMessage)) {  // returns false if message is NULL
         qWarning("The message received is an error message from the hub");
@@ -0,0 +1,126 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#include "Executor.h"
+#include "Logging.h"
+#include "Settings.h"
+
+Executor* Executor::s_instance = 0;
+
+Executor* Executor::instance()
+{
+	if (G_UNLIKELY(!s_instance))
+		s_instance = new Executor();
+
+	return s_instance;
+}
+
+Executor::Executor()
+	: m_workers(0)
+	, m_seq(0)
+	, m_pending(0)
+{
+	//a failed pool isn't fatal, work just runs where it's submitted then
+	int threads = Settings::settings()->m_workerThreads;
+	if (threads <= 0)
+		return;
+
+	GError* error = NULL;
+	m_workers = g_thread_pool_new(cbWorkerRun, this, threads, FALSE, &error);
+	if (!m_workers) {
+		qWarning("failed to start %d worker threads: %s", threads, error ? error->message : "unknown error");
+		if (error)
+			g_error_free(error);
+		return;
+	}
+
+	g_thread_pool_set_sort_function(m_workers, cbCompareTasks, NULL);
+}
+
+Executor::~Executor()
+{
+	if (m_workers)
+		g_thread_pool_free(m_workers, FALSE, TRUE);
+	s_instance = 0;
+}
+
+int Executor::threads() const
+{
+	return m_workers ? g_thread_pool_get_max_threads(m_workers) : 0;
+}
+
+void Executor::submit(Work work, Done done, void* data, Priority priority)
+{
+	Task* task = new Task;
+	task->work = work;
+	task->done = done;
+	task->data = data;
+	task->priority = priority;
+	task->seq = (guint) g_atomic_int_add(&m_seq, 1);
+	g_atomic_int_inc(&m_pending);
+
+	if (m_workers) {
+		GError* error = NULL;
+		if (g_thread_pool_push(m_workers, task, &error))
+			return;
+
+		qWarning("failed to queue work: %s", error ? error->message : "unknown error");
+		if (error)
+			g_error_free(error);
+	}
+
+	//no threads; do it now, but still finish from the main loop like always
+	task->work(task->data);
+	g_idle_add(cbTaskDone, task);
+}
+
+void Executor::cbWorkerRun(gpointer data, gpointer user_data)
+{
+	Task* task = static_cast<Task*>(data);
+	task->work(task->data);
+
+	//back to the main loop for done
+	g_idle_add(cbTaskDone, task);
+}
+
+gint Executor::cbCompareTasks(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const Task* ta = static_cast<const Task*>(a);
+	const Task* tb = static_cast<const Task*>(b);
+
+	if (ta->priority != tb->priority)
+		return (ta->priority > tb->priority) ? -1 : 1;
+
+	//seq wraps after 4 billion submissions; compare the difference so the order survives that
+	gint diff = (gint) (ta->seq - tb->seq);
+	return (diff < 0) ? -1 : ((diff > 0) ? 1 : 0);
+}
+
+gboolean Executor::cbTaskDone(gpointer data)
+{
+	Task* task = static_cast<Task*>(data);
+	if (task->done)
+		task->done(task->data);
+	delete task;
+
+	g_atomic_int_add(&s_instance->m_pending, -1);
+	return FALSE;
+}
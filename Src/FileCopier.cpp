@@ -0,0 +1,201 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+
+#include "Executor.h"
+#include "FileCopier.h"
+#include "Logging.h"
+
+FileCopier* FileCopier::s_instance = 0;
+
+FileCopier* FileCopier::instance()
+{
+	if (G_UNLIKELY(!s_instance))
+		s_instance = new FileCopier();
+
+	return s_instance;
+}
+
+FileCopier::FileCopier()
+{
+}
+
+FileCopier::~FileCopier()
+{
+	s_instance = 0;
+}
+
+void FileCopier::copy(const std::string& src, const std::string& dest, Callback callback, void* data)
+{
+	Job* job = new Job;
+	job->src = src;
+	job->dest = dest;
+	job->callback = callback;
+	job->data = data;
+	job->ok = false;
+
+	Executor::instance()->submit(cbWorkerCopy, cbCopyDone, job);
+}
+
+static bool writeAll(int fd, const char* buffer, size_t length)
+{
+	while (length > 0) {
+		ssize_t w = write(fd, buffer, length);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return false;
+		buffer += w;
+		length -= w;
+	}
+	return true;
+}
+
+//the fastest way the kernel and filesystems at hand allow; each step only falls through if it couldn't start
+static bool copyContents(int in, int out, off_t size)
+{
+#ifdef FICLONE
+	//same (btrfs/xfs) filesystem: share the blocks
+	if (ioctl(out, FICLONE, in) == 0)
+		return true;
+#endif
+
+	off_t done = 0;
+#ifdef __NR_copy_file_range
+	while (done < size) {
+		ssize_t n = syscall(__NR_copy_file_range, in, NULL, out, NULL, (size_t) (size - done), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	if (done >= size)
+		return true;
+#endif
+
+	//both offsets have moved along with whatever got copied, so carry on from there
+	while (done < size) {
+		ssize_t n = sendfile(out, in, NULL, (size_t) (size - done));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	if (done >= size)
+		return true;
+
+	char buffer[65536];
+	for (;;) {
+		ssize_t r = read(in, buffer, sizeof(buffer));
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return false;
+		if (r == 0)
+			return true;
+		if (!writeAll(out, buffer, r))
+			return false;
+	}
+}
+
+bool FileCopier::copyFile(const std::string& src, const std::string& dest)
+{
+	gchar* dir = g_path_get_dirname(dest.c_str());
+	gchar* name = g_path_get_basename(dest.c_str());
+	//hidden, so the dir watchers pass over it until it is renamed into place; unique, so two copies to the
+	//same destination never write into each other's temp
+	std::string temp = std::string(dir) + "/." + name + ".copy.XXXXXX";
+	g_free(dir);
+	g_free(name);
+
+	bool ok = false;
+	struct stat stBuf;
+	int out = -1;
+	bool haveTemp = false;
+	int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+	if (in < 0 || fstat(in, &stBuf) != 0) {
+		qWarning("can't read %s: %s", src.c_str(), strerror(errno));
+		goto Done;
+	}
+
+	out = mkostemp(&temp[0], O_CLOEXEC);
+	if (out < 0) {
+		qWarning("can't write %s: %s", temp.c_str(), strerror(errno));
+		goto Done;
+	}
+	haveTemp = true;
+	//mkstemp makes it 0600; the media files have to stay readable by everyone (reading the umask here would race other threads)
+	(void) fchmod(out, 0644);
+
+	if (!copyContents(in, out, stBuf.st_size)) {
+		qWarning("copy %s -> %s failed: %s", src.c_str(), dest.c_str(), strerror(errno));
+		goto Done;
+	}
+
+	//like Utils::fileCopy() flushing: our filesystem doesn't like to commit even on close
+	(void) fdatasync(out);
+	if (close(out) != 0) {
+		out = -1;
+		goto Done;
+	}
+	out = -1;
+
+	ok = (rename(temp.c_str(), dest.c_str()) == 0);
+	if (!ok)
+		qWarning("can't rename %s to %s: %s", temp.c_str(), dest.c_str(), strerror(errno));
+
+Done:
+
+	if (in >= 0)
+		close(in);
+	if (out >= 0)
+		close(out);
+	if (!ok && haveTemp)
+		(void) unlink(temp.c_str());
+	return ok;
+}
+
+void FileCopier::cbWorkerCopy(void* data)
+{
+	Job* job = static_cast<Job*>(data);
+	job->ok = copyFile(job->src, job->dest);
+}
+
+void FileCopier::cbCopyDone(void* data)
+{
+	Job* job = static_cast<Job*>(data);
+	qDebug("copy %s -> %s %s", job->src.c_str(), job->dest.c_str(), (job->ok ? "done" : "failed"));
+	if (job->callback)
+		job->callback(job->src, job->dest, job->ok, job->data);
+	delete job;
+}
@@ -17,23 +17,30 @@
 #include "ImageHelpers.h"
 #include "Logging.h"
 
+#include <QtGui/QImageIOHandler>
+#include <QtGui/QPainter>
+
 #define HALF_DECIMATION_THRESHOLD_H    1500
 #define QUARTER_DECIMATION_THRESHOLD_H 3000
 #define EIGHTH_DECIMATION_THRESHOLD_H  4500
 
 
-bool readImageWithPrescale(QImageReader& reader, QImage& image, double& prescaleFactor)
+double prescaleFactorFor(const QSize& size)
 {
-    // used to scale the file before it is actually read to memory
-    prescaleFactor = 1.0;
-
-    int height = reader.size().height();
+    int height = size.height();
     if (height > EIGHTH_DECIMATION_THRESHOLD_H)
-        prescaleFactor = 0.125;
+        return 0.125;
     else if(height > QUARTER_DECIMATION_THRESHOLD_H)
-        prescaleFactor = 0.25;
+        return 0.25;
     else if(height > HALF_DECIMATION_THRESHOLD_H)
-        prescaleFactor = 0.5;
+        return 0.5;
+    return 1.0;
+}
+
+bool readImageWithPrescale(QImageReader& reader, QImage& image, double& prescaleFactor)
+{
+    // used to scale the file before it is actually read to memory
+    prescaleFactor = prescaleFactorFor(reader.size());
 
     if(prescaleFactor != 1.0)
         reader.setScaledSize(QSize(reader.size().width() * prescaleFactor, reader.size().height() * prescaleFactor));
@@ -41,3 +48,73 @@ bool readImageWithPrescale(QImageReader& reader, QImage& image, double& prescale
 
     return reader.read(&image);
 }
+
+bool exceedsClippedDecodeSize(QImageReader& reader, size_t thresholdBytes)
+{
+    QSize size = reader.size();
+    if (thresholdBytes == 0 || !size.isValid())
+        return false;
+    return (size_t) size.width() * (size_t) size.height() * 4 > thresholdBytes;
+}
+
+bool readScaledRegion(const QString& path, const QSize& scaledSize, const QRect& region,
+                      QImage& r_image, QString& r_error)
+{
+    QImageReader reader(path);
+    QSize srcSize = reader.size();
+    bool scaledClip = reader.supportsOption(QImageIOHandler::ScaledClipRect) && reader.supportsOption(QImageIOHandler::ScaledSize);
+    bool sourceClip = reader.supportsOption(QImageIOHandler::ClipRect) && reader.supportsOption(QImageIOHandler::ScaledSize);
+    if (!srcSize.isValid() || scaledSize.isEmpty() || (!scaledClip && !sourceClip))
+        return false;
+
+    QRect visible = region & QRect(QPoint(0, 0), scaledSize);
+
+    qDebug("decoding %dx%d of %dx%d (scaled from %dx%d)", visible.width(), visible.height(),
+           scaledSize.width(), scaledSize.height(), srcSize.width(), srcSize.height());
+
+    QImage decoded;
+    if (!visible.isEmpty()) {
+        // decoders only go forward through the file, so this is one read for the lot: a reader per strip
+        // would decode from the top of the file again for each
+        if (scaledClip) {
+            reader.setScaledSize(scaledSize);
+            reader.setScaledClipRect(visible);
+        }
+        else {
+            // clipped at source resolution first, then scaled
+            double sx = (double) srcSize.width() / scaledSize.width();
+            double sy = (double) srcSize.height() / scaledSize.height();
+            QRect clip = QRectF(visible.x() * sx, visible.y() * sy, visible.width() * sx, visible.height() * sy).toAlignedRect()
+                         & QRect(QPoint(0, 0), srcSize);
+            reader.setClipRect(clip);
+            reader.setScaledSize(visible.size());
+        }
+
+        if (!reader.read(&decoded)) {
+            r_error = reader.errorString();
+            if (r_error.isEmpty())
+                r_error = "unable to decode image";
+            return false;
+        }
+
+        if (visible == region && decoded.size() == region.size()) {
+            r_image = decoded;
+            return true;
+        }
+    }
+
+    r_image = QImage(region.size(), QImage::Format_RGB32);
+    if (r_image.isNull()) {
+        r_error = "unable to allocate memory for QImage";
+        return false;
+    }
+    r_image.fill(Qt::black);
+
+    if (!decoded.isNull()) {
+        QPainter p(&r_image);
+        p.setCompositionMode(QPainter::CompositionMode_Source);
+        p.drawImage(visible.topLeft() - region.topLeft(), decoded);
+        p.end();
+    }
+    return true;
+}
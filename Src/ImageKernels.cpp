@@ -0,0 +1,229 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+#include <string.h>
+#include <vector>
+
+#include <glib.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define IMAGEKERNELS_NEON 1
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#include "ImageKernels.h"
+
+namespace ImageKernels
+{
+
+bool hasNeon()
+{
+#if defined(IMAGEKERNELS_NEON) && defined(__aarch64__)
+	return true;
+#elif defined(IMAGEKERNELS_NEON)
+	// built for neon doesn't mean every core it runs on has it (e.g. tegra2)
+	static int s_neon = -1;
+	if (s_neon < 0)
+		s_neon = (getauxval(AT_HWCAP) & HWCAP_NEON) ? 1 : 0;
+	return s_neon == 1;
+#else
+	return false;
+#endif
+}
+
+static int bytesPerPixel(QImage::Format format)
+{
+	switch (format) {
+	case QImage::Format_RGB32:
+	case QImage::Format_ARGB32:
+	case QImage::Format_ARGB32_Premultiplied:
+		return 4;
+	case QImage::Format_RGB888:
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+// one destination row from two source rows; returns how many pixels it did (the rest is left to the C loop)
+#if defined(IMAGEKERNELS_NEON)
+static int halveRowNeon(const uchar* row0, const uchar* row1, uchar* dst, int dstWidth, int bpp)
+{
+	int x = 0;
+	if (bpp == 4) {
+		for (; x + 8 <= dstWidth; x += 8) {
+			uint8x16x4_t a = vld4q_u8(row0 + x * 8);
+			uint8x16x4_t b = vld4q_u8(row1 + x * 8);
+			uint8x8x4_t out;
+			out.val[0] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[0]), b.val[0]), 2);
+			out.val[1] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[1]), b.val[1]), 2);
+			out.val[2] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[2]), b.val[2]), 2);
+			out.val[3] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[3]), b.val[3]), 2);
+			vst4_u8(dst + x * 4, out);
+		}
+	}
+	else if (bpp == 3) {
+		for (; x + 8 <= dstWidth; x += 8) {
+			uint8x16x3_t a = vld3q_u8(row0 + x * 6);
+			uint8x16x3_t b = vld3q_u8(row1 + x * 6);
+			uint8x8x3_t out;
+			out.val[0] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[0]), b.val[0]), 2);
+			out.val[1] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[1]), b.val[1]), 2);
+			out.val[2] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[2]), b.val[2]), 2);
+			vst3_u8(dst + x * 3, out);
+		}
+	}
+	return x;
+}
+#endif
+
+static void halve(const QImage& src, QImage& dst)
+{
+	const int bpp = bytesPerPixel(src.format());
+	const bool neon = hasNeon();
+
+	for (int y = 0; y < dst.height(); ++y) {
+		const uchar* row0 = src.constScanLine(2 * y);
+		const uchar* row1 = src.constScanLine(2 * y + 1);
+		uchar* out = dst.scanLine(y);
+
+		int x = 0;
+#if defined(IMAGEKERNELS_NEON)
+		if (neon)
+			x = halveRowNeon(row0, row1, out, dst.width(), bpp);
+#else
+		(void) neon;
+#endif
+		for (; x < dst.width(); ++x) {
+			const uchar* a = row0 + 2 * x * bpp;
+			const uchar* b = row1 + 2 * x * bpp;
+			for (int c = 0; c < bpp; ++c)
+				out[x * bpp + c] = (a[c] + a[bpp + c] + b[c] + b[bpp + c] + 2) >> 2;
+		}
+	}
+}
+
+// source sample positions for each destination pixel, pixel centres lined up; 8 bit fraction
+static void bilinearTaps(int srcSize, int dstSize, std::vector<int>& r_index, std::vector<int>& r_weight)
+{
+	r_index.resize(dstSize);
+	r_weight.resize(dstSize);
+	const gint64 last = (gint64) (srcSize - 1) << 16;
+	for (int i = 0; i < dstSize; ++i) {
+		gint64 pos = (((gint64) (2 * i + 1) * srcSize) << 16) / (2 * dstSize) - 32768;
+		if (pos < 0)
+			pos = 0;
+		if (pos > last)
+			pos = last;
+		r_index[i] = (int) (pos >> 16);
+		r_weight[i] = (int) ((pos >> 8) & 0xff);
+	}
+}
+
+static void bilinear(const QImage& src, QImage& dst)
+{
+	const int bpp = bytesPerPixel(src.format());
+	std::vector<int> xIndex, xWeight, yIndex, yWeight;
+	bilinearTaps(src.width(), dst.width(), xIndex, xWeight);
+	bilinearTaps(src.height(), dst.height(), yIndex, yWeight);
+
+	const int lastX = src.width() - 1;
+	const int lastY = src.height() - 1;
+	for (int y = 0; y < dst.height(); ++y) {
+		const uchar* row0 = src.constScanLine(yIndex[y]);
+		const uchar* row1 = src.constScanLine(qMin(yIndex[y] + 1, lastY));
+		const int wy = yWeight[y];
+		uchar* out = dst.scanLine(y);
+
+		for (int x = 0; x < dst.width(); ++x) {
+			const int x0 = xIndex[x] * bpp;
+			const int x1 = qMin(xIndex[x] + 1, lastX) * bpp;
+			const int wx = xWeight[x];
+			for (int c = 0; c < bpp; ++c) {
+				int top = row0[x0 + c] * (256 - wx) + row0[x1 + c] * wx;
+				int bottom = row1[x0 + c] * (256 - wx) + row1[x1 + c] * wx;
+				out[x * bpp + c] = (top * (256 - wy) + bottom * wy + 32768) >> 16;
+			}
+		}
+	}
+}
+
+QImage scaled(const QImage& image, int width, int height)
+{
+	if (width <= 0 || height <= 0 || image.isNull())
+		return QImage();
+	if (image.width() == width && image.height() == height)
+		return image;
+
+	// averaging straight alpha pulls colour out of transparent pixels into their neighbours
+	QImage src = (image.format() == QImage::Format_ARGB32) ? image.convertToFormat(QImage::Format_ARGB32_Premultiplied) : image;
+	if (!bytesPerPixel(src.format()))
+		return image.scaled(width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+	while (src.width() >= 2 * width && src.height() >= 2 * height) {
+		QImage half(src.width() / 2, src.height() / 2, src.format());
+		if (half.isNull())
+			break;
+		halve(src, half);
+		src = half;
+	}
+
+	QImage result;
+	if (src.width() == width && src.height() == height) {
+		result = src;
+	}
+	else {
+		result = QImage(width, height, src.format());
+		if (result.isNull())
+			return result;
+		bilinear(src, result);
+	}
+
+	// back to what the caller handed in, as QImage::scaled() would
+	if (result.format() != image.format())
+		result = result.convertToFormat(image.format());
+	return result;
+}
+
+QImage crop(const QImage& image, int width, int height, int left, int top)
+{
+	// a transparent pixel is matted onto the black, which a copy wouldn't do
+	if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_RGB888)
+		return QImage();
+
+	const int bpp = bytesPerPixel(image.format());
+	QImage result(width, height, image.format());
+	if (result.isNull())
+		return result;
+	result.fill(Qt::black);
+
+	QRect area = QRect(left, top, width, height) & image.rect();
+	for (int y = area.top(); y <= area.bottom(); ++y)
+		memcpy(result.scanLine(y - top) + (area.left() - left) * bpp,
+			   image.constScanLine(y) + area.left() * bpp, area.width() * bpp);
+
+	return result;
+}
+
+}
@@ -26,11 +26,14 @@
 
 #include "ImageServices.h"
 #include <QtGui/QImageReader>
+#include <QtGui/QImageIOHandler>
 #include <QtGui/QImage>
 #include <QtGui/QPainter>
 #include <QtCore/QtGlobal>
 
 #include "ImageHelpers.h"
+#include "Settings.h"
+#include "ServiceStats.h"
 
 #if 0
 #define IMS_TRACE(...) \
@@ -49,6 +52,12 @@ do { \
  *   - \ref image_service_convert
  *   - \ref image_service_ez_resize
  *   - \ref image_service_image_info
+ *   - \ref image_service_cancel
+ *
+ *  convert, ezResize and imageInfo run on a pool of worker threads ([ImageService] workerThreads in
+ *  sysservice.conf) and reply when done. Each takes two optional parameters for that:
+ *   - \c jobId: a caller chosen id, echoed in the reply, that \ref image_service_cancel can refer to
+ *   - \c priority: integer, queued jobs with a higher priority start first (default 0)
  */
 
 ImageServices * ImageServices::s_instance = NULL;
@@ -57,9 +66,43 @@ static LSMethod s_methods_public[] = {
 	{ "convert" , ImageServices::lsConvertImage },
 	{ "imageInfo" , ImageServices::lsImageInfo },
 	{ "ezResize" , ImageServices::lsEzResize },
+	{ "cancel" , ImageServices::lsCancel },
 	{ 0, 0 }
 };
 
+struct ImageServices::Job
+{
+	enum Kind { Transcode, Convert, EzResize, Info, InfoBatch };
+	enum State { Queued, Running, Cancelled };
+
+	Job(Kind k)
+		: kind(k), message(0), priority(0), seq(0), state(Queued), queuedAt(0)
+		, focusX(-1), focusY(-1), scale(-1), width(0), height(0)
+		, headerOnly(false) {}
+
+	Kind kind;
+	LSMessage* message;				// ref'd until the reply is sent
+	std::string jobId;
+	int priority;
+	guint64 seq;					// submission order, among jobs of the same priority
+	volatile gint state;			// moved on with g_atomic_int_compare_and_exchange(); cancel races the worker
+	gint64 queuedAt;				// ServiceStats::now() at dispatch, 0 if stats are off
+
+	std::string src;
+	std::string dest;
+	std::string destType;
+	double focusX;
+	double focusY;
+	double scale;
+	uint32_t width;
+	uint32_t height;
+
+	bool headerOnly;
+
+	std::string errorText;
+	std::vector<ImageInfo> infos;	// Info: one entry, InfoBatch: one per path, in order
+};
+
 static LSMethod s_methods_private[] = {
 	{ 0, 0 }
 };
@@ -151,8 +194,8 @@ bool ImageServices::lsConvertImage(LSHandle* lsHandle, LSMessage* message,void*
 	json_object * root = NULL;
 	json_object * label = NULL;
 	const char* str;
-	int rc;
 	bool specOn = false;
+	Job* job = NULL;
 	std::string srcfile;
 	std::string destfile;
 	std::string desttype;
@@ -162,10 +205,10 @@ bool ImageServices::lsConvertImage(LSHandle* lsHandle, LSMessage* message,void*
 	uint32_t cropW = 0;
 	uint32_t cropH = 0;
 
-    // {"src": string, "dest": string, "destType": string, "focusX": double, "focusY": double, "scale": double, "cropW": double, "cropH": double}
+    // {"src": string, "dest": string, "destType": string, "focusX": double, "focusY": double, "scale": double, "cropW": double, "cropH": double, "jobId": string, "priority": integer}
     VALIDATE_SCHEMA_AND_RETURN(lsHandle,
                                message,
-                               SCHEMA_8(REQUIRED(src, string), REQUIRED(dest, string), REQUIRED(destType, string), REQUIRED(focusX, double), REQUIRED(focusY, double), REQUIRED(scale, double), REQUIRED(cropW, double), REQUIRED(cropH, double)));
+                               SCHEMA_10(REQUIRED(src, string), REQUIRED(dest, string), REQUIRED(destType, string), REQUIRED(focusX, double), REQUIRED(focusY, double), REQUIRED(scale, double), REQUIRED(cropW, double), REQUIRED(cropH, double), OPTIONAL(jobId, string), OPTIONAL(priority, integer)));
 
 	
 	ImageServices * pImgSvc = instance();
@@ -246,53 +289,42 @@ bool ImageServices::lsConvertImage(LSHandle* lsHandle, LSMessage* message,void*
 		specOn = true;
 	}
 	
-	/*
-	 * 
-	 * bool convertImage(const std::string& pathToSourceFile,
-			const std::string& pathToDestFile,int destType,
-			double focusX,double focusY,double scale,
-			uint32_t widthFinal,uint32_t heightFinal,
-			std::string& r_errorText);
-	
-	bool convertImage(const std::string& pathToSourceFile,
-			const std::string& pathToDestFile,int destType,
-			std::string& r_errorText);
-			
-	 * 
-	 */
-    if (specOn) {
-        rc = ImageServices::instance()->convertImage(srcfile, destfile, desttype.c_str(),
-                                                     focusX, focusY,
-                                                     scale,
-                                                     cropW, cropH,
-                                                     errorText);
+    // without any of the focus/scale/crop parameters, the "just transcode" version of convert is called
+    job = new Job(specOn ? Job::Convert : Job::Transcode);
+    job->src = srcfile;
+    job->dest = destfile;
+    job->destType = desttype;
+    job->focusX = focusX;
+    job->focusY = focusY;
+    job->scale = scale;
+    job->width = cropW;
+    job->height = cropH;
+    parseJobOptions(root, *job);
+
+    if (pImgSvc->dispatchJob(job, message, errorText)) {
+        json_object_put(root);
+        return true;
     }
-    else {
-        // the "just transcode" version of convert is called
-        rc = ImageServices::instance()->convertImage(srcfile, destfile, desttype.c_str(), errorText);
-    }
-	
+
 Done_lsConvertImage:
 
 	if (root)
 		json_object_put(root);
 
-	json_object * reply = json_object_new_object();
-	json_object_object_add(reply, "subscribed", json_object_new_boolean(false));
+	JsonReplyBuilder reply;
+	reply.put("subscribed", false);
 	if (errorText.size() > 0) {
-		json_object_object_add(reply, "returnValue", json_object_new_boolean(false));
-		json_object_object_add(reply, "errorCode", json_object_new_string(errorText.c_str()));
+		reply.put("returnValue", false);
+		reply.put("errorCode", errorText);
         qWarning() << errorText.c_str();
 	}
 	else {
-		json_object_object_add(reply, "returnValue", json_object_new_boolean(true));
+		reply.put("returnValue", true);
 	}
 
-	if (!LSMessageReply(lsHandle, message, json_object_to_json_string(reply), &lserror))
+	if (!LSMessageReply(lsHandle, message, reply.c_str(), &lserror))
 		LSErrorFree (&lserror);
 
-	json_object_put(reply);
-
 	return true;
 }
 
@@ -372,11 +404,12 @@ bool ImageServices::lsEzResize(LSHandle* lsHandle, LSMessage* message,void* user
 	std::string desttype;
 	uint32_t destSizeW = 0;
 	uint32_t destSizeH = 0;
+	Job* job = NULL;
 
-    // {"src": string, "dest": string, "destType": string, "destSizeW": integer, "destSizeH": integer}
+    // {"src": string, "dest": string, "destType": string, "destSizeW": integer, "destSizeH": integer, "jobId": string, "priority": integer}
     VALIDATE_SCHEMA_AND_RETURN(lsHandle,
                                message,
-                               SCHEMA_5(REQUIRED(src, string), REQUIRED(dest, string), REQUIRED(destType, string), REQUIRED(destSizeW, integer), REQUIRED(destSizeH, integer)));
+                               SCHEMA_7(REQUIRED(src, string), REQUIRED(dest, string), REQUIRED(destType, string), REQUIRED(destSizeW, integer), REQUIRED(destSizeH, integer), OPTIONAL(jobId, string), OPTIONAL(priority, integer)));
 
 	ImageServices * pImgSvc = instance();
 	if (pImgSvc == NULL) {
@@ -434,29 +467,38 @@ bool ImageServices::lsEzResize(LSHandle* lsHandle, LSMessage* message,void* user
 		goto Done_ezResize;
 	}
 
-    (void)ImageServices::instance()->ezResize(srcfile, destfile, desttype.c_str(), destSizeW, destSizeH, errorText);
+    job = new Job(Job::EzResize);
+    job->src = srcfile;
+    job->dest = destfile;
+    job->destType = desttype;
+    job->width = destSizeW;
+    job->height = destSizeH;
+    parseJobOptions(root, *job);
+
+    if (pImgSvc->dispatchJob(job, message, errorText)) {
+        json_object_put(root);
+        return true;
+    }
 
 Done_ezResize:
 
 	if (root)
 		json_object_put(root);
 
-	json_object * reply = json_object_new_object();
-	json_object_object_add(reply, "subscribed", json_object_new_boolean(false));
+	JsonReplyBuilder reply;
+	reply.put("subscribed", false);
 	if (errorText.size() > 0) {
-		json_object_object_add(reply, "returnValue", json_object_new_boolean(false));
-		json_object_object_add(reply, "errorCode", json_object_new_string(errorText.c_str()));
+		reply.put("returnValue", false);
+		reply.put("errorCode", errorText);
         qWarning() << errorText.c_str();
 	}
 	else {
-		json_object_object_add(reply, "returnValue", json_object_new_boolean(true));
+		reply.put("returnValue", true);
 	}
 
-	if (!LSMessageReply(lsHandle, message, json_object_to_json_string(reply), &lserror))
+	if (!LSMessageReply(lsHandle, message, reply.c_str(), &lserror))
 		LSErrorFree (&lserror);
 
-	json_object_put(reply);
-
 	return true;
 }
 
@@ -470,45 +512,53 @@ com.palm.image/imageInfo
 
 Get information for an image.
 
+Only the image header is read: the pixels are never decoded. For the few formats whose reader can't tell the
+size from the header, the file is decoded to find out, unless headerOnly is set.
+
 \subsection image_service_image_info_syntax Syntax:
 \code
 {
-    "src": string
+    "src": string,
+    "srcs": string array,
+    "headerOnly": boolean
 }
 \endcode
 
-\param src Absolute path to source file. Required.
+\param src Absolute path to source file. Either this or srcs is required, not both.
+\param srcs Several source files to report on in one call. The reply then carries an "images" array with one
+             object per path, in order, each with src, returnValue and either errorCode or the fields below.
+\param headerOnly Never decode; width and height are -1 where the header doesn't give them. Default false.
 
 \subsection image_service_image_info_returns Returns:
 \code
 {
-    "subscribed": boolean,
     "returnValue": boolean,
     "errorCode": string,
     "width": int,
     "height": int,
     "bpp": int,
-    "type": "string
+    "type": "string,
+    "orientation": int
 }
 \endcode
 
-\param subscribed Always false.
 \param returnValue Indicates if the call was succesful or not.
 \param errorCode Description of the error if call was not succesful.
 \param with Width of the image.
 \param height Height of the image.
 \param bpp Color depth, bits per pixel.
 \param type Type of the image file.
+\param orientation Exif orientation (1-8) the image should be shown with, if the reader can tell.
 
 \subsection image_service_image_info_examples Examples:
 
 \code
 luna-send -n 1 -f  luna://com.palm.image/imageInfo '{"src":"/usr/lib/luna/system/luna-systemui/images/opensearch-small-icon.png"}'
+luna-send -n 1 -f  luna://com.palm.image/imageInfo '{"srcs":["/media/internal/DCIM/100PALM/a.jpg", "/media/internal/DCIM/100PALM/b.jpg"], "headerOnly": true}'
 \endcode
 Example response for a successful call:
 \code
 {
-    "subscribed": false,
     "returnValue": true,
     "width": 24,
     "height": 24,
@@ -520,7 +570,6 @@ Example response for a successful call:
 Example response in case of a failure:
 \code
 {
-    "subscribed": false,
     "returnValue": false,
     "errorCode": "source file does not exist"
 }
@@ -535,14 +584,13 @@ bool ImageServices::lsImageInfo(LSHandle* lsHandle, LSMessage* message,void* use
 	json_object * root = NULL;
 	const char* str;
 	std::string srcfile;
-	int srcWidth = 0;
-	int srcHeight = 0;
-	int srcBpp = 0;
-	const char* srcType = "";
-    // {"src": string}
+	json_object * srcs = NULL;
+	json_object * label = NULL;
+	Job* job = NULL;
+    // {"src": string, "srcs": [string], "headerOnly": boolean, "jobId": string, "priority": integer}
     VALIDATE_SCHEMA_AND_RETURN(lsHandle,
                                message,
-                               SCHEMA_1(REQUIRED(src, string)));
+                               SCHEMA_5(OPTIONAL(src, string), OPTIONAL(srcs, array), OPTIONAL(headerOnly, boolean), OPTIONAL(jobId, string), OPTIONAL(priority, integer)));
 
 	ImageServices * pImgSvc = instance();
 	if (pImgSvc == NULL) {
@@ -568,45 +616,43 @@ bool ImageServices::lsImageInfo(LSHandle* lsHandle, LSMessage* message,void* use
 		goto Done_lsImageInfo;
 	}
 
-	if (Utils::extractFromJson(root,"src",srcfile) == false) {
+	srcs = Utils::JsonGetObject(root,"srcs");
+	if (Utils::extractFromJson(root,"src",srcfile) == false && srcs == NULL) {
 		errorText = "'src' parameter missing";
 		goto Done_lsImageInfo;
 	}
 
-    {
-        QImageReader reader(QString::fromStdString(srcfile));
-        if(!reader.canRead()) {
-            errorText = reader.errorString().toStdString();
+    if (srcs) {
+        // whatever src holds, even "", one of the two would go unanswered
+        if (Utils::JsonGetObject(root,"src") != NULL) {
+            errorText = "'src' and 'srcs' are exclusive";
             goto Done_lsImageInfo;
         }
-        srcWidth = reader.size().width();
-        srcHeight = reader.size().height();
-        // QImageReader probably won't return all of these, but just to make sure we cover all cases
-        switch(reader.imageFormat()) {
-            case QImage::Format_ARGB32_Premultiplied:
-            case QImage::Format_ARGB32:
-            case QImage::Format_RGB32:
-            srcBpp = 32; break;
-            case QImage::Format_RGB888:
-            case QImage::Format_RGB666:
-            case QImage::Format_ARGB8565_Premultiplied:
-            case QImage::Format_ARGB6666_Premultiplied:
-            case QImage::Format_ARGB8555_Premultiplied:
-            srcBpp = 24; break;
-            case QImage::Format_RGB444:
-            case QImage::Format_ARGB4444_Premultiplied:
-            case QImage::Format_RGB16:
-            case QImage::Format_RGB555:
-            srcBpp = 16; break;
-            case QImage::Format_Indexed8:
-            srcBpp = 8; break;
-            case QImage::Format_Mono:
-            case QImage::Format_MonoLSB:
-            srcBpp = 1; break;
-            default:
-            srcBpp = 0;
+        job = new Job(Job::InfoBatch);
+        for (int i = 0; i < json_object_array_length(srcs); ++i) {
+            json_object * item = json_object_array_get_idx(srcs, i);
+            if (!item || !json_object_is_type(item, json_type_string)) {
+                errorText = "'srcs' must only hold paths";
+                delete job;
+                goto Done_lsImageInfo;
+            }
+            job->infos.push_back(ImageInfo());
+            job->infos.back().src = json_object_get_string(item);
         }
-       srcType = reader.format(); // png/jpg etc
+    }
+    else {
+        job = new Job(Job::Info);
+        job->infos.push_back(ImageInfo());
+        job->infos.back().src = srcfile;
+    }
+
+    if ((label = Utils::JsonGetObject(root,"headerOnly")) != NULL)
+        job->headerOnly = json_object_get_boolean(label);
+    parseJobOptions(root, *job);
+
+    if (pImgSvc->dispatchJob(job, message, errorText)) {
+        json_object_put(root);
+        return true;
     }
 
 Done_lsImageInfo:
@@ -614,36 +660,357 @@ Done_lsImageInfo:
 	if (root)
 		json_object_put(root);
 
-	json_object * reply = json_object_new_object();
-	json_object_object_add(reply, "subscribed", json_object_new_boolean(false));
+	JsonReplyBuilder reply;
 	if (errorText.size() > 0) {
-		json_object_object_add(reply, "returnValue", json_object_new_boolean(false));
-		json_object_object_add(reply, "errorCode", json_object_new_string(errorText.c_str()));
+		reply.put("returnValue", false);
+		reply.put("errorCode", errorText);
         qWarning() << errorText.c_str();
 	}
+	else {
+		reply.put("returnValue", true);
+	}
+
+	if (!LSMessageReply(lsHandle, message, reply.c_str(), &lserror))
+		LSErrorFree (&lserror);
+
+	return true;
+}
+
+/*! \page com_palm_image_service
+\n
+\section image_service_cancel cancel
+
+\e Public.
+
+com.palm.image/cancel
+
+Cancels a convert, ezResize or imageInfo call that is still waiting for a worker thread. The cancelled call
+replies with errorCode "cancelled". A job that has already started can't be cancelled.
+
+\subsection image_service_cancel_syntax Syntax:
+\code
+{
+    "jobId": string
+}
+\endcode
+
+\param jobId The jobId given to the call to cancel. Required.
+
+\subsection image_service_cancel_returns Returns:
+\code
+{
+    "returnValue": boolean,
+    "errorCode": string
+}
+\endcode
+
+\param returnValue Indicates if the job was cancelled.
+\param errorCode Description of the error if it wasn't.
+
+\subsection image_service_cancel_examples Examples:
+\code
+luna-send -n 1 -f luna://com.palm.image/cancel '{"jobId": "thumb-42"}'
+\endcode
+
+Example response for a failed call:
+\code
+{
+    "returnValue": false,
+    "errorCode": "job already running"
+}
+\endcode
+*/
+//static
+bool ImageServices::lsCancel(LSHandle* lsHandle, LSMessage* message,void* user_data)
+{
+	LSError lserror;
+	LSErrorInit(&lserror);
+	std::string errorText;
+	std::string jobId;
+	json_object * root = NULL;
+	const char* str;
+	std::map<std::string, Job*>::iterator it;
+
+    // {"jobId": string}
+    VALIDATE_SCHEMA_AND_RETURN(lsHandle,
+                               message,
+                               SCHEMA_1(REQUIRED(jobId, string)));
+
+	ImageServices * pImgSvc = instance();
+	if (pImgSvc == NULL || pImgSvc->isValid() == false) {
+		errorText = "Image Service has not started";
+		goto Done_lsCancel;
+	}
+
+	str = LSMessageGetPayload( message );
+	if (!str) {
+		errorText = "No payload provided";
+		goto Done_lsCancel;
+	}
+
+	root = json_tokener_parse( str );
+	if (!root) {
+		errorText = "Malformed JSON detected in payload";
+		root = 0;
+		goto Done_lsCancel;
+	}
+
+	if (Utils::extractFromJson(root,"jobId",jobId) == false) {
+		errorText = "'jobId' parameter missing";
+		goto Done_lsCancel;
+	}
+
+	it = pImgSvc->m_jobsById.find(jobId);
+	if (it == pImgSvc->m_jobsById.end()) {
+		errorText = "no such job";
+		goto Done_lsCancel;
+	}
+
+	//the worker that picks it up skips it; its reply goes out from there
+	if (!g_atomic_int_compare_and_exchange(&it->second->state, Job::Queued, Job::Cancelled))
+		errorText = "job already running";
+
+Done_lsCancel:
+
+	if (root)
+		json_object_put(root);
+
+	JsonReplyBuilder reply;
+	if (errorText.size() > 0) {
+		reply.put("returnValue", false);
+		reply.put("errorCode", errorText);
+	}
+	else {
+		reply.put("returnValue", true);
+	}
+
+	if (!LSMessageReply(lsHandle, message, reply.c_str(), &lserror))
+		LSErrorFree (&lserror);
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////// JOBS ////////////////////////////////////////////////
+
+//static
+void ImageServices::parseJobOptions(json_object* root, Job& job)
+{
+	(void) Utils::extractFromJson(root, "jobId", job.jobId);
+
+	json_object* label = Utils::JsonGetObject(root, "priority");
+	if (label)
+		job.priority = json_object_get_int(label);
+}
+
+// takes ownership of job. False (with r_errorText set, job deleted) only if it couldn't be accepted at all
+bool ImageServices::dispatchJob(Job* job, LSMessage* message, std::string& r_errorText)
+{
+	if (!job->jobId.empty() && m_jobsById.find(job->jobId) != m_jobsById.end()) {
+		r_errorText = "jobId already in use";
+		delete job;
+		return false;
+	}
+
+	job->message = message;
+	LSMessageRef(message);
+	job->seq = ++m_jobSeq;
+	if (ServiceStats::instance()->enabled())
+		job->queuedAt = ServiceStats::now();
+	if (!job->jobId.empty())
+		m_jobsById[job->jobId] = job;
+
+	if (m_workers) {
+		GError* error = NULL;
+		if (g_thread_pool_push(m_workers, job, &error))
+			return true;
+
+		qWarning("failed to queue image job: %s", error ? error->message : "unknown error");
+		if (error)
+			g_error_free(error);
+	}
+
+	//no pool; same as before there was one
+	runJob(job);
+	finishJob(job);
+	return true;
+}
+
+void ImageServices::runJob(Job* job)
+{
+	if (g_atomic_int_get(&m_stopping) || !g_atomic_int_compare_and_exchange(&job->state, Job::Queued, Job::Running)) {
+		job->errorText = "cancelled";
+		return;
+	}
+
+	switch (job->kind) {
+	case Job::Transcode:
+		(void) convertImage(job->src, job->dest, job->destType.c_str(), job->errorText);
+		break;
+	case Job::Convert:
+		(void) convertImage(job->src, job->dest, job->destType.c_str(),
+							job->focusX, job->focusY, job->scale,
+							job->width, job->height, job->errorText);
+		break;
+	case Job::EzResize:
+		(void) ezResize(job->src, job->dest, job->destType.c_str(), job->width, job->height, job->errorText);
+		break;
+	case Job::Info:
+	case Job::InfoBatch:
+		for (size_t i = 0; i < job->infos.size(); ++i)
+			(void) imageInfo(job->infos[i].src, job->headerOnly, job->infos[i]);
+		if (job->kind == Job::Info)
+			job->errorText = job->infos[0].errorText;
+		break;
+	}
+}
+
+// main loop only
+void ImageServices::finishJob(Job* job)
+{
+	replyToJob(job);
+
+	if (job->queuedAt && job->kind == Job::EzResize)
+		ServiceStats::instance()->recordMethod(ServiceStats::MethodEzResize, ServiceStats::now() - job->queuedAt);
+
+	if (!job->jobId.empty())
+		m_jobsById.erase(job->jobId);
+
+	LSMessageUnref(job->message);
+	delete job;
+}
+
+static void addImageInfo(json_object* reply, const ImageServices::ImageInfo& info)
+{
+	json_object_object_add(reply, "width",json_object_new_int(info.width));
+	json_object_object_add(reply, "height",json_object_new_int(info.height));
+	json_object_object_add(reply, "bpp",json_object_new_int(info.bpp));
+	json_object_object_add(reply, "type", json_object_new_string(info.type.c_str()));
+	if (info.orientation)
+		json_object_object_add(reply, "orientation", json_object_new_int(info.orientation));
+}
+
+//static
+void ImageServices::replyToJob(Job* job)
+{
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	json_object * reply = json_object_new_object();
+	if (job->kind != Job::Info && job->kind != Job::InfoBatch)
+		json_object_object_add(reply, "subscribed", json_object_new_boolean(false));
+	if (!job->jobId.empty())
+		json_object_object_add(reply, "jobId", json_object_new_string(job->jobId.c_str()));
+
+	if (job->errorText.size() > 0) {
+		json_object_object_add(reply, "returnValue", json_object_new_boolean(false));
+		json_object_object_add(reply, "errorCode", json_object_new_string(job->errorText.c_str()));
+        qWarning() << job->errorText.c_str();
+	}
 	else {
 		json_object_object_add(reply, "returnValue", json_object_new_boolean(true));
-		json_object_object_add(reply, "width",json_object_new_int(srcWidth));
-		json_object_object_add(reply, "height",json_object_new_int(srcHeight));
-		json_object_object_add(reply, "bpp",json_object_new_int(srcBpp));
-		json_object_object_add(reply, "type", json_object_new_string(srcType));
+		if (job->kind == Job::Info) {
+			addImageInfo(reply, job->infos[0]);
+		}
+		else if (job->kind == Job::InfoBatch) {
+			json_object * images = json_object_new_array();
+			for (size_t i = 0; i < job->infos.size(); ++i) {
+				const ImageInfo& info = job->infos[i];
+				json_object * image = json_object_new_object();
+				json_object_object_add(image, "src", json_object_new_string(info.src.c_str()));
+				if (info.errorText.size() > 0) {
+					json_object_object_add(image, "returnValue", json_object_new_boolean(false));
+					json_object_object_add(image, "errorCode", json_object_new_string(info.errorText.c_str()));
+				}
+				else {
+					json_object_object_add(image, "returnValue", json_object_new_boolean(true));
+					addImageInfo(image, info);
+				}
+				json_object_array_add(images, image);
+			}
+			json_object_object_add(reply, "images", images);
+		}
 	}
 
-	if (!LSMessageReply(lsHandle, message, json_object_to_json_string(reply), &lserror))
+	if (!LSMessageRespond(job->message, json_object_to_json_string(reply), &lserror))
 		LSErrorFree (&lserror);
 
 	json_object_put(reply);
+}
 
-	return true;
+//static - on a worker thread
+void ImageServices::cbWorkerRunJob(gpointer data, gpointer user_data)
+{
+	ImageServices* self = static_cast<ImageServices*>(user_data);
+	Job* job = static_cast<Job*>(data);
+
+	self->runJob(job);
+
+	//hand it back to the main loop for the reply; one source per job, each takes one off the queue. The
+	//sources carry self, so teardown can find and drop those that haven't run
+	g_async_queue_push(self->m_doneJobs, job);
+	GSource* source = g_idle_source_new();
+	g_source_set_callback(source, cbJobDone, self, NULL);
+	g_source_attach(source, g_main_loop_get_context(self->m_p_mainloop));
+	g_source_unref(source);
+}
+
+//static
+gboolean ImageServices::cbJobDone(gpointer data)
+{
+	ImageServices* self = static_cast<ImageServices*>(data);
+	Job* job = static_cast<Job*>(g_async_queue_try_pop(self->m_doneJobs));
+	if (job)
+		self->finishJob(job);
+	return FALSE;
+}
+
+//static
+gint ImageServices::cbCompareJobs(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const Job* ja = static_cast<const Job*>(a);
+	const Job* jb = static_cast<const Job*>(b);
+
+	if (ja->priority != jb->priority)
+		return (ja->priority > jb->priority) ? -1 : 1;
+
+	return (ja->seq < jb->seq) ? -1 : ((ja->seq > jb->seq) ? 1 : 0);
 }
 
 //////////////////////////////////////////////////////////////// PRIVATE ///////////////////////////////////////////////
 
 ImageServices::ImageServices()
+	: m_p_mainloop(NULL)
+	, m_workers(NULL)
+	, m_doneJobs(g_async_queue_new())
+	, m_stopping(0)
+	, m_jobSeq(0)
 {
 	m_valid = false;
 }
 
+// main loop only
+ImageServices::~ImageServices()
+{
+	//what's queued comes out cancelled; the running ones are waited for
+	g_atomic_int_set(&m_stopping, 1);
+	if (m_workers)
+		g_thread_pool_free(m_workers, FALSE, TRUE);
+
+	//the completions that haven't run would call into a deleted instance; reply from here instead
+	if (m_p_mainloop) {
+		GMainContext* context = g_main_loop_get_context(m_p_mainloop);
+		GSource* source;
+		while ((source = g_main_context_find_source_by_user_data(context, this)) != NULL)
+			g_source_destroy(source);
+	}
+	gpointer job;
+	while ((job = g_async_queue_try_pop(m_doneJobs)) != NULL)
+		finishJob(static_cast<Job*>(job));
+	g_async_queue_unref(m_doneJobs);
+
+	s_instance = NULL;
+}
+
 //IF THIS FUNCTION EVER RETURNS FALSE, IT'S PRETTY MUCH IMPOSSIBLE TO CONTINUE BECAUSE IT'S UNCERTAIN WHETHER THE MAIN LOOP (GMAINLOOP) STATE IS "CLEAN"; ONCE
 //LSGmainAttachPalmService SUCCEEDS, THERE IS NO WAY TO CLEANLY DETACH THE SERVICE (IF LSPalmServiceRegisterCategory, OR ANYTHING AFTERWARDS, FAILS)
 //THEREFORE, A FAILED init() SHOULD BE GROUNDS FOR PROCESS TERMINATION
@@ -696,6 +1063,21 @@ bool ImageServices::init(MainLoopProvider * p)
 		return false;
 	}
 
+	//a failed pool isn't fatal, jobs just run on the main loop then
+	int threads = Settings::settings()->m_imageWorkerThreads;
+	if (threads > 0) {
+		GError* error = NULL;
+		m_workers = g_thread_pool_new(cbWorkerRunJob, this, threads, TRUE, &error);
+		if (m_workers == NULL) {
+			qWarning("failed to start %d image worker threads: %s", threads, error ? error->message : "unknown error");
+			if (error)
+				g_error_free(error);
+		}
+		else {
+			g_thread_pool_set_sort_function(m_workers, cbCompareJobs, NULL);
+		}
+	}
+
 	return true;
 
 }
@@ -716,11 +1098,45 @@ bool ImageServices::ezResize(const std::string& pathToSourceFile,
         return false;
     }
 
+    // too big to decode at once: straight at the final size, by a decoder that scales as it goes
+    size_t threshold = (size_t) Settings::settings()->m_imageClippedDecodeSize * 1024;
+    if (exceedsClippedDecodeSize(reader, threshold) && widthFinal > 0 && heightFinal > 0) {
+        QSize finalSize(widthFinal, heightFinal);
+        QImage clipped;
+        QString error;
+        if (readScaledRegion(QString::fromStdString(pathToSourceFile), finalSize, QRect(QPoint(0, 0), finalSize),
+                             clipped, error)) {
+            if (!clipped.save(QString::fromStdString(pathToDestFile), destType, 100)) {
+                r_errorText = "ezResize: failed to save destination file";
+                return false;
+            }
+            return true;
+        }
+        if (!error.isEmpty()) {
+            r_errorText = error.toStdString();
+            return false;
+        }
+    }
+
+    // decoders that can scale (jpeg: DCT scaling) go straight to the final size, never holding the full image
+    if (reader.supportsOption(QImageIOHandler::ScaledSize) && widthFinal > 0 && heightFinal > 0)
+        reader.setScaledSize(QSize(widthFinal, heightFinal));
+
     QImage image;
     if (!reader.read(&image)) {
         r_errorText = reader.errorString().toStdString();
         return false;
     }
+
+    if (image.width() == (int) widthFinal && image.height() == (int) heightFinal) {
+        PMLOG_TRACE("About to save image");
+        if(!image.save(QString::fromStdString(pathToDestFile), destType, 100)) {
+            r_errorText = "ezResize: failed to save destination file";
+            return false;
+        }
+        return true;
+    }
+
     // cropped rescale, see http://qt-project.org/doc/qt-4.8/qt.html#AspectRatioMode-enum
     
     QImage result(widthFinal, heightFinal, image.format());
@@ -773,6 +1189,33 @@ bool ImageServices::convertImage(const std::string& pathToSourceFile,
         scale = 1.0;
     qDebug("After adjustments: scale: %f, focus:{x:%f,y:%f}", scale, focusX, focusY);
 
+    size_t threshold = (size_t) Settings::settings()->m_imageClippedDecodeSize * 1024;
+    if (exceedsClippedDecodeSize(reader, threshold)) {
+        // the mapping of the paths below, dest = (heightFinal/2, widthFinal/2) - focus * prescale * srcSize + scale * src,
+        // as a region of the source scaled by scale
+        QSize srcSize = reader.size();
+        double prescale = prescaleFactorFor(srcSize);
+        QSize scaledSize(qMax(1, qRound(srcSize.width() * scale)), qMax(1, qRound(srcSize.height() * scale)));
+        QRect region(qRound(focusX * prescale * srcSize.width()) - (int) (heightFinal/2),
+                     qRound(focusY * prescale * srcSize.height()) - (int) (widthFinal/2),
+                     widthFinal, heightFinal);
+
+        QImage clipped;
+        QString error;
+        if (readScaledRegion(QString::fromStdString(pathToSourceFile), scaledSize, region, clipped, error)) {
+            clipped.save(QString::fromStdString(pathToDestFile), destType, 100);
+            return true;
+        }
+        if (!error.isEmpty()) {
+            r_errorText = error.toStdString();
+            return false;
+        }
+    }
+
+    if (reader.supportsOption(QImageIOHandler::ClipRect) && reader.supportsOption(QImageIOHandler::ScaledSize))
+        return convertImageInDecoder(reader, pathToDestFile, destType, focusX, focusY, scale,
+                                     widthFinal, heightFinal, r_errorText);
+
     QImage image;
     double prescale;
     if(!readImageWithPrescale(reader, image, prescale)) {
@@ -797,6 +1240,113 @@ bool ImageServices::convertImage(const std::string& pathToSourceFile,
 
 }
 
+// convertImage() for decoders that crop and scale themselves: only the part of the source that lands in the
+// destination is decoded, at (at most) the size it is drawn at
+bool ImageServices::convertImageInDecoder(QImageReader& reader,
+                                          const std::string& pathToDestFile, const char* destType,
+                                          double focusX, double focusY, double scale,
+                                          uint32_t widthFinal, uint32_t heightFinal,
+                                          std::string& r_errorText)
+{
+    QSize srcSize = reader.size();
+
+    // same mapping as the painter path in convertImage(), taken in source coordinates. The focus there is
+    // applied to the prescaled image, so it is too here:
+    //   dest = (heightFinal/2, widthFinal/2) - focus * prescale * srcSize + scale * src
+    double prescale = prescaleFactorFor(srcSize);
+    double originX = (heightFinal/2) - focusX * prescale * srcSize.width();
+    double originY = (widthFinal/2) - focusY * prescale * srcSize.height();
+
+    QRectF visible(-originX / scale, -originY / scale, widthFinal / scale, heightFinal / scale);
+    QRect clip = visible.toAlignedRect() & QRect(QPoint(0, 0), srcSize);
+
+    QImage dest;
+    if (clip.isEmpty()) {
+        // nothing of the source shows; keep the output format the full decode would have had
+        dest = QImage(widthFinal, heightFinal, QImage::Format_ARGB32);
+        dest.fill(0);
+    }
+    else {
+        QSize decodeSize = clip.size();
+        if (scale < 1.0)
+            decodeSize = QSize(qMax(1, qRound(clip.width() * scale)), qMax(1, qRound(clip.height() * scale)));
+
+        reader.setClipRect(clip);
+        reader.setScaledSize(decodeSize);
+        qDebug("decoding clip {%d,%d %dx%d} at %dx%d", clip.x(), clip.y(), clip.width(), clip.height(),
+               decodeSize.width(), decodeSize.height());
+
+        QImage image;
+        if (!reader.read(&image)) {
+            r_errorText = reader.errorString().toStdString();
+            return false;
+        }
+
+        dest = QImage(widthFinal, heightFinal, image.format());
+        QPainter p (&dest);
+        p.setRenderHint(QPainter::SmoothPixmapTransform);
+        p.drawImage(QRectF(originX + scale * clip.x(), originY + scale * clip.y(),
+                           scale * clip.width(), scale * clip.height()), image);
+        p.end();
+    }
+
+    dest.save(QString::fromStdString(pathToDestFile), destType, 100);
+    return true;
+}
+
+// reads the header only; the pixels are decoded just when the handler has no other way to give the size,
+// and not at all with headerOnly
+bool ImageServices::imageInfo(const std::string& pathToSourceFile, bool headerOnly, ImageInfo& r_info)
+{
+    int& r_bpp = r_info.bpp;
+
+    QImageReader reader(QString::fromStdString(pathToSourceFile));
+    if(!reader.canRead()) {
+        r_info.errorText = reader.errorString().toStdString();
+        return false;
+    }
+    QSize size = reader.size();
+    r_info.type = reader.format().constData(); // png/jpg etc
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    // QImageIOHandler::Transformation values, in exif orientation terms
+    static const int exifOrientation[8] = { 1, 2, 4, 3, 6, 7, 5, 8 };
+    r_info.orientation = exifOrientation[reader.transformation() & 7];
+#endif
+    if (!size.isValid() && !headerOnly) {
+        QImage image;
+        if (reader.read(&image))
+            size = image.size();
+    }
+    r_info.width = size.width();
+    r_info.height = size.height();
+    // QImageReader probably won't return all of these, but just to make sure we cover all cases
+    switch(reader.imageFormat()) {
+        case QImage::Format_ARGB32_Premultiplied:
+        case QImage::Format_ARGB32:
+        case QImage::Format_RGB32:
+        r_bpp = 32; break;
+        case QImage::Format_RGB888:
+        case QImage::Format_RGB666:
+        case QImage::Format_ARGB8565_Premultiplied:
+        case QImage::Format_ARGB6666_Premultiplied:
+        case QImage::Format_ARGB8555_Premultiplied:
+        r_bpp = 24; break;
+        case QImage::Format_RGB444:
+        case QImage::Format_ARGB4444_Premultiplied:
+        case QImage::Format_RGB16:
+        case QImage::Format_RGB555:
+        r_bpp = 16; break;
+        case QImage::Format_Indexed8:
+        r_bpp = 8; break;
+        case QImage::Format_Mono:
+        case QImage::Format_MonoLSB:
+        r_bpp = 1; break;
+        default:
+        r_bpp = 0;
+    }
+    return true;
+}
+
 bool ImageServices::convertImage(const std::string& pathToSourceFile,
                                  const std::string& pathToDestFile, const char* destType,
                                        std::string& r_errorText)
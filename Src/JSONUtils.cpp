@@ -18,6 +18,10 @@
 #include "JSONUtils.h"
 #include "Utils.h"
 
+#include <map>
+#include <stdio.h>
+#include <string.h>
+
 using namespace Utils;
 
 bool JsonMessageParser::parse(const char * callerFunction)
@@ -76,10 +80,122 @@ std::string	jsonToString(pbnjson::JValue & reply, const char * schema)
 	return serialized;
 }
 
+void appendJsonString(std::string & out, const std::string & str)
+{
+	appendJsonString(out, str.data(), str.size());
+}
+
+void appendJsonString(std::string & out, const char * str, size_t len)
+{
+	out += '"';
+	for (const char * it = str; it != str + len; ++it) {
+		unsigned char c = *it;
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		}
+		else if (c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out += escaped;
+		}
+		else {
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+JsonReplyBuilder::JsonReplyBuilder(size_t reserve)
+    : mClosed(false)
+{
+	mOut.reserve(reserve);
+	mOut += '{';
+}
+
+void JsonReplyBuilder::key(const char * name, size_t len)
+{
+	if (!empty())
+		mOut += ',';
+	appendJsonString(mOut, name, len);
+	mOut += ':';
+}
+
+JsonReplyBuilder & JsonReplyBuilder::put(const char * name, const std::string & value)
+{
+	key(name, strlen(name));
+	appendJsonString(mOut, value);
+	return *this;
+}
+
+JsonReplyBuilder & JsonReplyBuilder::put(const char * name, const char * value)
+{
+	return put(name, std::string(value ? value : ""));
+}
+
+JsonReplyBuilder & JsonReplyBuilder::put(const char * name, bool value)
+{
+	key(name, strlen(name));
+	mOut += (value ? "true" : "false");
+	return *this;
+}
+
+JsonReplyBuilder & JsonReplyBuilder::put(const char * name, int value)
+{
+	char number[16];
+	snprintf(number, sizeof(number), "%d", value);
+	key(name, strlen(name));
+	mOut += number;
+	return *this;
+}
+
+JsonReplyBuilder & JsonReplyBuilder::putRaw(const char * name, const std::string & json)
+{
+	key(name, strlen(name));
+	mOut += json;
+	return *this;
+}
+
+JsonReplyBuilder & JsonReplyBuilder::putRaw(const std::string & name, const std::string & json)
+{
+	key(name.data(), name.size());
+	mOut += json;
+	return *this;
+}
+
+bool JsonReplyBuilder::putMembers(const std::string & object)
+{
+	std::string::size_type begin = object.find_first_not_of(" \t\r\n");
+	std::string::size_type end = object.find_last_not_of(" \t\r\n");
+	if (begin == std::string::npos || object[begin] != '{' || object[end] != '}')
+		return false;
+
+	// skip over the braces and any whitespace just inside them
+	begin = object.find_first_not_of(" \t\r\n", begin + 1);
+	end = object.find_last_not_of(" \t\r\n", end - 1);
+	if (begin > end)
+		return true;
+
+	if (!empty())
+		mOut += ',';
+	mOut.append(object, begin, end - begin + 1);
+	return true;
+}
+
+const std::string & JsonReplyBuilder::str()
+{
+	if (!mClosed) {
+		mOut += '}';
+		mClosed = true;
+	}
+	return mOut;
+}
+
 LSMessageJsonParser::LSMessageJsonParser(LSMessage * message, const char * schema)
     : mMessage(message)
     , mSchemaText(schema)
     , mSchema(pbnjson::JSchemaFragment(schema))
+    , mKeepDom(false)
 {
 }
 
@@ -87,9 +203,37 @@ LSMessageJsonParser::LSMessageJsonParser(LSMessage * message, const pbnjson::JSc
     : mMessage(message)
     , mSchemaText("(compiled)")
     , mSchema(schema)
+    , mKeepDom(false)
 {
 }
 
+LSMessageJsonParser::LSMessageJsonParser(LSMessage * message, const CompiledSchema &schema)
+    : mMessage(message)
+    , mSchemaText(schema.text.c_str())
+    , mSchema(schema.schema)
+    , mKeepDom(false)
+{
+}
+
+const CompiledSchema & compileSchema(const char * schema_v2)
+{
+    typedef std::map<std::string, CompiledSchema*> SchemaMap;
+    static SchemaMap s_schemas;
+
+    std::string key(schema_v2 ? schema_v2 : "");
+    SchemaMap::iterator it = s_schemas.find(key);
+    if (it != s_schemas.end())
+        return *it->second;
+
+    jvalue_ref schema_v4 = convert_schema_v2_to_v4(schema_v2);
+    CompiledSchema * compiled = new CompiledSchema(jvalue_tostring_simple(schema_v4));
+    if (!jis_null(schema_v4))
+        j_release(&schema_v4);
+
+    s_schemas[key] = compiled;
+    return *compiled;
+}
+
 std::string LSMessageJsonParser::getMsgCategoryMethod()
 {
     std::string context = "";
@@ -127,10 +271,16 @@ std::string LSMessageJsonParser::getSender()
 
 bool LSMessageJsonParser::parse(const char * callerFunction, LSHandle * lssender, ESchemaErrorOptions validationOption)
 {
-    if (EIgnore == validationOption) return true;
-
     const char * payload = getPayload();
 
+    if (EIgnore == validationOption) {
+        if (mKeepDom && payload) {
+            static pbnjson::JSchemaFragment s_genericSchema(SCHEMA_ANY);
+            (void) mParser.parse(payload, s_genericSchema);
+        }
+        return true;
+    }
+
     // Parse the message with given schema.
     if ((payload) && (!mParser.parse(payload, mSchema)))
     {
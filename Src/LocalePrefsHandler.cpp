@@ -18,6 +18,7 @@
 #include "Logging.h"
 #include "PrefsDb.h"
 #include "Utils.h"
+#include "ConfigFileCache.h"
 
 #include "LocalePrefsHandler.h"
 
@@ -30,6 +31,8 @@ static const char* s_custRegionFile = WEBOS_INSTALL_SYSMGR_DATADIR "/customizati
 LocalePrefsHandler::LocalePrefsHandler(LSPalmService* service)
 	: PrefsHandler(service)
 {
+	//the tables only change when the files are read again, which bumps the version
+	enableValuesCache();
 	init();
 }
 
@@ -322,11 +325,14 @@ void LocalePrefsHandler::readCurrentLocaleSetting()
 
 void LocalePrefsHandler::readLocaleFile()
 {
+	bumpValuesVersion();
+
 	// Read the locale file
-	char* jsonStr = Utils::readFile(s_custLocaleFile);
-	if (!jsonStr)
-		jsonStr = Utils::readFile(s_defaultLocaleFile);
-	if (!jsonStr) {
+	ConfigFileCache* cache = ConfigFileCache::instance();
+	const char* file = s_custLocaleFile;
+	if (!cache->readable(file))
+		file = s_defaultLocaleFile;
+	if (!cache->readable(file)) {
         //luna_critical(s_logChannel, "Failed to load locale files: [%s] nor [%s]", s_custLocaleFile,s_defaultLocaleFile);
         qCritical() << "Failed to load locale files: [" << s_custLocaleFile << "] nor [" << s_defaultLocaleFile << "]";
 		return;
@@ -336,7 +342,7 @@ void LocalePrefsHandler::readLocaleFile()
 	json_object* label = 0;
 	array_list* localeArray = 0;
 
-	root = json_tokener_parse(jsonStr);
+	root = cache->json(file);
 	if (!root) {
         //luna_critical(s_logChannel, "Failed to parse locale file contents into json");
         qCritical() << "Failed to parse locale file contents into json";
@@ -406,17 +412,18 @@ Done:
 
 	if (root)
 		json_object_put(root);
-
-	delete [] jsonStr;
 }
 
 void LocalePrefsHandler::readRegionFile() 
 {
+	bumpValuesVersion();
+
 	// Read the locale file
-	char* jsonStr = Utils::readFile(s_custRegionFile);
-	if (!jsonStr)
-		jsonStr = Utils::readFile(s_defaultRegionFile);
-	if (!jsonStr) {
+	ConfigFileCache* cache = ConfigFileCache::instance();
+	const char* file = s_custRegionFile;
+	if (!cache->readable(file))
+		file = s_defaultRegionFile;
+	if (!cache->readable(file)) {
         //luna_critical(s_logChannel, "Failed to load region files: [%s] nor [%s]", s_custRegionFile,s_defaultRegionFile);
         qCritical() << "Failed to load region files: [" << s_custRegionFile << "] nor [" << s_defaultRegionFile << "]";
 		return;
@@ -426,7 +433,7 @@ void LocalePrefsHandler::readRegionFile()
 	json_object* label = 0;
 	array_list* regionArray = 0;
 
-	root = json_tokener_parse(jsonStr);
+	root = cache->json(file);
 	if (!root) {
         //luna_critical(s_logChannel, "Failed to parse region file contents into json");
         qCritical() << "Failed to parse region file contents into json";
@@ -477,8 +484,6 @@ void LocalePrefsHandler::readRegionFile()
 
 	if (root)
 		json_object_put(root);
-
-	delete [] jsonStr;
 }
 
 std::string LocalePrefsHandler::currentLocale() const
@@ -54,6 +54,26 @@ void sysServiceLogInfo(const char * fileName, guint32 lineNbr,const char* funcNa
 }
 #endif // USE_PMLOG
 
+int sysServiceLogRateLimit(SysServiceLogRateLimit* limit, int interval, unsigned int* r_dropped)
+{
+    // worker threads log too, so only one of them gets to start the next interval
+    gint now = (gint) (g_get_monotonic_time() / G_USEC_PER_SEC) + 1;
+    gint last = g_atomic_int_get(&limit->last);
+
+    if ((last != 0 && now - last < interval) || !g_atomic_int_compare_and_exchange(&limit->last, last, now)) {
+        g_atomic_int_inc(&limit->dropped);
+        return 0;
+    }
+
+    gint dropped;
+    do {
+        dropped = g_atomic_int_get(&limit->dropped);
+    } while (!g_atomic_int_compare_and_exchange(&limit->dropped, dropped, 0));
+
+    *r_dropped = dropped;
+    return 1;
+}
+
 
 // Qt message handlers
 // (combination of Qt API x USE_PMLOG flag produces 4 variants)
@@ -17,9 +17,11 @@
 
 #include <stdio.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <strings.h>
 #include <time.h>
 #include <syslog.h>
+#include <signal.h>
 
 #include <QCoreApplication>
 
@@ -48,6 +50,7 @@
 #include "Utils.h"
 #include "Settings.h"
 #include "JSONUtils.h"
+#include "StartupProfile.h"
 
 
 static void logFilter(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer unused_data);
@@ -213,8 +216,38 @@ static bool cbComPalmImage2Status(LSHandle* lsHandle, LSMessage *message,
 	return true;
 }
 
+static gboolean cbQuitSignal(gpointer data)
+{
+	qWarning("terminating");
+	g_main_loop_quit(g_gmainLoop);
+	return TRUE;
+}
+
+static void openPrefsDb()
+{
+	// Initialize the Preferences database
+	{
+		StartupProfile::Phase phase("prefsDb");
+		(void) PrefsDb::instance();
+	}
+	///and system restore (refresh settings while I'm at it...)
+	{
+		StartupProfile::Phase phase("refreshDefaultSettings");
+		SystemRestore::instance()->refreshDefaultSettings();
+	}
+}
+
+static gboolean cbStartupReady(gpointer data)
+{
+	StartupProfile::instance()->markReady();
+	return FALSE;
+}
+
 int main(int argc, char ** argv)
 {
+	//the clock for all the startup phases starts here
+	(void) StartupProfile::instance();
+
     setenv("QT_PLUGIN_PATH","/usr/plugins",1);
     setenv("QT_QPA_PLATFORM", "minimal",1);
 
@@ -231,20 +264,26 @@ int main(int argc, char ** argv)
 		// error already reported
 		return 1;
 	}
-	setLoglevel(Settings::settings()->m_logLevel.c_str());
+	{
+		StartupProfile::Phase phase("settings");
+		setLoglevel(Settings::settings()->m_logLevel.c_str());
+	}
 
 	g_log_set_default_handler(logFilter, NULL);
 	PMLOG_TRACE("%s:Started",__FUNCTION__);
 
-	SystemRestore::createSpecialDirectories();
-	
-	// Initialize the Preferences database
-	(void) PrefsDb::instance();
-	///and system restore (refresh settings while I'm at it...)
-	SystemRestore::instance()->refreshDefaultSettings();
+	{
+		StartupProfile::Phase phase("createSpecialDirectories");
+		SystemRestore::createSpecialDirectories();
+	}
 	
-	//run startup restore before anything else starts
-	SystemRestore::startupConsistencyCheck();
+	//run startup restore before anything else starts (or, staged, the db is opened once the service name is
+	//on the bus and the restore runs from the main loop)
+	bool staged = Settings::settings()->m_stagedStartup;
+	if (!staged) {
+		openPrefsDb();
+		SystemRestore::startupConsistencyCheck();
+	}
 	
 	Mainloop * mainLoopObj = new Mainloop();
 	g_gmainLoop = mainLoopObj->getMainLoopPtr();
@@ -258,19 +297,28 @@ int main(int argc, char ** argv)
 	LSErrorInit(&lsError);
 
 	// Register the service
-	result = LSRegisterPalmService("com.palm.systemservice", &serviceHandle, &lsError);
-	if (!result) {
-        qCritical() << "Failed to register service: com.palm.sysservice";
-		return -1;
-	}
+	LSHandle * serviceHandlePrivate = NULL;
+	{
+		StartupProfile::Phase phase("registerService");
+		result = LSRegisterPalmService("com.palm.systemservice", &serviceHandle, &lsError);
+		if (!result) {
+			qCritical() << "Failed to register service: com.palm.sysservice";
+			return -1;
+		}
 
-//	LSHandle * serviceHandlePublic = LSPalmServiceGetPublicConnection(serviceHandle);
-	LSHandle * serviceHandlePrivate = LSPalmServiceGetPrivateConnection(serviceHandle);
+	//	LSHandle * serviceHandlePublic = LSPalmServiceGetPublicConnection(serviceHandle);
+		serviceHandlePrivate = LSPalmServiceGetPrivateConnection(serviceHandle);
 		
-	result = LSGmainAttachPalmService(serviceHandle, g_gmainLoop, &lsError);
-	if (!result) {
-        qCritical() << "Failed to attach service handle to main loop";
-		return -1;
+		result = LSGmainAttachPalmService(serviceHandle, g_gmainLoop, &lsError);
+		if (!result) {
+			qCritical() << "Failed to attach service handle to main loop";
+			return -1;
+		}
+	}
+
+	if (staged) {
+		openPrefsDb();
+		SystemRestore::scheduleStartupConsistencyCheck();
 	}
 
 	//turn novacom on if requested
@@ -325,40 +373,73 @@ int main(int argc, char ** argv)
 		return -1;
 
 	// Initialize the Prefs Factory
-	PrefsFactory::instance()->setServiceHandle(serviceHandle);
-	BackupManager::instance()->setServiceHandle(serviceHandle);
+	{
+		StartupProfile::Phase phase("prefsFactory");
+		PrefsFactory::instance()->setServiceHandle(serviceHandle);
+	}
+	{
+		StartupProfile::Phase phase("backupManager");
+		BackupManager::instance()->setServiceHandle(serviceHandle);
+	}
 
 	// Initialize erase handler
-	if (!EraseHandler::instance()->init())
 	{
-		PmLogError(sysServiceLogContext(), "ERASE_FAILURE", 0, "Failed to init EraseHandler (functionality disabled)");
+		StartupProfile::Phase phase("eraseHandler");
+		if (!EraseHandler::instance()->init())
+		{
+			PmLogError(sysServiceLogContext(), "ERASE_FAILURE", 0, "Failed to init EraseHandler (functionality disabled)");
+		}
+		EraseHandler::instance()->setServiceHandle(serviceHandle);
 	}
-	EraseHandler::instance()->setServiceHandle(serviceHandle);
 
 	// Clock handler
 	ClockHandler clockHandler;
-	setupClockHandler(clockHandler, serviceHandle);
+	{
+		StartupProfile::Phase phase("clockHandler");
+		setupClockHandler(clockHandler, serviceHandle);
+	}
 
 	//init the image service
-	ImageServices *imgSvc = ImageServices::instance(mainLoopObj);
-	if (!imgSvc) {
-        qCritical() << "Image service failed init!";
+	{
+		StartupProfile::Phase phase("imageServices");
+		ImageServices *imgSvc = ImageServices::instance(mainLoopObj);
+		if (!imgSvc) {
+			qCritical() << "Image service failed init!";
+		}
 	}
 
 	//init the timezone service;
-	TimeZoneService *tzSvc = TimeZoneService::instance();
-	tzSvc->setServiceHandle(serviceHandle);
+	{
+		StartupProfile::Phase phase("timeZoneService");
+		TimeZoneService *tzSvc = TimeZoneService::instance();
+		tzSvc->setServiceHandle(serviceHandle);
+	}
 
         //init the osinfo service;
-	OsInfoService *osiSvc = OsInfoService::instance();
-	osiSvc->setServiceHandle(serviceHandle);
+	{
+		StartupProfile::Phase phase("osInfoService");
+		OsInfoService *osiSvc = OsInfoService::instance();
+		osiSvc->setServiceHandle(serviceHandle);
+	}
 
 	//init the deviceinfo service;
-	DeviceInfoService *diSvc = DeviceInfoService::instance();
-	diSvc->setServiceHandle(serviceHandle);
+	{
+		StartupProfile::Phase phase("deviceInfoService");
+		DeviceInfoService *diSvc = DeviceInfoService::instance();
+		diSvc->setServiceHandle(serviceHandle);
+	}
+
+	//first idle of the main loop: everything registered has had a chance to answer
+	g_idle_add(cbStartupReady, NULL);
 	
+	//a normal stop closes the prefs db, so the next start knows it needn't run a full integrity check
+	g_unix_signal_add(SIGTERM, cbQuitSignal, NULL);
+	g_unix_signal_add(SIGINT, cbQuitSignal, NULL);
+
 	// Run the main loop
 	g_main_loop_run(g_gmainLoop);
+
+	PrefsDb::instance()->shutdown();
 	
 	return 0;
 }
@@ -22,12 +22,23 @@
  *  @file NTPClock.cpp
  */
 
+#include <algorithm>
+
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
 #include "Logging.h"
 
 #include "PrefsDb.h"
 #include "TimePrefsHandler.h"
 #include "ClockHandler.h"
 #include "NTPClock.h"
+#include "Settings.h"
 
 
 void NTPClock::postNTP(time_t offset)
@@ -92,6 +103,89 @@ void NTPClock::postError()
 			);
 		}
 	}
+	requestMessages.clear();
+}
+
+namespace {
+
+	// seconds from the NTP era (1900) to the unix epoch
+	const double ntpEpochOffset = 2208988800.0;
+	// the 32 bit seconds field wraps every era of this many seconds (the first wrap in 2036)
+	const double ntpEraSeconds = 4294967296.0;
+
+	const size_t ntpPacketSize = 48;
+
+	// filter samples older than this have drifted with the monotonic clock too far to be of use
+	const gint64 maxSampleAge = G_GINT64_CONSTANT(3600) * G_USEC_PER_SEC;
+
+	double now()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, 0);
+		return tv.tv_sec + tv.tv_usec / 1e6;
+	}
+
+	// 64 bit NTP timestamp: 32 bits of seconds and 32 of fraction, big endian. The era isn't on the wire;
+	// as RFC 5905 does, take the one that puts the time within 68 years of pivot (the local clock)
+	double readTimestamp(const unsigned char *p, double pivot)
+	{
+		guint32 seconds = (guint32(p[0]) << 24) | (guint32(p[1]) << 16) | (guint32(p[2]) << 8) | p[3];
+		guint32 fraction = (guint32(p[4]) << 24) | (guint32(p[5]) << 16) | (guint32(p[6]) << 8) | p[7];
+		double unixTime = seconds - ntpEpochOffset + fraction / 4294967296.0;
+		return unixTime + floor((pivot - unixTime) / ntpEraSeconds + 0.5) * ntpEraSeconds;
+	}
+
+	// 32 bit NTP short format: 16 bits of seconds, 16 of fraction
+	double readShort(const unsigned char *p)
+	{
+		guint32 value = (guint32(p[0]) << 24) | (guint32(p[1]) << 16) | (guint32(p[2]) << 8) | p[3];
+		return value / 65536.0;
+	}
+
+	struct Endpoint
+	{
+		double value;
+		int type;       // -1 lower end of an interval, +1 upper end, 0 its midpoint
+		bool operator<(const Endpoint &other) const { return value < other.value; }
+	};
+
+	void writeTimestamp(unsigned char *p, double unixTime)
+	{
+		// within its era; past 2036 the seconds wrap around rather than overflow the field
+		double ntpTime = fmod(unixTime + ntpEpochOffset, ntpEraSeconds);
+		if (ntpTime < 0) ntpTime += ntpEraSeconds;
+		guint32 seconds = (guint32) ntpTime;
+		guint32 fraction = (guint32) ((ntpTime - seconds) * 4294967296.0);
+		// low bits of the fraction are below the clock's resolution anyway; random ones make the
+		// originate timestamp harder to guess for an off-path spoofer
+		fraction ^= g_random_int() & 0xfff;
+		for (int i = 0; i < 4; ++i)
+		{
+			p[i] = (seconds >> (24 - 8 * i)) & 0xff;
+			p[4 + i] = (fraction >> (24 - 8 * i)) & 0xff;
+		}
+	}
+
+} // anonymous namespace
+
+struct NTPClock::ResolveJob
+{
+	NTPClock *ntpClock;
+	std::vector<std::string> hosts;
+	std::vector<std::string> addresses;
+};
+
+NTPClock::~NTPClock()
+{
+	cancelQueries();
+	// a lookup not started yet is dropped, one under way is waited for
+	if (resolver) g_thread_pool_free(resolver, TRUE, TRUE);
+	if (resolveJob)
+	{
+		// whichever it was, cbResolved mustn't run on us any more
+		g_idle_remove_by_data(resolveJob);
+		delete resolveJob;
+	}
 }
 
 bool NTPClock::requestNTP(LSMessage *message /* = NULL */)
@@ -102,12 +196,20 @@ bool NTPClock::requestNTP(LSMessage *message /* = NULL */)
 		requestMessages.push_back(message);
 	}
 
-	if (sntpPid != -1)
+	if (resolving || !queries.empty())
 	{
 		// already requested update
 		return true;
 	}
 
+	double offset;
+	if (cacheIsFresh() && filteredOffset(offset))
+	{
+		PmLogDebug(sysServiceLogContext(), "answering from the last NTP result");
+		postNTP((time_t) floor(offset + 0.5));
+		return true;
+	}
+
 	//try and retrieve the currently set NTP server to query
 	std::string ntpServer = PrefsDb::instance()->getPref("NTPServer");
 	if (ntpServer.empty()) {
@@ -119,144 +221,355 @@ bool NTPClock::requestNTP(LSMessage *message /* = NULL */)
 	{
 		ntpServerTimeout = "2"; // seconds
 	}
+	timeoutSeconds = strtoul(ntpServerTimeout.c_str(), 0, 10);
+	if (timeoutSeconds == 0) timeoutSeconds = 2;
 
-	gchar *argv[] = {
-		(gchar *)"sntp",
-		(gchar *)"-t",
-		(gchar *)ntpServerTimeout.c_str(),
-		(gchar *)"-d",
-		(gchar *)ntpServer.c_str(),
-		0
-	};
+	ResolveJob *job = new ResolveJob;
+	job->ntpClock = this;
+
+	gchar **hosts = g_strsplit_set(ntpServer.c_str(), ", \t", -1);
+	for (gchar **host = hosts; *host; ++host)
+	{
+		if (**host) job->hosts.push_back(*host);
+	}
+	g_strfreev(hosts);
 
 	PmLogDebug(sysServiceLogContext(),
-		"%s: running sntp on %s (timeout %s)",
+		"%s: querying %s (timeout %u)",
 		__FUNCTION__,
 		ntpServer.c_str(),
-		ntpServerTimeout.c_str()
+		timeoutSeconds
 	);
 
-	gchar **envp = g_get_environ();
+	if (!resolver)
+	{
+		GError *error = 0;
+		resolver = g_thread_pool_new(cbResolve, this, 1, FALSE, &error);
+		if (!resolver)
+		{
+			PmLogError(sysServiceLogContext(), "SNTP_RESOLVER_FAIL", 1,
+				PMLOGKS("REASON", error ? error->message : "unknown"),
+				"Failed to start NTP server name lookup thread"
+			);
+			if (error) g_error_free(error);
+			delete job;
+			postError();
+			return false;
+		}
+	}
 
-	// override all locale related variables (LC_*)
-	envp = g_environ_setenv(envp, "LC_ALL", "C", true);
+	resolving = true;
+	resolveJob = job;
+	g_thread_pool_push(resolver, job, 0);
+	return true;
+}
 
-	int fdOut;
-	GError *error;
-	gboolean ret = g_spawn_async_with_pipes(
-		/* workdir */ 0, argv, envp,
-		GSpawnFlags (G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD),
-		/* child_setup */ 0,
-		this, &sntpPid,
-		/* stdin */ 0, /* stdout */ &fdOut, /* stderr */ 0,
-		&error
-	);
+bool NTPClock::startQueries(const std::vector<std::string> &addresses)
+{
+	for (size_t i = 0; i < addresses.size(); ++i)
+	{
+		struct addrinfo hints, *info = 0;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+		if (getaddrinfo(addresses[i].c_str(), "123", &hints, &info) != 0 || !info) continue;
+
+		int fd = socket(info->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0 || connect(fd, info->ai_addr, info->ai_addrlen) != 0)
+		{
+			PmLogDebug(sysServiceLogContext(), "can't reach %s: %s", addresses[i].c_str(), strerror(errno));
+			if (fd >= 0) close(fd);
+			freeaddrinfo(info);
+			continue;
+		}
+		freeaddrinfo(info);
+
+		Query *query = new Query;
+		query->ntpClock = this;
+		query->address = addresses[i];
+		query->fd = fd;
+		query->answered = false;
+		query->offset = 0;
+		query->delay = 0;
+		query->distance = 0;
+
+		// LI 0, version 4, mode 3 (client); everything else is zero in a client request
+		unsigned char request[ntpPacketSize];
+		memset(request, 0, sizeof(request));
+		request[0] = 0x23;
+		query->sent = now();
+		writeTimestamp(request + 40, query->sent);
+		memcpy(query->originate, request + 40, sizeof(query->originate));
+
+		if (send(fd, request, sizeof(request), 0) != (ssize_t) sizeof(request))
+		{
+			PmLogDebug(sysServiceLogContext(), "send to %s failed: %s", addresses[i].c_str(), strerror(errno));
+			close(fd);
+			delete query;
+			continue;
+		}
+
+		GIOChannel *channel = g_io_channel_unix_new(fd);
+		query->watch = g_io_add_watch(channel, GIOCondition (G_IO_IN | G_IO_ERR | G_IO_HUP), (GIOFunc)cbReply, query);
+		g_io_channel_unref(channel);
+
+		queries.push_back(query);
+	}
+
+	if (queries.empty()) return false;
 
-	g_strfreev(envp);
+	timeoutSource = g_timeout_add_seconds(timeoutSeconds, (GSourceFunc)cbTimeout, this);
+	return true;
+}
 
-	if (!ret)
+NTPClock::Queries NTPClock::truechimers(const Queries &answered)
+{
+	std::vector<Endpoint> endpoints;
+	for (Queries::const_iterator it = answered.begin(); it != answered.end(); ++it)
 	{
-		PmLogError(sysServiceLogContext(), "SNTP_SPAWN_FAIL", 0,
-			"Failed to spawn sntp"
-		);
-		postError();
-		return false;
+		Endpoint lower = { (*it)->offset - (*it)->distance, -1 };
+		Endpoint middle = { (*it)->offset, 0 };
+		Endpoint upper = { (*it)->offset + (*it)->distance, 1 };
+		endpoints.push_back(lower);
+		endpoints.push_back(middle);
+		endpoints.push_back(upper);
+	}
+	std::sort(endpoints.begin(), endpoints.end());
+
+	const int n = answered.size();
+	for (int allow = 0; 2 * allow < n; ++allow)
+	{
+		// the lowest point inside n - allow intervals, going up, and the highest going down
+		int found = 0;
+		int chime = 0;
+		double low = 0, high = 0;
+		bool haveLow = false, haveHigh = false;
+		for (size_t i = 0; i < endpoints.size(); ++i)
+		{
+			chime -= endpoints[i].type;
+			if (chime >= n - allow) { low = endpoints[i].value; haveLow = true; break; }
+			if (endpoints[i].type == 0) ++found;
+		}
+		chime = 0;
+		for (size_t i = endpoints.size(); i-- > 0; )
+		{
+			chime += endpoints[i].type;
+			if (chime >= n - allow) { high = endpoints[i].value; haveHigh = true; break; }
+			if (endpoints[i].type == 0) ++found;
+		}
+
+		// more midpoints outside than falsetickers allowed: allow another one
+		if (found > allow || !haveLow || !haveHigh || low > high) continue;
+
+		Queries result;
+		for (Queries::const_iterator it = answered.begin(); it != answered.end(); ++it)
+		{
+			if ((*it)->offset - (*it)->distance <= high && (*it)->offset + (*it)->distance >= low)
+				result.push_back(*it);
+		}
+		return result;
 	}
 
-	g_child_watch_add( sntpPid, (GChildWatchFunc)cbChild, this);
+	return Queries();
+}
 
-	GIOChannel *chOut = g_io_channel_unix_new(fdOut);
-	g_io_add_watch( chOut, GIOCondition (G_IO_IN | G_IO_HUP), (GIOFunc)cbStdout, this);
+bool NTPClock::filteredOffset(double &r_offset) const
+{
+	const gint64 monotonic = g_get_monotonic_time();
+	const Sample *best = 0;
+	for (Samples::const_iterator it = samples.begin(); it != samples.end(); ++it)
+	{
+		if (monotonic - it->monotonic > maxSampleAge) continue;
+		if (!best || it->delay < best->delay) best = &*it;
+	}
+	if (!best) return false;
 
+	r_offset = best->ntpMinusMonotonic + monotonic / 1e6 - now();
 	return true;
 }
 
-// callbacks
-void NTPClock::cbChild(GPid pid, gint status, NTPClock *ntpClock)
+bool NTPClock::cacheIsFresh() const
 {
-	// move to new state
-	ntpClock->sntpPid = -1;
-	g_spawn_close_pid(pid);
+	int cacheTime = Settings::settings()->m_ntpCacheTime;
+	if (cacheTime <= 0 || samples.empty()) return false;
 
+	return g_get_monotonic_time() - samples.back().monotonic < (gint64) cacheTime * G_USEC_PER_SEC;
+}
 
-	std::string &sntpOutput = ntpClock->sntpOutput;
+void NTPClock::finishQueries()
+{
+	Queries answered;
+	for (Queries::const_iterator it = queries.begin(); it != queries.end(); ++it)
+	{
+		if ((*it)->answered) answered.push_back(*it);
+	}
 
-	if (status != 0)
+	if (answered.empty())
 	{
-		PmLogDumpDataDebug(sysServiceLogContext(),
-			sntpOutput.data(), sntpOutput.size(),
-			kPmLogDumpFormatDefault
-		);
-		ntpClock->postError();
+		cancelQueries();
+		postError();
 		return;
 	}
 
-	//success, maybe...parse the output
+	Queries chosen = truechimers(answered);
+	if (chosen.empty())
+	{
+		// no majority agrees; better the closest server than no time at all
+		PmLogDebug(sysServiceLogContext(), "NTP servers disagree, %zu answered", answered.size());
+		chosen = answered;
+	}
 
-	//sntp -d us.pool.ntp.org returns below offset.
-	//
-	//15 Aug 21:41:33 sntp[5529]: Started sntp
-	//Starting to read KoD file /var/db/ntp-kod...
-	//sntp sendpkt: Sending packet to 173.49.198.27... Packet sent.
-	//sntp recvpkt: packet received from 173.49.198.27 is not authentic. Authentication not enforced.
-	//sntp handle_pkt: Received 48 bytes from 173.49.198.27
-	//sntp offset_calculation:	t21: 0.099049		 t34: -0.110320
-	//        delta: 0.209369	 offset: -0.005636
-	//get time offset from sntp's return output : "offset: -0.005636"
+	const Query *best = 0;
+	for (Queries::const_iterator it = chosen.begin(); it != chosen.end(); ++it)
+	{
+		if (!best || (*it)->delay < best->delay) best = *it;
+	}
 
-	static const char * const offsetStr = "offset: ";
+	PmLogDebug(sysServiceLogContext(), "NTP sample from %s: offset %f delay %f (%zu of %zu agree)",
+		best->address.c_str(), best->offset, best->delay, chosen.size(), answered.size());
 
-	size_t offsetIndex = sntpOutput.find(offsetStr);
-	if (offsetIndex == std::string::npos) {
-		//the query failed in some way
-		ntpClock->postError();
-		return;
+	gint64 monotonic = g_get_monotonic_time();
+	Sample sample;
+	sample.monotonic = monotonic;
+	sample.ntpMinusMonotonic = now() + best->offset - monotonic / 1e6;
+	sample.delay = best->delay;
+	samples.push_back(sample);
+
+	size_t maxSamples = std::max(1, Settings::settings()->m_ntpFilterSamples);
+	while (samples.size() > maxSamples) samples.pop_front();
+
+	double offset = best->offset;
+	(void) filteredOffset(offset);
+
+	cancelQueries();
+	postNTP((time_t) floor(offset + 0.5));
+}
+
+void NTPClock::cancelQueries()
+{
+	for (Queries::iterator it = queries.begin(); it != queries.end(); ++it)
+	{
+		if ((*it)->watch) g_source_remove((*it)->watch);
+		close((*it)->fd);
+		delete *it;
 	}
+	queries.clear();
 
-	const char *startptr = sntpOutput.c_str() + offsetIndex + strlen(offsetStr);
-	char *endptr = 0;
+	if (timeoutSource)
+	{
+		g_source_remove(timeoutSource);
+		timeoutSource = 0;
+	}
+}
+
+// callbacks
+void NTPClock::cbResolve(gpointer data, gpointer userData)
+{
+	ResolveJob *job = static_cast<ResolveJob *>(data);
+
+	for (size_t i = 0; i < job->hosts.size() && job->addresses.size() < maxQueries; ++i)
+	{
+		struct addrinfo hints, *info = 0;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_ADDRCONFIG;
+		if (getaddrinfo(job->hosts[i].c_str(), "123", &hints, &info) != 0) continue;
+
+		// a pool name gives several servers; ask each of them
+		for (struct addrinfo *ai = info; ai && job->addresses.size() < maxQueries; ai = ai->ai_next)
+		{
+			char host[NI_MAXHOST];
+			if (getnameinfo(ai->ai_addr, ai->ai_addrlen, host, sizeof(host), 0, 0, NI_NUMERICHOST) != 0) continue;
+			if (std::find(job->addresses.begin(), job->addresses.end(), host) == job->addresses.end())
+				job->addresses.push_back(host);
+		}
+		freeaddrinfo(info);
+	}
+
+	g_idle_add(cbResolved, job);
+}
 
-	PmLogDebug(sysServiceLogContext(), "offset: \"%.*s\"...", 20, startptr);
+gboolean NTPClock::cbResolved(gpointer data)
+{
+	ResolveJob *job = static_cast<ResolveJob *>(data);
+	NTPClock *ntpClock = job->ntpClock;
+	ntpClock->resolving = false;
+	ntpClock->resolveJob = 0;
 
-	time_t offsetValue = strtol(startptr, &endptr, /* base = */ 10);
-	if ( endptr == startptr ||
-	     (*endptr != '\0' && strchr(" \t#.", *endptr) == NULL) )
+	if (job->addresses.empty())
 	{
-		// either empty string interpreted as a number
-		// or string ends with unexpedted char
-		// consider that as error
+		PmLogDebug(sysServiceLogContext(), "no address for any NTP server");
 		ntpClock->postError();
 	}
-	else
+	else if (!ntpClock->startQueries(job->addresses))
 	{
-		ntpClock->postNTP(offsetValue);
+		ntpClock->postError();
 	}
 
-	sntpOutput.clear();
+	delete job;
+	return false;
 }
 
-gboolean NTPClock::cbStdout(GIOChannel *channel, GIOCondition cond, NTPClock *ntpClock)
+gboolean NTPClock::cbReply(GIOChannel *channel, GIOCondition cond, Query *query)
 {
-	if (cond == G_IO_HUP)
+	NTPClock *ntpClock = query->ntpClock;
+	unsigned char reply[ntpPacketSize + 64];   // room for extension fields we don't look at
+
+	ssize_t length = recv(query->fd, reply, sizeof(reply), 0);
+	double received = now();
+	if (length < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+
+	// this query is over either way
+	query->watch = 0;
+
+	if (length < (ssize_t) ntpPacketSize)
 	{
-		g_io_channel_unref(channel);
-		return false;
+		PmLogDebug(sysServiceLogContext(), "no usable reply from %s", query->address.c_str());
 	}
-
-	while (true)
+	else
 	{
-		char buf[4096];
-		gsize bytesRead;
-		GIOStatus status = g_io_channel_read_chars(channel, buf, sizeof(buf), &bytesRead, 0);
-		if (status == G_IO_STATUS_AGAIN) continue;
-		else if (status == G_IO_STATUS_EOF) break;
-		else if (status == G_IO_STATUS_ERROR)
+		int leap = reply[0] >> 6;
+		int version = (reply[0] >> 3) & 0x7;
+		int mode = reply[0] & 0x7;
+		int stratum = reply[1];
+
+		// a reply not echoing our timestamp is stale or forged; stratum 0 is a kiss-o'-death,
+		// leap 3 an unsynchronized server
+		if (memcmp(reply + 24, query->originate, sizeof(query->originate)) != 0 ||
+			(mode != 4 && mode != 5) || version < 3 || stratum == 0 || stratum > 15 || leap == 3)
 		{
-			PmLogDebug(sysServiceLogContext(), "Error during read");
-			return false;
+			PmLogDebug(sysServiceLogContext(), "rejected reply from %s (mode %d, stratum %d, leap %d)",
+				query->address.c_str(), mode, stratum, leap);
+		}
+		else
+		{
+			double t1 = query->sent;
+			double t2 = readTimestamp(reply + 32, t1);
+			double t3 = readTimestamp(reply + 40, t1);
+			double t4 = received;
+
+			query->offset = ((t2 - t1) + (t3 - t4)) / 2;
+			query->delay = (t4 - t1) - (t3 - t2);
+			if (query->delay < 0) query->delay = 0;
+			query->distance = query->delay / 2 + readShort(reply + 4) / 2 + readShort(reply + 8);
+			query->answered = true;
 		}
+	}
 
-		ntpClock->sntpOutput.append(buf, bytesRead);
+	// done once every server has had its say (or the timeout hits)
+	bool pending = false;
+	for (Queries::const_iterator it = ntpClock->queries.begin(); it != ntpClock->queries.end(); ++it)
+	{
+		if ((*it)->watch) pending = true;
 	}
-	return true;
+	if (!pending) ntpClock->finishQueries();
+
+	return false;
+}
+
+gboolean NTPClock::cbTimeout(NTPClock *ntpClock)
+{
+	ntpClock->timeoutSource = 0;
+	ntpClock->finishQueries();
+	return false;
 }
@@ -16,12 +16,14 @@
 
 
 #include <json.h>
+#include <string.h>
 
 #include "PrefsFactory.h"
 
 #include "NetworkConnectionListener.h"
 #include "Logging.h"
 #include "JSONUtils.h"
+#include "Settings.h"
 
 NetworkConnectionListener* NetworkConnectionListener::instance()
 {
@@ -34,12 +36,104 @@ NetworkConnectionListener* NetworkConnectionListener::instance()
 
 NetworkConnectionListener::NetworkConnectionListener()
 	: m_isInternetConnectionAvailable(false)
+	, m_rawAvailable(false)
+	, m_haveStatus(false)
+	, m_settleSource(0)
+	, m_lastReconnectSync(0)
 {
+	memset(&m_stats, 0, sizeof(m_stats));
 	registerForConnectionManager();
 }
 
 NetworkConnectionListener::~NetworkConnectionListener()
 {
+	if (m_settleSource)
+		g_source_remove(m_settleSource);
+}
+
+bool NetworkConnectionListener::takeReconnectSync()
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 holdoff = (gint64) Settings::settings()->m_networkSyncHoldoff * G_USEC_PER_SEC;
+	if (m_lastReconnectSync && holdoff > 0 && now - m_lastReconnectSync < holdoff) {
+		++m_stats.syncsHeldOff;
+		qDebug("reconnect sync held off, last one %llds ago", (long long) ((now - m_lastReconnectSync) / G_USEC_PER_SEC));
+		return false;
+	}
+
+	m_lastReconnectSync = now;
+	++m_stats.syncsAllowed;
+	return true;
+}
+
+json_object* NetworkConnectionListener::statsToJson() const
+{
+	json_object* stats = json_object_new_object();
+	json_object_object_add(stats, "internetAvailable", json_object_new_boolean(m_isInternetConnectionAvailable));
+	json_object_object_add(stats, "settling", json_object_new_boolean(m_settleSource != 0));
+	json_object_object_add(stats, "statusUpdates", json_object_new_int((int) m_stats.statusUpdates));
+	json_object_object_add(stats, "duplicateUpdates", json_object_new_int((int) m_stats.duplicateUpdates));
+	json_object_object_add(stats, "rawChanges", json_object_new_int((int) m_stats.rawChanges));
+	json_object_object_add(stats, "reportedChanges", json_object_new_int((int) m_stats.reportedChanges));
+	json_object_object_add(stats, "flapsSuppressed", json_object_new_int((int) m_stats.flapsSuppressed));
+	json_object_object_add(stats, "syncsAllowed", json_object_new_int((int) m_stats.syncsAllowed));
+	json_object_object_add(stats, "syncsHeldOff", json_object_new_int((int) m_stats.syncsHeldOff));
+	return stats;
+}
+
+void NetworkConnectionListener::setRawState(bool available)
+{
+	++m_stats.statusUpdates;
+
+	//the first status is reported right away, there is nothing to flap from yet
+	if (!m_haveStatus) {
+		m_haveStatus = true;
+		m_rawAvailable = available;
+		reportState();
+		return;
+	}
+
+	if (available == m_rawAvailable)
+		return;
+
+	m_rawAvailable = available;
+	++m_stats.rawChanges;
+
+	if (m_settleSource) {
+		g_source_remove(m_settleSource);
+		m_settleSource = 0;
+	}
+
+	if (m_rawAvailable == m_isInternetConnectionAvailable) {
+		//went back before the change settled
+		++m_stats.flapsSuppressed;
+		return;
+	}
+
+	int settle = Settings::settings()->m_networkSettleTime;
+	if (settle <= 0) {
+		reportState();
+		return;
+	}
+	m_settleSource = g_timeout_add_seconds(settle, cbSettle, this);
+}
+
+void NetworkConnectionListener::reportState()
+{
+	if (m_isInternetConnectionAvailable == m_rawAvailable)
+		return;
+
+	m_isInternetConnectionAvailable = m_rawAvailable;
+	++m_stats.reportedChanges;
+	signalConnectionStateChanged.fire(m_isInternetConnectionAvailable);
+}
+
+gboolean NetworkConnectionListener::cbSettle(gpointer data)
+{
+	NetworkConnectionListener* listener = static_cast<NetworkConnectionListener*>(data);
+	listener->m_settleSource = 0;
+	listener->reportState();
+	return FALSE;
 }
 
 void NetworkConnectionListener::registerForConnectionManager()
@@ -132,6 +226,19 @@ bool NetworkConnectionListener::connectionManagerConnectCallback(LSHandle *sh, L
 
 bool NetworkConnectionListener::connectionManagerGetStatusCallback(LSHandle *sh, LSMessage *message)
 {
+	if (!message)
+		return true;
+
+	//connectionmanager repeats itself a lot (every interface change resends the whole status); a repeat of
+	//the last payload, which was validated then, needs neither the schema nor the parser
+	const char* payload = LSMessageGetPayload(message);
+	if (!payload)
+		return true;
+	if (m_haveStatus && m_lastStatusPayload == payload) {
+		++m_stats.duplicateUpdates;
+		return true;
+	}
+
     // {"isInternetConnectionAvailable": boolean}
 	VALIDATE_SCHEMA_AND_RETURN( sh, message, RELAXED_SCHEMA(
 		PROPS_3(
@@ -143,14 +250,12 @@ bool NetworkConnectionListener::connectionManagerGetStatusCallback(LSHandle *sh,
 		REQUIRED_1( returnValue )
 	));
 
-	if (!message)
-		return true;
-
-	const char* payload = LSMessageGetPayload(message); 
 	json_object* label = 0;
 	json_object* json = 0;
 	bool isInternetConnectionAvailable;
 
+	m_lastStatusPayload = payload;
+
 	json = json_tokener_parse(payload);
 	if (!json) {
 		return true;
@@ -166,10 +271,7 @@ bool NetworkConnectionListener::connectionManagerGetStatusCallback(LSHandle *sh,
 
 	json_object_put(json);
 
-	if (m_isInternetConnectionAvailable != isInternetConnectionAvailable) {
-		m_isInternetConnectionAvailable = isInternetConnectionAvailable;
-		signalConnectionStateChanged.fire(isInternetConnectionAvailable);
-	}
+	setRawState(isInternetConnectionAvailable);
 
 	return true;	
 }
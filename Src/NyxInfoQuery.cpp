@@ -0,0 +1,219 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#include <set>
+
+#include <json.h>
+
+#include "NyxInfoQuery.h"
+#include "Logging.h"
+
+static std::string errorReply(const std::string& errorText)
+{
+	json_object* text = json_object_new_string(errorText.c_str());
+	std::string reply = "{\"returnValue\": false, \"errorText\": ";
+	reply += json_object_to_json_string(text);
+	reply += "}";
+	json_object_put(text);
+	return reply;
+}
+
+NyxInfoQuery::NyxInfoQuery(nyx_device_type_t type, QueryFunction query, const char* what, const char* unsupported)
+	: m_type(type)
+	, m_query(query)
+	, m_what(what)
+	, m_unsupported(unsupported)
+	, m_nyxInitialized(false)
+	, m_device(NULL)
+{
+}
+
+NyxInfoQuery::~NyxInfoQuery()
+{
+	if (m_device)
+		nyx_device_close(m_device);
+	if (m_nyxInitialized)
+		nyx_deinit();
+}
+
+void NyxInfoQuery::addItem(const std::string& name, int item, CachePolicy policy, int ttlSeconds)
+{
+	Item& entry = m_items[name];
+	entry.id = item;
+	entry.policy = policy;
+	entry.ttl = (gint64)ttlSeconds * G_USEC_PER_SEC;
+	entry.cached = false;
+	entry.queried = 0;
+}
+
+bool NyxInfoQuery::hasItem(const std::string& name) const
+{
+	return m_items.find(name) != m_items.end();
+}
+
+nyx_device_handle_t NyxInfoQuery::device()
+{
+	if (m_device)
+		return m_device;
+
+	nyx_error_t error;
+	if (!m_nyxInitialized) {
+		error = nyx_init();
+		if (NYX_ERROR_NONE != error) {
+			qCritical() << "Failed to inititalize nyx library: " << error;
+			return NULL;
+		}
+		m_nyxInitialized = true;
+	}
+
+	// a failed open is tried again on the next query
+	error = nyx_device_open(m_type, "Main", &m_device);
+	if ((NYX_ERROR_NONE != error) || (NULL == m_device)) {
+		qCritical() << "Failed to open `Main` nyx device: " << error;
+		m_device = NULL;
+		return NULL;
+	}
+
+	return m_device;
+}
+
+bool NyxInfoQuery::append(const std::string& name, Item& item, std::string& r_reply, std::string& r_error)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (item.cached && (item.policy == CacheForever || now - item.queried < item.ttl)) {
+		r_reply += item.fragment;
+		return true;
+	}
+
+	if (!device()) {
+		r_error = "Internal error. Can't open nyx device";
+		return false;
+	}
+
+	const char* nyx_result = NULL;
+	nyx_error_t error = m_query(m_device, item.id, &nyx_result);
+	bool answered = (NYX_ERROR_NONE == error && nyx_result);
+	if (!answered) {
+		if (!m_unsupported) {
+			qCritical() << "Failed to query nyx. Parameter: " << name.c_str() << ". Error: " << error;
+			r_error = "Internal error. Can't get " + m_what + " parameter: " + name;
+			return false;
+		}
+		// some devices don't have all available parameters
+		nyx_result = m_unsupported;
+	}
+
+	json_object* value = json_object_new_string(nyx_result);
+	item.fragment = "\"" + name + "\": ";
+	item.fragment += json_object_to_json_string(value);
+	json_object_put(value);
+
+	//a failure may be transient; keep asking until nyx has an answer
+	item.cached = (answered && item.policy != CacheNever);
+	item.queried = now;
+
+	r_reply += item.fragment;
+	return true;
+}
+
+std::string NyxInfoQuery::reply(const char* payload, const std::vector<NyxInfoQuery*>& engines)
+{
+	std::string reply;
+	std::string error;
+	std::string parameter;
+	std::set<std::string> seen;
+
+	json_object* json = NULL;
+	json_object* parameters = NULL;
+
+	if (!payload) {
+		reply = errorReply("No payload specifed for message");
+		goto Done;
+	}
+
+	json = json_tokener_parse(payload);
+	if (!json || !json_object_is_type(json, json_type_object)) {
+		reply = errorReply("Cannot parse/validate json payload");
+		goto Done;
+	}
+
+	reply = "{";
+
+	if (json_object_object_get_ex(json, "parameters", &parameters))
+	{
+		if (!parameters || !json_object_is_type(parameters, json_type_array)) {
+			reply = errorReply("`parameters` needs to be an array");
+			goto Done;
+		}
+
+		for (int i = 0; i < json_object_array_length(parameters); i++)
+		{
+			json_object* name = json_object_array_get_idx(parameters, i);
+			parameter = json_object_get_string(name) ? json_object_get_string(name) : "";
+			if (!seen.insert(parameter).second)
+				continue;
+
+			ItemMap::iterator item;
+			NyxInfoQuery* engine = NULL;
+			for (size_t e = 0; e < engines.size() && !engine; e++) {
+				item = engines[e]->m_items.find(parameter);
+				if (item != engines[e]->m_items.end())
+					engine = engines[e];
+			}
+
+			if (!engine || !json_object_is_type(name, json_type_string)) {
+				reply = errorReply("Invalid parameter: " + parameter);
+				goto Done;
+			}
+
+			if (reply.size() > 1)
+				reply += ", ";
+			if (!engine->append(parameter, item->second, reply, error)) {
+				reply = errorReply(error);
+				goto Done;
+			}
+		}
+	}
+	else if (!engines.empty())
+	{
+		NyxInfoQuery* engine = engines[0];
+		for (ItemMap::iterator it = engine->m_items.begin(); it != engine->m_items.end(); ++it)
+		{
+			if (reply.size() > 1)
+				reply += ", ";
+			if (!engine->append(it->first, it->second, reply, error)) {
+				reply = errorReply(error);
+				goto Done;
+			}
+		}
+	}
+
+	if (reply.size() > 1)
+		reply += ", ";
+	reply += "\"returnValue\": true}";
+
+Done:
+	if (json)
+		json_object_put(json);
+
+	return reply;
+}
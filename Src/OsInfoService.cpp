@@ -14,13 +14,9 @@
  *  limitations under the License.
  */
 
-#include <json.h>
-
 #include "OsInfoService.h"
 #include "Logging.h"
 
-OsInfoService::command_map_t OsInfoService::s_commandMap;
-
 LSMethod s_os_methods[]  = {
 	{ "query",  OsInfoService::cbGetOsInformation },
 	{ 0, 0 },
@@ -36,15 +32,30 @@ OsInfoService* OsInfoService::instance()
 	static OsInfoService* s_instance = 0;
 	if (G_UNLIKELY(s_instance == 0))
 	{
-		OsInfoService::initCommandMap();
 		s_instance = new OsInfoService;
 	}
 
 	return s_instance;
 }
 
-OsInfoService::OsInfoService(): m_service(0)
+OsInfoService::OsInfoService()
+	: m_service(0)
+	, m_query(NYX_DEVICE_OS_INFO, OsInfoService::queryOsInfo, "os", 0)
 {
+	// none of these change at runtime
+	m_query.addItem("core_os_kernel_config", NYX_OS_INFO_CORE_OS_KERNEL_CONFIG); // Return Core OS kernel config
+	m_query.addItem("core_os_kernel_version", NYX_OS_INFO_CORE_OS_KERNEL_VERSION); // Return Core OS kernel version info
+	m_query.addItem("core_os_name", NYX_OS_INFO_CORE_OS_NAME); // Return Core OS name
+	m_query.addItem("core_os_release", NYX_OS_INFO_CORE_OS_RELEASE); // Return Core OS release info
+	m_query.addItem("core_os_release_codename", NYX_OS_INFO_CORE_OS_RELEASE_CODENAME); // Return Core OS release codename
+	m_query.addItem("webos_api_version", NYX_OS_INFO_WEBOS_API_VERSION); // Return webOS API version
+	m_query.addItem("webos_build_id", NYX_OS_INFO_WEBOS_BUILD_ID); // Return webOS build ID
+	m_query.addItem("webos_imagename", NYX_OS_INFO_WEBOS_IMAGENAME); // Return webOS imagename
+	m_query.addItem("webos_name", NYX_OS_INFO_WEBOS_NAME); // Return webOS name
+	m_query.addItem("webos_prerelease", NYX_OS_INFO_WEBOS_PRERELEASE); // Return webOS prerelease info
+	m_query.addItem("webos_release", NYX_OS_INFO_WEBOS_RELEASE); // Return webOS release info
+	m_query.addItem("webos_release_codename", NYX_OS_INFO_WEBOS_RELEASE_CODENAME); // Return webOS release codename
+	m_query.addItem("webos_manufacturing_version", NYX_OS_INFO_MANUFACTURING_VERSION); // Return webOS manufacting version
 }
 
 OsInfoService::~OsInfoService()
@@ -52,22 +63,9 @@ OsInfoService::~OsInfoService()
     // NO-OP
 }
 
-void OsInfoService::initCommandMap()
+nyx_error_t OsInfoService::queryOsInfo(nyx_device_handle_t device, int item, const char** r_value)
 {
-	s_commandMap["core_os_kernel_config"] = NYX_OS_INFO_CORE_OS_KERNEL_CONFIG; // Return Core OS kernel config
-	s_commandMap["core_os_kernel_version"] = NYX_OS_INFO_CORE_OS_KERNEL_VERSION; // Return Core OS kernel version info
-	s_commandMap["core_os_name"] = NYX_OS_INFO_CORE_OS_NAME; // Return Core OS name
-	s_commandMap["core_os_release"] = NYX_OS_INFO_CORE_OS_RELEASE; // Return Core OS release info
-	s_commandMap["core_os_release_codename"] = NYX_OS_INFO_CORE_OS_RELEASE_CODENAME; // Return Core OS release codename
-	s_commandMap["webos_api_version"] = NYX_OS_INFO_WEBOS_API_VERSION; // Return webOS API version
-	s_commandMap["webos_build_id"] = NYX_OS_INFO_WEBOS_BUILD_ID; // Return webOS build ID
-	s_commandMap["webos_imagename"] = NYX_OS_INFO_WEBOS_IMAGENAME; // Return webOS imagename
-	s_commandMap["webos_name"] = NYX_OS_INFO_WEBOS_NAME; // Return webOS name
-	s_commandMap["webos_prerelease"] = NYX_OS_INFO_WEBOS_PRERELEASE; // Return webOS prerelease info
-	s_commandMap["webos_release"] = NYX_OS_INFO_WEBOS_RELEASE; // Return webOS release info
-	s_commandMap["webos_release_codename"] = NYX_OS_INFO_WEBOS_RELEASE_CODENAME; // Return webOS release codename
-	s_commandMap["webos_manufacturing_version"] = NYX_OS_INFO_MANUFACTURING_VERSION; // Return webOS manufacting version
-
+	return nyx_os_info_query(device, (nyx_os_info_query_t)item, r_value);
 }
 
 void OsInfoService::setServiceHandle(LSPalmService* service)
@@ -171,114 +169,17 @@ Example response for a failed call:
 */
 bool OsInfoService::cbGetOsInformation(LSHandle* lsHandle, LSMessage *message, void *user_data)
 {
-	std::string reply;
-	std::string parameter;
-	const char *nyx_result = NULL;
-	bool is_parameters_verified = false; // Becomes `true` if we've formed parameter ourself.
 	LSError lsError;
-
-	json_object *payload = NULL;
-	json_object *payloadParameterList = NULL;
-	json_object *jsonResult = json_object_new_object();
-
 	LSErrorInit(&lsError);
 
-	nyx_error_t error = NYX_ERROR_GENERIC;
-	nyx_device_handle_t device = NULL;
-
-	const char *payload_data = LSMessageGetPayload(message);
-	if (!payload_data) {
-		reply = "{\"returnValue\": false, "
-			" \"errorText\": \"No payload specifed for message\"}";
-		goto Done;
-	}
-
-	payload = json_tokener_parse(payload_data);
-	if (!payload || !json_object_is_type(payload, json_type_object)) {
-		reply = "{\"returnValue\": false, "
-		        " \"errorText\": \"Cannot parse/validate json payload\"}";
-		goto Done;
-	}
-
-	if (json_object_object_get_ex(payload, "parameters", &payloadParameterList))
-	{
-		if (!payloadParameterList || !json_object_is_type(payloadParameterList, json_type_array)) {
-			reply = "{\"returnValue\": false, "
-				" \"errorText\": \"`parameters` needs to be an array\"}";
-			goto Done;
-		}
-	}
-	else
-	{
-		// No parameters. Fill array with all available parameters from the s_commandMap.
-		is_parameters_verified = true;
-		payloadParameterList = json_object_new_array();
-		for (command_map_t::iterator it = s_commandMap.begin(); it != s_commandMap.end(); ++it)
-		{
-			json_object_array_add(payloadParameterList, json_object_new_string(it->first.c_str()));
-		}
-	}
-
-	error = nyx_init();
-	if (NYX_ERROR_NONE != error)
-	{
-		qCritical() << "Failed to inititalize nyx library: " << error;
-		reply = "{\"returnValue\": false, "
-			" \"errorText\": \"Can not initialize nyx\"}";
-		goto Done;
-	}
-
-	error = nyx_device_open(NYX_DEVICE_OS_INFO, "Main", &device);
-	if ((NYX_ERROR_NONE != error) || (NULL == device))
-	{
-		qCritical() << "Failed to get `Main` nyx device: " << error << "";
-		reply = "{\"returnValue\": false, "
-			" \"errorText\": \"Internal error. Can't open nyx device\"}";
-		goto Done;
-	}
-
-	for (int i = 0; i < json_object_array_length(payloadParameterList); i++)
-	{
-		parameter = json_object_get_string(json_object_array_get_idx(payloadParameterList, i));
-		command_map_t::iterator query = s_commandMap.find(parameter);
-
-		if (!is_parameters_verified && query == s_commandMap.end())
-		{
-			reply = "{\"returnValue\": false, "
-				" \"errorText\": \"Invalid parameter: " + parameter + "\"}";
-			goto Done;
-		}
+	std::vector<NyxInfoQuery*> engines;
+	engines.push_back(OsInfoService::instance()->query());
 
-		error = nyx_os_info_query(device, query->second, &nyx_result);
-		if (NYX_ERROR_NONE != error)
-		{
-			qCritical() << "Failed to query nyx. Parameter: " << parameter.c_str() << ". Error: " << error;
-			reply = "{\"returnValue\": false, "
-				" \"errorText\": \"Internal error. Can't get os parameter: " + parameter + "\"}";
-			goto Done;
-		}
-
-		json_object_object_add(jsonResult, parameter.c_str(), json_object_new_string(nyx_result));
-	}
+	std::string reply = NyxInfoQuery::reply(LSMessageGetPayload(message), engines);
 
-	json_object_object_add(jsonResult, "returnValue", json_object_new_boolean(true));
-	reply = json_object_to_json_string(jsonResult);
-
-Done:
 	bool ret = LSMessageReply(lsHandle, message, reply.c_str(), &lsError);
 	if (!ret)
 		LSErrorFree(&lsError);
 
-	if (NULL != device)
-		nyx_device_close(device);
-	nyx_deinit();
-
-	if (payload)
-		json_object_put(payload);
-	if (payloadParameterList)
-		json_object_put(payloadParameterList);
-	if (jsonResult)
-		json_object_put(jsonResult);
-
 	return true;
 }
@@ -21,10 +21,15 @@
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "Logging.h"
 #include "PrefsDb.h"
 #include "Utils.h"
+#include "Settings.h"
+#include "ServiceStats.h"
+#include "ConfigFileCache.h"
+#include "StartupProfile.h"
 #include "SystemRestore.h"
 
 PrefsDb* PrefsDb::s_instance = 0;
@@ -63,6 +68,25 @@ const char* PrefsDb::s_volumeIconFileAndPathDest = MEDIAPARTITIONPATH ".VolumeIc
 const char* PrefsDb::s_sysDefaultWallpaperKey = ".prefsdb.setting.default.wallpaper";
 const char* PrefsDb::s_sysDefaultRingtoneKey = ".prefsdb.setting.default.ringtone";
 
+//next to the main db: present while it is open (a crash leaves it behind), and touched after each full check
+static const char* s_openMarkerSuffix = ".open";
+static const char* s_fullCheckStampSuffix = ".fullcheck";
+
+static bool isJsonValue(const std::string& value)
+{
+	//json_tokener_parse() stops after the first value and takes "1 abc" as 1; the whole string has to be the value
+	json_tokener* tok = json_tokener_new();
+	if (!tok)
+		return false;
+
+	json_object* parsed = json_tokener_parse_ex(tok, value.c_str(), -1);
+	bool valid = parsed && tok->err == json_tokener_success && tok->char_offset == (int) value.size();
+	json_tokener_free(tok);
+	if (parsed)
+		json_object_put(parsed);
+	return valid;
+}
+
 PrefsDb* PrefsDb::instance()
 {
 	if (!s_instance)
@@ -90,7 +114,13 @@ PrefsDb::PrefsDb()
 , m_standalone(false)
 , m_dbFilename(s_prefsDbPath)
 , m_deleteOnDestroy(false)
+, m_cacheValid(false)
+, m_walMode(false)
+, m_checkpointSource(0)
+, m_mergeInSteps(0)
+, m_forceFullCheck(false)
 {
+	memset(m_cachedStatements, 0, sizeof(m_cachedStatements));
 	s_instance = this;
 	openPrefsDb();
 }
@@ -100,12 +130,20 @@ PrefsDb::PrefsDb(const std::string& standaloneDbFilename)
 , m_standalone(true)
 , m_dbFilename(standaloneDbFilename)
 , m_deleteOnDestroy(false)
+, m_cacheValid(false)
+, m_walMode(false)
+, m_checkpointSource(0)
+, m_mergeInSteps(0)
+, m_forceFullCheck(false)
 {
+	memset(m_cachedStatements, 0, sizeof(m_cachedStatements));
 	openPrefsDb();
 }
 
 PrefsDb::~PrefsDb()
 {
+	if (m_mergeInSteps)
+		finishMergeInSteps(false);
 	closePrefsDb();
 	if (!m_standalone)
 	{
@@ -120,95 +158,144 @@ PrefsDb::~PrefsDb()
 
 bool PrefsDb::setPref(const std::string& key, const std::string& value)
 {
-	char * queryStr = 0;
-
+	ServiceStats::PhaseTimer sqliteTimer(ServiceStats::PhaseSqlite);
 	if (!m_prefsDb)
 		return false;
 
 	if (key.empty())
 		return false;
 
-	//gchar* queryStr = g_strdup_printf("INSERT INTO Preferences "
-	//								  "VALUES ('%s', '%s')",
-	//								  key.c_str(), value.c_str());
-
-	queryStr = sqlite3_mprintf("INSERT INTO Preferences "
-									  "VALUES (%Q, %Q)",
-									  key.c_str(), value.c_str());
+	sqlite3_stmt* statement = cachedStatement(StatementUpsert);
+	if (!statement)
+		return false;
 
-	if (!queryStr)
+	if ((sqlite3_bind_text(statement, 1, key.c_str(), key.size(), SQLITE_TRANSIENT) != SQLITE_OK)
+		|| (sqlite3_bind_text(statement, 2, value.c_str(), value.size(), SQLITE_TRANSIENT) != SQLITE_OK))
+	{
+		qWarning("Failed to bind values for key %s", key.c_str());
+		sqlite3_reset(statement);
 		return false;
+	}
 
-	int ret = sqlite3_exec(m_prefsDb, queryStr, NULL, NULL, NULL);
+	int ret = sqlite3_step(statement);
+	sqlite3_reset(statement);
 
-	if (ret) {
+	if (ret != SQLITE_DONE) {
 		qWarning("Failed to execute query for key %s", key.c_str());
-
-		sqlite3_free(queryStr);
 		return false;
 	}
 
-	sqlite3_free(queryStr);
+	if (m_cacheValid)
+		cachePref(key,value);
+
+	scheduleCheckpoint();
 
 	qDebug("set ( [%s] , [---, length %zu] )", key.c_str(), value.size());
 	return true;
 }
 
-std::string PrefsDb::getPref(const std::string& key)
+bool PrefsDb::setPrefs(const std::map<std::string, std::string>& keyValues)
 {
+	ServiceStats::PhaseTimer sqliteTimer(ServiceStats::PhaseSqlite);
 	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
+	std::map<std::string, std::string>::const_iterator it;
 	int ret = 0;
-	//gchar* queryStr = 0;
-	char * queryStr = 0;
-
-	std::string result="";
 
 	if (!m_prefsDb)
-		return result;
+		return false;
 
-	if (key.empty())
-		goto Done;
+	if (keyValues.empty())
+		return true;
 
-	queryStr = sqlite3_mprintf("SELECT value FROM Preferences WHERE key=%Q",key.c_str());
+	for (it = keyValues.begin(); it != keyValues.end(); ++it)
+	{
+		if (it->first.empty())
+			return false;
+	}
 
-	//queryStr = g_strdup_printf("SELECT value FROM Preferences WHERE key='%s'",
-	//						   key.c_str());
-	if (!queryStr)
-		goto Done;
+	statement = cachedStatement(StatementUpsert);
+	if (!statement)
+		return false;
 
-	ret = sqlite3_prepare(m_prefsDb, queryStr, -1, &statement, &tail);
-	if (ret) {
-		qWarning("Failed to prepare sql statement: %s", queryStr);
-		goto Done;
+	ret = sqlite3_exec(m_prefsDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	if (ret != SQLITE_OK) {
+		qWarning("Failed to begin transaction (%s)", sqlite3_errmsg(m_prefsDb));
+		return false;
 	}
 
-	ret = sqlite3_step(statement);
-	if (ret == SQLITE_ROW) {
-		const unsigned char* res = sqlite3_column_text(statement, 0);
-		if (res)
-			result = (const char*) res;
+	for (it = keyValues.begin(); it != keyValues.end(); ++it)
+	{
+		sqlite3_reset(statement);
+		sqlite3_clear_bindings(statement);
+
+		if ((sqlite3_bind_text(statement, 1, it->first.c_str(), it->first.size(), SQLITE_TRANSIENT) != SQLITE_OK)
+			|| (sqlite3_bind_text(statement, 2, it->second.c_str(), it->second.size(), SQLITE_TRANSIENT) != SQLITE_OK))
+		{
+			qWarning("Failed to bind values for key %s", it->first.c_str());
+			goto Rollback;
+		}
+
+		ret = sqlite3_step(statement);
+		if (ret != SQLITE_DONE) {
+			qWarning("Failed to execute query for key %s", it->first.c_str());
+			goto Rollback;
+		}
 	}
 
-Done:
+	sqlite3_reset(statement);
 
-	if (statement)
-		sqlite3_finalize(statement);
+	ret = sqlite3_exec(m_prefsDb, "COMMIT TRANSACTION", NULL, NULL, NULL);
+	if (ret != SQLITE_OK) {
+		qWarning("Failed to commit transaction (%s)", sqlite3_errmsg(m_prefsDb));
+		goto Rollback;
+	}
 
-	if (queryStr)
-		sqlite3_free(queryStr);
+	if (m_cacheValid)
+	{
+		for (it = keyValues.begin(); it != keyValues.end(); ++it)
+			cachePref(it->first,it->second);
+	}
+
+	scheduleCheckpoint();
+
+	qDebug("set %zu keys in one transaction", keyValues.size());
+	return true;
 
+Rollback:
 
+	sqlite3_reset(statement);
+	(void) sqlite3_exec(m_prefsDb, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+	return false;
+}
+
+std::string PrefsDb::getPref(const std::string& key)
+{
+	std::string result="";
+	(void) getPref(key,result);
 	return result;
 }
 
 bool PrefsDb::getPref(const std::string& key,std::string& r_val)
 {
+	if (!m_cacheValid)
+		return getPrefFromDb(key,r_val);
+
+	if (!m_prefsDb || key.empty())
+		return false;
+
+	PrefsCache::const_iterator it = m_cache.find(key);
+	if (it == m_cache.end())
+		return false;
+
+	r_val = it->second;
+	return true;
+}
+
+bool PrefsDb::getPrefFromDb(const std::string& key,std::string& r_val)
+{
+	ServiceStats::PhaseTimer sqliteTimer(ServiceStats::PhaseSqlite);
 	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
 	int ret = 0;
-	//gchar* queryStr = 0;
-	char * queryStr = 0;
 
 	bool result=false;
 
@@ -218,14 +305,13 @@ bool PrefsDb::getPref(const std::string& key,std::string& r_val)
 	if (key.empty())
 		goto Done;
 
-	queryStr = sqlite3_mprintf("SELECT value FROM Preferences WHERE key=%Q",key.c_str());
-
-	if (!queryStr)
+	statement = cachedStatement(StatementSelectByKey);
+	if (!statement)
 		goto Done;
 
-	ret = sqlite3_prepare(m_prefsDb, queryStr, -1, &statement, &tail);
-	if (ret) {
-		qWarning("Failed to prepare sql statement: %s", queryStr);
+	ret = sqlite3_bind_text(statement, 1, key.c_str(), key.size(), SQLITE_TRANSIENT);
+	if (ret != SQLITE_OK) {
+		qWarning("Failed to bind key %s", key.c_str());
 		goto Done;
 	}
 
@@ -242,9 +328,7 @@ bool PrefsDb::getPref(const std::string& key,std::string& r_val)
 	Done:
 
 	if (statement)
-		sqlite3_finalize(statement);
-	if (queryStr)
-		sqlite3_free(queryStr);
+		sqlite3_reset(statement);
 
 	return result;
 }
@@ -252,22 +336,24 @@ bool PrefsDb::getPref(const std::string& key,std::string& r_val)
 std::map<std::string,std::string> PrefsDb::getAllPrefs()
 {
 	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
 	int ret = 0;
-	std::string query;
 	std::map<std::string, std::string> result;
 
 	if (!m_prefsDb)
 		return result;
 
-	query = "SELECT * FROM Preferences;";
-
-	ret = sqlite3_prepare(m_prefsDb, query.c_str(), -1, &statement, &tail);
-	if (ret) {
-		qWarning() << "Failed to prepare sql statement";
-		goto Done;
+	if (m_cacheValid)
+	{
+		result.insert(m_cache.begin(),m_cache.end());
+		return result;
 	}
 
+	ServiceStats::PhaseTimer sqliteTimer(ServiceStats::PhaseSqlite);
+
+	statement = cachedStatement(StatementSelectAll);
+	if (!statement)
+		return result;
+
 	while ((ret = sqlite3_step(statement)) == SQLITE_ROW) {
 		const char* key = (const char*) sqlite3_column_text(statement, 0);
 		const char* val = (const char*) sqlite3_column_text(statement, 1);
@@ -277,10 +363,7 @@ std::map<std::string,std::string> PrefsDb::getAllPrefs()
 		result[key] = val;
 	}
 
-	Done:
-
-	if (statement)
-		sqlite3_finalize(statement);
+	sqlite3_reset(statement);
 
 	return result;
 }
@@ -329,6 +412,79 @@ int PrefsDb::merge(const std::string& sourceDbFilename,bool overwriteSameKeys)
 }
 
 int PrefsDb::copyKeys(PrefsDb * p_sourceDb,const std::list<std::string>& keys,bool overwriteSameKeys)
+{
+	if (!p_sourceDb || (p_sourceDb == this))
+		return 0;
+	if (keys.empty())
+		return 0;
+	if (p_sourceDb->m_prefsDb == 0 || m_prefsDb == 0)
+		return 0;
+
+	qDebug("source DB file: [%s] , target DB file: [%s] , overwriteSameKeys = %s",
+		p_sourceDb->m_dbFilename.c_str(), m_dbFilename.c_str(),(overwriteSameKeys ? "YES" : "NO"));
+
+	sqlite3_stmt* statement = 0;
+	int n = 0;
+	int ret;
+	char* attachCmd = sqlite3_mprintf("ATTACH %Q AS sourceDb", p_sourceDb->m_dbFilename.c_str());
+	ret = sqlite3_exec(m_prefsDb, attachCmd, NULL, NULL, NULL);
+	sqlite3_free(attachCmd);
+	if (ret != SQLITE_OK) {
+		qWarning("Failed to attach [%s] (%s), copying key by key", p_sourceDb->m_dbFilename.c_str(), sqlite3_errmsg(m_prefsDb));
+		return copyKeysRowByRow(p_sourceDb,keys,overwriteSameKeys);
+	}
+
+	ret = sqlite3_exec(m_prefsDb,
+					   "BEGIN TRANSACTION;"
+					   "CREATE TEMP TABLE IF NOT EXISTS CopyKeys (key TEXT PRIMARY KEY ON CONFLICT IGNORE);"
+					   "DELETE FROM temp.CopyKeys;", NULL, NULL, NULL);
+	if (ret != SQLITE_OK)
+		goto Rollback;
+
+	ret = sqlite3_prepare_v2(m_prefsDb, "INSERT INTO temp.CopyKeys VALUES (?1)", -1, &statement, 0);
+	if (ret != SQLITE_OK)
+		goto Rollback;
+	for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+	{
+		sqlite3_reset(statement);
+		if (sqlite3_bind_text(statement, 1, it->c_str(), it->size(), SQLITE_TRANSIENT) != SQLITE_OK
+			|| sqlite3_step(statement) != SQLITE_DONE)
+			goto Rollback;
+	}
+	sqlite3_finalize(statement);
+	statement = 0;
+
+	ret = sqlite3_exec(m_prefsDb, (overwriteSameKeys
+			? "INSERT INTO main.Preferences SELECT key, value FROM sourceDb.Preferences WHERE key IN (SELECT key FROM temp.CopyKeys)"
+			: "INSERT OR IGNORE INTO main.Preferences SELECT key, value FROM sourceDb.Preferences WHERE key IN (SELECT key FROM temp.CopyKeys)"),
+			NULL, NULL, NULL);
+	if (ret != SQLITE_OK)
+		goto Rollback;
+	n = sqlite3_changes(m_prefsDb);
+
+	ret = sqlite3_exec(m_prefsDb, "DELETE FROM temp.CopyKeys; COMMIT TRANSACTION", NULL, NULL, NULL);
+	if (ret != SQLITE_OK)
+		goto Rollback;
+
+	(void) sqlite3_exec(m_prefsDb, "DETACH sourceDb", NULL, NULL, NULL);
+	if (m_cacheValid)
+		loadCache();
+	scheduleCheckpoint();
+	qDebug("copied %d keys in one statement", n);
+	return n;
+
+Rollback:
+
+	qWarning("Failed to copy keys from [%s] (%s)", p_sourceDb->m_dbFilename.c_str(), sqlite3_errmsg(m_prefsDb));
+	if (statement)
+		sqlite3_finalize(statement);
+	(void) sqlite3_exec(m_prefsDb, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+	(void) sqlite3_exec(m_prefsDb, "DETACH sourceDb", NULL, NULL, NULL);
+	return 0;
+}
+
+//what copyKeys() used to do, one setPref() per key; in a transaction so it isn't one per key too
+int PrefsDb::copyKeysRowByRow(PrefsDb * p_sourceDb,const std::list<std::string>& keys,bool overwriteSameKeys)
 {
 	if (!p_sourceDb || (p_sourceDb == this))
 		return 0;
@@ -340,6 +496,7 @@ int PrefsDb::copyKeys(PrefsDb * p_sourceDb,const std::list<std::string>& keys,bo
 	qDebug("source DB file: [%s] , target DB file: [%s] , overwriteSameKeys = %s",
 		p_sourceDb->m_dbFilename.c_str(), m_dbFilename.c_str(),(overwriteSameKeys ? "YES" : "NO"));
 	int n=0;
+	(void) sqlite3_exec(m_prefsDb, "BEGIN TRANSACTION", NULL, NULL, NULL);
 	for (std::list<std::string>::const_iterator it = keys.begin();
 			it != keys.end();++it)
 	{
@@ -356,9 +513,197 @@ int PrefsDb::copyKeys(PrefsDb * p_sourceDb,const std::list<std::string>& keys,bo
 			}
 		}
 	}
+	(void) sqlite3_exec(m_prefsDb, "COMMIT TRANSACTION", NULL, NULL, NULL);
 	return n;
 }
 
+#define MERGE_BATCH_ROWS 64
+
+bool PrefsDb::mergeInSteps(const std::string& sourceDbFilename, MergeProgress progress, MergeDone done, void* data)
+{
+	if (!m_prefsDb || m_mergeInSteps)
+		return false;
+
+	char* attachCmd = sqlite3_mprintf("ATTACH %Q AS backupDb", sourceDbFilename.c_str());
+	bool sqlOk = runSqlCommand(attachCmd);
+	sqlite3_free(attachCmd);
+	if (!sqlOk)
+	{
+		qWarning() << "Failed to run ATTACH cmd to attach [" << sourceDbFilename.c_str() << "] to this db";
+		return false;
+	}
+
+	m_mergeInSteps = new MergeInSteps;
+	m_mergeInSteps->progress = progress;
+	m_mergeInSteps->done = done;
+	m_mergeInSteps->data = data;
+	m_mergeInSteps->lastRowid = 0;
+	m_mergeInSteps->merged = 0;
+	m_mergeInSteps->total = (int) queryInt64("SELECT COUNT(*) FROM backupDb.Preferences");
+	m_mergeInSteps->source = g_idle_add_full(G_PRIORITY_LOW, cbMergeStep, this, NULL);
+
+	qDebug("merging %d rows from [%s] in steps", m_mergeInSteps->total, sourceDbFilename.c_str());
+	return true;
+}
+
+// false once there is nothing left (or it failed, then m_mergeInSteps->total is set to -1)
+bool PrefsDb::mergeStep()
+{
+	sqlite3_int64 last = m_mergeInSteps->lastRowid;
+	gchar* rangeQuery = g_strdup_printf("SELECT COUNT(*), MAX(rowid) FROM "
+			"(SELECT rowid FROM backupDb.Preferences WHERE rowid > %lld ORDER BY rowid LIMIT %d)",
+			(long long) last, MERGE_BATCH_ROWS);
+	sqlite3_stmt* statement = runSqlQuery(rangeQuery);
+	g_free(rangeQuery);
+	if (!statement || sqlite3_step(statement) != SQLITE_ROW) {
+		if (statement)
+			sqlite3_finalize(statement);
+		m_mergeInSteps->total = -1;
+		return false;
+	}
+	int rows = sqlite3_column_int(statement, 0);
+	sqlite3_int64 next = sqlite3_column_int64(statement, 1);
+	sqlite3_finalize(statement);
+	if (rows == 0)
+		return false;
+
+	gchar* mergeCmd = g_strdup_printf("BEGIN TRANSACTION;"
+			"INSERT INTO main.Preferences SELECT key, value FROM backupDb.Preferences WHERE rowid > %lld AND rowid <= %lld;"
+			"COMMIT TRANSACTION;", (long long) last, (long long) next);
+	bool sqlOk = runSqlCommand(mergeCmd);
+	g_free(mergeCmd);
+	if (!sqlOk) {
+		(void) sqlite3_exec(m_prefsDb, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+		m_mergeInSteps->total = -1;
+		return false;
+	}
+
+	m_mergeInSteps->lastRowid = next;
+	m_mergeInSteps->merged += rows;
+	if (m_mergeInSteps->progress)
+		m_mergeInSteps->progress(m_mergeInSteps->merged, m_mergeInSteps->total, m_mergeInSteps->data);
+	return true;
+}
+
+void PrefsDb::finishMergeInSteps(bool ok)
+{
+	MergeInSteps* merge = m_mergeInSteps;
+	m_mergeInSteps = 0;
+	if (merge->source)
+		g_source_remove(merge->source);
+
+	(void) runSqlCommand("DETACH backupDb");
+	//as merge() does: reopening runs checkTableConsistency() again, so a backup from an older build gets the
+	//defaults, platform defaults and overrides it is missing; it also reloads the cache every batch went around
+	closePrefsDb();
+	openPrefsDb();
+
+	qDebug("merge in steps %s after %d rows", (ok ? "done" : "failed"), merge->merged);
+	if (merge->done)
+		merge->done(ok, merge->merged, merge->data);
+	delete merge;
+}
+
+gboolean PrefsDb::cbMergeStep(gpointer data)
+{
+	PrefsDb* db = static_cast<PrefsDb*>(data);
+	if (db->mergeStep())
+		return TRUE;
+
+	db->m_mergeInSteps->source = 0;
+	db->finishMergeInSteps(db->m_mergeInSteps->total >= 0);
+	return FALSE;
+}
+
+/*
+ * The journal is kept by triggers, so that every way Preferences gets written (setPref(), merge(), raw sql
+ * from the handlers) is covered. A deleted key stays in the journal as a tombstone: it has a generation
+ * but no row in Preferences, so a backup taken before the delete counts as out of date. The row with the empty key is the generation the journal started at; it is
+ * seeded from the clock so that a journal which was dropped and recreated never reuses an id
+ */
+bool PrefsDb::createJournal()
+{
+	if (!m_prefsDb)
+		return false;
+
+	gchar* sql = g_strdup_printf(
+			"BEGIN TRANSACTION;"
+			"CREATE TABLE IF NOT EXISTS PrefsJournal "
+			"(key TEXT NOT NULL UNIQUE ON CONFLICT REPLACE, generation INTEGER NOT NULL);"
+			"CREATE INDEX IF NOT EXISTS PrefsJournalGeneration ON PrefsJournal (generation);"
+			"INSERT INTO PrefsJournal SELECT '', %lld WHERE NOT EXISTS (SELECT 1 FROM PrefsJournal WHERE key='');"
+			"CREATE TRIGGER IF NOT EXISTS PrefsJournalWrite AFTER INSERT ON Preferences WHEN NEW.key <> '' BEGIN "
+			"INSERT INTO PrefsJournal VALUES (NEW.key, IFNULL((SELECT MAX(generation) FROM PrefsJournal), 0) + 1); "
+			"END;"
+			"CREATE TRIGGER IF NOT EXISTS PrefsJournalUpdate AFTER UPDATE ON Preferences WHEN NEW.key <> '' BEGIN "
+			"INSERT INTO PrefsJournal VALUES (NEW.key, IFNULL((SELECT MAX(generation) FROM PrefsJournal), 0) + 1); "
+			"END;"
+			"CREATE TRIGGER IF NOT EXISTS PrefsJournalDelete AFTER DELETE ON Preferences WHEN OLD.key <> '' BEGIN "
+			"INSERT INTO PrefsJournal VALUES (OLD.key, IFNULL((SELECT MAX(generation) FROM PrefsJournal), 0) + 1); "
+			"END;"
+			"COMMIT TRANSACTION;", (long long) g_get_real_time());
+
+	char* pErrMsg = 0;
+	int ret = sqlite3_exec(m_prefsDb, sql, NULL, NULL, &pErrMsg);
+	g_free(sql);
+	if (ret) {
+		qWarning("Failed to set up PrefsJournal (%s)", (pErrMsg ? pErrMsg : "<none>"));
+		if (pErrMsg)
+			sqlite3_free(pErrMsg);
+		(void) sqlite3_exec(m_prefsDb, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+		return false;
+	}
+	return true;
+}
+
+gint64 PrefsDb::queryInt64(const char* query)
+{
+	gint64 value = 0;
+	sqlite3_stmt* statement = runSqlQuery(query);
+	if (!statement)
+		return 0;
+
+	if (sqlite3_step(statement) == SQLITE_ROW)
+		value = sqlite3_column_int64(statement, 0);
+	sqlite3_finalize(statement);
+	return value;
+}
+
+gint64 PrefsDb::journalId()
+{
+	if (m_standalone)
+		return 0;
+	return queryInt64("SELECT generation FROM PrefsJournal WHERE key=''");
+}
+
+gint64 PrefsDb::journalGeneration()
+{
+	if (m_standalone)
+		return 0;
+	return queryInt64("SELECT MAX(generation) FROM PrefsJournal");
+}
+
+std::list<std::string> PrefsDb::keysChangedSince(gint64 generation)
+{
+	std::list<std::string> keys;
+	if (m_standalone)
+		return keys;
+
+	sqlite3_stmt* statement = runSqlQuery("SELECT key FROM PrefsJournal WHERE generation > ?1 AND key <> ''");
+	if (!statement)
+		return keys;
+
+	if (sqlite3_bind_int64(statement, 1, generation) == SQLITE_OK) {
+		while (sqlite3_step(statement) == SQLITE_ROW) {
+			const char* key = (const char*) sqlite3_column_text(statement, 0);
+			if (key)
+				keys.push_back(key);
+		}
+	}
+	sqlite3_finalize(statement);
+	return keys;
+}
+
 sqlite3_stmt* PrefsDb::runSqlQuery(const std::string& queryStr)
 {
 	sqlite3_stmt* statement = 0;
@@ -394,13 +739,18 @@ bool PrefsDb::runSqlCommand(const std::string& cmdStr)
 	if (!queryStr)
 		return false;
 
+	//no telling what the command touched
+	invalidateCache();
+
 	ret = sqlite3_exec(m_prefsDb, queryStr, NULL, NULL, &pErrMsg);
 	if (ret) {
 		qWarning() << "Failed to execute cmd [" << queryStr << "] - extended error: [" << (pErrMsg ? pErrMsg : "<none>") << "]";
 		rc = false;
 	}
-	else
+	else {
 		rc = true;
+		scheduleCheckpoint();
+	}
 
 	if (queryStr)
 		sqlite3_free(queryStr);
@@ -409,53 +759,245 @@ bool PrefsDb::runSqlCommand(const std::string& cmdStr)
 	return rc;
 }
 
-//TODO: STILL UNSAFE IF THE KEY HAS SINGLE QUOTES IN IT! (SEE getPref() FOR EXAMPLE OF HOW TO FIX)
 std::map<std::string, std::string> PrefsDb::getPrefs(const std::list<std::string>& keys)
 {
-	sqlite3_stmt* statement = 0;
-	const char* tail = 0;
-	int ret = 0;
-	std::string query;
 	std::map<std::string, std::string> result;
-	std::list<std::string>::const_iterator it;
 
 	if (!m_prefsDb)
 		return result;
 
-	if (keys.empty())
-		goto Done;
+	//each key goes through the cached select-by-key statement; this avoids building (and re-parsing) an OR-chain query per call
+	for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+	{
+		std::string val;
+		if (getPref(*it,val))
+			result[*it] = val;
+	}
 
-	query = "SELECT * FROM Preferences WHERE key='";
-	query += keys.front() + "'";
+	return result;
+}
 
-	it = keys.begin();
-	++it;
+std::map<std::string, std::string> PrefsDb::getJsonPrefs(const std::list<std::string>& keys,std::list<std::string>& r_invalidKeys)
+{
+	std::map<std::string, std::string> result;
 
-	for (; it != keys.end(); ++it)
-		query += " OR key='" + (*it) + "'";
-	query += ";";
+	if (!m_prefsDb)
+		return result;
 
-	ret = sqlite3_prepare(m_prefsDb, query.c_str(), -1, &statement, &tail);
-	if (ret) {
-		qWarning() << "Failed to prepare sql statement";
-		goto Done;
+	for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+	{
+		std::string val;
+		if (!getPref(*it,val))
+			continue;
+
+		bool valid = (m_cacheValid ? (m_nonJsonKeys.find(*it) == m_nonJsonKeys.end()) : isJsonValue(val));
+		if (valid)
+			result[*it] = val;
+		else
+			r_invalidKeys.push_back(*it);
+	}
+
+	return result;
+}
+
+sqlite3_stmt* PrefsDb::cachedStatement(CachedStatement which)
+{
+	static const char* s_cachedStatementSql[StatementCount] = {
+		"SELECT value FROM Preferences WHERE key=?1",
+		"INSERT INTO Preferences VALUES (?1, ?2)",
+		"SELECT * FROM Preferences"
+	};
+
+	if (!m_prefsDb)
+		return 0;
+
+	sqlite3_stmt* statement = m_cachedStatements[which];
+	if (statement)
+	{
+		sqlite3_reset(statement);
+		sqlite3_clear_bindings(statement);
+		return statement;
+	}
+
+	int ret = sqlite3_prepare_v2(m_prefsDb, s_cachedStatementSql[which], -1, &statement, 0);
+	if (ret != SQLITE_OK) {
+		qWarning("Failed to prepare sql statement: %s (%s)", s_cachedStatementSql[which], sqlite3_errmsg(m_prefsDb));
+		if (statement)
+			sqlite3_finalize(statement);
+		return 0;
+	}
+
+	m_cachedStatements[which] = statement;
+	return statement;
+}
+
+void PrefsDb::finalizeCachedStatements()
+{
+	for (int i = 0; i < StatementCount; ++i)
+	{
+		if (m_cachedStatements[i])
+		{
+			sqlite3_finalize(m_cachedStatements[i]);
+			m_cachedStatements[i] = 0;
+		}
 	}
+}
+
+void PrefsDb::loadCache()
+{
+	m_cache.clear();
+	m_nonJsonKeys.clear();
+	m_cacheValid = false;
+
+	if (!m_prefsDb)
+		return;
 
+	sqlite3_stmt* statement = cachedStatement(StatementSelectAll);
+	if (!statement)
+		return;
+
+	int ret;
 	while ((ret = sqlite3_step(statement)) == SQLITE_ROW) {
 		const char* key = (const char*) sqlite3_column_text(statement, 0);
 		const char* val = (const char*) sqlite3_column_text(statement, 1);
 		if (!key || !val)
 			continue;
 
-		result[key] = val;
+		cachePref(key,val);
 	}
 
-Done:
+	sqlite3_reset(statement);
 
-	if (statement)
+	if (ret != SQLITE_DONE) {
+		qWarning("Failed to load preferences cache (%s); reads will go to the db", sqlite3_errmsg(m_prefsDb));
+		m_cache.clear();
+		m_nonJsonKeys.clear();
+		return;
+	}
+
+	m_cacheValid = true;
+	qDebug("preferences cache loaded with %zu keys", m_cache.size());
+}
+
+void PrefsDb::invalidateCache()
+{
+	m_cache.clear();
+	m_nonJsonKeys.clear();
+	m_cacheValid = false;
+}
+
+void PrefsDb::cachePref(const std::string& key,const std::string& value)
+{
+	m_cache[key] = value;
+
+	//parsed here once so readers that splice values into json replies never have to
+	if (isJsonValue(value))
+		m_nonJsonKeys.erase(key);
+	else
+		m_nonJsonKeys.insert(key);
+}
+
+void PrefsDb::refreshCache()
+{
+	loadCache();
+}
+
+void PrefsDb::applyConnectionPragmas()
+{
+	if (!m_prefsDb)
+		return;
+
+	Settings* settings = Settings::settings();
+	char* pragmaStr = 0;
+	sqlite3_stmt* statement = 0;
+
+	m_walMode = false;
+	if (!m_standalone && settings->m_prefsDbWalMode) {
+		//journal_mode answers with the mode actually in effect
+		if (sqlite3_prepare_v2(m_prefsDb, "PRAGMA journal_mode=WAL", -1, &statement, NULL) == SQLITE_OK) {
+			if (sqlite3_step(statement) == SQLITE_ROW) {
+				const unsigned char* mode = sqlite3_column_text(statement, 0);
+				m_walMode = (mode && strcasecmp((const char*) mode, "wal") == 0);
+			}
+		}
 		sqlite3_finalize(statement);
 
-	return result;
+		if (!m_walMode)
+			qWarning() << "Failed to switch [" << m_dbFilename.c_str() << "] to wal mode; staying on the rollback journal";
+	}
+
+	//only pass through the values sqlite knows; this ends up in a raw sql string
+	const std::string& sync = settings->m_prefsDbSynchronous;
+	if (strcasecmp(sync.c_str(), "OFF") == 0 || strcasecmp(sync.c_str(), "NORMAL") == 0
+		|| strcasecmp(sync.c_str(), "FULL") == 0 || strcasecmp(sync.c_str(), "EXTRA") == 0) {
+		pragmaStr = sqlite3_mprintf("PRAGMA synchronous=%s", sync.c_str());
+		(void) sqlite3_exec(m_prefsDb, pragmaStr, NULL, NULL, NULL);
+		sqlite3_free(pragmaStr);
+	}
+	else {
+		qWarning() << "Ignoring unknown PrefsDb synchronous setting [" << sync.c_str() << "]";
+	}
+
+	if (settings->m_prefsDbCacheSize) {
+		pragmaStr = sqlite3_mprintf("PRAGMA cache_size=%d", settings->m_prefsDbCacheSize);
+		(void) sqlite3_exec(m_prefsDb, pragmaStr, NULL, NULL, NULL);
+		sqlite3_free(pragmaStr);
+	}
+
+	if (settings->m_prefsDbMmapSize > 0) {
+		pragmaStr = sqlite3_mprintf("PRAGMA mmap_size=%d", settings->m_prefsDbMmapSize);
+		(void) sqlite3_exec(m_prefsDb, pragmaStr, NULL, NULL, NULL);
+		sqlite3_free(pragmaStr);
+	}
+
+	if (m_walMode)
+		(void) sqlite3_wal_autocheckpoint(m_prefsDb, MAX(settings->m_prefsDbWalAutoCheckpoint, 0));
+
+	qDebug("[%s] opened with journal %s, synchronous %s", m_dbFilename.c_str(), (m_walMode ? "wal" : "default"), sync.c_str());
+}
+
+void PrefsDb::scheduleCheckpoint()
+{
+	if (!m_walMode || m_checkpointSource)
+		return;
+
+	int interval = Settings::settings()->m_prefsDbCheckpointInterval;
+	if (interval < 0)
+		return;
+
+	//one pending checkpoint covers every write that lands before it fires
+	if (interval == 0)
+		m_checkpointSource = g_idle_add_full(G_PRIORITY_LOW, cbCheckpoint, this, NULL);
+	else
+		m_checkpointSource = g_timeout_add_seconds(interval, cbCheckpoint, this);
+}
+
+void PrefsDb::cancelCheckpoint()
+{
+	if (m_checkpointSource) {
+		g_source_remove(m_checkpointSource);
+		m_checkpointSource = 0;
+	}
+}
+
+gboolean PrefsDb::cbCheckpoint(gpointer data)
+{
+	PrefsDb* pThis = static_cast<PrefsDb*>(data);
+	pThis->m_checkpointSource = 0;
+
+	if (!pThis->m_prefsDb)
+		return FALSE;
+
+	//passive never waits on other connections, so this can't stall the main loop behind a reader
+	int walFrames = 0;
+	int checkpointed = 0;
+	int ret = sqlite3_wal_checkpoint_v2(pThis->m_prefsDb, NULL, SQLITE_CHECKPOINT_PASSIVE, &walFrames, &checkpointed);
+	if (ret != SQLITE_OK)
+		qWarning("wal checkpoint failed (%s)", sqlite3_errmsg(pThis->m_prefsDb));
+	else
+		PMLOG_TRACE("wal checkpoint: %d of %d frames", checkpointed, walFrames);
+
+	return FALSE;
 }
 
 void PrefsDb::openPrefsDb()
@@ -466,6 +1008,10 @@ void PrefsDb::openPrefsDb()
 		return;
 	}
 
+	//statements belong to the connection they were prepared on
+	finalizeCachedStatements();
+	invalidateCache();
+
 	gchar* prefsDirPath = g_path_get_dirname(m_dbFilename.c_str());
 	g_mkdir_with_parents(prefsDirPath, 0755);
 	g_free(prefsDirPath);
@@ -476,9 +1022,12 @@ void PrefsDb::openPrefsDb()
 		return;
 	}
 
+	applyConnectionPragmas();
+
 	if (!checkTableConsistency()) {
 
 		qWarning() << "Failed to create Preferences table";
+		finalizeCachedStatements();
 		sqlite3_close(m_prefsDb);
 		m_prefsDb = 0;
 		return;
@@ -490,10 +1039,21 @@ void PrefsDb::openPrefsDb()
 					   " value TEXT);", NULL, NULL, NULL);
 	if (ret) {
 		qWarning() << "Failed to create Preferences table";
+		finalizeCachedStatements();
 		sqlite3_close(m_prefsDb);
 		m_prefsDb = 0;
 		return;
 	}
+
+	if (!m_standalone && !createJournal())
+		qWarning() << "Failed to create the preferences change journal; backups will all be full ones";
+
+	//until shutdown() says otherwise, the next open assumes this run crashed
+	if (!m_standalone)
+		(void) g_file_set_contents((m_dbFilename + s_openMarkerSuffix).c_str(), "", 0, NULL);
+
+	//the table is consistent and all defaults are in; from here on reads are served from memory
+	loadCache();
 }
 
 void PrefsDb::closePrefsDb()
@@ -501,6 +1061,10 @@ void PrefsDb::closePrefsDb()
 	if (!m_prefsDb)
 		return;
 
+	//closing the last connection checkpoints the wal into the db file anyway
+	cancelCheckpoint();
+	finalizeCachedStatements();
+	invalidateCache();
 	(void) sqlite3_close(m_prefsDb);
 	m_prefsDb = 0;
 }
@@ -515,7 +1079,7 @@ bool PrefsDb::checkTableConsistency()
 	sqlite3_stmt* statement = 0;
 	const char* tail = 0;
 
-	if (!integrityCheckDb())
+	if (!integrityCheckDb(needsFullIntegrityCheck()))
 	{
 		qCritical("integrity check failed on prefs db and it cannot be recreated");
 		return false;
@@ -553,6 +1117,8 @@ bool PrefsDb::checkTableConsistency()
 
 Recreate:
 
+	//generations recorded against the old table mean nothing now
+	(void) sqlite3_exec(m_prefsDb, "DROP TABLE IF EXISTS PrefsJournal", NULL, NULL, NULL);
 	(void) sqlite3_exec(m_prefsDb, "DROP TABLE Preferences", NULL, NULL, NULL);
 	ret = sqlite3_exec(m_prefsDb,
 					   "CREATE TABLE Preferences "
@@ -580,35 +1146,112 @@ Recreate:
 	return true;
 }
 
-bool PrefsDb::integrityCheckDb()
+bool PrefsDb::needsFullIntegrityCheck()
 {
-	if (!m_prefsDb)
+	if (m_forceFullCheck || Settings::settings()->m_prefsDbIntegrityCheck == "full")
+		return true;
+	if (m_standalone)
 		return false;
 
+	struct stat stBuf;
+	if (stat((m_dbFilename + s_openMarkerSuffix).c_str(), &stBuf) == 0) {
+		qWarning("prefs db wasn't closed cleanly last time; running a full integrity check");
+		return true;
+	}
+
+	int days = Settings::settings()->m_prefsDbFullCheckInterval;
+	if (days <= 0)
+		return false;
+	if (stat((m_dbFilename + s_fullCheckStampSuffix).c_str(), &stBuf) != 0)
+		return true;
+
+	//a stamp from the future means the clock was reset; don't trust it either
+	time_t now = time(NULL);
+	return (stBuf.st_mtime > now || now - stBuf.st_mtime >= (time_t) days * 24 * 60 * 60);
+}
+
+bool PrefsDb::runIntegrityCheck(bool full, std::string& r_result)
+{
 	sqlite3_stmt* statement = 0;
 	const char* tail = 0;
 	int ret = 0;
 	bool integrityOk = false;
+	const char* pragma = full ? "PRAGMA integrity_check" : "PRAGMA quick_check";
 
-	ret = sqlite3_prepare(m_prefsDb, "PRAGMA integrity_check", -1, &statement, &tail);
+	r_result.clear();
+	ret = sqlite3_prepare(m_prefsDb, pragma, -1, &statement, &tail);
 	if (ret) {
-		qCritical() << "Failed to prepare sql statement for integrity_check";
-		goto CorruptDb;
+		qCritical() << "Failed to prepare sql statement for" << pragma;
+		r_result = sqlite3_errmsg(m_prefsDb);
+		return false;
 	}
 
 	ret = sqlite3_step(statement);
 	if (ret == SQLITE_ROW) {
 		const unsigned char* result = sqlite3_column_text(statement, 0);
-		if (result && strcasecmp((const char*) result, "ok") == 0)
-			integrityOk = true;
+		if (result) {
+			r_result = (const char*) result;
+			integrityOk = (strcasecmp((const char*) result, "ok") == 0);
+		}
+	}
+	else {
+		r_result = sqlite3_errmsg(m_prefsDb);
 	}
 
 	sqlite3_finalize(statement);
 
-	if (!integrityOk)
+	if (integrityOk && full && !m_standalone)
+		(void) g_file_set_contents((m_dbFilename + s_fullCheckStampSuffix).c_str(), "", 0, NULL);
+
+	return integrityOk;
+}
+
+bool PrefsDb::checkIntegrity(bool full, std::string& r_result)
+{
+	if (!m_prefsDb) {
+		r_result = "not open";
+		return false;
+	}
+
+	if (runIntegrityCheck(full, r_result)) {
+		qDebug("%s check for database passed", (full ? "Integrity" : "Quick"));
+		return true;
+	}
+
+	qCritical("%s check failed on the open prefs db: %s", (full ? "integrity" : "quick"), r_result.c_str());
+
+	//the same as failing it when opening: reopen, which recreates it
+	if (m_mergeInSteps)
+		finishMergeInSteps(false);
+	m_forceFullCheck = true;
+	closePrefsDb();
+	openPrefsDb();
+	m_forceFullCheck = false;
+	return false;
+}
+
+void PrefsDb::shutdown()
+{
+	if (m_mergeInSteps)
+		finishMergeInSteps(false);
+	closePrefsDb();
+	if (!m_standalone)
+		(void) unlink((m_dbFilename + s_openMarkerSuffix).c_str());
+}
+
+bool PrefsDb::integrityCheckDb(bool full)
+{
+	StartupProfile::Phase phase(full ? "integrityCheckDb" : "quickCheckDb");
+
+	if (!m_prefsDb)
+		return false;
+
+	std::string result;
+	int ret = 0;
+	if (!runIntegrityCheck(full, result))
 		goto CorruptDb;
 
-	qDebug("Integrity check for database passed");
+	qDebug("%s check for database passed", (full ? "Integrity" : "Quick"));
 
 	return true;
 
@@ -616,8 +1259,13 @@ CorruptDb:
 
 	qCritical() << "integrity check failed. recreating database";
 
+	cancelCheckpoint();
+	finalizeCachedStatements();
 	sqlite3_close(m_prefsDb);
 	unlink(m_dbFilename.c_str());
+	//a leftover wal would be replayed over the fresh db
+	unlink((m_dbFilename + "-wal").c_str());
+	unlink((m_dbFilename + "-shm").c_str());
 
 	ret = sqlite3_open_v2 (m_dbFilename.c_str(), &m_prefsDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
 	if (ret) {
@@ -625,30 +1273,22 @@ CorruptDb:
 		return false;
 	}
 
+	applyConnectionPragmas();
+
 	return true;
 }
 
 void PrefsDb::synchronizeDefaults() {
+	StartupProfile::Phase phase("synchronizeDefaults");
 
-	char* jsonStr = Utils::readFile(s_defaultPrefsFile);
-	if (!jsonStr) {
-		qWarning() << "Failed to load default prefs file:" << s_defaultPrefsFile;
-		return;
-	}
-
-	json_object* root = 0;
-	json_object* label = 0;
-	int ret;
-	gchar* queryStr;
-
-	root = json_tokener_parse(jsonStr);
+	json_object* root = ConfigFileCache::instance()->json(s_defaultPrefsFile);
 	if (!root) {
-		delete [] jsonStr;
-		qWarning() << "Failed to parse file contents into json";
+		qWarning() << "Failed to load/parse default prefs file:" << s_defaultPrefsFile;
 		return;
 	}
 
-	delete [] jsonStr;
+	json_object* label = 0;
+	std::map<std::string, std::string> missingPrefs;
 
 	label = json_object_object_get(root, "preferences");
 	if (!label || !json_object_is_type(label, json_type_object)) {
@@ -670,47 +1310,29 @@ void PrefsDb::synchronizeDefaults() {
 			std::string cv = getPref(key);
 
 			if ((cv.length() == 0) || ((strncmp(key,".sysservice",11) == 0))) {		//allow special keys to be overriden
-				queryStr = g_strdup_printf("INSERT INTO Preferences "
-						"VALUES ('%s', '%s')",
-						key, json_object_to_json_string(val));
-				if (!queryStr) {
-					qWarning() << "PrefsDb::synchronizeDefaults(): Failed to allocate query string for key:" << key;
-					continue;
-				}
-
-				ret = sqlite3_exec(m_prefsDb, queryStr, NULL, NULL, NULL);
-				g_free(queryStr);
-
-				if (ret) {
-					qWarning() << "Failed to execute query for key:" << key;
-					continue;
-				}
+				missingPrefs[key] = p_cDbv;
 			}
 		}
 	}
 
+	if (!setPrefs(missingPrefs)) {
+		qWarning() << "Failed to write" << missingPrefs.size() << "default prefs";
+	}
+
 	json_object_put(root);
 
 }
 
 void PrefsDb::synchronizePlatformDefaults() {
 
-	char* jsonStr = Utils::readFile(s_defaultPlatformPrefsFile);
-	if (!jsonStr) {
-		qWarning() << "Failed to load default platform prefs file:" << s_defaultPlatformPrefsFile;
+	json_object* root = ConfigFileCache::instance()->json(s_defaultPlatformPrefsFile);
+	if (!root) {
+		qWarning() << "Failed to load/parse default platform prefs file:" << s_defaultPlatformPrefsFile;
 		return;
 	}
 
-	json_object* root = 0;
 	json_object* label = 0;
-	int ret;
-	gchar* queryStr;
-
-	root = json_tokener_parse(jsonStr);
-	if (!root) {
-		qWarning() << "Failed to parse file contents into json";
-		return;
-	}
+	std::map<std::string, std::string> missingPrefs;
 
 	label = json_object_object_get(root, "preferences");
 	if (!label || !json_object_is_type(label, json_type_object)) {
@@ -731,25 +1353,15 @@ void PrefsDb::synchronizePlatformDefaults() {
 			std::string cv = getPref(key);
 
 			if (cv.length() == 0) {
-				queryStr = g_strdup_printf("INSERT INTO Preferences "
-						"VALUES ('%s', '%s')",
-						key, json_object_to_json_string(val));
-				if (!queryStr) {
-					qWarning() << "Failed to allocate query string for key:" << key;
-					continue;
-				}
-
-				ret = sqlite3_exec(m_prefsDb, queryStr, NULL, NULL, NULL);
-				g_free(queryStr);
-
-				if (ret) {
-					qWarning() << "Failed to execute query for key:" << key;
-					continue;
-				}
+				missingPrefs[key] = p_cDbv;
 			}
 		}
 	}
 
+	if (!setPrefs(missingPrefs)) {
+		qWarning() << "Failed to write" << missingPrefs.size() << "default platform prefs";
+	}
+
 	json_object_put(root);
 
 }
@@ -822,8 +1434,7 @@ void PrefsDb::updateWithCustomizationPrefOverrides()
 
 	json_object* root = 0;
 	json_object* label = 0;
-	int ret;
-	gchar* queryStr;
+	std::map<std::string, std::string> overridePrefs;
 
 	root = json_tokener_parse(jsonStr);
 	if (!root) {
@@ -847,24 +1458,18 @@ void PrefsDb::updateWithCustomizationPrefOverrides()
 			if (val == NULL)
 				continue;		//TODO: really should delete this key if it is in the database
 
-			queryStr = g_strdup_printf("INSERT INTO Preferences "
-					"VALUES ('%s', '%s')",
-					key, json_object_to_json_string(val));
-			if (!queryStr) {
-				qWarning() << "Failed to allocate query string for key:" << key;
+			const char * p_cDbv = json_object_to_json_string(val);
+			if (p_cDbv == NULL)
 				continue;
-			}
 
-			ret = sqlite3_exec(m_prefsDb, queryStr, NULL, NULL, NULL);
-			g_free(queryStr);
-
-			if (ret) {
-				qWarning() << "Failed to execute query for key:" << key;
-				continue;
-			}
+			overridePrefs[key] = p_cDbv;
 		}
 	}
 
+	if (!setPrefs(overridePrefs)) {
+		qWarning() << "Failed to write" << overridePrefs.size() << "customization override prefs";
+	}
+
 	json_object_put(root);
 }
 
@@ -874,12 +1479,12 @@ static const char* s_DBNEWTOKEN[] = {".prefsdb.setting.dbReset","\"1\""};
 
 void PrefsDb::loadDefaultPrefs()
 {
-	char* jsonStr = Utils::readFile(s_defaultPrefsFile);
-	if (!jsonStr) {
+	if (!ConfigFileCache::instance()->readable(s_defaultPrefsFile)) {
 		qWarning() << "Failed to load default prefs file:" << s_defaultPrefsFile;
 		return;
 	}
 
+	char* jsonStr = 0;
 	json_object* root = 0;
 	json_object* label = 0;
 	std::string ccurl;
@@ -888,7 +1493,7 @@ void PrefsDb::loadDefaultPrefs()
 	gchar* queryStr;
 	const char * p_cDbv;
 
-	root = json_tokener_parse(jsonStr);
+	root = ConfigFileCache::instance()->json(s_defaultPrefsFile);
 	if (!root) {
 		qWarning() << "Failed to parse preferences file contents into json";
 		goto Stage1a;
@@ -1047,25 +1652,18 @@ Done:
 
 void PrefsDb::loadDefaultPlatformPrefs()
 {
-	char* jsonStr = Utils::readFile(s_defaultPlatformPrefsFile);
-	if (!jsonStr) {
-		qWarning() << "Failed to load platform default prefs file:" << s_defaultPlatformPrefsFile;
+	json_object* root = ConfigFileCache::instance()->json(s_defaultPlatformPrefsFile);
+	if (!root) {
+		qWarning() << "Failed to load/parse platform default prefs file:" << s_defaultPlatformPrefsFile;
 		return;
 	}
 
-	json_object* root = 0;
 	json_object* label = 0;
 	std::string ccurl;
 	std::string ccstring;
 	int ret;
 	gchar* queryStr;
 
-	root = json_tokener_parse(jsonStr);
-	if (!root) {
-		qWarning() << "Failed to parse preferences file contents into json";
-		goto Done;
-	}
-
 	label = json_object_object_get(root, "preferences");
 	if (!label || !json_object_is_type(label, json_type_object)) {
 		qWarning() << "Failed to get valid preferences entry from file";
@@ -1098,10 +1696,6 @@ Done:
 	if (root)
 		json_object_put(root);
 
-	if (jsonStr) {
-		delete [] jsonStr;
-	}
-
 	//back up the defaults for certain prefs
 	backupDefaultPrefs();
 	//refresh system restore
@@ -28,11 +28,16 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
 #include <glib.h>
 #include "PrefsFactory.h"
 
 #include "LocalePrefsHandler.h"
 #include "Logging.h"
+#include "NetworkConnectionListener.h"
 #include "PrefsDb.h"
 #include "PrefsHandler.h"
 #include "TimePrefsHandler.h"
@@ -42,17 +47,64 @@
 
 #include "UrlRep.h"
 #include "JSONUtils.h"
+#include "ServiceStats.h"
+#include "SystemRestore.h"
+#include "StartupProfile.h"
 
 static const char* s_logChannel = "PrefsFactory";
 
 static PrefsFactory* s_instance = 0;
 
+const char* PrefsFactory::s_valuesSubscriptionPrefix = "values:";
+
+namespace {
+
+// a key from a setPreferences payload that passed its handler's validation; the pointers are owned by
+// the request's root json object and the handler map
+struct ValidatedPref
+{
+	ValidatedPref(const char* k, json_object* v, PrefsHandler* h)
+		: key(k), val(v), handler(h) {}
+
+	const char* key;
+	json_object* val;
+	PrefsHandler* handler;
+};
+
+struct DispatchKeyLess
+{
+	template <typename Entry>
+	bool operator()(const Entry& entry, const char* key) const
+	{ return strcmp(entry.key.c_str(), key) < 0; }
+};
+
+// a serialized json object with "returnValue":true added at the end
+std::string withReturnValue(const std::string& object, bool subscribed = false)
+{
+	JsonReplyBuilder reply(object.size() + 40);
+	if (!reply.putMembers(object))
+		return std::string("{\"returnValue\":false}");
+
+	if (subscribed)
+		reply.put("subscribed", true);
+	reply.put("returnValue", true);
+	return reply.str();
+}
+
+}
+
 static bool cbSetPreferences(LSHandle* lsHandle, LSMessage* message,
 							 void* user_data);
 static bool cbGetPreferences(LSHandle* lsHandle, LSMessage* message,
 							 void* user_data);
 static bool cbGetPreferenceValues(LSHandle* lsHandle, LSMessage* message,
 								  void* user_data);
+static bool cbGetServiceStats(LSHandle* lsHandle, LSMessage* message,
+							  void* user_data);
+static bool cbGetStartupProfile(LSHandle* lsHandle, LSMessage* message,
+							  void* user_data);
+static bool cbCheckPrefsDb(LSHandle* lsHandle, LSMessage* message,
+							  void* user_data);
 
 /*!
  * \page com_palm_systemservice Service API com.palm.systemservice/
@@ -61,6 +113,9 @@ static bool cbGetPreferenceValues(LSHandle* lsHandle, LSMessage* message,
  * - \ref com_palm_systemservice_set_preferences
  * - \ref com_palm_systemservice_get_preferences
  * - \ref com_palm_systemservice_get_preference_values
+ *
+ * Private methods:
+ * - \ref com_palm_systemservice_get_service_stats
  */
 
 static LSMethod s_methods[] = {
@@ -70,6 +125,13 @@ static LSMethod s_methods[] = {
 	{ 0, 0 }
 };
 
+static LSMethod s_privateMethods[] = {
+	{ "getServiceStats", cbGetServiceStats },
+	{ "getStartupProfile", cbGetStartupProfile },
+	{ "checkPrefsDb", cbCheckPrefsDb },
+	{ 0, 0 }
+};
+
 PrefsFactory* PrefsFactory::instance()
 {
 	if (!s_instance)
@@ -80,6 +142,11 @@ PrefsFactory* PrefsFactory::instance()
 
 PrefsFactory::PrefsFactory()
 	: m_service(0)
+	, m_serviceHandlePublic(0)
+	, m_serviceHandlePrivate(0)
+	, m_flushSource(0)
+	, m_dispatchFrozen(false)
+	, m_dispatchMisses(0)
 {
 	s_instance = this;
 	(void) PrefsDb::instance();
@@ -87,6 +154,8 @@ PrefsFactory::PrefsFactory()
 
 PrefsFactory::~PrefsFactory()
 {
+	if (m_flushSource)
+		g_source_remove(m_flushSource);
 	s_instance = 0;
 }
 
@@ -98,7 +167,7 @@ void PrefsFactory::setServiceHandle(LSPalmService* service)
 	LSError lsError;
 	LSErrorInit(&lsError);
 
-	result = LSPalmServiceRegisterCategory( m_service, "/", s_methods, NULL,
+	result = LSPalmServiceRegisterCategory( m_service, "/", s_methods, s_privateMethods,
 			NULL, this, &lsError);
 	if (!result) {
 		//luna_critical(s_logChannel, "Failed to register methods: %s", lsError.message);
@@ -110,12 +179,36 @@ void PrefsFactory::setServiceHandle(LSPalmService* service)
 	m_serviceHandlePublic = LSPalmServiceGetPublicConnection(m_service);
 	m_serviceHandlePrivate = LSPalmServiceGetPrivateConnection(m_service);
 
+	//clients going away take their getPreferences subscriptions with them
+	if (!LSSubscriptionSetCancelFunction(m_serviceHandlePublic, cbSubscriptionCancel, this, &lsError))
+		LSErrorFree(&lsError);
+	LSErrorInit(&lsError);
+	if (!LSSubscriptionSetCancelFunction(m_serviceHandlePrivate, cbSubscriptionCancel, this, &lsError))
+		LSErrorFree(&lsError);
+
 	// Now we can create all the prefs handlers
-	registerPrefHandler(new LocalePrefsHandler(service));
-	registerPrefHandler(new TimePrefsHandler(service));
-	registerPrefHandler(new WallpaperPrefsHandler(service));
-	registerPrefHandler(new BuildInfoHandler(service));
-	registerPrefHandler(new RingtonePrefsHandler(service));
+	{
+		StartupProfile::Phase phase("LocalePrefsHandler");
+		registerPrefHandler(new LocalePrefsHandler(service));
+	}
+	{
+		StartupProfile::Phase phase("TimePrefsHandler");
+		registerPrefHandler(new TimePrefsHandler(service));
+	}
+	{
+		StartupProfile::Phase phase("WallpaperPrefsHandler");
+		registerPrefHandler(new WallpaperPrefsHandler(service));
+	}
+	{
+		StartupProfile::Phase phase("BuildInfoHandler");
+		registerPrefHandler(new BuildInfoHandler(service));
+	}
+	{
+		StartupProfile::Phase phase("RingtonePrefsHandler");
+		registerPrefHandler(new RingtonePrefsHandler(service));
+	}
+
+	m_dispatchFrozen = true;
 }
 
 LSPalmService* PrefsFactory::serviceHandle() const
@@ -125,11 +218,22 @@ LSPalmService* PrefsFactory::serviceHandle() const
 
 PrefsHandler* PrefsFactory::getPrefsHandler(const std::string& key) const
 {
-	PrefsHandlerMap::const_iterator it = m_handlersMaps.find(key);
-	if (it == m_handlersMaps.end())
+	return getPrefsHandler(key.c_str());
+}
+
+PrefsHandler* PrefsFactory::getPrefsHandler(const char* key) const
+{
+	if (!key)
 		return 0;
 
-	return (*it).second;
+	DispatchTable::const_iterator it = std::lower_bound(m_dispatchTable.begin(), m_dispatchTable.end(), key, DispatchKeyLess());
+	if (it == m_dispatchTable.end() || strcmp(it->key.c_str(), key) != 0) {
+		++m_dispatchMisses;
+		return 0;
+	}
+
+	++it->hits;
+	return it->handler;
 }
 
 void PrefsFactory::registerPrefHandler(PrefsHandler* handler)
@@ -137,60 +241,133 @@ void PrefsFactory::registerPrefHandler(PrefsHandler* handler)
 	if (!handler)
 		return;
 
+	if (m_dispatchFrozen) {
+		qWarning() << "handler registered after the dispatch table was frozen; ignoring it";
+		return;
+	}
+
 	std::list<std::string> keys = handler->keys();
-	for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
-		m_handlersMaps[*it] = handler;
+	for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+		DispatchTable::iterator pos = std::lower_bound(m_dispatchTable.begin(), m_dispatchTable.end(), it->c_str(), DispatchKeyLess());
+		if (pos != m_dispatchTable.end() && pos->key == *it) {
+			//last registration wins, same as it always has
+			pos->handler = handler;
+			continue;
+		}
+
+		DispatchEntry entry;
+		entry.key = *it;
+		entry.handler = handler;
+		entry.hits = 0;
+		m_dispatchTable.insert(pos, entry);
+	}
+}
+
+json_object* PrefsFactory::dispatchStats() const
+{
+	json_object* handlers = json_object_new_array();
+	std::map<PrefsHandler*, json_object*> byHandler;
+	std::map<PrefsHandler*, unsigned long> hitsByHandler;
+
+	for (DispatchTable::const_iterator it = m_dispatchTable.begin(); it != m_dispatchTable.end(); ++it) {
+		json_object*& keys = byHandler[it->handler];
+		if (!keys)
+			keys = json_object_new_array();
+		json_object_array_add(keys, json_object_new_string(it->key.c_str()));
+		hitsByHandler[it->handler] += it->hits;
+	}
+
+	for (std::map<PrefsHandler*, json_object*>::const_iterator it = byHandler.begin(); it != byHandler.end(); ++it) {
+		json_object* entry = json_object_new_object();
+		json_object_object_add(entry, "keys", it->second);
+		json_object_object_add(entry, "hits", json_object_new_int((int) hitsByHandler[it->first]));
+		json_object_array_add(handlers, entry);
+	}
+
+	json_object* stats = json_object_new_object();
+	json_object_object_add(stats, "handlers", handlers);
+	json_object_object_add(stats, "misses", json_object_new_int((int) m_dispatchMisses));
+	return stats;
 }
 
 void PrefsFactory::postPrefChange(const std::string& keyStr,const std::string& valueStr)
 {
-	LSSubscriptionIter *iter=NULL;
+	//a later change to the same key replaces the queued value; subscribers only care about the latest
+	m_pendingPrefChanges[keyStr] = valueStr;
+
+	if (!m_flushSource)
+		m_flushSource = g_idle_add_full(G_PRIORITY_HIGH_IDLE, cbFlushPrefChanges, this, NULL);
+}
+
+gboolean PrefsFactory::cbFlushPrefChanges(gpointer data)
+{
+	PrefsFactory* pThis = static_cast<PrefsFactory*>(data);
+	pThis->m_flushSource = 0;
+	pThis->flushPrefChanges();
+	return FALSE;
+}
+
+void PrefsFactory::flushPrefChanges()
+{
+	if (m_pendingPrefChanges.empty())
+		return;
+
+	//anything posted while replying goes into the next batch
+	std::map<std::string,std::string> changes;
+	changes.swap(m_pendingPrefChanges);
+
 	LSError lserror;
-	LSHandle * lsHandle;
+	//a subscriber watching several of these keys gets them all in one reply
+	std::map<PrefsSubscriptions::Subscriber*,JsonReplyBuilder> merged;
+	unsigned int perKeyReplies = 0;
 
-	LSErrorInit(&lserror);
+	for (std::map<std::string,std::string>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+	{
+		const PrefsSubscriptions::SubscriberSet* subscribers = m_subscriptions.subscribers(it->first);
+		if (!subscribers)
+			continue;
 
-	std::string reply = std::string("{ \"")+keyStr+std::string("\":")+valueStr+std::string("}");
-	// Find out which handle this subscription needs to go to
-	bool retVal = LSSubscriptionAcquire(m_serviceHandlePublic, keyStr.c_str(), &iter, &lserror);
-	if (retVal) {
-		lsHandle = m_serviceHandlePublic;
-		while (LSSubscriptionHasNext(iter)) {
+		std::string perKeyReply;
 
-			LSMessage *message = LSSubscriptionNext(iter);
-			if (!LSMessageReply(lsHandle,message,reply.c_str(),&lserror)) {
-				LSErrorPrint(&lserror,stderr);
-				LSErrorFree(&lserror);
+		for (PrefsSubscriptions::SubscriberSet::const_iterator sub = subscribers->begin(); sub != subscribers->end(); ++sub)
+		{
+			PrefsSubscriptions::Subscriber* subscriber = *sub;
+
+			//subscribers that asked for one reply per key get the old payload right away
+			if (subscriber->delivery == PrefsSubscriptions::PerKey) {
+				if (perKeyReply.empty())
+					perKeyReply = JsonReplyBuilder(it->first.size() + it->second.size() + 8).putRaw(it->first,it->second).str();
+				++perKeyReplies;
+				LSErrorInit(&lserror);
+				if (!LSMessageReply(subscriber->handle,subscriber->message,perKeyReply.c_str(),&lserror)) {
+					LSErrorPrint(&lserror,stderr);
+					LSErrorFree(&lserror);
+				}
+				continue;
 			}
-		}
 
-		LSSubscriptionRelease(iter);
-	}
-	else {
-		LSErrorFree(&lserror);
+			merged[subscriber].putRaw(it->first,it->second);
+		}
 	}
 
-	LSErrorInit(&lserror);
-	iter=NULL;
-	retVal = LSSubscriptionAcquire(m_serviceHandlePrivate, keyStr.c_str(), &iter, &lserror);
-	if (retVal) {
-		lsHandle = m_serviceHandlePrivate;
-		while (LSSubscriptionHasNext(iter)) {
+	for (std::map<PrefsSubscriptions::Subscriber*,JsonReplyBuilder>::iterator it = merged.begin(); it != merged.end(); ++it)
+	{
+		PrefsSubscriptions::Subscriber* subscriber = it->first;
 
-			LSMessage *message = LSSubscriptionNext(iter);
-			if (!LSMessageReply(lsHandle,message,reply.c_str(),&lserror)) {
-				LSErrorPrint(&lserror,stderr);
-				LSErrorFree(&lserror);
-			}
+		LSErrorInit(&lserror);
+		if (!LSMessageReply(subscriber->handle,subscriber->message,it->second.c_str(),&lserror)) {
+			LSErrorPrint(&lserror,stderr);
+			LSErrorFree(&lserror);
 		}
-
-		LSSubscriptionRelease(iter);
-	}
-	else {
-		LSErrorFree(&lserror);
 	}
 
+	ServiceStats::instance()->recordFanout(merged.size() + perKeyReplies);
+}
 
+bool PrefsFactory::cbSubscriptionCancel(LSHandle* lsHandle, LSMessage* message, void* user_data)
+{
+	static_cast<PrefsFactory*>(user_data)->m_subscriptions.remove(message);
+	return true;
 }
 
 void PrefsFactory::postPrefChangeValueIsCompleteString(const std::string& keyStr,const std::string& json_string)
@@ -252,46 +429,134 @@ void PrefsFactory::postPrefChangeValueIsCompleteString(const std::string& keyStr
 
 void PrefsFactory::refreshAllKeys()
 {
-
 	//get all the keys from the db
+	refreshKeys(PrefsDb::instance()->getAllPrefs());
+}
+
+void PrefsFactory::refreshChangedKeys(const std::map<std::string,std::string>& snapshot)
+{
 	std::map<std::string,std::string> allPrefs = PrefsDb::instance()->getAllPrefs();
+	std::map<std::string,std::string> changed;
 
+	//both are sorted by key, so walk them side by side
+	std::map<std::string,std::string>::const_iterator old = snapshot.begin();
 	for (std::map<std::string,std::string>::const_iterator it = allPrefs.begin();
 			it != allPrefs.end(); ++it)
 	{
-		//iterate over all the keys in the database
-		std::string key = it->first;
-		std::string val = it->second;
-		json_object* json = json_object_new_object();
-		PrefsHandler* handler = PrefsFactory::instance()->getPrefsHandler(key);
-		// Inform the handler about the change
+		while (old != snapshot.end() && old->first < it->first)
+			++old;
+
+		if (old == snapshot.end() || old->first != it->first || old->second != it->second)
+			changed.insert(changed.end(), *it);
+	}
+
+	qDebug("refreshing %zu of %zu keys", changed.size(), allPrefs.size());
+	refreshKeys(changed);
+}
+
+void PrefsFactory::refreshKeys(const std::map<std::string,std::string>& keyValues)
+{
+	//the whole db may have been swapped out from under the handlers
+	invalidatePrefConsistency(0);
+
+	std::map<PrefsHandler*, std::map<std::string,std::string> > byHandler;
+
+	for (std::map<std::string,std::string>::const_iterator it = keyValues.begin();
+			it != keyValues.end(); ++it)
+	{
+		PrefsHandler* handler = getPrefsHandler(it->first);
 		if (handler)
-		{
-			handler->valueChanged(key, val);
-		}
+			byHandler[handler].insert(*it);
 
 		//post change about it
-		postPrefChange(key,val);
-		json_object_put(json);
+		postPrefChange(it->first,it->second);
+	}
+
+	// Inform the handlers about the change
+	for (std::map<PrefsHandler*, std::map<std::string,std::string> >::const_iterator it = byHandler.begin();
+			it != byHandler.end(); ++it)
+	{
+		it->first->valuesChanged(it->second);
+	}
+}
+
+bool PrefsFactory::isPrefConsistent(PrefsHandler* handler)
+{
+	if (!handler)
+		return true;
+
+	if (m_consistentHandlers.find(handler) != m_consistentHandlers.end())
+		return true;
+
+	if (!handler->isPrefConsistent())
+		return false;
+
+	m_consistentHandlers.insert(handler);
+	return true;
+}
+
+void PrefsFactory::invalidatePrefConsistency(PrefsHandler* handler)
+{
+	if (handler)
+		m_consistentHandlers.erase(handler);
+	else
+		m_consistentHandlers.clear();
+}
+
+void PrefsFactory::recheckPrefConsistency(PrefsHandler* handler)
+{
+	invalidatePrefConsistency(handler);
+
+	//before the startup check has run, it does the restoring
+	if (!SystemRestore::isReady())
+		return;
+
+	for (DispatchTable::const_iterator it = m_dispatchTable.begin();it != m_dispatchTable.end();++it) {
+		if (it->handler != handler || isPrefConsistent(handler))
+			continue;
+
+		//the restore copies in the background; the key is set and posted once the file is in
+		qWarning() << "reports inconsistency with key [" << it->key.c_str() << "]. Restoring default...";
+		handler->restoreToDefault();
 	}
+}
 
+void PrefsFactory::postPrefValues(const std::string& key)
+{
+	PrefsHandler* handler = getPrefsHandler(key);
+	if (!handler)
+		return;
+
+	const std::string* serializedValues = handler->cachedValuesForKey(key);
+	if (serializedValues) {
+		postPrefChangeValueIsCompleteString(std::string(s_valuesSubscriptionPrefix)+key,withReturnValue(*serializedValues,true));
+		return;
+	}
+
+	json_object* values = handler->valuesForKey(key);
+	if (!values)
+		return;
+
+	postPrefChangeValueIsCompleteString(std::string(s_valuesSubscriptionPrefix)+key,
+										withReturnValue(json_object_to_json_string(values),true));
+	json_object_put(values);
 }
 
 void PrefsFactory::runConsistencyChecksOnAllHandlers()
 {
+	//this is the explicit (re)check, e.g. after the media partition comes back; don't trust earlier results
+	invalidatePrefConsistency(0);
+
 	//go through all the handlers
 
-	for (PrefsHandlerMap::iterator it = m_handlersMaps.begin();it != m_handlersMaps.end();++it) {
-		std::string key = it->first;
-		PrefsHandler * handler = it->second;
+	for (DispatchTable::const_iterator it = m_dispatchTable.begin();it != m_dispatchTable.end();++it) {
+		const std::string& key = it->key;
+		PrefsHandler * handler = it->handler;
 		if (handler) {
 			//run the verifier on this key to make sure the pref is correct
-			if (handler->isPrefConsistent() == false) {
+			if (isPrefConsistent(handler) == false) {
 				qWarning() << "reports inconsistency with key [" << key.c_str() << "]. Restoring default...";
-				handler->restoreToDefault();		//something is wrong with this...try and restore it
-				std::string restoreVal = PrefsDb::instance()->getPref(key);
-				qWarning() << "key [" << key.c_str() << "] restored to value [" << restoreVal.c_str() << "]";
-				PrefsFactory::instance()->postPrefChange(key,restoreVal);
+				handler->restoreToDefault();		//something is wrong with this...try and restore it (set and posted once the copy is in)
 			}
 		}
 	}
@@ -351,6 +616,11 @@ Example response for a failed call:
 static bool cbSetPreferences(LSHandle* lsHandle, LSMessage* message,
 							 void* user_data)
 {
+	if (SystemRestore::deferUntilReady(lsHandle, message, cbSetPreferences, user_data))
+		return true;
+
+	ServiceStats::MethodTimer methodTimer(ServiceStats::MethodSetPreferences);
+
 	json_object* root = 0;
 	bool result;
 	bool success = true;
@@ -386,56 +656,61 @@ static bool cbSetPreferences(LSHandle* lsHandle, LSMessage* message,
 	callerId = (LSMessageGetApplicationID(message) != 0 ? LSMessageGetApplicationID(message) : "" );
 
 	{
+		std::vector<ValidatedPref> validated;
+		std::map<std::string, std::string> keyValues;
+
 		json_object_object_foreach(root, key, val) {
 			// Is there a preferences handler for this?
 
-			bool savedPref = false;
-
 			PrefsHandler* handler = PrefsFactory::instance()->getPrefsHandler(key);
 
 			if (handler) {
 				PMLOG_TRACE("found handler for %s", key);
-				if (handler->validate(key, val, callerId)) {
- 					qDebug("handler validated value for key [%s]",key);
-					savedPref = PrefsDb::instance()->setPref(key, json_object_to_json_string(val));
+				bool validated;
+				{
+					ServiceStats::PhaseTimer handlerTimer(ServiceStats::PhaseHandler);
+					validated = handler->validate(key, val, callerId);
 				}
-				else {
+				if (!validated) {
 					qWarning() << "handler DID NOT validate value for key:" << key;
+					++errcount;
+					continue;
 				}
+				SYSSERVICE_DEBUG("handler validated value for key [%s]",key);
 			}
 			else {
-				qWarning() << "setPref did NOT find handler for:" << key;
-
-				//filter out
-				savedPref = PrefsDb::instance()->setPref(key, json_object_to_json_string(val));
+				SYSSERVICE_WARNING_RATELIMITED(10, "setPref did NOT find handler for: %s", key);
 			}
-			qDebug("setPref saved? %s",(savedPref ? "true" : "false"));
 
-			if (savedPref) {
-				++savecount;
-
-				// successfully set the preference. post a notification about it
+			validated.push_back(ValidatedPref(key, val, handler));
+			keyValues[key] = json_object_to_json_string(val);
+		}
 
-				json_object* json = 0;
+		// write everything that validated in one transaction, so a multi-key request costs one commit
+		bool savedPrefs = PrefsDb::instance()->setPrefs(keyValues);
+		SYSSERVICE_DEBUG("setPrefs saved %zu keys? %s", keyValues.size(), (savedPrefs ? "true" : "false"));
 
-				json = json_object_new_object();
-				json_object_object_add(json, (char*) key, json_object_get(val));
+		if (!savedPrefs) {
+			errcount += validated.size();
+		}
+		else {
+			for (std::vector<ValidatedPref>::const_iterator it = validated.begin(); it != validated.end(); ++it) {
+				++savecount;
+				ServiceStats::instance()->countKeyWrite(it->key);
 
-				std::string subKeyStr = std::string(key);
-				std::string subValStr = std::string(json_object_to_json_string(json));
+				// successfully set the preference. post a notification about it
 
-				PrefsFactory::instance()->postPrefChangeValueIsCompleteString(subKeyStr,subValStr);
+				PrefsFactory::instance()->postPrefChange(it->key,keyValues[it->key]);
 
 				// Inform the handler about the change
-				if (handler)
-					handler->valueChanged(key, val);
+				if (it->handler) {
+					ServiceStats::PhaseTimer handlerTimer(ServiceStats::PhaseHandler);
+					PrefsFactory::instance()->invalidatePrefConsistency(it->handler);
+					it->handler->valueChanged(it->key, it->val);
+				}
 
-				json_object_put(json);
 				success=true;
 			}
-			else {
-				++errcount;
-			}
 		}
 	}
 
@@ -445,19 +720,17 @@ static bool cbSetPreferences(LSHandle* lsHandle, LSMessage* message,
 	}
 
 Done:
-	json_object * result_object = json_object_new_object();
-	json_object_object_add(result_object,(char *)"returnValue",json_object_new_boolean(success));
+	JsonReplyBuilder reply;
+	reply.put("returnValue", success);
 	if (!success) {
-		json_object_object_add(result_object,(char *)"errorText",json_object_new_string((char*) errorText.c_str()));
+		reply.put("errorText", errorText);
 		qWarning() << errorText.c_str();
 	}
 
-	const char * r = json_object_to_json_string(result_object);
-	result = LSMessageReply(lsHandle, message, r, &lsError);
+	result = LSMessageReply(lsHandle, message, reply.c_str(), &lsError);
 	if (!result)
 		LSErrorFree (&lsError);
 
-	json_object_put(result_object);
 	if (root)
 		json_object_put(root);
 
@@ -478,13 +751,15 @@ Retrieves the values for keys specified in a passed array. If subscribe is set t
 \subsection com_palm_systemservice_get_preferences_syntax Syntax:
 \code
 {
-    "subscribe" : boolean,
-    "keys"      : string array
+    "subscribe"          : boolean,
+    "keys"               : string array,
+    "mergeNotifications" : boolean
 }
 \endcode
 
 \param subscribe If true, getPreferences sends an update whenever the value of one of the keys changes.
 \param keys An array of key names. Required.
+\param mergeNotifications Defaults to true, where keys changed together arrive in one update. If false, each changed key is sent as its own update.
 
 \subsection com_palm_systemservice_get_preferences_returns Returns:
 \code
@@ -530,119 +805,117 @@ Example response for a failed call:
 static bool cbGetPreferences(LSHandle* lsHandle, LSMessage* message,
 							 void* user_data)
 {
+	ServiceStats::MethodTimer methodTimer(ServiceStats::MethodGetPreferences);
+
     // {"subscribe": boolean, "keys": array}
-    VALIDATE_SCHEMA_AND_RETURN(lsHandle,
-                               message,
-                               SCHEMA_2(REQUIRED(keys, array),OPTIONAL(subscribe, boolean)));
+    VALIDATE_SCHEMA_PARSE_AND_RETURN(lsHandle,
+                                     message,
+                                     SCHEMA_3(REQUIRED(keys, array),OPTIONAL(subscribe, boolean),OPTIONAL(mergeNotifications, boolean)),
+                                     parser);
 
 	bool retVal;
 	LSError lsError;
 	const char* r = 0;
 	std::string reply;
-	json_object* root = 0;
-	json_object* label = 0;
-	json_object* replyRoot = 0;
-	array_list* keyArray = 0;
+	pbnjson::JValue root = parser.get();
+	pbnjson::JValue keyArray;
 	std::list<std::string> keyList;
+	std::list<std::string> invalidKeys;
 	std::map<std::string, std::string> resultMap;
 	bool subscription = false;
+	bool mergeNotifications = true;
 	bool success = false;
 	std::string errorCode;
 	PrefsHandler* handler=NULL;
 	std::string key;
-	std::string restoreVal;
 
-	const char* payload = LSMessageGetPayload(message);
-	if (!payload)
+	if (!LSMessageGetPayload(message))
 		return false;
 
 	LSErrorInit(&lsError);
 
-	root = json_tokener_parse(payload);
-	if (!root)
+	//the payload was parsed once already, for the schema
+	if (!root.isObject())
 		goto Done;
 
-	label = json_object_object_get(root, "subscribe");
-	if (label)
-		subscription = json_object_get_boolean(label);
+	if (root["subscribe"].isBoolean())
+		(void) root["subscribe"].asBool(subscription);
 
-	label = json_object_object_get(root, "keys");
-	if (!label) {
+	if (root["mergeNotifications"].isBoolean())
+		(void) root["mergeNotifications"].asBool(mergeNotifications);
+
+	if (!root.hasKey("keys")) {
 		errorCode = "no keys specified";
 		goto Done;
 	}
 
-	keyArray = json_object_get_array(label);
-	if (!keyArray) {
+	keyArray = root["keys"];
+	if (!keyArray.isArray()) {
 		errorCode = "no key array specified";
 		goto Done;
 	}
 
-	if (array_list_length(keyArray) <= 0) {
+	if (keyArray.arraySize() <= 0) {
 		errorCode = "invalid key array";
 		goto Done;
 	}
 
-	for (int i = 0; i < array_list_length(keyArray); i++) {
-		json_object* obj = (json_object*) array_list_get_idx(keyArray, i);
-		if (!obj)
+	for (ssize_t i = 0; i < keyArray.arraySize(); i++) {
+		if (!keyArray[i].isString())
 			continue;
-//		printf("getPrefs: [%s]",json_object_get_string(obj));
-		if (!json_object_is_type(obj,json_type_string))
+		if (keyArray[i].asString(key) != CONV_OK)
 			continue;
-		key = json_object_get_string(obj);
+		ServiceStats::instance()->countKeyRead(key);
 		handler = PrefsFactory::instance()->getPrefsHandler(key);
 		if (handler) {
-			//run the verifier on this key to make sure the pref is correct
-			if (handler->isPrefConsistent() == false) {
-				handler->restoreToDefault();		//something is wrong with this...try and restore it
-				restoreVal = PrefsDb::instance()->getPref(key);
-				PrefsFactory::instance()->postPrefChange(key,restoreVal);
+			ServiceStats::PhaseTimer handlerTimer(ServiceStats::PhaseHandler);
+			//run the verifier on this key to make sure the pref is correct (free unless something invalidated it).
+			//Until the startup check is done it is the one restoring the media files, so leave them to it
+			if (SystemRestore::isReady() && PrefsFactory::instance()->isPrefConsistent(handler) == false) {
+				//something is wrong with this...try and restore it; the reply carries the current value and
+				//subscribers hear about the default once its file is copied in
+				handler->restoreToDefault();
 			}
 		}
-		keyList.push_back(json_object_get_string(obj));
+		keyList.push_back(key);
 	}
 
-	resultMap = PrefsDb::instance()->getPrefs(keyList);
+	resultMap = PrefsDb::instance()->getJsonPrefs(keyList,invalidKeys);
 
-	if (LSMessageIsSubscription(message)) {
-
-		for (std::list<std::string>::const_iterator it = keyList.begin();
-			 it != keyList.end(); ++it) {
-			(void) LSSubscriptionAdd(lsHandle, (*it).c_str(),
-									 message, &lsError);
-		}
-		subscription = true;
-	}
+	if (LSMessageIsSubscription(message))
+		subscription = PrefsFactory::instance()->subscriptions().add(lsHandle, message, keyList,
+				mergeNotifications ? PrefsSubscriptions::Merged : PrefsSubscriptions::PerKey);
 	else
 		subscription = false;
 
-	replyRoot = json_object_new_object();
+	if (!invalidKeys.empty()) {
+		errorCode = std::string("invalid value encoded in preference (\"did you escape your strings?\")");
+		success=false;
+		goto Done;
+	}
 
-	for (std::map<std::string, std::string>::const_iterator it = resultMap.begin();
-		 it != resultMap.end(); ++it) {
-		json_object* value = json_tokener_parse((*it).second.c_str());
-		if (value) {
-			qDebug("resultMap: [%s] -> [---, length %zu]",(*it).first.c_str(),(*it).second.size());
-			json_object_object_add(replyRoot,
-					(char*) (*it).first.c_str(), value);
-		}
-		else {
-			errorCode = std::string("invalid value encoded in preference (\"did you escape your strings?\")");
-			success=false;
-			goto Done;
+	//the stored values are already serialized (and were checked to be json when written), so splice them in as-is
+	{
+		size_t replySize = 48;
+		for (std::map<std::string, std::string>::const_iterator it = resultMap.begin();
+			 it != resultMap.end(); ++it)
+			replySize += (*it).first.size() + (*it).second.size() + 4;
+
+		JsonReplyBuilder builder(replySize);
+		for (std::map<std::string, std::string>::const_iterator it = resultMap.begin();
+			 it != resultMap.end(); ++it) {
+			SYSSERVICE_DEBUG("resultMap: [%s] -> [---, length %zu]",(*it).first.c_str(),(*it).second.size());
+			builder.putRaw((*it).first,(*it).second);
 		}
+		builder.put("subscribed", subscription).put("returnValue", true);
+		reply = builder.str();
 	}
-	json_object_object_add(replyRoot,"subscribed",json_object_new_boolean(subscription));
-	json_object_object_add(replyRoot,"returnValue",json_object_new_boolean(true));
 	success = true;
 
 Done:
 
-	if (replyRoot && (success))
-		reply = json_object_to_json_string(replyRoot);
-	else {
-		reply = "{\"returnValue\":false,\"subscribed\":false , \"errorCode\":\""+errorCode+"\"}";
+	if (!success) {
+		reply = JsonReplyBuilder().put("returnValue", false).put("subscribed", false).put("errorCode", errorCode).str();
 		qWarning() << errorCode.c_str();
 	}
 
@@ -652,12 +925,6 @@ Done:
 	if (!retVal)
 		LSErrorFree (&lsError);
 
-	if (replyRoot)
-		json_object_put(replyRoot);
-
-	if (root)
-		json_object_put(root);
-
 	return true;
 }
 
@@ -675,21 +942,25 @@ Retrieve the list of valid values for the specified key. If the key is of a type
 \subsection com_palm_systemservice_get_preference_values_syntax Syntax:
 \code
 {
-    "key": string
+    "key": string,
+    "subscribe": boolean
 }
 \endcode
 
 \param key Key name.
+\param subscribe If true, the whole set is sent again whenever it changes (e.g. a wallpaper or ringtone file is added to or removed from the media partition).
 
 \subsection com_palm_systemservice_get_preference_value_returns Returns:
 \code
 {
     "[no name]"   : object,
+    "subscribed"  : boolean,
     "returnValue" : boolean
 }
 \endcode
 
 \param "[no name]" The key and the valid values.
+\param subscribed Present and true if updates will follow.
 \param returnValue Indicates if the call was succesful.
 
 \subsection com_palm_systemservice_get_preference_value_examples Examples:
@@ -730,46 +1001,66 @@ Example response for a failed call:
 static bool cbGetPreferenceValues(LSHandle* lsHandle, LSMessage* message,
 								  void* user_data)
 {
-	// {"key": string}
-	VALIDATE_SCHEMA_AND_RETURN(lsHandle,
+	ServiceStats::MethodTimer methodTimer(ServiceStats::MethodGetPreferenceValues);
+
+	// {"key": string, "subscribe": boolean}
+	VALIDATE_SCHEMA_PARSE_AND_RETURN(lsHandle,
 		message,
-		SCHEMA_1(REQUIRED(key, string)));
+		SCHEMA_2(REQUIRED(key, string),OPTIONAL(subscribe, boolean)),
+		parser);
 
 	bool retVal;
 	LSError lsError;
 	const char* reply = 0;
-	json_object* root = 0;
-	json_object* label = 0;
+	pbnjson::JValue root = parser.get();
 	json_object* replyRoot = 0;
 	PrefsHandler* handler = 0;
 	std::string key;
+	std::string serializedReply;
+	const std::string* serializedValues = 0;
 	bool success = false;
+	bool subscribed = false;
 
-	const char* payload = LSMessageGetPayload(message);
-	if (!payload)
+	if (!LSMessageGetPayload(message))
 		return false;
 
 	LSErrorInit(&lsError);
 
-	root = json_tokener_parse(payload);
-	if (!root)
-		goto Done;
-
-	label = json_object_object_get(root, "key");
-	if (!label)
+	if (!root.isObject() || !root["key"].isString())
 		goto Done;
-	key = json_object_get_string(label);
+	(void) root["key"].asString(key);
+	ServiceStats::instance()->countKeyRead(key);
 
 	handler = PrefsFactory::instance()->getPrefsHandler(key);
 	if (!handler)
 		goto Done;
 
-	replyRoot = handler->valuesForKey(key);
+	if (LSMessageIsSubscription(message)) {
+		std::string subscriptionKey = std::string(PrefsFactory::s_valuesSubscriptionPrefix)+key;
+		subscribed = LSSubscriptionAdd(lsHandle, subscriptionKey.c_str(), message, &lsError);
+		if (!subscribed)
+			LSErrorFree(&lsError);
+	}
+
+	{
+		ServiceStats::PhaseTimer handlerTimer(ServiceStats::PhaseHandler);
+		serializedValues = handler->cachedValuesForKey(key);
+		if (!serializedValues)
+			replyRoot = handler->valuesForKey(key);
+	}
+
+	if (serializedValues) {
+		serializedReply = withReturnValue(*serializedValues,subscribed);
+		reply = serializedReply.c_str();
+		success = true;
+		goto Done;
+	}
+
 	if (!replyRoot)
 		goto Done;
 
-	json_object_object_add(replyRoot,"returnValue",json_object_new_boolean(true));
-	reply = json_object_to_json_string(replyRoot);
+	serializedReply = withReturnValue(json_object_to_json_string(replyRoot),subscribed);
+	reply = serializedReply.c_str();
 	success = true;
 
 Done:
@@ -784,8 +1075,228 @@ Done:
 	if (replyRoot)
 		json_object_put(replyRoot);
 
-	if (root)
-		json_object_put(root);
+	return true;
+}
+
+/*!
+\page com_palm_systemservice
+\n
+\section com_palm_systemservice_get_service_stats getServiceStats
+
+\e Private.
+
+com.palm.systemservice/getServiceStats
+
+Returns the access statistics: per-method latency histograms with estimated p50/p90/p99 (the preferences
+methods, getTimeZoneRules, convertDate and com.palm.image ezResize), time spent in sqlite and in the
+handlers, per-key read/write counts, notification fan-out sizes, getPreferences subscribers per key, handler
+lookup counts, zoneinfo cache hits and decode times, and network connectivity changes (raw, settled,
+suppressed flaps and held off time syncs). Collection has to be turned on with "enabled=true" in the [Stats]
+section of sysservice.conf; the zoneinfo and network counters are cheap enough to be kept always.
+
+\subsection com_palm_systemservice_get_service_stats_syntax Syntax:
+\code
+{
+    "reset": boolean
+}
+\endcode
+
+\param reset If true, the counters are cleared after they are returned.
+
+\subsection com_palm_systemservice_get_service_stats_examples Examples:
+\code
+luna-send -n 1 -f luna://com.palm.systemservice/getServiceStats '{}'
+\endcode
+*/
+static bool cbGetServiceStats(LSHandle* lsHandle, LSMessage* message,
+							  void* user_data)
+{
+	// {"reset": boolean}
+	VALIDATE_SCHEMA_PARSE_AND_RETURN(lsHandle,
+		message,
+		SCHEMA_1(OPTIONAL(reset, boolean)),
+		parser);
+
+	LSError lsError;
+	pbnjson::JValue root = parser.get();
+	json_object* replyRoot = 0;
+	bool reset = false;
+
+	if (!LSMessageGetPayload(message))
+		return false;
+
+	LSErrorInit(&lsError);
+
+	//the payload was parsed once already, for the schema
+	if (root.isObject() && root["reset"].isBoolean())
+		(void) root["reset"].asBool(reset);
+
+	replyRoot = ServiceStats::instance()->toJson();
+	json_object_object_add(replyRoot, "dispatch", PrefsFactory::instance()->dispatchStats());
+	json_object_object_add(replyRoot, "subscriptions", PrefsFactory::instance()->subscriptions().toJson());
+	json_object_object_add(replyRoot, "network", NetworkConnectionListener::instance()->statsToJson());
+	json_object_object_add(replyRoot, "returnValue", json_object_new_boolean(true));
+
+	if (reset)
+		ServiceStats::instance()->reset();
+
+	if (!LSMessageReply(lsHandle, message, json_object_to_json_string(replyRoot), &lsError))
+		LSErrorFree (&lsError);
+
+	json_object_put(replyRoot);
+
+	return true;
+}
+
+/*!
+\page com_palm_systemservice
+\n
+\section com_palm_systemservice_get_startup_profile getStartupProfile
+
+\e Private.
+
+com.palm.systemservice/getStartupProfile
+
+Returns how long each startup step took, in microseconds since main() started. Nested steps have a higher
+depth than the step they are part of; a step still running has a duration of -1. "ready" is when the main
+loop started serving requests (-1 if it hasn't yet).
+
+\subsection com_palm_systemservice_get_startup_profile_syntax Syntax:
+\code
+{
+}
+\endcode
+
+\subsection com_palm_systemservice_get_startup_profile_returns Returns:
+\code
+{
+    "ready": int,
+    "now": int,
+    "phases": [ { "name": string, "depth": int, "start": int, "duration": int } ],
+    "returnValue": boolean
+}
+\endcode
+
+\subsection com_palm_systemservice_get_startup_profile_examples Examples:
+\code
+luna-send -n 1 -f luna://com.palm.systemservice/getStartupProfile '{}'
+\endcode
+
+Example response:
+\code
+{
+    "ready": 1874210,
+    "now": 93120544,
+    "phases": [
+        { "name": "settings", "depth": 0, "start": 112, "duration": 2310 },
+        { "name": "prefsDb", "depth": 0, "start": 2950, "duration": 181022 },
+        { "name": "integrityCheckDb", "depth": 1, "start": 3410, "duration": 120880 },
+        ...
+    ],
+    "returnValue": true
+}
+\endcode
+*/
+static bool cbGetStartupProfile(LSHandle* lsHandle, LSMessage* message,
+							  void* user_data)
+{
+	EMPTY_SCHEMA_RETURN(lsHandle,message);
+
+	LSError lsError;
+	LSErrorInit(&lsError);
+
+	json_object* replyRoot = StartupProfile::instance()->toJson();
+	json_object_object_add(replyRoot, "returnValue", json_object_new_boolean(true));
+
+	if (!LSMessageReply(lsHandle, message, json_object_to_json_string(replyRoot), &lsError))
+		LSErrorFree (&lsError);
+
+	json_object_put(replyRoot);
+	return true;
+}
+
+/*!
+\page com_palm_systemservice
+\n
+\section com_palm_systemservice_check_prefs_db checkPrefsDb
+
+\e Private.
+
+com.palm.systemservice/checkPrefsDb
+
+Runs an integrity check on the preferences database now. Opening the database only runs the quick check
+unless the last run didn't shut down cleanly or a full check is due (see [PrefsDb] in sysservice.conf). A
+database that fails is recreated from the defaults, the same as when that happens at startup, and every key
+is sent out to subscribers again.
+
+\subsection com_palm_systemservice_check_prefs_db_syntax Syntax:
+\code
+{
+    "full": boolean
+}
+\endcode
+
+\param full True for PRAGMA integrity_check, false (the default) for PRAGMA quick_check.
+
+\subsection com_palm_systemservice_check_prefs_db_returns Returns:
+\code
+{
+    "passed": boolean,
+    "result": string,
+    "returnValue": boolean
+}
+\endcode
+
+\param passed False if the database failed the check and was recreated.
+\param result The first line sqlite returned ("ok" when it passed).
+
+\subsection com_palm_systemservice_check_prefs_db_examples Examples:
+\code
+luna-send -n 1 -f luna://com.palm.systemservice/checkPrefsDb '{"full": true}'
+\endcode
+
+Example response:
+\code
+{
+    "passed": true,
+    "result": "ok",
+    "returnValue": true
+}
+\endcode
+*/
+static bool cbCheckPrefsDb(LSHandle* lsHandle, LSMessage* message,
+							  void* user_data)
+{
+	// {"full": boolean}
+	VALIDATE_SCHEMA_PARSE_AND_RETURN(lsHandle,
+		message,
+		SCHEMA_1(OPTIONAL(full, boolean)),
+		parser);
+
+	LSError lsError;
+	pbnjson::JValue root = parser.get();
+	bool full = false;
+	bool passed = false;
+	std::string result;
+
+	if (!LSMessageGetPayload(message))
+		return false;
+
+	LSErrorInit(&lsError);
+
+	//the payload was parsed once already, for the schema
+	if (root.isObject() && root["full"].isBoolean())
+		(void) root["full"].asBool(full);
+
+	passed = PrefsDb::instance()->checkIntegrity(full, result);
+	if (!passed)
+		PrefsFactory::instance()->refreshAllKeys();
+
+	JsonReplyBuilder reply;
+	reply.put("passed", passed).put("result", result).put("returnValue", true);
+
+	if (!LSMessageReply(lsHandle, message, reply.c_str(), &lsError))
+		LSErrorFree (&lsError);
 
 	return true;
 }
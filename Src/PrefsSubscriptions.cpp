@@ -0,0 +1,113 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#include "PrefsSubscriptions.h"
+#include "Logging.h"
+
+const char* PrefsSubscriptions::s_cancelKey = "prefsSubscription";
+
+PrefsSubscriptions::PrefsSubscriptions()
+{
+}
+
+PrefsSubscriptions::~PrefsSubscriptions()
+{
+	for (SubscriberMap::iterator it = m_subscribers.begin(); it != m_subscribers.end(); ++it) {
+		LSMessageUnref(it->second->message);
+		delete it->second;
+	}
+}
+
+bool PrefsSubscriptions::add(LSHandle* handle, LSMessage* message, const std::list<std::string>& keys, Delivery delivery)
+{
+	if (!handle || !message || keys.empty())
+		return false;
+
+	//the same message subscribing twice can't happen through getPreferences; treat it as a resubscribe
+	remove(message);
+
+	LSError lsError;
+	LSErrorInit(&lsError);
+	if (!LSSubscriptionAdd(handle, s_cancelKey, message, &lsError)) {
+		qWarning("failed to track a preferences subscription: %s", lsError.message);
+		LSErrorFree(&lsError);
+		return false;
+	}
+
+	Subscriber* subscriber = new Subscriber;
+	subscriber->handle = handle;
+	subscriber->message = message;
+	subscriber->delivery = delivery;
+	LSMessageRef(message);
+
+	for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+		//a key listed twice is registered once
+		if (m_byKey[*it].insert(subscriber).second)
+			subscriber->keys.push_back(*it);
+	}
+
+	m_subscribers[message] = subscriber;
+	return true;
+}
+
+void PrefsSubscriptions::remove(LSMessage* message)
+{
+	SubscriberMap::iterator found = m_subscribers.find(message);
+	if (found == m_subscribers.end())
+		return;
+
+	Subscriber* subscriber = found->second;
+	m_subscribers.erase(found);
+
+	for (std::vector<std::string>::const_iterator it = subscriber->keys.begin(); it != subscriber->keys.end(); ++it) {
+		KeyIndex::iterator index = m_byKey.find(*it);
+		if (index == m_byKey.end())
+			continue;
+
+		index->second.erase(subscriber);
+		if (index->second.empty())
+			m_byKey.erase(index);
+	}
+
+	LSMessageUnref(subscriber->message);
+	delete subscriber;
+}
+
+const PrefsSubscriptions::SubscriberSet* PrefsSubscriptions::subscribers(const std::string& key) const
+{
+	KeyIndex::const_iterator it = m_byKey.find(key);
+	if (it == m_byKey.end())
+		return 0;
+
+	return &it->second;
+}
+
+json_object* PrefsSubscriptions::toJson() const
+{
+	json_object* keys = json_object_new_object();
+	for (KeyIndex::const_iterator it = m_byKey.begin(); it != m_byKey.end(); ++it)
+		json_object_object_add(keys, it->first.c_str(), json_object_new_int((int) it->second.size()));
+
+	json_object* stats = json_object_new_object();
+	json_object_object_add(stats, "subscribers", json_object_new_int((int) m_subscribers.size()));
+	json_object_object_add(stats, "keys", keys);
+	return stats;
+}
@@ -13,8 +13,14 @@
  *  See the License for the specific language governing permissions and
  *  limitations under the License.
  */
+#include <dirent.h>
+#include <sys/stat.h>
+
 #include "RingtonePrefsHandler.h"
 #include "SystemRestore.h"
+#include "PrefsFactory.h"
+#include "PrefsDb.h"
+#include "DirectoryWatcher.h"
 #include "Utils.h"
 #include "UrlRep.h"
 #include "Logging.h"
@@ -87,6 +93,10 @@ void RingtonePrefsHandler::init() {
 		return;
 	}
 
+	m_ringtoneDir = std::string(PrefsDb::s_mediaPartitionPath)+std::string(PrefsDb::s_mediaPartitionRingtonesDir);
+	//may fail if the media partition isn't there yet; SystemRestore rearms it when it is
+	DirectoryWatcher::instance()->watch(m_ringtoneDir, cbRingtoneDirChanged, this);
+	scanRingtones();
 }
 
 std::list<std::string> RingtonePrefsHandler::keys() const 
@@ -108,14 +118,73 @@ void RingtonePrefsHandler::valueChanged(const std::string& key, json_object* val
 
 json_object* RingtonePrefsHandler::valuesForKey(const std::string& key)
 {
-	//TODO: could scan ringtone folders and return possible files. However, since selection is handled by file picker which
-	// 		may be scanning in unspecified locations, this wouldn't exactly be accurate
+	//only the ringtones dir on the media partition; selection is handled by file picker which
+	// 		may be scanning in other locations, so this isn't necessarily everything that can be set
+	if (!DirectoryWatcher::instance()->isWatching(m_ringtoneDir))
+		scanRingtones();
+
 	json_object* json = json_object_new_object();
 	json_object* arrayObj = json_object_new_array();
+	for (std::set<std::string>::const_iterator it = m_ringtones.begin(); it != m_ringtones.end(); ++it) {
+		json_object* element = json_object_new_object();
+		std::string name = *it;
+		std::string::size_type dot = name.find_last_of('.');
+		if (dot != std::string::npos && dot > 0)
+			name.erase(dot);
+		json_object_object_add(element,(char *)"fullPath",json_object_new_string((m_ringtoneDir+std::string("/")+(*it)).c_str()));
+		json_object_object_add(element,(char *)"name",json_object_new_string(name.c_str()));
+		json_object_array_add(arrayObj,element);
+	}
 	json_object_object_add(json,(char *)"ringtone",arrayObj);
 	return json;	
 }
 
+void RingtonePrefsHandler::scanRingtones()
+{
+	m_ringtones.clear();
+
+	DIR* dir = opendir(m_ringtoneDir.c_str());
+	if (!dir)
+		return;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != 0) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		struct stat stBuf;
+		std::string path = m_ringtoneDir+std::string("/")+entry->d_name;
+		if (stat(path.c_str(), &stBuf) == 0 && S_ISREG(stBuf.st_mode))
+			m_ringtones.insert(entry->d_name);
+	}
+	closedir(dir);
+}
+
+void RingtonePrefsHandler::cbRingtoneDirChanged(const std::string& name, bool present, void* data)
+{
+	static_cast<RingtonePrefsHandler*>(data)->ringtoneFileChanged(name, present);
+}
+
+void RingtonePrefsHandler::ringtoneFileChanged(const std::string& name, bool present)
+{
+	if (name.empty()) {
+		scanRingtones();
+	}
+	else if (present) {
+		if (!m_ringtones.insert(name).second)
+			return;			// rewritten, still the same listing
+	}
+	else if (!m_ringtones.erase(name)) {
+		return;
+	}
+
+	PrefsFactory::instance()->postPrefValues("ringtone");
+
+	//cheap, and the current ringtone may be the one that went away
+	if (name.empty() || !present)
+		PrefsFactory::instance()->recheckPrefConsistency(this);
+}
+
 bool RingtonePrefsHandler::isPrefConsistent()
 {
 	return SystemRestore::instance()->isRingtoneSettingConsistent();
@@ -178,6 +247,9 @@ Example response for a failed call:
 */
 static bool cbAddRingtone(LSHandle* lsHandle, LSMessage *message,void *user_data)
 {
+    if (SystemRestore::deferUntilReady(lsHandle, message, cbAddRingtone, user_data))
+        return true;
+
     // {"filePath": string}
     VALIDATE_SCHEMA_AND_RETURN(lsHandle,
                                message,
@@ -345,6 +417,9 @@ Example response for a failed call:
 */
 static bool cbDeleteRingtone(LSHandle* lsHandle, LSMessage *message, void *user_data)
 {
+    if (SystemRestore::deferUntilReady(lsHandle, message, cbDeleteRingtone, user_data))
+        return true;
+
     // {"filePath": string}
     VALIDATE_SCHEMA_AND_RETURN(lsHandle,
                                message,
@@ -422,6 +497,9 @@ static bool cbDeleteRingtone(LSHandle* lsHandle, LSMessage *message, void *user_
 		success = false;
 		goto Done;
 	}
+
+	//in case it was the current ringtone after all
+	PrefsFactory::instance()->invalidatePrefConsistency(PrefsFactory::instance()->getPrefsHandler("ringtone"));
 	
 	Done: 
 	
@@ -0,0 +1,262 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+#include <string.h>
+
+#include "ServiceStats.h"
+#include "Settings.h"
+#include "Logging.h"
+#include "TzParser.h"
+
+//arbitrary keys come in from the bus; don't let them grow the table forever
+static const size_t s_maxTrackedKeys = 512;
+
+static const char* s_methodNames[ServiceStats::MethodCount] = {
+	"setPreferences",
+	"getPreferences",
+	"getPreferenceValues",
+	"getTimeZoneRules",
+	"convertDate",
+	"ezResize"
+};
+
+static const char* s_phaseNames[ServiceStats::PhaseCount] = {
+	"sqlite",
+	"handler"
+};
+
+ServiceStats* ServiceStats::s_instance = 0;
+
+ServiceStats* ServiceStats::instance()
+{
+	if (G_UNLIKELY(!s_instance))
+		s_instance = new ServiceStats();
+
+	return s_instance;
+}
+
+ServiceStats::ServiceStats()
+	: m_enabled(Settings::settings()->m_serviceStatsEnabled)
+{
+	int interval = Settings::settings()->m_serviceStatsDumpInterval;
+	if (m_enabled && interval > 0)
+		g_timeout_add_seconds(interval, cbDump, this);
+}
+
+ServiceStats::~ServiceStats()
+{
+	s_instance = 0;
+}
+
+void ServiceStats::recordMethod(Method method, gint64 usecs)
+{
+	if (!m_enabled || method >= MethodCount)
+		return;
+
+	m_methods[method].add(usecs);
+}
+
+void ServiceStats::recordPhase(Phase phase, gint64 usecs)
+{
+	if (!m_enabled || phase >= PhaseCount)
+		return;
+
+	m_phases[phase].add(usecs);
+}
+
+void ServiceStats::recordFanout(unsigned int subscribers)
+{
+	if (!m_enabled)
+		return;
+
+	m_fanout.add(subscribers);
+}
+
+void ServiceStats::countKey(const std::string& key, bool read)
+{
+	std::map<std::string, KeyCounters>::iterator it = m_keys.find(key);
+	KeyCounters* counters = 0;
+
+	if (it != m_keys.end())
+		counters = &it->second;
+	else if (m_keys.size() < s_maxTrackedKeys)
+		counters = &m_keys[key];
+	else
+		counters = &m_otherKeys;
+
+	if (read)
+		++counters->reads;
+	else
+		++counters->writes;
+}
+
+json_object* ServiceStats::toJson() const
+{
+	json_object* stats = json_object_new_object();
+	json_object_object_add(stats, "enabled", json_object_new_boolean(m_enabled));
+
+	json_object* methods = json_object_new_object();
+	for (int i = 0; i < MethodCount; ++i)
+		json_object_object_add(methods, s_methodNames[i], m_methods[i].toJson());
+	json_object_object_add(stats, "methods", methods);
+
+	json_object* phases = json_object_new_object();
+	for (int i = 0; i < PhaseCount; ++i)
+		json_object_object_add(phases, s_phaseNames[i], m_phases[i].toJson());
+	json_object_object_add(stats, "phases", phases);
+
+	json_object_object_add(stats, "fanout", m_fanout.toJson());
+
+	json_object* keys = json_object_new_object();
+	for (std::map<std::string, KeyCounters>::const_iterator it = m_keys.begin(); it != m_keys.end(); ++it) {
+		json_object* counters = json_object_new_object();
+		json_object_object_add(counters, "reads", json_object_new_int((int) it->second.reads));
+		json_object_object_add(counters, "writes", json_object_new_int((int) it->second.writes));
+		json_object_object_add(keys, it->first.c_str(), counters);
+	}
+	json_object_object_add(stats, "keys", keys);
+
+	json_object* other = json_object_new_object();
+	json_object_object_add(other, "reads", json_object_new_int((int) m_otherKeys.reads));
+	json_object_object_add(other, "writes", json_object_new_int((int) m_otherKeys.writes));
+	json_object_object_add(stats, "untrackedKeys", other);
+
+	const TzParserStats& tz = tzParserStats();
+	json_object* tzParser = json_object_new_object();
+	json_object_object_add(tzParser, "loads", json_object_new_int((int) tz.loads));
+	json_object_object_add(tzParser, "cacheHits", json_object_new_int((int) tz.cacheHits));
+	json_object_object_add(tzParser, "decodes", json_object_new_int((int) tz.decodes));
+	json_object_object_add(tzParser, "transitions", json_object_new_int((int) tz.transitions));
+	json_object_object_add(tzParser, "decodeTime", json_object_new_double((double) tz.decodeUsecs));
+	json_object_object_add(tzParser, "decodeTimePerZone",
+			json_object_new_double(tz.decodes ? (double) tz.decodeUsecs / tz.decodes : 0.0));
+	json_object_object_add(stats, "tzParser", tzParser);
+
+	return stats;
+}
+
+void ServiceStats::reset()
+{
+	for (int i = 0; i < MethodCount; ++i)
+		m_methods[i].clear();
+	for (int i = 0; i < PhaseCount; ++i)
+		m_phases[i].clear();
+	m_fanout.clear();
+	m_keys.clear();
+	m_otherKeys = KeyCounters();
+	resetTzParserStats();
+}
+
+void ServiceStats::dumpToLog() const
+{
+	//one short line per histogram; the full picture is on /getServiceStats
+	for (int i = 0; i < MethodCount; ++i) {
+		const Histogram& h = m_methods[i];
+		__qMessage("stats: %s calls %lu avg %lldus p50 %lldus p99 %lldus max %lldus", s_methodNames[i], h.count,
+				(long long) (h.count ? h.total / (gint64) h.count : 0), (long long) h.percentile(50),
+				(long long) h.percentile(99), (long long) h.max);
+	}
+
+	for (int i = 0; i < PhaseCount; ++i) {
+		const Histogram& h = m_phases[i];
+		__qMessage("stats: %s total %lldus over %lu samples", s_phaseNames[i], (long long) h.total, h.count);
+	}
+
+	__qMessage("stats: fanout %lu posts max %lld subscribers, %zu keys tracked",
+			m_fanout.count, (long long) m_fanout.max, m_keys.size());
+
+	const TzParserStats& tz = tzParserStats();
+	__qMessage("stats: tz loads %lu hits %lu decodes %lu avg %lldus", tz.loads, tz.cacheHits, tz.decodes,
+			tz.decodes ? tz.decodeUsecs / (long long) tz.decodes : 0LL);
+}
+
+gboolean ServiceStats::cbDump(gpointer data)
+{
+	static_cast<ServiceStats*>(data)->dumpToLog();
+	return TRUE;
+}
+
+void ServiceStats::Histogram::clear()
+{
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	total = 0;
+	max = 0;
+}
+
+void ServiceStats::Histogram::add(gint64 value)
+{
+	if (value < 0)
+		value = 0;
+
+	int bucket = 0;
+	for (gint64 v = value; v > 1 && bucket < BucketCount - 1; v >>= 1)
+		++bucket;
+
+	++buckets[bucket];
+	++count;
+	total += value;
+	if (value > max)
+		max = value;
+}
+
+gint64 ServiceStats::Histogram::percentile(int p) const
+{
+	if (count == 0)
+		return 0;
+
+	//rank of the sample we're after, 1 based
+	unsigned long rank = (unsigned long) (((unsigned long long) count * p + 99) / 100);
+	if (rank == 0)
+		rank = 1;
+
+	unsigned long seen = 0;
+	for (int i = 0; i < BucketCount - 1; ++i) {
+		seen += buckets[i];
+		if (seen >= rank) {
+			gint64 top = ((gint64) 2 << i) - 1;
+			return top < max ? top : max;
+		}
+	}
+	return max;
+}
+
+json_object* ServiceStats::Histogram::toJson() const
+{
+	json_object* obj = json_object_new_object();
+	json_object_object_add(obj, "count", json_object_new_int((int) count));
+	json_object_object_add(obj, "total", json_object_new_double((double) total));
+	json_object_object_add(obj, "max", json_object_new_double((double) max));
+	json_object_object_add(obj, "p50", json_object_new_double((double) percentile(50)));
+	json_object_object_add(obj, "p90", json_object_new_double((double) percentile(90)));
+	json_object_object_add(obj, "p99", json_object_new_double((double) percentile(99)));
+
+	//log2 buckets, trailing empty ones dropped
+	int last = BucketCount - 1;
+	while (last >= 0 && buckets[last] == 0)
+		--last;
+
+	json_object* histogram = json_object_new_array();
+	for (int i = 0; i <= last; ++i)
+		json_object_array_add(histogram, json_object_new_int((int) buckets[i]));
+	json_object_object_add(obj, "log2Buckets", histogram);
+
+	return obj;
+}
@@ -40,12 +40,35 @@ Settings::Settings()
 bool Settings::initValues()
 {
 	m_turnNovacomOnAtStartup = false;
+	m_stagedStartup = false;
+	m_workerThreads = 2;
 	m_saveLastBackedUpTempDb = false;
 	m_saveLastRestoredTempDb = false;
 	m_logLevel = std::string("");
 	m_useComPalmImage2 = false;
 	m_image2svcAvailable = false;
 	m_comPalmImage2BinaryFile = ("/usr/bin/acuteimaging");
+	m_wallpaperImportBackend = std::string("lowMem");
+	m_prefsDbWalMode = true;
+	m_prefsDbSynchronous = std::string("FULL");
+	m_prefsDbCacheSize = 0;
+	m_prefsDbMmapSize = 0;
+	m_prefsDbWalAutoCheckpoint = 1000;
+	m_prefsDbCheckpointInterval = 0;
+	m_prefsDbIntegrityCheck = std::string("quick");
+	m_prefsDbFullCheckInterval = 7;
+	m_imageWorkerThreads = 2;
+	m_imageClippedDecodeSize = 4096;
+	m_wallpaperCacheSize = 16384;
+	m_wallpaperVariants = std::string();
+	m_ntpCacheTime = 60;
+	m_ntpFilterSamples = 8;
+	m_timeSlewThreshold = 0;
+	m_zoneListBudget = 512;
+	m_networkSettleTime = 3;
+	m_networkSyncHoldoff = 300;
+	m_serviceStatsEnabled = false;
+	m_serviceStatsDumpInterval = 0;
 	return true;
 }
 
@@ -115,8 +138,35 @@ bool Settings::load(const char* settingsFile)
 
 	KEY_BOOLEAN("ImageService","useComPalmImage2",m_useComPalmImage2);
 	KEY_STRING("ImageService","comPalmImage2Binary",m_comPalmImage2BinaryFile);
-
-    KEY_INTEGER("General", "schemaValidationOption", schemaValidationOption);
+	KEY_STRING("ImageService","wallpaperImportBackend",m_wallpaperImportBackend);
+	KEY_INTEGER("ImageService","workerThreads",m_imageWorkerThreads);
+	KEY_INTEGER("ImageService","clippedDecodeSize",m_imageClippedDecodeSize);
+
+	KEY_INTEGER("General", "schemaValidationOption", schemaValidationOption);
+	KEY_BOOLEAN("General","stagedStartup",m_stagedStartup);
+	KEY_INTEGER("General","workerThreads",m_workerThreads);
+
+	KEY_INTEGER("Wallpaper","cacheSize",m_wallpaperCacheSize);
+	KEY_STRING("Wallpaper","variants",m_wallpaperVariants);
+
+	KEY_INTEGER("Time","ntpCacheTime",m_ntpCacheTime);
+	KEY_INTEGER("Time","ntpFilterSamples",m_ntpFilterSamples);
+	KEY_INTEGER("Time","slewThreshold",m_timeSlewThreshold);
+	KEY_INTEGER("Time","zoneListBudget",m_zoneListBudget);
+	KEY_INTEGER("Time","networkSettleTime",m_networkSettleTime);
+	KEY_INTEGER("Time","networkSyncHoldoff",m_networkSyncHoldoff);
+
+	KEY_BOOLEAN("PrefsDb","walMode",m_prefsDbWalMode);
+	KEY_STRING("PrefsDb","synchronous",m_prefsDbSynchronous);
+	KEY_INTEGER("PrefsDb","cacheSize",m_prefsDbCacheSize);
+	KEY_INTEGER("PrefsDb","mmapSize",m_prefsDbMmapSize);
+	KEY_INTEGER("PrefsDb","walAutoCheckpoint",m_prefsDbWalAutoCheckpoint);
+	KEY_INTEGER("PrefsDb","checkpointInterval",m_prefsDbCheckpointInterval);
+	KEY_STRING("PrefsDb","integrityCheck",m_prefsDbIntegrityCheck);
+	KEY_INTEGER("PrefsDb","fullCheckInterval",m_prefsDbFullCheckInterval);
+
+	KEY_BOOLEAN("Stats","enabled",m_serviceStatsEnabled);
+	KEY_INTEGER("Stats","dumpInterval",m_serviceStatsDumpInterval);
 
 	g_key_file_free( keyfile );
 	return true;
@@ -0,0 +1,126 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#include <stdio.h>
+
+#include "StartupProfile.h"
+#include "Logging.h"
+
+//a backstop; phases after markReady() aren't recorded at all
+static const size_t s_maxPhases = 128;
+
+//json-c here has no 64 bit ints; an int runs out after 35 minutes of microseconds
+static json_object* newUsecs(gint64 usecs)
+{
+	return json_object_new_int(usecs > G_MAXINT ? G_MAXINT : (int) usecs);
+}
+
+StartupProfile* StartupProfile::s_instance = 0;
+
+StartupProfile* StartupProfile::instance()
+{
+	if (G_UNLIKELY(!s_instance))
+		s_instance = new StartupProfile();
+
+	return s_instance;
+}
+
+StartupProfile::StartupProfile()
+	: m_start(g_get_monotonic_time())
+	, m_ready(-1)
+	, m_depth(0)
+{
+	m_entries.reserve(32);
+}
+
+int StartupProfile::begin(const char* name)
+{
+	//after startup the same scopes run per request; they are neither kept nor logged then
+	if (m_ready >= 0 || m_entries.size() >= s_maxPhases)
+		return -1;
+
+	++m_depth;
+	Entry entry;
+	entry.name = name;
+	entry.depth = m_depth - 1;
+	entry.start = elapsed();
+	entry.duration = -1;
+	m_entries.push_back(entry);
+	return (int) m_entries.size() - 1;
+}
+
+void StartupProfile::end(int index)
+{
+	if (index < 0)
+		return;
+
+	--m_depth;
+	if (m_ready >= 0)
+		return;
+
+	Entry& entry = m_entries[index];
+	entry.duration = elapsed() - entry.start;
+
+	char start[32], duration[32];
+	snprintf(start, sizeof(start), "%lld", (long long) entry.start);
+	snprintf(duration, sizeof(duration), "%lld", (long long) entry.duration);
+	PmLogInfo(sysServiceLogContext(), "STARTUP_PHASE", 4,
+		PMLOGKS("PHASE", entry.name),
+		PMLOGKFV("DEPTH", "%d", entry.depth),
+		PMLOGKS("START_US", start),
+		PMLOGKS("DURATION_US", duration),
+		"startup phase %s took %s us", entry.name, duration
+	);
+}
+
+void StartupProfile::markReady()
+{
+	if (m_ready >= 0)
+		return;
+
+	m_ready = elapsed();
+	char ready[32];
+	snprintf(ready, sizeof(ready), "%lld", (long long) m_ready);
+	PmLogInfo(sysServiceLogContext(), "STARTUP_DONE", 1,
+		PMLOGKS("ELAPSED_US", ready),
+		"startup done after %s us", ready
+	);
+}
+
+json_object* StartupProfile::toJson() const
+{
+	json_object* profile = json_object_new_object();
+	json_object_object_add(profile, "ready", newUsecs(m_ready));
+	json_object_object_add(profile, "now", newUsecs(elapsed()));
+
+	json_object* phases = json_object_new_array();
+	for (std::vector<Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+		json_object* phase = json_object_new_object();
+		json_object_object_add(phase, "name", json_object_new_string(it->name));
+		json_object_object_add(phase, "depth", json_object_new_int(it->depth));
+		json_object_object_add(phase, "start", newUsecs(it->start));
+		json_object_object_add(phase, "duration", newUsecs(it->duration));
+		json_object_array_add(phases, phase);
+	}
+	json_object_object_add(profile, "phases", phases);
+
+	return profile;
+}
@@ -24,6 +24,10 @@
 #include "Logging.h"
 #include "PrefsDb.h"
 #include "PrefsFactory.h"
+#include "DirectoryWatcher.h"
+#include "FileCopier.h"
+#include "ConfigFileCache.h"
+#include "StartupProfile.h"
 
 //place the debug define HERE
  
@@ -47,7 +51,13 @@ SystemRestore * SystemRestore::instance()
 	return s_instance;
 }
 
-SystemRestore::SystemRestore() : m_msmState(Phone)
+SystemRestore::SystemRestore()
+	: m_msmState(Phone)
+	, m_pendingCopies(0)
+	, m_copyFailed(false)
+	, m_writeTokenAfterCopies(false)
+	, m_ready(false)
+	, m_readyAfterCopies(false)
 {
 	s_instance = this;
 	std::string overrideStr;
@@ -57,16 +67,9 @@ SystemRestore::SystemRestore() : m_msmState(Phone)
 	std::string valueStr;
 		
 	//load the defaults file
-	char* jsonStr = Utils::readFile(PrefsDb::s_defaultPrefsFile);
-	if (!jsonStr) {
-        qWarning() << "Failed to load prefs file:" << PrefsDb::s_defaultPrefsFile;
-		goto Platform;
-	}
-
-	root = json_tokener_parse(jsonStr);
+	root = ConfigFileCache::instance()->json(PrefsDb::s_defaultPrefsFile);
 	if (!root) {
-		root = 0;
-        qWarning() << "Failed to parse file contents into json";
+        qWarning() << "Failed to load/parse prefs file:" << PrefsDb::s_defaultPrefsFile;
 		goto Platform;
 	}
 
@@ -89,25 +92,14 @@ SystemRestore::SystemRestore() : m_msmState(Phone)
 	//load the platform defaults file if it exists
 Platform:
 
-	if (jsonStr) {
-		delete[] jsonStr;
-		jsonStr = 0;
-	}
 	if (root) {
 		json_object_put(root);
 		root = 0;
 	}
 	
-	jsonStr = Utils::readFile(PrefsDb::s_defaultPlatformPrefsFile);
-	if (!jsonStr) {
-        qWarning() << "Failed to load platform prefs file:" << PrefsDb::s_defaultPlatformPrefsFile;
-		goto Exit;
-	}
-		
-	root = json_tokener_parse(jsonStr);
+	root = ConfigFileCache::instance()->json(PrefsDb::s_defaultPlatformPrefsFile);
 	if (!root) {
-		root = 0;
-        qWarning() << "Failed to parse file [" << PrefsDb::s_defaultPlatformPrefsFile << "] contents into json";
+        qWarning() << "Failed to load/parse platform prefs file:" << PrefsDb::s_defaultPlatformPrefsFile;
 		goto Exit;
 	}
 
@@ -155,8 +147,6 @@ Platform:
 	
 	Exit:
 	
-	if (jsonStr)
-		delete[] jsonStr;
 	if (root)
 		json_object_put(root);
 	
@@ -217,12 +207,7 @@ int SystemRestore::restoreDefaultRingtoneToMediaPartition()
 		return -1;
 	}
 	std::string targetFileAndPath = std::string(PrefsDb::s_mediaPartitionPath)+std::string(PrefsDb::s_mediaPartitionRingtonesDir)+std::string("/")+filePart;
-	int rc = Utils::fileCopy(defaultRingtoneFileAndPath.c_str(),targetFileAndPath.c_str());
-	if (rc == -1)
-	{
-        qWarning() << "filecopy" << defaultRingtoneFileAndPath.c_str() << "->" << targetFileAndPath.c_str() << "failed";
-		return -1;
-	}
+	queueCopy(defaultRingtoneFileAndPath,targetFileAndPath,"ringtone",defaultRingtoneString);
 	return 1;
 }
 int SystemRestore::restoreDefaultWallpaperToMediaPartition()
@@ -245,16 +230,78 @@ int SystemRestore::restoreDefaultWallpaperToMediaPartition()
 	}
 		
 	std::string targetFileAndPath = std::string(PrefsDb::s_mediaPartitionPath)+std::string(PrefsDb::s_mediaPartitionWallpapersDir)+std::string("/")+filePart;
-	int rc = Utils::fileCopy(defaultWallpaperFileAndPath.c_str(),targetFileAndPath.c_str());
-	if (rc == -1)
-	{
-        qWarning() << "filecopy" << defaultWallpaperFileAndPath.c_str() << "->" << targetFileAndPath.c_str() << "failed";
-		return -1;
-	}
+	queueCopy(defaultWallpaperFileAndPath,targetFileAndPath,"wallpaper",defaultWallpaperString);
 
 	return 1;
 }
 
+void SystemRestore::queueCopy(const std::string& src, const std::string& dest, const std::string& prefKey, const std::string& prefValue)
+{
+	if (!m_copiesInFlight.insert(dest).second) {
+		qDebug("%s is already being copied", dest.c_str());
+		return;
+	}
+
+	PendingCopy* copy = new PendingCopy;
+	copy->self = this;
+	copy->dest = dest;
+	copy->prefKey = prefKey;
+	copy->prefValue = prefValue;
+	++m_pendingCopies;
+	FileCopier::instance()->copy(src,dest,cbCopied,copy);
+}
+
+//static
+void SystemRestore::cbCopied(const std::string& src, const std::string& dest, bool ok, void* data)
+{
+	PendingCopy* copy = static_cast<PendingCopy*>(data);
+	SystemRestore* self = copy->self;
+	self->m_copiesInFlight.erase(copy->dest);
+	if (!ok) {
+        qWarning() << "filecopy" << src.c_str() << "->" << dest.c_str() << "failed; [" << copy->prefKey.c_str() << "] left as it was";
+		self->m_copyFailed = true;
+	}
+	else if (!copy->prefKey.empty()) {
+		//the handlers aren't necessarily up when the restore is asked for, so set the key into the database
+		//directly and tell them (and the subscribers) after
+		PrefsDb::instance()->setPref(copy->prefKey,copy->prefValue);
+		std::map<std::string,std::string> keyValues;
+		keyValues[copy->prefKey] = copy->prefValue;
+		PrefsFactory::instance()->refreshKeys(keyValues);
+	}
+	delete copy;
+
+	if (--self->m_pendingCopies > 0)
+		return;
+
+	if (self->m_writeTokenAfterCopies) {
+		if (!self->m_copyFailed)
+			writeSystemToken();
+		else
+            qWarning() << "running - system token missing and WAS NOT written because a restore copy failed!";
+	}
+	self->m_writeTokenAfterCopies = false;
+	self->m_copyFailed = false;
+
+	//done with or without the files; holding the calls any longer wouldn't bring them back
+	if (self->m_readyAfterCopies) {
+		self->m_readyAfterCopies = false;
+		self->m_ready = true;
+		self->runDeferredCalls();
+	}
+}
+
+//static
+void SystemRestore::writeSystemToken()
+{
+	FILE * fp = fopen(PrefsDb::s_systemTokenFileAndPath,"w");
+	if (fp != NULL) {
+		fprintf(fp,"%lu",time(NULL));		//doesn't matter what I put in here, but timestamp seems sane
+		fflush(fp);
+		fclose(fp);
+	}
+}
+
 int SystemRestore::restoreDefaultRingtoneSetting()
 {
 	//parse json in the defaultRingtoneString
@@ -280,14 +327,12 @@ int SystemRestore::restoreDefaultRingtoneSetting()
 
 	defaultRingtoneFileAndPath = json_object_get_string(label);
 	
-	//restore the default ringtone files to the media partition
+	//restore the default ringtone files to the media partition; the key is set once the copy is in
 	rc = restoreDefaultRingtoneToMediaPartition();
 	if (rc == -1) {
 		rc = 0;
 		goto Exit;		//error of some kind
 	}
-	//set the key into the database...remember, at this point the handlers are *NOT* up yet, so have to do it manually
-	PrefsDb::instance()->setPref(std::string("ringtone"),defaultRingtoneString);
 	
 	rc = 1;
 	
@@ -325,7 +370,7 @@ int SystemRestore::restoreDefaultWallpaperSetting()
 	//TODO: use this to cache for later so I don't have to reparse json each time
 	defaultWallpaperFileAndPath = json_object_get_string(label);
 
-	//restore the default wallpaper file to the media partition
+	//restore the default wallpaper file to the media partition; the key is set once the copy is in
 	rc = restoreDefaultWallpaperToMediaPartition();
 	if (rc == -1) {
         qWarning() << "SystemRestore::restoreDefaultWallpaperSetting(): [ERROR] could not copy default wallpaper [" <<
@@ -333,8 +378,6 @@ int SystemRestore::restoreDefaultWallpaperSetting()
 		rc=0;
 		goto Exit;		//error of some kind
 	}
-	//set the key into the database...remember, at this point the handlers are *NOT* up yet, so have to do it manually
-	PrefsDb::instance()->setPref(std::string("wallpaper"),defaultWallpaperString);
 	
 	rc=1;
 	
@@ -551,6 +594,7 @@ int SystemRestore::createSpecialDirectories()
 
 int SystemRestore::startupConsistencyCheck() 
 {
+	StartupProfile::Phase phase("startupConsistencyCheck");
 
 	PMLOG_TRACE("%s:started",__FUNCTION__);
 	// -- run startup tests to determine the state of the device
@@ -565,13 +609,12 @@ int SystemRestore::startupConsistencyCheck()
 		rc += SystemRestore::instance()->restoreDefaultWallpaperSetting();
 
 		//create token if all these succeeded
+		//(once the files are actually on the media partition, if they're still being copied)
 		if (rc == 2) {
-			FILE * fp = fopen(PrefsDb::s_systemTokenFileAndPath,"w");
-			if (fp != NULL) {
-				fprintf(fp,"%lu",time(NULL));		//doesn't matter what I put in here, but timestamp seems sane
-				fflush(fp);
-				fclose(fp);
-			}
+			if (SystemRestore::instance()->m_pendingCopies > 0)
+				SystemRestore::instance()->m_writeTokenAfterCopies = true;
+			else
+				writeSystemToken();
 		}
 		else {
             qWarning() << "running - system token missing and WAS NOT written because one of the restore functions failed!";
@@ -595,7 +638,7 @@ int SystemRestore::startupConsistencyCheck()
 	if (Utils::filesizeOnFilesystem(PrefsDb::s_volumeIconFileAndPathDest) == 0) {
 		PMLOG_TRACE("running - restoring volume icon file");
 		//restore it
-		Utils::fileCopy(PrefsDb::s_volumeIconFileAndPathSrc,PrefsDb::s_volumeIconFileAndPathDest);
+		FileCopier::instance()->copy(PrefsDb::s_volumeIconFileAndPathSrc,PrefsDb::s_volumeIconFileAndPathDest,0,0);
 	}
 
 //	//attrib it all for good measure
@@ -612,22 +655,88 @@ int SystemRestore::startupConsistencyCheck()
 //	g_warning("SystemRestore::startupConsistencyCheck() running - [%s] returned %d",cmdline.c_str(),exitCode);
 //#endif
 
+	//the calls waiting on this want the restored files, which may still be being copied
+	if (SystemRestore::instance()->m_pendingCopies > 0)
+		SystemRestore::instance()->m_readyAfterCopies = true;
+	else
+		SystemRestore::instance()->m_ready = true;
+
 	PMLOG_TRACE("%s:finished",__FUNCTION__);
 	return 1;
 }
 
+//static
+void SystemRestore::scheduleStartupConsistencyCheck()
+{
+	//idle priority, so the requests that came in while starting up get their answers first
+	g_idle_add(cbStartupConsistencyCheck,NULL);
+}
+
+//static
+gboolean SystemRestore::cbStartupConsistencyCheck(gpointer data)
+{
+	//the handlers are up by now and have read the keys the restore may overwrite
+	std::map<std::string,std::string> snapshot = PrefsDb::instance()->getAllPrefs();
+	startupConsistencyCheck();
+	PrefsFactory::instance()->refreshChangedKeys(snapshot);
+
+	//otherwise the last restore copy runs them
+	if (isReady())
+		SystemRestore::instance()->runDeferredCalls();
+	return FALSE;
+}
+
+//static
+bool SystemRestore::isReady()
+{
+	return SystemRestore::instance()->m_ready;
+}
+
+//static
+bool SystemRestore::deferUntilReady(LSHandle* lsHandle, LSMessage* message, LSMethodFunction method, void* data)
+{
+	SystemRestore* self = SystemRestore::instance();
+	if (self->m_ready)
+		return false;
+
+	qDebug("deferring %s until the startup check is done", LSMessageGetMethod(message));
+	DeferredCall call;
+	call.lsHandle = lsHandle;
+	call.message = message;
+	call.method = method;
+	call.data = data;
+	LSMessageRef(message);
+	self->m_deferredCalls.push_back(call);
+	return true;
+}
+
+void SystemRestore::runDeferredCalls()
+{
+	//in the order they came in
+	std::vector<DeferredCall> calls;
+	calls.swap(m_deferredCalls);
+	for (std::vector<DeferredCall>::const_iterator it = calls.begin(); it != calls.end(); ++it) {
+		(void) it->method(it->lsHandle,it->message,it->data);
+		LSMessageUnref(it->message);
+	}
+}
+
 //static
 int SystemRestore::runtimeConsistencyCheck() 
 {
 	PMLOG_TRACE("%s:started",__FUNCTION__);
 	
+	//bring back the watches the remount dropped (rearm() leaves intact ones alone). Intact watches don't
+	//mean nothing changed though: files that went away over usb, in a remount or an erase never show up on
+	//them, so the handlers check their settings every time
+	(void) DirectoryWatcher::instance()->rearm();
 	PrefsFactory::instance()->runConsistencyChecksOnAllHandlers();
 	
 	//check the media icon file
 	if (Utils::filesizeOnFilesystem(PrefsDb::s_volumeIconFileAndPathDest) == 0) {
 	PMLOG_TRACE("running - restoring volume icon file");
 		//restore it
-		Utils::fileCopy(PrefsDb::s_volumeIconFileAndPathSrc,PrefsDb::s_volumeIconFileAndPathDest);
+		FileCopier::instance()->copy(PrefsDb::s_volumeIconFileAndPathSrc,PrefsDb::s_volumeIconFileAndPathDest,0,0);
 	}
 
 	//attrib it all for good measure
@@ -786,6 +895,8 @@ bool SystemRestore::msmEntry(LSMessage* message)
 	struct json_object* mode = json_object_object_get(payload, "new-mode");
 	if (mode) {
 		modeStr = std::string(json_object_get_string(mode));
+		//the media partition is (or was) exported; whatever was checked on it before can't be trusted
+		PrefsFactory::instance()->invalidatePrefConsistency(0);
 		if (modeStr == "brick") {
 			m_msmState = Brick;
 		}
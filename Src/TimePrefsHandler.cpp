@@ -20,6 +20,7 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/timex.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,6 +28,7 @@
 #include <string.h>
 #include <errno.h>
 #include <memory.h>
+#include <algorithm>
 #include <set>
 
 #if defined(HAVE_LUNA_PREFS)
@@ -34,22 +36,29 @@
 #endif
 
 #include "NetworkConnectionListener.h"
+#include "TimeZoneTable.h"
+#include "TzParser.h"
 #include "PrefsDb.h"
 #include "PrefsFactory.h"
 #include "ClockHandler.h"
 #include "Logging.h"
 #include "Utils.h"
 #include "JSONUtils.h"
+#include "StartupProfile.h"
+#include "Settings.h"
+#include "ServiceStats.h"
 
 #include <json.h>
 #include <json_util.h>
 
 static const char*	  s_tzFile	=	WEBOS_INSTALL_WEBOS_PREFIX "/ext-timezones.json";
 static const char*    s_tzFilePath = WEBOS_INSTALL_SYSMGR_LOCALSTATEDIR "/preferences/localtime";
+static const char*    s_tzSnapshotFile = WEBOS_INSTALL_SYSMGR_LOCALSTATEDIR "/preferences/timezones.snapshot";
 static const char*    s_zoneInfoFolder = "/usr/share/zoneinfo/";
 static const int      s_sysTimeNotificationThreshold = 3000; // 5 mins
 static const char*    s_logChannel = "TimePrefsHandler";
 static const char*    s_factoryTimeSource = "factory";
+static const time_t   s_nitzRepeatDriftThreshold = 60; // secs a repeated NITZ report may be off from the last one
 
 #define				  	ORIGIN_NITZ			"nitz"
 #define					HOURFORMAT_12		"HH12"
@@ -75,7 +84,14 @@ namespace {
 	const int lowestTimeSourcePriority = INT_MIN; // mark for overriding
 } // anonymous namespace
 
-json_object * TimePrefsHandler::s_timeZonesJson = NULL;
+//everything but timeZoneListAsJson() works off this; the json tree itself is never kept around
+static TimeZoneTable s_timeZoneTable;
+static bool s_timeZoneTableLoaded = false;
+//serialized zone list, if it fits in the budget
+static std::string s_timeZonesJsonString;
+//or the one built for the current caller when it doesn't, cleared from an idle
+static std::string s_timeZonesJsonTransient;
+static guint s_timeZonesJsonReleaseSource = 0;
 TimePrefsHandler * TimePrefsHandler::s_inst = NULL;
 
 extern GMainLoop * g_gmainLoop;
@@ -313,6 +329,7 @@ static void tzsetWorkaround(const char * newTZ) __attribute__((unused));
  *   - \ref com_palm_systemservice_time_get_ntp_time
  *   - \ref com_palm_systemservice_time_set_time_with_ntp
  *   - \ref com_palm_systemservice_time_convert_date
+ *   - \ref com_palm_systemservice_time_dst_transition
  */
 static LSMethod s_methods[]  = {
 	{ "getSystemTime",     TimePrefsHandler::cbGetSystemTime },
@@ -331,6 +348,7 @@ static LSMethod s_private_methods[]  = {
 	{ "setSystemNetworkTime", TimePrefsHandler::cbSetSystemNetworkTime },
 	{ "setBroadcastTime",     TimePrefsHandler::cbSetBroadcastTime },
 	{ "setTimeWithNTP",       TimePrefsHandler::cbSetTimeWithNTP },
+	{ "dstTransition",        TimePrefsHandler::cbDstTransition },
 	{ 0, 0 },
 };
 
@@ -373,6 +391,8 @@ time_t TimePrefsHandler::currentStamp()
 
 TimePrefsHandler::TimePrefsHandler(LSPalmService* service)
 	: PrefsHandler(service)
+	, m_zoneStore(0)
+	, m_zoneStoreSize(0)
 	, m_cpCurrentTimeZone(0)
 	, m_pDefaultTimeZone(0)
 	, m_nitzSetting(TimePrefsHandler::NITZ_TimeEnable | TimePrefsHandler::NITZ_TZEnable)
@@ -381,10 +401,18 @@ TimePrefsHandler::TimePrefsHandler(LSPalmService* service)
     , m_immNitzZoneValid(false)
 	, m_p_lastNitzParameter(0)
 	, m_lastNitzFlags(0)
+	, m_lastNitzReportFlags(0)
+	, m_lastNitzReportSetting(0)
+	, m_lastNitzReportStamp(0)
+	, m_lastNitzReportApplied(false)
 	, m_gsource_periodic(NULL)
     , m_gsource_periodic_id(0)
     , m_timeoutCycleCount(0)
     , m_sendWakeupSetToPowerD(true)
+    , m_nextDstTransition(0)
+    , m_dstTransitionSourceId(0)
+    , m_sendDstAlarmToPowerD(false)
+	, m_timeChangeLaunchSourceId(0)
 	, m_lastNtpUpdate(0)
     , m_nitzTimeZoneAvailable(true)
 	, m_currentTimeSourcePriority(lowestTimeSourcePriority)
@@ -395,12 +423,22 @@ TimePrefsHandler::TimePrefsHandler(LSPalmService* service)
 	if (!s_inst)
 		s_inst=this;
 
+	//the values lists besides timeZone (which has its own string) are fixed
+	enableValuesCache();
 	init();
 }
 
 TimePrefsHandler::~TimePrefsHandler()
 {
-
+	if (m_dstTransitionSourceId)
+		g_source_remove(m_dstTransitionSourceId);
+	if (m_timeChangeLaunchSourceId)
+		g_source_remove(m_timeChangeLaunchSourceId);
+	for (std::map<LSMessageToken, guint>::const_iterator it = m_timeChangeLaunchesInFlight.begin();
+			it != m_timeChangeLaunchesInFlight.end(); ++it)
+		g_source_remove(it->second);
+
+	delete [] m_zoneStore;
 }
 
 std::list<std::string> TimePrefsHandler::keys() const
@@ -555,69 +593,59 @@ json_object* TimePrefsHandler::valuesForKey(const std::string& key)
 
 json_object * TimePrefsHandler::timeZoneListAsJson()
 {
-	if (TimePrefsHandler::s_timeZonesJson != NULL)
-		return json_object_get(TimePrefsHandler::s_timeZonesJson);		//"copy" it!
-
-	return (NULL);
+	return json_object_from_file(const_cast<char*>(s_tzFile));
 }
 
-bool TimePrefsHandler::isValidTimeZoneName(const std::string& tzName)
+static gboolean cbReleaseTimeZonesJson(gpointer data)
 {
-	if (TimePrefsHandler::s_timeZonesJson == NULL)
-		return false;
+	s_timeZonesJsonReleaseSource = 0;
+	std::string().swap(s_timeZonesJsonTransient);
+	return FALSE;
+}
 
-	json_object * label = json_object_object_get(TimePrefsHandler::s_timeZonesJson, "timeZone");
-	if (!label) {
-		return false;
-	}
+const std::string& TimePrefsHandler::timeZoneListAsJsonString()
+{
+	if (!s_timeZonesJsonString.empty())
+		return s_timeZonesJsonString;
+	if (!s_timeZonesJsonTransient.empty())
+		return s_timeZonesJsonTransient;
 
-	array_list * srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-		return false;
+	std::string serialized;
+	json_object * json = timeZoneListAsJson();
+	if (json) {
+		serialized = json_object_to_json_string(json);
+		json_object_put(json);
 	}
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
 
-		//parse out the TZ name
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (!label) {
-			continue;
-		}
-		const char * tzname = json_object_get_string(label);
-		if (tzname == NULL) {
-			continue;
-		}
-		if (tzName == tzname)
-			return true;
+	int budget = Settings::settings()->m_zoneListBudget;
+	if (budget > 0 && serialized.size() <= (size_t) budget * 1024) {
+		s_timeZonesJsonString.swap(serialized);
+		return s_timeZonesJsonString;
 	}
 
-	label = json_object_object_get(TimePrefsHandler::s_timeZonesJson, "syszones");
-	if (!label) {
-		return false;
-	}
+	//the callers are done with it by the time the main loop gets back to idles
+	s_timeZonesJsonTransient.swap(serialized);
+	if (!s_timeZonesJsonReleaseSource)
+		s_timeZonesJsonReleaseSource = g_idle_add(cbReleaseTimeZonesJson, NULL);
+	return s_timeZonesJsonTransient;
+}
 
-	srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-		return false;
-	}
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
+const std::string* TimePrefsHandler::serializedValuesForKey(const std::string& key)
+{
+	//the zone list is hundreds of KB; everything else is small enough to build each time
+	if (key != "timeZone")
+		return 0;
 
-		//parse out the TZ name
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (!label) {
-			continue;
-		}
-		const char * tzname = json_object_get_string(label);
-		if (tzname == NULL) {
-			continue;
-		}
-		if (tzName == tzname)
-			return true;
-	}
+	const std::string& zoneList = timeZoneListAsJsonString();
+	if (zoneList.empty())
+		return 0;
 
-	return false;
+	return &zoneList;
+}
 
+bool TimePrefsHandler::isValidTimeZoneName(const std::string& tzName)
+{
+	return timeZone_ZoneFromName(tzName) != 0;
 }
 
 static json_object * presetValues_boolean()
@@ -700,49 +728,18 @@ static bool validateFor_timeZone( TimePrefsHandler * pTimePrefsHandler,const jso
  */
 std::string TimePrefsHandler::getDefaultTZFromJson(TimeZoneInfo * r_pZoneInfo)
 {
-	if (s_timeZonesJson == NULL)
+	//the first entry with a "default" key - I actually don't care if it's true or false...its mere existence
+	//is enough to consider this a default. The table only keeps its index if the entry is usable
+	if (s_timeZoneTableLoaded && s_timeZoneTable.defaultZone >= 0 && r_pZoneInfo)
 	{
-		if (r_pZoneInfo)
-			*r_pZoneInfo = s_failsafeDefaultZone;
-		return s_failsafeDefaultZone.jsonStringValue;
-	}
-
-	json_object * label = json_object_object_get(s_timeZonesJson, "timeZone");
-	if (!label) {
-        qWarning() << "error on json object: it doesn't contain a timezones array";
-		if (r_pZoneInfo)
-			*r_pZoneInfo = s_failsafeDefaultZone;
-		return s_failsafeDefaultZone.jsonStringValue;
-	}
-
-	array_list * srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-        qWarning("error on json object: it doesn't contain a timezones array");
-		if (r_pZoneInfo)
-			*r_pZoneInfo = s_failsafeDefaultZone;
-		return s_failsafeDefaultZone.jsonStringValue;
-	}
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
-
-		//look for "default" boolean
-		label = json_object_object_get(obj,(char*)"default");
-		if (!label)
-			continue;
-
-		//found it - I actually don't care if it's true or false...its mere existence is enough to 
-		//consider this a default. 
-
-		if (r_pZoneInfo)
-		{
-			if (TimePrefsHandler::jsonUtil_ZoneFromJson(obj,*r_pZoneInfo) == false)
-			{
-				*r_pZoneInfo = s_failsafeDefaultZone;
-				return (s_failsafeDefaultZone.jsonStringValue);
-			}
-			else
-			    return (r_pZoneInfo->jsonStringValue);
-		}
+		const TimeZoneTable::Zone& zone = s_timeZoneTable.zones[s_timeZoneTable.defaultZone];
+		r_pZoneInfo->offsetToUTC = zone.offsetFromUTC;
+		r_pZoneInfo->preferred = zone.preferred;
+		r_pZoneInfo->dstSupported = zone.supportsDST;
+		r_pZoneInfo->name = zone.zoneId;
+		r_pZoneInfo->countryCode = s_timeZoneTable.defaultCountryCode;
+		r_pZoneInfo->jsonStringValue = zone.json;
+		return (r_pZoneInfo->jsonStringValue);
 	}
 
 	if (r_pZoneInfo)
@@ -847,22 +844,13 @@ void TimePrefsHandler::init()
     m_serviceHandlePublic = LSPalmServiceGetPublicConnection(m_service);
     m_serviceHandlePrivate = LSPalmServiceGetPrivateConnection(m_service);
 
-	if (!s_timeZonesJson) {		//or else I'll leak
-		s_timeZonesJson = json_object_from_file(const_cast<char*>(s_tzFile));
-		if (!s_timeZonesJson)
-			s_timeZonesJson = NULL;
-		else {
-			json_object* ja = json_object_object_get(s_timeZonesJson,(char *)"timeZone");
-			if (ja) {
-				int s = json_object_array_length(ja);
-				qDebug("%d timezones loaded from [%s]",s,s_tzFile);
-			}
-			json_object* jsa = json_object_object_get(s_timeZonesJson,(char *)"syszones");
-			if (jsa) {
-				int s = json_object_array_length(jsa);
-				qDebug("%d sys timezones loaded from [%s]",s,s_tzFile);
-			}
-
+	if (!s_timeZoneTableLoaded) {
+		//only parses the json if the snapshot is stale
+		s_timeZoneTableLoaded = s_timeZoneTable.load(s_tzFile, s_tzSnapshotFile, NULL);
+		s_timeZonesJsonString.clear();
+		if (s_timeZoneTableLoaded) {
+			qDebug("%zu timezones loaded from [%s]",s_timeZoneTable.zones.size(),s_tzFile);
+			qDebug("%zu sys timezones loaded from [%s]",s_timeZoneTable.sysZones.size(),s_tzFile);
 		}
 	}
 
@@ -1049,71 +1037,26 @@ std::string TimePrefsHandler::tzNameFromJsonString(const std::string& TZJson)
 }
 
 /**
- * Scans s_timeZonesJson for ZoneID == tzName. Returns that json object as a string, or "" if none found
+ * Looks up the zone with ZoneID == tzName. Returns that zone's json object as a string, or "" if none found
  * 
  * 
  */
 
 std::string TimePrefsHandler::getQualifiedTZIdFromName(const std::string& tzName)
 {
-	if ((tzName.length() == 0) || (s_timeZonesJson == NULL))
-		return std::string("");
-
-	json_object * label = json_object_object_get(s_timeZonesJson, "timeZone");
-	if (!label) {
-        qWarning() << "error on json object: it doesn't contain a timezones array";
-		return std::string("");
-	}
-
-	array_list * srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-        qWarning() << "error on json object: it doesn't contain a timezones array";
-		return std::string("");
-	}
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
-
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (!label)
-			continue;
-
-		std::string zoneId = json_object_get_string(label);
-		if (zoneId == tzName)
-			return (std::string(json_object_to_json_string(obj)));
-
-	}
-
-	//try the sys zones
-
-	label = json_object_object_get(s_timeZonesJson, "syszones");
-	if (!label) {
-        qWarning() << "error on json object: it doesn't contain a syszones array";
+	if (!s_inst)
 		return std::string("");
-	}
 
-	srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-        qWarning() << "error on json object: it doesn't contain a syszones array";
+	const TimeZoneInfo* tz = s_inst->timeZone_ZoneFromName(tzName);
+	if (!tz)
 		return std::string("");
-	}	
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
 
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (!label)
-			continue;
-
-		std::string zoneId = json_object_get_string(label);
-		if (zoneId == tzName)
-			return (std::string(json_object_to_json_string(obj)));
-	}
-		
-	return std::string("");
+	return tz->jsonStringValue;
 }
 
 std::string TimePrefsHandler::getQualifiedTZIdFromJson(const std::string& jsonTz)
 {
-	if ((jsonTz.length() == 0) || (s_timeZonesJson == NULL))
+	if ((jsonTz.length() == 0) || (!s_timeZoneTableLoaded))
 		return std::string("");
 
 	std::string tzName;
@@ -1134,142 +1077,62 @@ std::string TimePrefsHandler::getQualifiedTZIdFromJson(const std::string& jsonTz
 	}
 	json_object_put(jsontzRoot);
 
-	label = json_object_object_get(s_timeZonesJson, "timeZone");
-	if (!label) {
-        qWarning() << "error on json object: it doesn't contain a timezones array";
-		return std::string("");
-	}
-
-	array_list * srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-        qWarning() << "error on json object: it doesn't contain a timezones array";
-		return std::string("");
-	}
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
-
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (!label)
-			continue;
-
-		std::string zoneId = json_object_get_string(label);
-		if (zoneId == tzName)
-			return (std::string(json_object_to_json_string(obj)));
-
-	}
-
-	//try the sys zones
-
-	label = json_object_object_get(s_timeZonesJson, "syszones");
-	if (!label) {
-        qWarning() << "error on json object: it doesn't contain a syszones array";
-		return std::string("");
-	}
-
-	srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-        qWarning() << "error on json object: it doesn't contain a syszones array";
-		return std::string("");
-	}	
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
-
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (!label)
-			continue;
-
-		std::string zoneId = json_object_get_string(label);
-		if (zoneId == tzName)
-			return (std::string(json_object_to_json_string(obj)));
-	}
-
-	return std::string("");
+	return getQualifiedTZIdFromName(tzName);
 }
 
-//a replacement for the scanTimeZoneFile so that I only need to deal with 1 file...see init() for where the json obj is created
+//a replacement for the scanTimeZoneFile so that I only need to deal with 1 file...see init() for where the zone table is loaded
 void TimePrefsHandler::scanTimeZoneJson()
 {
-	std::string name;
-	std::string countryCode;
-	int offset;
-	bool pref;
-	int supportsDst;
-	int mcc;
+	StartupProfile::Phase phase("scanTimeZoneJson");
+
 	std::map<int,PreferredZones> tmpPrefZoneMap;
 	std::map<int,PreferredZones>::iterator tmpPrefZoneMapIter;
 	std::map<std::string,std::set<int> > tmpCountryZoneCounterMap;
 
-	if (s_timeZonesJson == NULL) {
+	if (!s_timeZoneTableLoaded) {
 	    qWarning () << "no json loaded";
 		return;
 	}
 
-	json_object * label = json_object_object_get(TimePrefsHandler::s_timeZonesJson, "timeZone");
-	if (!label) {
-        qWarning() << "invalid json; missing timeZone array";
-		return;
-	}
-	else if (!(json_object_is_type(label,json_type_array))) {
-        qWarning() << "invalid json; timeZone is not an array";
+	if (m_zoneStore) {
+		qWarning () << "zone json already scanned";
 		return;
 	}
 
-	array_list * srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-        qWarning() << "invalid json; timeZone array invalid";
-		return;
-	}
+	//size the store up front so the pointers into it stay put
+	size_t storeCapacity = s_timeZoneTable.mccZones.size();
+	for (TimeZoneTable::ZoneList::const_iterator zoneIt = s_timeZoneTable.zones.begin();
+		 zoneIt != s_timeZoneTable.zones.end(); ++zoneIt)
+		storeCapacity += zoneIt->complete ? 1 : 0;
+	for (TimeZoneTable::ZoneList::const_iterator zoneIt = s_timeZoneTable.sysZones.begin();
+		 zoneIt != s_timeZoneTable.sysZones.end(); ++zoneIt)
+		storeCapacity += zoneIt->complete ? 1 : 0;
 
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
+	m_zoneStore = new TimeZoneInfo[storeCapacity]();
+	m_timeZonesForOffsetCache.clear();
+	m_zoneList.reserve(storeCapacity);
+	m_syszoneList.reserve(s_timeZoneTable.sysZones.size());
 
-		if (!obj)
-			continue;
+	for (TimeZoneTable::ZoneList::const_iterator zoneIt = s_timeZoneTable.zones.begin();
+		 zoneIt != s_timeZoneTable.zones.end(); ++zoneIt) {
 
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (!label) {
+		if (!zoneIt->complete)
 			continue;
-		}
-
-		name = json_object_get_string(label);
-
-		label = json_object_object_get(obj,(char*)"offsetFromUTC");
-		if (!label) {
-			continue;
-		}
-
-		offset = json_object_get_int(label);
 
-		label = json_object_object_get(obj,(char*)"supportsDST");
-		if (!label) {
-			continue;
-		}
-
-		supportsDst = json_object_get_int(label);
-
-		label = json_object_object_get(obj,(char*)"preferred");
-		if (!label) {
-			pref=false;
-		}
-		else
-			pref = json_object_get_boolean(label);
-
-		label = json_object_object_get(obj, (char*)"CountryCode");
-		if (label)
-			countryCode = json_object_get_string(label);
-		else
-			countryCode = "";
+		int offset = zoneIt->offsetFromUTC;
+		int supportsDst = zoneIt->supportsDST;
+		bool pref = zoneIt->preferred;
 
 		//update "counter map"
-		tmpCountryZoneCounterMap[countryCode].insert(offset);
+		tmpCountryZoneCounterMap[zoneIt->countryCode].insert(offset);
 
-		TimeZoneInfo* tz = new TimeZoneInfo;
+		TimeZoneInfo* tz = &m_zoneStore[m_zoneStoreSize++];
 		tz->offsetToUTC = offset;
 		tz->preferred = pref;
 		tz->dstSupported = supportsDst;
-		tz->name = name;
-		tz->countryCode = countryCode;
-		tz->jsonStringValue = json_object_to_json_string(obj);
+		tz->name = zoneIt->zoneId;
+		tz->countryCode = zoneIt->countryCode;
+		tz->jsonStringValue = zoneIt->json;
 
 		tmpPrefZoneMapIter = tmpPrefZoneMap.find(tz->offsetToUTC);
 		if (tmpPrefZoneMapIter == tmpPrefZoneMap.end()) {
@@ -1299,7 +1162,14 @@ void TimePrefsHandler::scanTimeZoneJson()
 
 		m_zoneList.push_back(tz);
 
-		m_offsetZoneMultiMap.insert(TimeZonePair(offset, tz));
+		m_zonesByOffset[offset].push_back(tz);
+
+		OffsetCountryKey key;
+		key.offset = offset;
+		key.countryCode = tz->countryCode;
+		m_zonesByOffsetAndCountry[key].push_back(tz);
+
+		m_zoneByName.insert(TimeZoneNameMap::value_type(tz->name, tz));
 
 	}
 
@@ -1309,7 +1179,18 @@ void TimePrefsHandler::scanTimeZoneJson()
 		(*it)->howManyZonesForCountry = tmpCountryZoneCounterMap[(*it)->countryCode].size();
 	}
 
-	//go through the temp map and assign values to the final dst and non-dst maps
+	for (std::map<std::string,std::set<int> >::const_iterator it = tmpCountryZoneCounterMap.begin();
+		 it != tmpCountryZoneCounterMap.end(); ++it)
+	{
+		int index = countryCodeIndex(it->first);
+		if (index >= 0 && it->second.size() > 1)
+			m_multiZoneCountries.set(index);
+	}
+
+	//go through the temp map and assign values to the final dst and non-dst maps; it's in offset order,
+	//so these just append
+	m_preferredTimeZoneMapDST.reserve(tmpPrefZoneMap.size());
+	m_preferredTimeZoneMapNoDST.reserve(tmpPrefZoneMap.size());
 	for (tmpPrefZoneMapIter = tmpPrefZoneMap.begin();tmpPrefZoneMapIter != tmpPrefZoneMap.end();++tmpPrefZoneMapIter) {
 		int off_key = (*tmpPrefZoneMapIter).second.offset;
 
@@ -1352,129 +1233,44 @@ void TimePrefsHandler::scanTimeZoneJson()
 	}
 
 	//now grab the "syszones"...these are the default, generic, timezones that get set in case NITZ supplies "dstinvalid"
+	m_sysZoneByOffset.reserve(s_timeZoneTable.sysZones.size());
 
-	label = json_object_object_get(s_timeZonesJson, "syszones");
-	if (!label) {
-        qWarning() << "invalid json; missing syszones array";
-		return;
-	}
-	else if (!(json_object_is_type(label,json_type_array))) {
-        qWarning() << "invalid json; syszones is not an array";
-		return;
-	}
-
-	srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-        qWarning() << "invalid json; syszones array invalid";
-		return;
-	}
-
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
+	for (TimeZoneTable::ZoneList::const_iterator zoneIt = s_timeZoneTable.sysZones.begin();
+		 zoneIt != s_timeZoneTable.sysZones.end(); ++zoneIt) {
 
-		if (!obj)
+		if (!zoneIt->complete)
 			continue;
 
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (!label) {
-			continue;
-		}
-
-		name = json_object_get_string(label);
-
-		label = json_object_object_get(obj,(char*)"offsetFromUTC");
-		if (!label) {
-			continue;
-		}
-
-		offset = json_object_get_int(label);
-
-		TimeZoneInfo* tz = new TimeZoneInfo;
-		tz->offsetToUTC = offset;
+		TimeZoneInfo* tz = &m_zoneStore[m_zoneStoreSize++];
+		tz->offsetToUTC = zoneIt->offsetFromUTC;
 		tz->preferred = false;
 		tz->dstSupported = 0;
 		//setTZIName(tz,name.c_str());
-		tz->name = name;
-		tz->jsonStringValue = json_object_to_json_string(obj);
+		tz->name = zoneIt->zoneId;
+		tz->jsonStringValue = zoneIt->json;
 
 		m_syszoneList.push_back(tz);
+
+		m_zoneByName.insert(TimeZoneNameMap::value_type(tz->name, tz));
+		m_sysZoneByOffset.insert(std::make_pair(tz->offsetToUTC, (const TimeZoneInfo*) tz));
 	}
 
 	//now grab the time zone info for known MCCs...
 	// This is used to correct problems in many networks' NITZ data
+	m_mccZoneInfoMap.reserve(s_timeZoneTable.mccZones.size());
 
-	label = json_object_object_get(s_timeZonesJson, "mccInfo");
-	if (!label) {
-        qWarning() << "invalid json; missing mccInfo array";
-		return;
-	}
-	else if (!(json_object_is_type(label,json_type_array))) {
-        qWarning() << "invalid json; mccInfo is not an array";
-		return;
-	}
-	
-	srcJsonArray = json_object_get_array(label);
-	if (!srcJsonArray) {
-        qWarning() << "invalid json; mccInfo array invalid";
-		return;
-	}
-
-	for (int i = 0; i < array_list_length(srcJsonArray); i++) {
-		json_object* obj = static_cast<json_object*>(array_list_get_idx(srcJsonArray, i));
-
-		if (!obj)
-			continue;
-
-		label = json_object_object_get(obj,(char*)"ZoneID");
-		if (label) {
-			name = json_object_get_string(label);
-		}
-		else
-			name = "";
-
-		label = json_object_object_get(obj, (char*)"CountryCode");
-		if (label)
-			countryCode = json_object_get_string(label);
-		else
-			countryCode = "";
-			
-		label = json_object_object_get(obj,(char*)"offsetFromUTC");
-		if (!label) {
-			continue;
-		}
-
-		offset = json_object_get_int(label);
-		
-		label = json_object_object_get(obj,(char*)"supportsDST");
-		if (!label) {
-			continue;
-		}
-
-		supportsDst = json_object_get_int(label);
-				
-		label = json_object_object_get(obj,(char*)"mcc");
-		if (!label) {
-			continue;
-		}
+	for (TimeZoneTable::ZoneList::const_iterator zoneIt = s_timeZoneTable.mccZones.begin();
+		 zoneIt != s_timeZoneTable.mccZones.end(); ++zoneIt) {
 
-		mcc = json_object_get_int(label);
-
-		TimeZoneInfo* tz = new TimeZoneInfo;
-		tz->offsetToUTC = offset;
+		TimeZoneInfo* tz = &m_zoneStore[m_zoneStoreSize++];
+		tz->offsetToUTC = zoneIt->offsetFromUTC;
 		tz->preferred = false;
-		tz->dstSupported = supportsDst;
-		tz->countryCode = countryCode;
-		if (name.size()) {
-			//setTZIName(tz,name.c_str());
-			tz->name = name;
-			tz->jsonStringValue = json_object_to_json_string(obj);
-		}
-		else {
-			tz->name = "";
-			tz->jsonStringValue = "";
-		}
-		m_mccZoneInfoMap[mcc] = tz;
-		
+		tz->dstSupported = zoneIt->supportsDST;
+		tz->countryCode = zoneIt->countryCode;
+		//setTZIName(tz,name.c_str());
+		tz->name = zoneIt->zoneId;
+		tz->jsonStringValue = zoneIt->json;
+		m_mccZoneInfoMap[zoneIt->mcc] = tz;
 	}
 
 }
@@ -1524,17 +1320,65 @@ void TimePrefsHandler::systemSetTimeZone(const std::string &tzFileActual, const
 			zoneInfo.name.c_str(), zoneInfo.offsetToUTC);
 	tzsetWorkaround(zoneInfo.name.c_str());
     __qMessage("TZ env is now [%s]", getenv("TZ"));
+
+	scheduleNextDstTransition();
+}
+
+// seconds; larger slewThreshold settings are cut down to this
+static const int s_maxSlewThreshold = 2;
+
+long TimePrefsHandler::pendingSlewUsecs()
+{
+	struct timex tx;
+	memset(&tx, 0, sizeof(tx));
+	tx.modes = ADJ_OFFSET_SS_READ;
+	if (adjtimex(&tx) < 0) return 0;
+	return tx.offset;
 }
 
 bool TimePrefsHandler::systemSetTime(time_t deltaTime, const std::string &source)
 {
-	struct timeval timeVal;
-	timeVal.tv_sec = time(0) + deltaTime;
-	timeVal.tv_usec = 0;
-	qDebug("%s: settimeofday: %u",__FUNCTION__,(unsigned int)timeVal.tv_sec);
+	// clocks and broadcast time were already moved by the whole of the last slew; whatever of it
+	// hasn't happened yet is dropped by a step or a new slew, so they get that part back
+	long pendingUsecs = deltaTime == 0 ? 0 : pendingSlewUsecs();
+	time_t pending = (pendingUsecs + (pendingUsecs < 0 ? -500000 : 500000)) / 1000000;
+
+	// at the kernel's 500ppm even 2 seconds take over an hour to slew in; anything bigger is better stepped
+	int threshold = std::min(Settings::settings()->m_timeSlewThreshold, s_maxSlewThreshold);
+	bool slew = threshold > 0 && source != ClockHandler::manual &&
+	            deltaTime <= threshold && deltaTime >= -threshold;
+
+	int rc = 0;
+	if (deltaTime == 0)
+	{
+		// nothing to set
+	}
+	else if (slew)
+	{
+		struct timex tx;
+		memset(&tx, 0, sizeof(tx));
+		tx.modes = ADJ_OFFSET_SINGLESHOT;
+		// long is 32 bits on arm; the threshold keeps this well inside it
+		tx.offset = (long) ((int64_t) deltaTime * 1000000);
+		rc = adjtimex(&tx) < 0 ? -1 : 0;
+		PmLogInfo(sysServiceLogContext(), "SLEW_SYSTEM_TIME", 3,
+			PMLOGKS("SOURCE", source.c_str()),
+			PMLOGKFV("OFFSET", "%ld", deltaTime),
+			PMLOGKFV("CANCELLED_USEC", "%ld", pendingUsecs),
+			"adjtimex %s", ( rc == 0 ? "succeeded" : "failed")
+		);
+	}
+	else
+	{
+		struct timeval timeVal;
+		timeVal.tv_sec = time(0) + deltaTime;
+		timeVal.tv_usec = 0;
+		qDebug("%s: settimeofday: %u",__FUNCTION__,(unsigned int)timeVal.tv_sec);
+
+		rc = settimeofday(&timeVal, 0);
+		qDebug("settimeofday %s", ( rc == 0 ? "succeeded" : "failed"));
+	}
 
-	int rc = deltaTime == 0 ? 0 : settimeofday(&timeVal, 0);
-	qDebug("settimeofday %s", ( rc == 0 ? "succeeded" : "failed"));
     if (rc == 0)
     {
 		// remember last synchronized with time
@@ -1542,14 +1386,25 @@ bool TimePrefsHandler::systemSetTime(time_t deltaTime, const std::string &source
 		PrefsDb::instance()->setPref("lastSystemTimeSource", m_systemTimeSourceTag);
 		// next time "micom" will come we'll use this clock tag instead
 
+		// a slew is counted as done right away: offsets from time sources are measured against the system
+		// time, which is on its way to where this puts it
+		time_t adjustment = deltaTime - pending;
+
 		// TODO: drop direct broadcastTime adjust in favor of signal and clocks
-		m_broadcastTime.adjust(deltaTime);
+		m_broadcastTime.adjust(adjustment);
 
-		systemTimeChanged.fire(deltaTime);
+		systemTimeChanged.fire(adjustment);
 
-		postSystemTimeChange();
-		if (isSystemTimeBroadcastEffective()) postBroadcastEffectiveTimeChange();
-		launchAppsOnTimeChange();
+		// no jump anyone would need to hear about
+		if (!slew)
+		{
+			//the wall clock moved, so the timer to the next transition is off by deltaTime
+			scheduleNextDstTransition();
+
+			postSystemTimeChange();
+			if (isSystemTimeBroadcastEffective()) postBroadcastEffectiveTimeChange();
+			launchAppsOnTimeChange();
+		}
     }
 
 	// if we had valid NTP in our system-time we destroy it here
@@ -1643,30 +1498,22 @@ void TimePrefsHandler::postSystemTimeChange()
 	if (!m_cpCurrentTimeZone)
 		return;
 
-	LSError lsError;
-	json_object* json = 0;
-	LSErrorInit(&lsError);
-
-	json = json_object_new_object();
-	attachSystemTime(json);
-
-	//the new "sub"keys for nitz validity...
 	//the new "sub"keys for nitz validity...
+	std::string extra;
 	if (isNITZTimeEnabled())
-		json_object_object_add(json,(char*) "NITZValidTime", json_object_new_boolean(m_immNitzTimeValid));
-	if (isNITZTZEnabled())
-		json_object_object_add(json,(char*) "NITZValidZone", json_object_new_boolean(m_immNitzZoneValid));
-
-	const char * reply = json_object_to_json_string(json);
+		extra += m_immNitzTimeValid ? "\"NITZValidTime\":true" : "\"NITZValidTime\":false";
+	if (isNITZTZEnabled()) {
+		if (!extra.empty())
+			extra += ',';
+		extra += m_immNitzZoneValid ? "\"NITZValidZone\":true" : "\"NITZValidZone\":false";
+	}
 
 	std::string subKeyStr = std::string("getSystemTime");
-	std::string subValStr = std::string(reply);
+	std::string subValStr = systemTimeReply(extra);
 	PrefsFactory::instance()->postPrefChangeValueIsCompleteString(subKeyStr,subValStr);
-
-	json_object_put(json);    
 }
 
-void TimePrefsHandler::attachSystemTime(json_object *json)
+std::string TimePrefsHandler::systemTimeReply(const std::string &extra)
 {
 	time_t utctime = time(NULL);
 	struct tm localTm;
@@ -1676,17 +1523,43 @@ void TimePrefsHandler::attachSystemTime(json_object *json)
 	assert( pLocalTm == &localTm );
 	(void) pLocalTm; // unused variable (in release)
 
-	json_object_object_add(json, "utc", json_object_new_int(utctime));
-	json_object *localtime_json = json_object_new_object();
-	json_object_object_add(localtime_json, "year", json_object_new_int(localTm.tm_year + 1900));
-	json_object_object_add(localtime_json, "month", json_object_new_int(localTm.tm_mon + 1));
-	json_object_object_add(localtime_json, "day", json_object_new_int(localTm.tm_mday));
-	json_object_object_add(localtime_json, "hour", json_object_new_int(localTm.tm_hour));
-	json_object_object_add(localtime_json, "minute", json_object_new_int(localTm.tm_min));
-	json_object_object_add(localtime_json, "second", json_object_new_int(localTm.tm_sec));
-	json_object_object_add(json, "localtime", localtime_json);
+	// what the rest of the reply is made of; all of it is at hand without a syscall
+	SystemTimeTemplate &tmpl = m_systemTimeTemplate;
+	std::string nitzValidity;
+	(void) PrefsDb::instance()->getPref("nitzValidity", nitzValidity);
+	if (!tmpl.valid || tmpl.zone != currentTimeZone() || tmpl.gmtOffset != localTm.tm_gmtoff ||
+	    tmpl.isDst != localTm.tm_isdst || tmpl.source != getSystemTimeSource() || tmpl.nitzValidity != nitzValidity)
+	{
+		tmpl.zone = currentTimeZone();
+		tmpl.gmtOffset = localTm.tm_gmtoff;
+		tmpl.isDst = localTm.tm_isdst;
+		tmpl.source = getSystemTimeSource();
+		tmpl.nitzValidity = nitzValidity;
+		tmpl.tail = buildSystemTimeTail(localTm, nitzValidity);
+		tmpl.valid = true;
+	}
+
+	char head[192];
+	snprintf(head, sizeof(head),
+		"{\"utc\":%ld,\"localtime\":{\"year\":%d,\"month\":%d,\"day\":%d,\"hour\":%d,\"minute\":%d,\"second\":%d},",
+		(long) utctime, localTm.tm_year + 1900, localTm.tm_mon + 1, localTm.tm_mday,
+		localTm.tm_hour, localTm.tm_min, localTm.tm_sec);
+
+	std::string reply(head);
+	reply += tmpl.tail;
+	if (!extra.empty()) {
+		reply += ',';
+		reply += extra;
+	}
+	reply += '}';
+	return reply;
+}
+
+std::string TimePrefsHandler::buildSystemTimeTail(struct tm &localTm, const std::string &nitzValidity)
+{
+	json_object *json = json_object_new_object();
 
-	json_object_object_add(json, "offset", json_object_new_int(offsetToUtcSecs()/60));
+	json_object_object_add(json, "offset", json_object_new_int(localTm.tm_gmtoff / 60));
 
 	if (currentTimeZone()) {
 		json_object_object_add(json, "timezone", json_object_new_string(currentTimeZone()->name.c_str()));
@@ -1705,12 +1578,22 @@ void TimePrefsHandler::attachSystemTime(json_object *json)
 
 	json_object_object_add(json, "systemTimeSource", json_object_new_string(getSystemTimeSource().c_str()));
 
-	std::string nitzValidity = PrefsDb::instance()->getPref("nitzValidity");
-
 	if (nitzValidity == NITZVALIDITY_STATE_NITZVALID)
 		json_object_object_add(json, "NITZValid", json_object_new_boolean(true));
 	else if (nitzValidity == NITZVALIDITY_STATE_NITZINVALIDUSERNOTSET)
 		json_object_object_add(json, "NITZValid", json_object_new_boolean(false));
+
+	// the members without the braces around them, to be spliced into the reply
+	std::string tail = json_object_to_json_string(json);
+	json_object_put(json);
+
+	size_t first = tail.find('{') + 1;
+	size_t last = tail.rfind('}');
+	while (first < last && tail[first] == ' ')
+		++first;
+	while (last > first && tail[last - 1] == ' ')
+		--last;
+	return tail.substr(first, last - first);
 }
 
 
@@ -1746,13 +1629,33 @@ void TimePrefsHandler::postNitzValidityStatus()
 }
 
 
+//one time change tends to come as several (NITZ, then NTP, then the DST fix-up); their launches go out together
+static const guint s_timeChangeLaunchDelay = 2000;	//ms after the first change
+//launches waiting on applicationManager at once; the rest wait for replies
+static const size_t s_maxTimeChangeLaunchesInFlight = 2;
+//s a launch may keep its slot; an applicationManager that never answers mustn't hold up the rest for good
+static const guint s_timeChangeLaunchTimeout = 10;
+
 void TimePrefsHandler::launchAppsOnTimeChange()
 {
+	//the window starts at the first change and isn't pushed back by later ones
+	if (m_timeChangeLaunchSourceId)
+		return;
 
-	bool rc;
-	LSError lsError;
-	LSErrorInit(&lsError);
+	m_timeChangeLaunchSourceId = g_timeout_add(s_timeChangeLaunchDelay, cbTimeChangeLaunchDelay, this);
+}
+
+gboolean TimePrefsHandler::cbTimeChangeLaunchDelay(gpointer userData)
+{
+	TimePrefsHandler* th = static_cast<TimePrefsHandler*>(userData);
+	th->m_timeChangeLaunchSourceId = 0;
+	th->queueTimeChangeLaunches();
+	th->startTimeChangeLaunches();
+	return FALSE;
+}
 
+void TimePrefsHandler::queueTimeChangeLaunches()
+{
 	//grab the pref and parse out the json
 	std::string rawCurrentPref = PrefsDb::instance()->getPref("timeChangeLaunch");
 	struct json_object * storedJson = json_tokener_parse(rawCurrentPref.c_str());
@@ -1765,6 +1668,7 @@ void TimePrefsHandler::launchAppsOnTimeChange()
 	struct json_object * storedJson_listArray = Utils::JsonGetObject(storedJson,"launchList");
 	if (storedJson_listArray == NULL) {
 		//nothing to do
+		json_object_put(storedJson);
 		return;
 	}
 
@@ -1777,6 +1681,11 @@ void TimePrefsHandler::launchAppsOnTimeChange()
 			continue;		//something really bad happened; something was stored in the list w/o an appId!
 		}
 		std::string appId = json_object_get_string(label);
+
+		//an app still waiting from an earlier change gets launched once, not again
+		if (!m_timeChangeLaunchQueued.insert(appId).second)
+			continue;
+
 		label = Utils::JsonGetObject(storedJson_listObject,"parameters");
 		std::string launchStr;
 		if (label)
@@ -1784,18 +1693,74 @@ void TimePrefsHandler::launchAppsOnTimeChange()
 		else
 			launchStr = std::string("{ \"id\":\"")+appId+std::string("\", \"params\":\"\" }");
 
-		LSErrorInit(&lsError);
-		rc = LSCall(getPrivateHandle(),
-				"luna://com.palm.applicationManager/launch",
-				launchStr.c_str(),
-				NULL,NULL,NULL, &lsError);
+		m_timeChangeLaunchQueue.push_back(std::make_pair(appId, launchStr));
+	}
+
+	json_object_put(storedJson);
+}
+
+void TimePrefsHandler::startTimeChangeLaunches()
+{
+	LSError lsError;
+
+	while (m_timeChangeLaunchesInFlight.size() < s_maxTimeChangeLaunchesInFlight && !m_timeChangeLaunchQueue.empty()) {
+		std::pair<std::string, std::string> launch = m_timeChangeLaunchQueue.front();
+		m_timeChangeLaunchQueue.pop_front();
+		m_timeChangeLaunchQueued.erase(launch.first);
+
+		LSErrorInit(&lsError);
+		LSMessageToken token = LSMESSAGE_TOKEN_INVALID;
+		if (LSCallOneReply(getPrivateHandle(),
+				"luna://com.palm.applicationManager/launch",
+				launch.second.c_str(),
+				cbTimeChangeLaunchResponse,this,&token, &lsError)) {
+			m_timeChangeLaunchesInFlight[token] = g_timeout_add_seconds(s_timeChangeLaunchTimeout,
+					cbTimeChangeLaunchTimeout, GSIZE_TO_POINTER(token));
+		}
+		else {
+			qWarning("failed to launch %s on time change: %s", launch.first.c_str(), lsError.message);
+			LSErrorFree(&lsError);
+		}
+	}
+}
+
+bool TimePrefsHandler::cbTimeChangeLaunchResponse(LSHandle* lsHandle, LSMessage *message,
+								void *user_data)
+{
+	TimePrefsHandler* th = static_cast<TimePrefsHandler*>(user_data);
+	th->finishTimeChangeLaunch(LSMessageGetResponseToken(message), false);
+	return true;
+}
+
+gboolean TimePrefsHandler::cbTimeChangeLaunchTimeout(gpointer userData)
+{
+	//the source goes away with the handler, so s_inst is still it
+	LSMessageToken token = GPOINTER_TO_SIZE(userData);
+	qWarning("applicationManager didn't answer a time change launch within %u s, going on without it",
+			s_timeChangeLaunchTimeout);
+	s_inst->finishTimeChangeLaunch(token, true);
+	return FALSE;
+}
+
+void TimePrefsHandler::finishTimeChangeLaunch(LSMessageToken token, bool timedOut)
+{
+	std::map<LSMessageToken, guint>::iterator it = m_timeChangeLaunchesInFlight.find(token);
+	if (it == m_timeChangeLaunchesInFlight.end())
+		return;
 
-		if (!rc) {
+	if (timedOut) {
+		//so a late reply doesn't come in for a slot that has been given away
+		LSError lsError;
+		LSErrorInit(&lsError);
+		if (!LSCallCancel(getPrivateHandle(), token, &lsError))
 			LSErrorFree(&lsError);
-			LSErrorInit(&lsError);
-		}
+	}
+	else {
+		g_source_remove(it->second);
 	}
 
+	m_timeChangeLaunchesInFlight.erase(it);
+	startTimeChangeLaunches();
 }
 
 time_t TimePrefsHandler::offsetToUtcSecs() const
@@ -1882,19 +1847,15 @@ const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromOffset(int offset,int dst
 
 			std::string countryCode = tzMcc->countryCode;
 
-			// All timezones wih matching offset
-			std::pair<TimeZoneMultiMapConstIterator, TimeZoneMultiMapConstIterator> iterPair
-				= m_offsetZoneMultiMap.equal_range(offset);
+			// All timezones wih matching offset, narrowed down to those matching the MCC code
+			OffsetCountryKey key;
+			key.offset = offset;
+			key.countryCode = countryCode;
+			TimeZoneOffsetCountryMap::const_iterator matchIt = m_zonesByOffsetAndCountry.find(key);
 
-			// narrow down list to those matching the MCC code
-			TimeZoneInfoList mccMatchingTzList;			
-			for (TimeZoneMultiMapConstIterator iter = iterPair.first; iter != iterPair.second; ++iter) {
-				if (iter->second->countryCode == countryCode) {
-					mccMatchingTzList.push_back(iter->second);
-				}
-			}
+			if (matchIt != m_zonesByOffsetAndCountry.end() && !matchIt->second.empty()) {
 
-			if (!mccMatchingTzList.empty()) {
+				const TimeZoneInfoList& mccMatchingTzList = matchIt->second;
 
 //				if (dstValue == 1) {
 					
@@ -1972,17 +1933,11 @@ const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromOffset(int offset,int dst
 
 const TimeZoneInfo* TimePrefsHandler::timeZone_GenericZoneFromOffset(int offset) const
 {
-
-	//scan the sys zones list
-	for (TimeZoneInfoListConstIterator 	it = m_syszoneList.begin();
-									it != m_syszoneList.end();
-									it++) 
-	{
-		TimeZoneInfo * zc = *it;
-		if (zc->offsetToUTC == offset)
-			return zc;
-	}
-	return NULL;
+	//the first sys zone with the offset
+	FlatMap<int,const TimeZoneInfo*>::const_iterator it = m_sysZoneByOffset.find(offset);
+	if (it == m_sysZoneByOffset.end())
+		return NULL;
+	return it->second;
 }
 
 const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromMCC(int mcc,int mnc) const
@@ -1998,23 +1953,11 @@ const TimeZoneInfo* TimePrefsHandler::timeZone_ZoneFromName(const std::string& n
 	if (name.empty())
 		return 0;
 
-	for (TimeZoneInfoList::const_iterator it = m_zoneList.begin();
-		 it != m_zoneList.end(); ++it) {
-		TimeZoneInfo* z = (TimeZoneInfo*) (*it);
-
-		if (z->name == name)
-			return z;
-	}
-
-	for (TimeZoneInfoList::const_iterator it = m_syszoneList.begin();
-	it != m_syszoneList.end(); ++it) {
-		TimeZoneInfo* z = (TimeZoneInfo*) (*it);
-
-		if (z->name == name)
-			return z;
-	}
+	TimeZoneNameMap::const_iterator it = m_zoneByName.find(name);
+	if (it == m_zoneByName.end())
+		return 0;
 
-	return 0;
+	return it->second;
 }
 
 const TimeZoneInfo* TimePrefsHandler::timeZone_GetDefaultZoneFailsafe()
@@ -2043,9 +1986,27 @@ const TimeZoneInfo* TimePrefsHandler::timeZone_GetDefaultZoneFailsafe()
 bool TimePrefsHandler::isCountryAcrossMultipleTimeZones(const TimeZoneInfo& tzinfo) const
 {
 	//placeholder fn in case this logic needs to get more complex
+	int index = countryCodeIndex(tzinfo.countryCode);
+	if (index >= 0)
+		return m_multiZoneCountries.test(index);
+
 	return ((tzinfo.howManyZonesForCountry) > 1);
 }
 
+//static
+int TimePrefsHandler::countryCodeIndex(const std::string& countryCode)
+{
+	if (countryCode.size() != 2)
+		return -1;
+
+	int first = countryCode[0] - 'A';
+	int second = countryCode[1] - 'A';
+	if (first < 0 || first >= 26 || second < 0 || second >= 26)
+		return -1;
+
+	return first * 26 + second;
+}
+
 /*!
 \page com_palm_systemservice_time
 \n
@@ -2111,15 +2072,13 @@ bool TimePrefsHandler::cbSetSystemTime(LSHandle* lshandle, LSMessage *message,
 							void *user_data)
 {
     // {"utc": integer/string}
-    jvalue_ref schema_v4 = convert_schema_v2_to_v4(STRICT_SCHEMA(
+    static const CompiledSchema & s_schema = compileSchema(STRICT_SCHEMA(
 		PROPS_1(
 			"\"utc\":{\"type\":[\"integer\",\"string\"]}"
 		)
 
 		REQUIRED_1( utc )));
-    LSMessageJsonParser parser(message, jvalue_tostring_simple(schema_v4));
-    if (!jis_null(schema_v4))
-	j_release(&schema_v4);
+    LSMessageJsonParser parser(message, s_schema);
 
 	ESchemaErrorOptions schErrOption = static_cast<ESchemaErrorOptions>(Settings::settings()->schemaValidationOption);
 	if (!parser.parse(__FUNCTION__, lshandle, schErrOption))
@@ -2348,7 +2307,7 @@ bool TimePrefsHandler::cbSetSystemNetworkTime(LSHandle * lshandle, LSMessage *me
         }
     */
     const char* pSchema = SCHEMA_15(REQUIRED(sec, string), REQUIRED(min, string), REQUIRED(hour, string), REQUIRED(mday, string), REQUIRED(mon, string), REQUIRED(year, string), REQUIRED(offset, string), REQUIRED(mcc, string), REQUIRED(mnc, string), REQUIRED(tzvalid, boolean), REQUIRED(timevalid, boolean), REQUIRED(dstvalid, boolean), REQUIRED(dst, integer), REQUIRED(timestamp, string), REQUIRED(tilIgnore, boolean));
-    VALIDATE_SCHEMA_AND_RETURN(lshandle, message, pSchema);
+    VALIDATE_SCHEMA_PARSE_AND_RETURN(lshandle, message, pSchema, parser);
 
 	PmLogInfo(sysServiceLogContext(), "SET_SYSTEM_NET_TIME", 1,
 		PMLOGKS("SENDER", LSMessageGetSenderServiceName(message)),
@@ -2359,7 +2318,9 @@ bool TimePrefsHandler::cbSetSystemNetworkTime(LSHandle * lshandle, LSMessage *me
 	LSError lserror;
 	std::string errorText;
 
-	json_object* label = 0;
+	pbnjson::JValue root = parser.get();
+	std::string field;
+	bool flag = false;
 	int rc=0;
 	int utcOffset=-1;
 	struct tm timeStruct;
@@ -2371,7 +2332,10 @@ bool TimePrefsHandler::cbSetSystemNetworkTime(LSHandle * lshandle, LSMessage *me
 	int mnc = 0;
 	time_t remotetimeStamp = 0;
 	NitzParameters nitzParam;
+	NitzParameters nitzReport;
 	int nitzFlags = 0;
+	int nitzEntryFlags = 0;
+	bool repeatedReport = false;
 	std::string nitzFnMsg;
 
 	TimePrefsHandler* th = (TimePrefsHandler*)user_data;
@@ -2380,97 +2344,75 @@ bool TimePrefsHandler::cbSetSystemNetworkTime(LSHandle * lshandle, LSMessage *me
 	if( !str )
 		return false;
 
-	json_object* root = json_tokener_parse(str);
-	if (!root) {
-		root = 0;
+	//the schema validation parsed it already
+	if (root.isNull()) {
 		errorText = std::string("unable to parse json");
 		goto Done_cbSetSystemNetworkTime;
 	}
-	if (!json_object_is_type(root, json_type_object)) {
+	if (!root.isObject()) {
 		errorText = std::string("unable to validate json");
 		goto Done_cbSetSystemNetworkTime;
 	}
 
 	memset(&timeStruct,0,sizeof(struct tm));
-	qDebug("NITZ message received from Telephony Service: %s",str);
+	SYSSERVICE_DEBUG("NITZ message received from Telephony Service: %s",str);
 
-	label = json_object_object_get(root, "sec");
-	if (!label)
+	if (!parser.get("sec",field))
 		++rc;
 	else
-		timeStruct.tm_sec = strtol(json_object_get_string(label),0,10);
-	label = json_object_object_get(root, "min");
-	if (!label)
+		timeStruct.tm_sec = strtol(field.c_str(),0,10);
+	if (!parser.get("min",field))
 		++rc;
 	else
-		timeStruct.tm_min = strtol(json_object_get_string(label),0,10);
-	label = json_object_object_get(root, "hour");
-	if (!label)
+		timeStruct.tm_min = strtol(field.c_str(),0,10);
+	if (!parser.get("hour",field))
 		++rc;
 	else
-		timeStruct.tm_hour = strtol(json_object_get_string(label),0,10);
-	label = json_object_object_get(root, "mday");
-	if (!label)
+		timeStruct.tm_hour = strtol(field.c_str(),0,10);
+	if (!parser.get("mday",field))
 		++rc;
 	else
-		timeStruct.tm_mday = strtol(json_object_get_string(label),0,10);
-	label = json_object_object_get(root, "mon");
-	if (!label)
+		timeStruct.tm_mday = strtol(field.c_str(),0,10);
+	if (!parser.get("mon",field))
 		++rc;
 	else
-		timeStruct.tm_mon = strtol(json_object_get_string(label),0,10);
-	label = json_object_object_get(root, "year");
-	if (!label)
+		timeStruct.tm_mon = strtol(field.c_str(),0,10);
+	if (!parser.get("year",field))
 		++rc;
 	else
-		timeStruct.tm_year = strtol(json_object_get_string(label),0,10);
+		timeStruct.tm_year = strtol(field.c_str(),0,10);
 
-	label = json_object_object_get(root, "offset");
-	if (label)
-		utcOffset = strtol(json_object_get_string(label),0,10);
+	if (parser.get("offset",field))
+		utcOffset = strtol(field.c_str(),0,10);
 	else
 		utcOffset = -1000;					// this is an invalid value so it can be detected later on
 
-	label = json_object_object_get(root, "mcc");
-	if (label)
-		mcc = strtol(json_object_get_string(label),0,10);
+	if (parser.get("mcc",field))
+		mcc = strtol(field.c_str(),0,10);
 	else
 		mcc = 0;
 
-	label = json_object_object_get(root, "mnc");
-	if (label)
-		mnc = strtol(json_object_get_string(label),0,10);
+	if (parser.get("mnc",field))
+		mnc = strtol(field.c_str(),0,10);
 	else
 		mnc = 0;
 
-	label = json_object_object_get(root, "tzvalid");
-	if (label)
-		tzValid = json_object_get_boolean(label);
-	else 
+	if (!parser.get("tzvalid",tzValid))
 		tzValid = false;
 
 	dbg_time_tzvalidOverride(tzValid);
 	
-	label = json_object_object_get(root, "timevalid");
-	if (label)
-		timeValid = json_object_get_boolean(label);
-	else
+	if (!parser.get("timevalid",timeValid))
 		timeValid = false;
 
 	dbg_time_timevalidOverride(timeValid);
 
-	label = json_object_object_get(root, "dstvalid");
-	if (label)
-		dstValid = json_object_get_boolean(label);
-	else
+	if (!parser.get("dstvalid",dstValid))
 		dstValid = false;
 
 	dbg_time_dstvalidOverride(dstValid);
 
-	label = json_object_object_get(root, "dst");
-	if (label)
-		dst = json_object_get_int(label);
-	else
+	if (!parser.get("dst",dst))
 		dst = 0;
 
 	//additional param checks
@@ -2478,20 +2420,16 @@ bool TimePrefsHandler::cbSetSystemNetworkTime(LSHandle * lshandle, LSMessage *me
 		tzValid = false;
 
 	//check to see if there is a valid timestamp
-	label = json_object_object_get(root, "timestamp");
-	if (label)
-		remotetimeStamp = strtoul(json_object_get_string(label),0,10);
+	if (parser.get("timestamp",field))
+		remotetimeStamp = strtoul(field.c_str(),0,10);
 	else
 		remotetimeStamp = 0;			//...I suppose this can be valid in some cases...like for "threshold" seconds when the time() clock rolls over [not a big deal]
 
-	label = json_object_object_get(root, "tilIgnore");
-	if (label)
-	{
-		if (json_object_get_boolean(label))
-			nitzFlags |= NITZHANDLER_FLAGBIT_IGNORE_TIL_SET;
-	}
+	if (parser.get("tilIgnore",flag) && flag)
+		nitzFlags |= NITZHANDLER_FLAGBIT_IGNORE_TIL_SET;
 
 	nitzParam = NitzParameters(timeStruct,utcOffset,dst,mcc,mnc,timeValid,tzValid,dstValid,remotetimeStamp);	//wasteful copy but this fn isn't called much
+	nitzReport = nitzParam;
 
 	//run the nitz chain
 	if (th->nitzHandlerEntry(nitzParam,nitzFlags,nitzFnMsg) != NITZHANDLER_RETURN_SUCCESS)
@@ -2499,6 +2437,24 @@ bool TimePrefsHandler::cbSetSystemNetworkTime(LSHandle * lshandle, LSMessage *me
 		errorText = "nitz message failed entry: "+nitzFnMsg;
 		goto Done_cbSetSystemNetworkTime;
 	}
+	nitzEntryFlags = nitzFlags;
+
+	//modems tend to resend the same report; once it is applied, a repeat only needs the clock part
+	if (th->isRepeatedNitzReport(nitzReport,nitzEntryFlags))
+	{
+		qDebug("NITZ report repeats the last applied one...skipping zone selection");
+		repeatedReport = true;
+		nitzFlags |= NITZHANDLER_FLAGBIT_REPEAT;
+		if (th->nitzHandlerTimeValue(nitzParam,nitzFlags,nitzFnMsg) != NITZHANDLER_RETURN_SUCCESS)
+		{
+			errorText = "nitz message failed in time-value handler: "+nitzFnMsg;
+			goto Done_cbSetSystemNetworkTime;
+		}
+		th->rememberNitzReport(nitzReport,nitzEntryFlags);
+		goto Done_cbSetSystemNetworkTime;
+	}
+	th->m_lastNitzReportApplied = false;
+
 	if (th->nitzHandlerTimeValue(nitzParam,nitzFlags,nitzFnMsg) != NITZHANDLER_RETURN_SUCCESS)
 	{
 		errorText = "nitz message failed in time-value handler: "+nitzFnMsg;
@@ -2527,35 +2483,31 @@ bool TimePrefsHandler::cbSetSystemNetworkTime(LSHandle * lshandle, LSMessage *me
 		*(th->m_p_lastNitzParameter) = nitzParam;
 
 	th->m_lastNitzFlags = nitzFlags;
+	th->rememberNitzReport(nitzReport,nitzEntryFlags);
 
 Done_cbSetSystemNetworkTime:
 
-	//start the timeout cycle for completing NITZ processing later
-	th->startTimeoutCycle();
-
-	if (root)
-		json_object_put(root);
-
-	root = json_object_new_object();
+	//start the timeout cycle for completing NITZ processing later (a repeat leaves nothing to complete)
+	if (!repeatedReport)
+		th->startTimeoutCycle();
 
+	JsonReplyBuilder reply;
 	if (errorText.empty())
 	{
 		//success
-		json_object_object_add(root,"returnValue",json_object_new_boolean(true));
-
+		reply.put("returnValue",true);
 	}
 	else
 	{
-		json_object_object_add(root,"returnValue",json_object_new_boolean(false));
-		json_object_object_add(root,"errorText",json_object_new_string(errorText.c_str()));
+		reply.put("returnValue",false);
+		reply.put("errorText",errorText);
         qWarning() << errorText.c_str();
 	}
 
 	LSErrorInit(&lserror);
-	if (!LSMessageReply( lshandle, message,json_object_to_json_string(root), &lserror )) {
+	if (!LSMessageReply( lshandle, message,reply.c_str(), &lserror )) {
 		LSErrorFree (&lserror);
 	}
-	json_object_put(root);
 
 	return true;
 
@@ -2606,7 +2558,8 @@ int  TimePrefsHandler::nitzHandlerTimeValue(NitzParameters& nitz,int& flags,std:
 
 	if (nitz._timevalid)
 	{
-		signalReceivedNITZUpdate(true,false);
+		if ((flags & NITZHANDLER_FLAGBIT_REPEAT) == 0)
+			signalReceivedNITZUpdate(true,false);		//already done for the report this one repeats
 		return NITZHANDLER_RETURN_SUCCESS;			//the time was already set by the TIL...nothing to do, so exit
 	}
 
@@ -2716,6 +2669,47 @@ int  TimePrefsHandler::nitzHandlerExit(NitzParameters& nitz,int& flags,std::stri
 	return NITZHANDLER_RETURN_SUCCESS;
 }
 	
+bool TimePrefsHandler::isRepeatedNitzReport(const NitzParameters& nitz,int flags) const
+{
+	if (!m_lastNitzReportApplied)
+		return false;
+
+	const NitzParameters& last = m_lastNitzReport;
+	if ((nitz._offset != last._offset) || (nitz._dst != last._dst)
+		|| (nitz._mcc != last._mcc) || (nitz._mnc != last._mnc)
+		|| (nitz._timevalid != last._timevalid) || (nitz._tzvalid != last._tzvalid)
+		|| (nitz._dstvalid != last._dstvalid))
+		return false;
+
+	//anything that changed what the chain would do since then
+	if ((flags != m_lastNitzReportFlags) || (m_nitzSetting != m_lastNitzReportSetting))
+		return false;
+	if ((m_cpCurrentTimeZone == NULL) || (m_cpCurrentTimeZone->name != m_lastNitzReportZone))
+		return false;
+
+	//the reported time has to have moved on with the clock, give or take drift
+	struct tm lastTm = last._timeStruct;
+	struct tm nitzTm = nitz._timeStruct;
+	time_t lastUtc = timegm(&lastTm);
+	time_t nitzUtc = timegm(&nitzTm);
+	if ((lastUtc == (time_t)-1) || (nitzUtc == (time_t)-1))
+		return false;
+
+	time_t expected = lastUtc + (currentStamp() - m_lastNitzReportStamp);
+	time_t drift = (nitzUtc > expected ? nitzUtc - expected : expected - nitzUtc);
+	return (drift <= s_nitzRepeatDriftThreshold);
+}
+
+void TimePrefsHandler::rememberNitzReport(const NitzParameters& nitz,int flags)
+{
+	m_lastNitzReport = nitz;
+	m_lastNitzReportFlags = flags;
+	m_lastNitzReportSetting = m_nitzSetting;
+	m_lastNitzReportZone = (m_cpCurrentTimeZone ? m_cpCurrentTimeZone->name : std::string());
+	m_lastNitzReportStamp = currentStamp();
+	m_lastNitzReportApplied = true;
+}
+
 void  TimePrefsHandler::nitzHandlerSpecialCaseOffsetValue(NitzParameters& nitz,int& flags,std::string& r_statusMsg)
 {
 	//Special Case #1:  If the MCC is France (208), and the offset value is 120, then flip that to offset 60, tzvalid=true, dst=1, dstvalid=true
@@ -3124,6 +3118,188 @@ void TimePrefsHandler::setPeriodicTimeSetWakeup()
 }
 
 
+/*
+ * Rather than having clients poll around DST changes, the next offset change of the current zone is read
+ * off its zone file and a single wakeup is set for it: a glib timeout for while the device is awake (it
+ * runs on the monotonic clock, so it falls behind across a suspend) and a powerd alarm for when it wasn't.
+ * Whichever arrives first posts the time change and schedules the transition after it.
+ */
+void TimePrefsHandler::scheduleNextDstTransition()
+{
+	if (m_dstTransitionSourceId) {
+		g_source_remove(m_dstTransitionSourceId);
+		m_dstTransitionSourceId = 0;
+	}
+
+	time_t previous = m_nextDstTransition;
+	m_nextDstTransition = 0;
+
+	if (m_cpCurrentTimeZone == NULL)
+		return;
+
+	TzZonePtr zone = loadTimeZone(m_cpCurrentTimeZone->name.c_str());
+	if (!zone)
+		return;
+
+	time_t now = time(NULL);
+	TzTransition next;
+	if (!zone->nextOffsetChangeAfter(now, next)) {
+		qDebug("%s: no upcoming offset change in [%s]", __FUNCTION__, m_cpCurrentTimeZone->name.c_str());
+		return;
+	}
+
+	m_nextDstTransition = next.time;
+
+	//one second late rather than early; the source is only second-accurate
+	guint interval = (guint) (m_nextDstTransition - now) + 1;
+	m_dstTransitionSourceId = g_timeout_add_seconds(interval, cbDstTransitionTimeout, this);
+
+	qDebug("%s: next offset change in [%s] at %ld (in %u seconds)", __FUNCTION__,
+			m_cpCurrentTimeZone->name.c_str(), (long) m_nextDstTransition, interval);
+
+	//the alarm is keyed, so setting it again just moves it
+	if (m_nextDstTransition != previous || m_sendDstAlarmToPowerD)
+		setDstTransitionWakeup();
+}
+
+void TimePrefsHandler::setDstTransitionWakeup()
+{
+	if (getPrivateHandle() == NULL)
+	{
+		//not yet on the bus
+		m_sendDstAlarmToPowerD = true;
+		return;
+	}
+
+	if (m_nextDstTransition == 0)
+	{
+		m_sendDstAlarmToPowerD = false;
+		return;
+	}
+
+	struct tm atTm;
+	time_t at = m_nextDstTransition + 1;
+	if (gmtime_r(&at, &atTm) == NULL)
+		return;
+
+	char atStr[32];
+	strftime(atStr, sizeof(atStr), "%m/%d/%Y %H:%M:%S", &atTm);
+
+	//no wakeup: if the device is asleep the change only matters once it wakes, and powerd delivers it then
+	std::string payload = std::string("{\"key\":\"sysservice_dst_transition\",\"at\":\"")
+							+ atStr
+							+ std::string("\",\"wakeup\":false,\"uri\":\"palm://com.palm.systemservice/time/dstTransition\",\"params\":\"{}\"}");
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSCall(getPrivateHandle(), "palm://com.palm.power/timeout/set", payload.c_str(),
+				cbSetDstTransitionPowerDResponse, this, NULL, &lserror))
+	{
+		qWarning() << "call to powerD failed";
+		LSErrorFree(&lserror);
+		m_sendDstAlarmToPowerD = true;
+	}
+	else
+	{
+		m_sendDstAlarmToPowerD = false;
+	}
+}
+
+void TimePrefsHandler::dstTransitionReached()
+{
+	//both the timeout and the alarm end up here; only the first one past the transition is a change
+	if (m_nextDstTransition && time(NULL) >= m_nextDstTransition) {
+		__qMessage("offset change in [%s] reached", m_cpCurrentTimeZone ? m_cpCurrentTimeZone->name.c_str() : "");
+		postSystemTimeChange();
+		launchAppsOnTimeChange();
+	}
+
+	scheduleNextDstTransition();
+}
+
+//static
+gboolean TimePrefsHandler::cbDstTransitionTimeout(gpointer userData)
+{
+	TimePrefsHandler* th = (TimePrefsHandler*) userData;
+
+	//this source is done either way; dstTransitionReached() adds the next one
+	th->m_dstTransitionSourceId = 0;
+	th->dstTransitionReached();
+	return FALSE;
+}
+
+/*!
+\page com_palm_systemservice_time
+\n
+\section com_palm_systemservice_time_dst_transition dstTransition
+
+\e Private.
+
+com.palm.systemservice/time/dstTransition
+
+Called by the powerd alarm set for the current time zone's next offset change. If that change has been
+reached, time change subscribers are notified and the timeChangeLaunch apps are launched; either way the
+alarm for the following change is set.
+
+\subsection com_palm_systemservice_time_dst_transition_syntax Syntax:
+\code
+{
+}
+\endcode
+
+\subsection com_palm_systemservice_time_dst_transition_returns Returns:
+\code
+{
+    "returnValue": true
+}
+\endcode
+*/
+//static
+bool TimePrefsHandler::cbDstTransition(LSHandle* lsHandle, LSMessage *message,
+							void *user_data)
+{
+	EMPTY_SCHEMA_RETURN(lsHandle, message);
+
+	TimePrefsHandler* th = (TimePrefsHandler*) user_data;
+	if (th == NULL)
+		return false;
+
+	th->dstTransitionReached();
+
+	LSError lsError;
+	LSErrorInit(&lsError);
+	if (!LSMessageReply(lsHandle, message, "{\"returnValue\":true}", &lsError))
+		LSErrorFree(&lsError);
+
+	return true;
+}
+
+//static
+bool TimePrefsHandler::cbSetDstTransitionPowerDResponse(LSHandle* lsHandle, LSMessage *message,
+							void *user_data)
+{
+	TimePrefsHandler* th = (TimePrefsHandler*) user_data;
+	const char* str = LSMessageGetPayload(message);
+	if (!str || !th)
+		return false;
+
+	json_object* root = json_tokener_parse(str);
+	bool returnValue = false;
+	if (root && json_object_is_type(root, json_type_object)) {
+		json_object* label = Utils::JsonGetObject(root, "returnValue");
+		returnValue = label && json_object_get_boolean(label);
+	}
+	if (root)
+		json_object_put(root);
+
+	if (!returnValue)
+		qWarning("powerd refused the dst transition alarm: %s", str);
+
+	//retry when powerd reconnects
+	th->m_sendDstAlarmToPowerD = !returnValue;
+	return true;
+}
+
 bool TimePrefsHandler::isNTPAllowed()
 {
 	return (PrefsDb::instance()->getPref("AllowNTPTime") == "true");
@@ -3231,14 +3407,12 @@ luna-send -n 1 -f luna://com.palm.systemservice/time/setTimeWithNTP '{}'
 bool TimePrefsHandler::cbSetTimeWithNTP(LSHandle* lsHandle, LSMessage *message,
                                         void *user_data)
 {
-    jvalue_ref schema_v4 = convert_schema_v2_to_v4(STRICT_SCHEMA(
+    static const CompiledSchema & s_schema = compileSchema(STRICT_SCHEMA(
 		PROPS_1(
 			WITHDEFAULT(source, string, "unknown")
 		)
 	));
-    LSMessageJsonParser parser(message, jvalue_tostring_simple(schema_v4));
-    if (!jis_null(schema_v4))
-	j_release(&schema_v4);
+    LSMessageJsonParser parser(message, s_schema);
 
 	ESchemaErrorOptions schErrOption = static_cast<ESchemaErrorOptions>(Settings::settings()->schemaValidationOption);
 	if (!parser.parse(__FUNCTION__, lsHandle, schErrOption))
@@ -3396,6 +3570,8 @@ bool TimePrefsHandler::cbServiceStateTracker(LSHandle* lsHandle, LSMessage *mess
 			//powerD is connected, and the flag is set to schedule a periodic wakeup for NTP
 			th->setPeriodicTimeSetWakeup();
 		}
+		if ((isConnected) && (th->m_sendDstAlarmToPowerD))
+			th->setDstTransitionWakeup();
 	}
     else if (serviceName == "com.palm.telephony") {
 		if (isConnected)
@@ -3494,7 +3670,7 @@ bool TimePrefsHandler::cbGetSystemTime(LSHandle* lsHandle, LSMessage *message,
     bool        retVal;
 	LSError     lsError;
 	const char* reply = 0;
-	json_object* json = 0;
+	std::string replyStr;
 	
 	TimePrefsHandler* th = (TimePrefsHandler*) user_data;
 
@@ -3516,10 +3692,8 @@ bool TimePrefsHandler::cbGetSystemTime(LSHandle* lsHandle, LSMessage *message,
 			subscribed=true;
 	}
 
-	json = json_object_new_object();
-	th->attachSystemTime(json);
-
-	reply = json_object_to_json_string(json);
+	replyStr = th->systemTimeReply();
+	reply = replyStr.c_str();
 
 	//**DEBUG validate for correct UTF-8 output
 	 if (!g_utf8_validate (reply, -1, NULL))
@@ -3533,9 +3707,6 @@ Done:
 	if (!retVal)
 		LSErrorFree (&lsError);
 
-	if (json)
-		json_object_put(json);
-
 	return true;
 }
 
@@ -3957,12 +4128,14 @@ Converts a date from one timezone to another.
 \code
 {
     "date": string,
+    "dates": string array,
     "source_tz": string,
     "dest_tz": string
 }
 \endcode
 
-\param date Date to convert as a string in format: "Y-m-d H:M:S". Required.
+\param date Date to convert as a string in format: "Y-m-d H:M:S". Either this or dates is required.
+\param dates Several dates to convert in one call, each in the same format as date.
 \param source_tz Source timezone. Required.
 \param dest_tz Destination timezone. Required.
 
@@ -3971,17 +4144,20 @@ Converts a date from one timezone to another.
 {
     "returnValue": boolean,
     "date": string,
+    "dates": string array,
     "errorText": string
 }
 \endcode
 
 \param returnValue Indicates if the call was succesful.
 \param date The date in the new destination timezone if call was succesful.
+\param dates The converted dates, in the order given, if dates was passed. One bad date fails the whole call.
 \param errorText Description of the error if call was not succesful.
 
 \subsection com_palm_systemservice_time_convert_date_examples Examples:
 \code
 luna-send -n 1 -f luna://com.palm.systemservice/time/convertDate '{ "date": "1982-12-06 17:25:33", "source_tz": "America/Los_Angeles", "dest_tz":"America/New_York" }'
+luna-send -n 1 -f luna://com.palm.systemservice/time/convertDate '{ "dates": ["1982-12-06 17:25:33", "1983-07-01 09:00:00"], "source_tz": "America/Los_Angeles", "dest_tz":"America/New_York" }'
 \endcode
 
 Example response for a succesful call:
@@ -3992,6 +4168,14 @@ Example response for a succesful call:
 }
 \endcode
 
+Example response for a succesful call with dates:
+\code
+{
+    "returnValue": true,
+    "dates": [ "Mon Dec  6 20:25:33 1982\n", "Fri Jul  1 12:00:00 1983\n" ]
+}
+\endcode
+
 Example response for a failed call:
 \code
 {
@@ -4000,25 +4184,92 @@ Example response for a failed call:
 }
 \endcode
 */
+// converts one "Y-m-d H:M:S" date from source_tz to dest_tz, in ctime() format. Works off the parsed zone
+// files; only dates the transition tables don't cover are left to mktime() with TZ switched over
+static bool convertOneDate(const char* date, const char* source_tz, const TzZonePtr& sourceZone,
+						   const char* dest_tz, const TzZonePtr& destZone, std::string& r_date, gchar** r_errorText)
+{
+	struct tm local_tm;
+	char buf[64];
+	time_t local_time;
+	time_t utc_time;
+	time_t dest_offset;
+
+	memset(&local_tm, 0, sizeof(local_tm));
+	const char* bad_char = strptime(date, "%Y-%m-%d %H:%M:%S", &local_tm);
+	if (NULL == bad_char) {
+		*r_errorText = g_strdup_printf("unrecognized date format: '%s'", date);
+		return false;
+	} else if (*bad_char != '\0') {
+		*r_errorText = g_strdup_printf("unrecognized characters in date: '%s'", date);
+		return false;
+	}
+
+	local_time = timegm(&local_tm);
+
+	if (sourceZone && destZone &&
+		sourceZone->utcFromLocal(local_time, utc_time) &&
+		destZone->utcOffsetAt(utc_time, dest_offset)) {
+
+		struct tm dest_tm;
+		time_t dest_time = utc_time + dest_offset;
+		if (!gmtime_r(&dest_time, &dest_tm) || !asctime_r(&dest_tm, buf)) {
+			*r_errorText = g_strdup_printf("date out of range: '%s'", date);
+			return false;
+		}
+	}
+	else {
+		// outside the tables (past the last transition the zone's rule string applies), let libc do it
+		const char* current_tz = getenv("TZ");
+		std::string saved_tz = current_tz ? current_tz : "";
+
+		local_tm.tm_isdst = -1;
+		set_tz(source_tz);
+		local_time = mktime(&local_tm);
+		set_tz(dest_tz);
+		bool converted = (ctime_r(&local_time, buf) != NULL);
+
+		// the rest of the service relies on TZ being the system zone
+		if (current_tz) {
+			set_tz(saved_tz.c_str());
+		}
+		else {
+			unsetenv("TZ");
+			tzset();
+		}
+
+		if (!converted) {
+			*r_errorText = g_strdup_printf("date out of range: '%s'", date);
+			return false;
+		}
+	}
+
+	qDebug("%s: %s in %s is %s in %s", __func__, date, source_tz, buf, dest_tz);
+	r_date = buf;
+	return true;
+}
+
 bool TimePrefsHandler::cbConvertDate(LSHandle* pHandle, LSMessage* pMessage, void* pUserData)
 {
+	ServiceStats::MethodTimer methodTimer(ServiceStats::MethodConvertDate);
 	const char* date = NULL;
 	const char* source_tz = NULL;
 	const char* dest_tz = NULL;
 	char *status = NULL;
 	char *error_text = NULL;
 	bool ret = false;
-	struct tm local_tm;
-	char * bad_char = NULL;
-	time_t local_time;
+	struct json_object *dates_o = NULL;
+	TzZonePtr sourceZone;
+	TzZonePtr destZone;
+	std::string converted;
 	const char * str = LSMessageGetPayload(pMessage);
 	if (str == NULL)
 		return false;
 
-     // {"date": string, "source_tz": string, "dest_tz": string}
+     // {"date": string, "dates": [string], "source_tz": string, "dest_tz": string}
     VALIDATE_SCHEMA_AND_RETURN(pHandle,
                                pMessage,
-                               SCHEMA_3(REQUIRED(date, string), REQUIRED(source_tz, string), REQUIRED(dest_tz, string)));
+                               SCHEMA_4(OPTIONAL(date, string), OPTIONAL(dates, array), REQUIRED(source_tz, string), REQUIRED(dest_tz, string)));
 
     //json_t* json_o = json_parse_document(str);
     struct json_object *json_o = json_tokener_parse(str);
@@ -4034,10 +4285,17 @@ bool TimePrefsHandler::cbConvertDate(LSHandle* pHandle, LSMessage* pMessage, voi
 	}
 
 	date = _json_get_string(json_o, "date");
-	if (!date) {
+	if (!json_object_object_get_ex(json_o, "dates", &dates_o))
+		dates_o = NULL;
+
+	if (!date && !dates_o) {
 		error_text = g_strdup("no date in payload");
 		goto respond;
 	}
+	if (date && dates_o) {
+		error_text = g_strdup("date and dates are exclusive");
+		goto respond;
+	}
 
 	source_tz = _json_get_string(json_o, "source_tz");
 	if (!source_tz) {
@@ -4051,17 +4309,6 @@ bool TimePrefsHandler::cbConvertDate(LSHandle* pHandle, LSMessage* pMessage, voi
 		goto respond;
 	}
 
-	qDebug("%s: converting %s from %s to %s", __func__, date, source_tz, dest_tz);
-	
-	bad_char = (char *) strptime(date, "%Y-%m-%d %H:%M:%S", &local_tm);
-	if (NULL == bad_char) {
-		error_text = g_strdup_printf("unrecognized date format: '%s'", date);
-		goto respond;
-	} else if (*bad_char != '\0') {
-		error_text = g_strdup_printf("unrecognized characters in date: '%s'", date);
-		goto respond;
-	}
-
 	if (!tz_exists(source_tz)) {
 		error_text = g_strdup_printf("timezone not found: '%s'", source_tz);
 		goto respond;
@@ -4072,20 +4319,45 @@ bool TimePrefsHandler::cbConvertDate(LSHandle* pHandle, LSMessage* pMessage, voi
 		goto respond;
 	}
 
-	set_tz(source_tz);
+	// cached after the first load, so a batch (or a run of calls) parses each zone file once
+	sourceZone = loadTimeZone(source_tz);
+	destZone = loadTimeZone(dest_tz);
 
-	local_time = mktime(&local_tm);
-    qDebug("0 date='%s' ctime='%s' local_time=%ld timezone=%ld", date, ctime(&local_time), local_time, timezone);
+	if (date) {
+		qDebug("%s: converting %s from %s to %s", __func__, date, source_tz, dest_tz);
 
-	if (!tz_exists(dest_tz)) {
-		error_text = g_strdup_printf("timezone not found: '%s'", dest_tz);
+		if (!convertOneDate(date, source_tz, sourceZone, dest_tz, destZone, converted, &error_text))
+			goto respond;
+
+		status = g_strdup_printf("{\"returnValue\":true,\"date\":\"%s\"}", converted.c_str());
 	}
+	else {
+		int count = json_object_array_length(dates_o);
+		qDebug("%s: converting %d dates from %s to %s", __func__, count, source_tz, dest_tz);
+
+		struct json_object *reply = json_object_new_object();
+		struct json_object *replyDates = json_object_new_array();
+		json_object_object_add(reply, "returnValue", json_object_new_boolean(true));
+		json_object_object_add(reply, "dates", replyDates);
+
+		for (int i = 0; i < count; ++i) {
+			struct json_object *item = json_object_array_get_idx(dates_o, i);
+			if (!item || !json_object_is_type(item, json_type_string)) {
+				error_text = g_strdup_printf("dates[%d] is not a string", i);
+				break;
+			}
 
-	set_tz(dest_tz);
-    qDebug("1 date='%s' ctime='%s' local_time=%ld timezone=%ld", date, ctime(&local_time), local_time, timezone);
+			if (!convertOneDate(json_object_get_string(item), source_tz, sourceZone, dest_tz, destZone,
+								converted, &error_text))
+				break;
+
+			json_object_array_add(replyDates, json_object_new_string(converted.c_str()));
+		}
 
-	g_assert(!error_text);
-	status = g_strdup_printf("{\"returnValue\":true,\"date\":\"%s\"}", ctime(&local_time));
+		if (!error_text)
+			status = g_strdup(json_object_to_json_string(reply));
+		json_object_put(reply);
+	}
 
 respond:
 	if (!status) {
@@ -4156,7 +4428,9 @@ void TimePrefsHandler::source_periodic_destroy(gpointer userData)
 
 com.palm.systemservice/time/launchTimeChangeApps
 
-Launch all applications on the timeChangeLaunch list. You can check what's on the list with:
+Launch all applications on the timeChangeLaunch list, the same way a time change does: after a two second
+delay that time changes arriving meanwhile share, with each app launched once. You can check what's on the
+list with:
 \code
 luna-send -n 1 -f luna://com.palm.systemservice/getPreferences '{"subscribe": false, "keys":["timeChangeLaunch"]}'
 \endcode
@@ -4236,16 +4510,21 @@ static void tzsetWorkaround(const char * newTZ) {
  * 
  */
 
-std::list<std::string> TimePrefsHandler::getTimeZonesForOffset(int offset)
+const std::list<std::string>& TimePrefsHandler::getTimeZonesForOffset(int offset)
 {
-	std::list<std::string> timeZones;
+	std::map<int,std::list<std::string> >::const_iterator cached = m_timeZonesForOffsetCache.find(offset);
+	if (cached != m_timeZonesForOffsetCache.end())
+		return cached->second;
+
+	std::list<std::string>& timeZones = m_timeZonesForOffsetCache[offset];
 
 	// All timezones wih matching offset
-	std::pair<TimeZoneMultiMapConstIterator, TimeZoneMultiMapConstIterator> iterPair
-		= m_offsetZoneMultiMap.equal_range(offset);
+	TimeZoneOffsetMap::const_iterator it = m_zonesByOffset.find(offset);
+	if (it == m_zonesByOffset.end())
+		return timeZones;
 
-	for (TimeZoneMultiMapConstIterator iter = iterPair.first; iter != iterPair.second; ++iter)
-		timeZones.push_back(iter->second->name);
+	for (TimeZoneInfoListConstIterator iter = it->second.begin(); iter != it->second.end(); ++iter)
+		timeZones.push_back((*iter)->name);
 
 	return timeZones;    
 }
@@ -4270,6 +4549,11 @@ void TimePrefsHandler::slotNetworkConnectionStateChanged(bool connected)
 	if ((m_lastNtpUpdate > 0) && (time_t)(m_lastNtpUpdate + timev) > currTime)
 		return;
 
+	//on marginal coverage the link comes and goes and the NTP attempts keep failing, so the check above
+	//never stops them; one attempt per holdoff is plenty
+	if (!NetworkConnectionListener::instance()->takeReconnectSync())
+		return;
+
 	PMLOG_TRACE("startBootstrapCycle");
     startBootstrapCycle(0);
 }
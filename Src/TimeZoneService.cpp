@@ -24,6 +24,9 @@
 
 #include <string>
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 
 #include "TimeZoneService.h"
 
@@ -32,6 +35,7 @@
 #include "TzParser.h"
 #include "Logging.h"
 #include "JSONUtils.h"
+#include "ServiceStats.h"
 
 static LSMethod s_methods[]  = {
 	{ "getTimeZoneRules",  TimeZoneService::cbGetTimeZoneRules },
@@ -57,6 +61,9 @@ TimeZoneService* TimeZoneService::instance()
 
 TimeZoneService::TimeZoneService()
 	: m_service(0)
+	, m_serviceHandlePublic(0)
+	, m_serviceHandlePrivate(0)
+	, m_easIndexYear(0)
 {
 }
 
@@ -112,6 +119,19 @@ com.palm.systemservice/timezone/getTimeZoneRules
 \param tz The timezone for which to get information. Required.
 \param years Array of years for which to get information. If not specified, information for the current year is returned.
 
+The entry array can also be wrapped in an object to pass options:
+\code
+{
+    "entries": [ { "tz": string, "years": [int array] } ],
+    "compact": boolean
+}
+\endcode
+
+\param entries The entry array described above. Required in this form.
+\param compact If true, results are grouped per timezone and each year is returned as an array of numbers instead of an object. Optional, defaults to false.
+
+Every timezone is read once per request, however many entries name it.
+
 \subsection com_palm_systemservice_timezone_get_time_zone_rules_returns Returns:
 \code
 {
@@ -194,6 +214,26 @@ Example responses for succesful calls:
 }
 \endcode
 
+Example of a compact request and its response:
+\code
+luna-send -n 1 -f luna://com.palm.systemservice/timezone/getTimeZoneRules '{"compact": true, "entries": [ {"tz": "Europe/Helsinki", "years": [2012, 2010]} ]}'
+\endcode
+\code
+{
+    "returnValue": true,
+    "fields": ["year", "hasDstChange", "utcOffset", "dstOffset", "dstStart", "dstEnd"],
+    "results": [
+        {
+            "tz": "Europe\/Helsinki",
+            "rules": [
+                [2012, 1, 7200, 10800, 1332637200, 1351386000],
+                [2010, 1, 7200, 10800, 1269738000, 1288486800]
+            ]
+        }
+    ]
+}
+\endcode
+
 Example response for a failed call:
 \code
 {
@@ -205,10 +245,13 @@ Example response for a failed call:
 bool TimeZoneService::cbGetTimeZoneRules(LSHandle* lsHandle, LSMessage *message,
 										 void *user_data)
 {
+	ServiceStats::MethodTimer methodTimer(ServiceStats::MethodGetTimeZoneRules);
 	std::string reply;
 	bool ret;
 	LSError lsError;
 	json_object* root = 0;
+	json_object* entryArray = 0;
+	bool compact = false;
 	TimeZoneEntryList entries;
 
 	LSErrorInit(&lsError);
@@ -227,14 +270,32 @@ bool TimeZoneService::cbGetTimeZoneRules(LSHandle* lsHandle, LSMessage *message,
 		goto Done;
 	}
 
-	if (!json_object_is_type(root, json_type_array)) {
+	if (json_object_is_type(root, json_type_object)) {
+		// { "entries": [...], "compact": bool }
+		json_object* l = json_object_object_get(root, "compact");
+		if (l) {
+			if (!json_object_is_type(l, json_type_boolean)) {
+				reply = "{\"returnValue\": false, "
+						" \"errorText\": \"compact entry is not boolean\"}";
+				goto Done;
+			}
+			compact = json_object_get_boolean(l);
+		}
+
+		entryArray = json_object_object_get(root, "entries");
+	}
+	else {
+		entryArray = root;
+	}
+
+	if (!entryArray || !json_object_is_type(entryArray, json_type_array)) {
 		reply = "{\"returnValue\": false, "
 				" \"errorText\": \"json root needs to be an array\"}";
 		goto Done;
 	}
 
-	for (int i = 0; i < json_object_array_length(root); i++) {
-		json_object* obj = json_object_array_get_idx(root, i);
+	for (int i = 0; i < json_object_array_length(entryArray); i++) {
+		json_object* obj = json_object_array_get_idx(entryArray, i);
 		json_object* l = 0;
 
 		TimeZoneEntry tzEntry;
@@ -287,7 +348,7 @@ bool TimeZoneService::cbGetTimeZoneRules(LSHandle* lsHandle, LSMessage *message,
 		entries.push_back(tzEntry);
 	}	
 	
-	reply = TimeZoneService::instance()->getTimeZoneRules(entries);
+	reply = TimeZoneService::instance()->getTimeZoneRules(entries, compact);
 	
 Done:
 
@@ -301,16 +362,56 @@ Done:
 	return true;
 }
 
-std::string TimeZoneService::getTimeZoneRules(const TimeZoneService::TimeZoneEntryList& entries)
+std::string TimeZoneService::getTimeZoneRules(const TimeZoneService::TimeZoneEntryList& entries, bool compact)
 {
-	TimeZoneResultList totalResult;
+	// group by tz (in order of first appearance) so a zone that shows up in many entries is looked up once
+	// and each of its years is only computed once
+	typedef std::map<std::string, size_t> ZoneIndexMap;
+	struct ZoneGroup {
+		std::string tz;
+		TzZonePtr zone;
+		std::set<int> yearsSeen;
+		TimeZoneResultList results;
+	};
+
+	std::vector<ZoneGroup> groups;
+	ZoneIndexMap groupIndex;
+	bool anyResult = false;
+
 	for (TimeZoneEntryList::const_iterator it = entries.begin();
 		 it != entries.end(); ++it) {
-		TimeZoneResultList r = getTimeZoneRuleOne(*it);
-		totalResult.splice(totalResult.end(), r);
+
+		ZoneIndexMap::const_iterator indexIt = groupIndex.find(it->tz);
+		size_t index;
+		if (indexIt == groupIndex.end()) {
+			index = groups.size();
+			groupIndex[it->tz] = index;
+			groups.push_back(ZoneGroup());
+			groups.back().tz = it->tz;
+			groups.back().zone = loadTimeZone(it->tz.c_str());
+		}
+		else {
+			index = indexIt->second;
+		}
+
+		ZoneGroup& group = groups[index];
+		if (!group.zone)
+			continue;
+
+		for (IntList::const_iterator yearIt = it->years.begin(); yearIt != it->years.end(); ++yearIt) {
+			if (!group.yearsSeen.insert(*yearIt).second && compact)
+				continue;
+
+			TimeZoneResult res;
+			if (!getTimeZoneRule(*group.zone, it->tz, *yearIt, res))
+				continue;
+
+			group.results.push_back(res);
+			anyResult = true;
+		}
 	}
 
-	if (totalResult.empty()) {
+	if (!anyResult) {
 		return std::string("{\"returnValue\": false, \"errorText\":\"Failed to retrieve results for specified timezones\"}");
 	}
 
@@ -318,23 +419,72 @@ std::string TimeZoneService::getTimeZoneRules(const TimeZoneService::TimeZoneEnt
 	json_object_object_add(obj, "returnValue", json_object_new_boolean(true));
 
 	json_object* array = json_object_new_array();
-	for (TimeZoneResultList::const_iterator it = totalResult.begin();
-		 it != totalResult.end(); ++it) {
-		const TimeZoneResult& r = (*it);
-		json_object* o = json_object_new_object();
-		json_object_object_add(o, "tz", json_object_new_string(r.tz.c_str()));
-		json_object_object_add(o, "year", json_object_new_int(r.year));
-		json_object_object_add(o, "hasDstChange", json_object_new_boolean(r.hasDstChange));
-		json_object_object_add(o, "utcOffset", json_object_new_int(r.utcOffset));
-		json_object_object_add(o, "dstOffset", json_object_new_int(r.dstOffset));
-		json_object_object_add(o, "dstStart", json_object_new_int(r.dstStart));
-		json_object_object_add(o, "dstEnd", json_object_new_int(r.dstEnd));
-		json_object_array_add(array, o);
-		// printf("Name: %s, Year: %d, hasDstChange: %d, utcOffset: %lld, "
-		// 	   "dstOffset: %lld, dstStart: %lld, dstEnd: %lld\n",
-		// 	   r.tz.c_str(), r.year, r.hasDstChange,
-		// 	   r.utcOffset, r.dstOffset, r.dstStart, r.dstEnd);
+
+	if (compact) {
+		static const char* s_compactFields[] = {
+			"year", "hasDstChange", "utcOffset", "dstOffset", "dstStart", "dstEnd"
+		};
+
+		json_object* fields = json_object_new_array();
+		for (size_t i = 0; i < G_N_ELEMENTS(s_compactFields); i++)
+			json_object_array_add(fields, json_object_new_string(s_compactFields[i]));
+		json_object_object_add(obj, "fields", fields);
+
+		for (size_t i = 0; i < groups.size(); i++) {
+			if (groups[i].results.empty())
+				continue;
+
+			json_object* rules = json_object_new_array();
+			for (TimeZoneResultList::const_iterator it = groups[i].results.begin();
+				 it != groups[i].results.end(); ++it) {
+				const TimeZoneResult& r = (*it);
+				json_object* row = json_object_new_array();
+				json_object_array_add(row, json_object_new_int(r.year));
+				json_object_array_add(row, json_object_new_int(r.hasDstChange ? 1 : 0));
+				json_object_array_add(row, json_object_new_int(r.utcOffset));
+				json_object_array_add(row, json_object_new_int(r.dstOffset));
+				json_object_array_add(row, json_object_new_int(r.dstStart));
+				json_object_array_add(row, json_object_new_int(r.dstEnd));
+				json_object_array_add(rules, row);
+			}
+
+			json_object* o = json_object_new_object();
+			json_object_object_add(o, "tz", json_object_new_string(groups[i].tz.c_str()));
+			json_object_object_add(o, "rules", rules);
+			json_object_array_add(array, o);
+		}
 	}
+	else {
+		// same order as the request: walk the entries again and pick each one's results off its group
+		std::vector<TimeZoneResultList::const_iterator> cursors;
+		for (size_t i = 0; i < groups.size(); i++)
+			cursors.push_back(groups[i].results.begin());
+
+		for (TimeZoneEntryList::const_iterator it = entries.begin();
+			 it != entries.end(); ++it) {
+
+			size_t index = groupIndex[it->tz];
+			TimeZoneResultList::const_iterator& cursor = cursors[index];
+
+			for (IntList::const_iterator yearIt = it->years.begin(); yearIt != it->years.end(); ++yearIt) {
+				if (cursor == groups[index].results.end() || cursor->year != *yearIt)
+					continue;
+
+				const TimeZoneResult& r = (*cursor);
+				json_object* o = json_object_new_object();
+				json_object_object_add(o, "tz", json_object_new_string(r.tz.c_str()));
+				json_object_object_add(o, "year", json_object_new_int(r.year));
+				json_object_object_add(o, "hasDstChange", json_object_new_boolean(r.hasDstChange));
+				json_object_object_add(o, "utcOffset", json_object_new_int(r.utcOffset));
+				json_object_object_add(o, "dstOffset", json_object_new_int(r.dstOffset));
+				json_object_object_add(o, "dstStart", json_object_new_int(r.dstStart));
+				json_object_object_add(o, "dstEnd", json_object_new_int(r.dstEnd));
+				json_object_array_add(array, o);
+				++cursor;
+			}
+		}
+	}
+
 	json_object_object_add(obj, "results", array);
 
 	std::string res = json_object_to_json_string(obj);
@@ -343,85 +493,66 @@ std::string TimeZoneService::getTimeZoneRules(const TimeZoneService::TimeZoneEnt
     return res;
 }
 
-TimeZoneService::TimeZoneResultList TimeZoneService::getTimeZoneRuleOne(const TimeZoneEntry& entry)
+bool TimeZoneService::getTimeZoneRule(const TzZone& zone, const std::string& tz, int year, TimeZoneResult& r_result)
 {
-	TimeZoneResultList results;
-
-	TzTransitionList transitionList = parseTimeZone(entry.tz.c_str());
-
-	for (IntList::const_iterator it = entry.years.begin();
-		 it != entry.years.end(); ++it) {
-
-		int year = (*it);
-
-		TimeZoneResult res;
-		res.tz = entry.tz;
-		res.year = year;
-		res.hasDstChange = false;
-		res.utcOffset = -1;
-		res.dstOffset = -1;
-		res.dstStart  = -1;
-		res.dstEnd    = -1;
-
-		// First do a scan to check if there are entries for this year
-		bool hasEntriesForYear = false;
-		for (TzTransitionList::const_iterator iter = transitionList.begin();
-			 iter != transitionList.end(); ++iter) {
-
-			const TzTransition& trans = (*iter);
-			if (trans.year == year) {
-				hasEntriesForYear = true;
-				break;
+	TimeZoneResult& res = r_result;
+	res.tz = tz;
+	res.year = year;
+	res.hasDstChange = false;
+	res.utcOffset = -1;
+	res.dstOffset = -1;
+	res.dstStart  = -1;
+	res.dstEnd    = -1;
+
+	const TzTransition* first = 0;
+	const TzTransition* last = 0;
+
+	if (zone.transitionsForYear(year, first, last)) {
+
+		for (const TzTransition* trans = first; trans != last; ++trans) {
+
+			if (trans->isDst) {
+				res.hasDstChange = true;
+				res.dstOffset    = trans->utcOffset;
+				res.dstStart     = trans->time;
+			}
+			else {
+				res.utcOffset    = trans->utcOffset;
+				res.dstEnd       = trans->time;
 			}
 		}
+	}
+	else {
 
-		if (hasEntriesForYear) {
-		
-			for (TzTransitionList::const_iterator iter = transitionList.begin();
-				 iter != transitionList.end(); ++iter) {
-
-				const TzTransition& trans = (*iter);
-				if (trans.year != year)
-					continue;
+		// Pick the latest year which is < the specified year
+		const TzTransition* trans = zone.lastTransitionUpToYear(year);
+		if (trans)
+			res.utcOffset = trans->utcOffset;
+	}
 
-				if (trans.isDst) {
-					res.hasDstChange = true;
-					res.dstOffset    = trans.utcOffset;
-					res.dstStart     = trans.time;
-				}
-				else {
-					res.utcOffset    = trans.utcOffset;
-					res.dstEnd       = trans.time;
-				}
-			}
-		}
-		else {
+	if (res.utcOffset == -1)
+		return false;
 
-			// Pick the latest year which is < the specified year
-			for (TzTransitionList::const_reverse_iterator iter = transitionList.rbegin();
-				 iter != transitionList.rend(); ++iter) {
+	if (res.dstStart == -1)
+		res.dstEnd = -1;
 
-				const TzTransition& trans = (*iter);
-				if (trans.year > year)
-					continue;
+	return true;
+}
 
-				res.hasDstChange = false;
-				res.dstOffset    = -1;
-				res.dstStart     = -1;
-				res.dstEnd       = -1;
-				res.utcOffset    = trans.utcOffset;
+TimeZoneService::TimeZoneResultList TimeZoneService::getTimeZoneRuleOne(const TimeZoneEntry& entry)
+{
+	TimeZoneResultList results;
 
-				break;
-			}
-		}
+	TzZonePtr zone = loadTimeZone(entry.tz.c_str());
+	if (!zone)
+		return results;
 
-		if (res.utcOffset == -1)
-			continue;
-					
-		if (res.dstStart == -1)
-			res.dstEnd = -1;
+	for (IntList::const_iterator it = entry.years.begin();
+		 it != entry.years.end(); ++it) {
 
-		results.push_back(res);
+		TimeZoneResult res;
+		if (getTimeZoneRule(*zone, entry.tz, *it, res))
+			results.push_back(res);
 	}	
 	
     return results;
@@ -628,7 +759,7 @@ bool TimeZoneService::cbGetTimeZoneFromEasData(LSHandle* lsHandle, LSMessage *me
 		TimePrefsHandler* tzHandler = static_cast<TimePrefsHandler*>(handler);
 		TimeZoneService* tzService = TimeZoneService::instance();
 
-		std::list<std::string> timeZones = tzHandler->getTimeZonesForOffset(-easBias);
+		const std::list<std::string>& timeZones = tzHandler->getTimeZonesForOffset(-easBias);
 
 		if (timeZones.empty()) {
 
@@ -658,66 +789,32 @@ bool TimeZoneService::cbGetTimeZoneFromEasData(LSHandle* lsHandle, LSMessage *me
 			updateEasDateDayOfMonth(easDaylightDate, currentYear);
 				
 			
-			for (std::list<std::string>::const_iterator it = timeZones.begin();
-				 it != timeZones.end(); ++it) {
-				TimeZoneEntry tzEntry;
-				tzEntry.tz = (*it);
-				tzEntry.years.push_back(currentYear);
-
-				TimeZoneResultList tzResultList = tzService->getTimeZoneRuleOne(tzEntry);
-				if (tzResultList.empty())
-					continue;
-
-				const TimeZoneResult& tzResult = tzResultList.front();
-	
-				printf("For timezone: %s\n", tzEntry.tz.c_str());
-				printf("year: %d, utcOffset: %"PRIu64", dstOffset: %"PRIu64", dstStart: %"PRIu64", dstEnd: %"PRIu64"\n",
-					   tzResult.year, tzResult.utcOffset, tzResult.dstOffset,
-					   tzResult.dstStart, tzResult.dstEnd);
-
-				// Set this timezone as the current timezone, so that we can calculate when the
-				// DST transitions occurs in seconds for the specified eas data
-				setenv("TZ", tzEntry.tz.c_str(), 1);
-
-				struct tm tzBrokenTime;
-				tzBrokenTime.tm_sec = easStandardDate.second;
-				tzBrokenTime.tm_min = easStandardDate.minute;
-				tzBrokenTime.tm_hour = easStandardDate.hour;
-				tzBrokenTime.tm_mday = easStandardDate.day;
-				tzBrokenTime.tm_mon = easStandardDate.month - 1;
-				tzBrokenTime.tm_year = currentYear - 1900;
-				tzBrokenTime.tm_wday = 0;
-				tzBrokenTime.tm_yday = 0;
-				tzBrokenTime.tm_isdst = 1;
-
-				time_t easStandardDateSeconds = ::mktime(&tzBrokenTime);
-
-				tzBrokenTime.tm_sec = easDaylightDate.second;
-				tzBrokenTime.tm_min = easDaylightDate.minute;
-				tzBrokenTime.tm_hour = easDaylightDate.hour;
-				tzBrokenTime.tm_mday = easDaylightDate.day;
-				tzBrokenTime.tm_mon = easDaylightDate.month - 1;
-				tzBrokenTime.tm_year = currentYear - 1900;
-				tzBrokenTime.tm_wday = 0;
-				tzBrokenTime.tm_yday = 0;
-				tzBrokenTime.tm_isdst = 0;
-
-				time_t easDaylightDateSeconds = ::mktime(&tzBrokenTime);
-
-				printf("eas dstStart: %ld, dstEnd: %ld\n", easDaylightDateSeconds, easStandardDateSeconds);
-				
-				if (easStandardDateSeconds == tzResult.dstEnd &&
-					easDaylightDateSeconds == tzResult.dstStart) {
-					// We have a winner
-					json_object* obj = json_object_new_object();
-					json_object_object_add(obj, "returnValue", json_object_new_boolean(true));
-					json_object_object_add(obj, "timeZone", json_object_new_string(tzEntry.tz.c_str()));
-					reply = json_object_to_json_string(obj);
-					json_object_put(obj);
-					goto Done;
+			// EAS gives the transitions as local wall clock times: daylightDate in standard time,
+			// standardDate in daylight time
+			time_t easDstStartLocal = easLocalTime(easDaylightDate, currentYear);
+			time_t easDstEndLocal = easLocalTime(easStandardDate, currentYear);
+			int64_t easDstOffset = -(easBias + easDaylightBias) * 60;
+
+			const EasCandidateList* candidates = tzService->easCandidates(-easBias, timeZones, currentYear,
+																		  easDstStartLocal, easDstEndLocal);
+			if (candidates) {
+				// the first zone whose dst offset also agrees with daylightBias, otherwise the first one
+				// with the same transitions
+				const EasCandidate* winner = &candidates->front();
+				for (EasCandidateList::const_iterator it = candidates->begin(); it != candidates->end(); ++it) {
+					if (it->dstOffset == easDstOffset) {
+						winner = &(*it);
+						break;
+					}
 				}
-			}
 
+				json_object* obj = json_object_new_object();
+				json_object_object_add(obj, "returnValue", json_object_new_boolean(true));
+				json_object_object_add(obj, "timeZone", json_object_new_string(winner->tz.c_str()));
+				reply = json_object_to_json_string(obj);
+				json_object_put(obj);
+				goto Done;
+			}
 			reply = "{\"returnValue\": false, "
 					" \"errorText\": \"Failed to find any timezones with specified parametes\"}";
 		}
@@ -735,6 +832,67 @@ Done:
 	return true;	
 }
 
+const TimeZoneService::EasCandidateList* TimeZoneService::easCandidates(int offset, const std::list<std::string>& timeZones,
+																		int year, time_t dstStartLocal, time_t dstEndLocal)
+{
+	// the rules are only good for one year
+	if (year != m_easIndexYear) {
+		m_easIndex.clear();
+		m_easIndexedOffsets.clear();
+		m_easIndexYear = year;
+	}
+
+	// offsets get indexed the first time they are asked for
+	if (m_easIndexedOffsets.insert(offset).second) {
+
+		for (std::list<std::string>::const_iterator it = timeZones.begin(); it != timeZones.end(); ++it) {
+
+			TzZonePtr zone = loadTimeZone(it->c_str());
+			if (!zone)
+				continue;
+
+			TimeZoneResult res;
+			if (!getTimeZoneRule(*zone, *it, year, res) || !res.hasDstChange)
+				continue;
+
+			EasRuleKey key;
+			key.offset = offset;
+			key.dstStartLocal = (time_t) (res.dstStart + res.utcOffset);
+			key.dstEndLocal = (time_t) (res.dstEnd + res.dstOffset);
+
+			EasCandidate candidate;
+			candidate.tz = (*it);
+			candidate.dstOffset = res.dstOffset;
+			m_easIndex[key].push_back(candidate);
+		}
+	}
+
+	EasRuleKey key;
+	key.offset = offset;
+	key.dstStartLocal = dstStartLocal;
+	key.dstEndLocal = dstEndLocal;
+
+	EasRuleIndex::const_iterator it = m_easIndex.find(key);
+	if (it == m_easIndex.end())
+		return 0;
+
+	return &it->second;
+}
+
+time_t TimeZoneService::easLocalTime(const TimeZoneService::EasSystemTime& time, int year)
+{
+	struct tm brokenTime;
+	memset(&brokenTime, 0, sizeof(brokenTime));
+	brokenTime.tm_sec = time.second;
+	brokenTime.tm_min = time.minute;
+	brokenTime.tm_hour = time.hour;
+	brokenTime.tm_mday = time.day;
+	brokenTime.tm_mon = time.month - 1;
+	brokenTime.tm_year = year - 1900;
+
+	return ::timegm(&brokenTime);
+}
+
 void TimeZoneService::readEasDate(json_object* obj, TimeZoneService::EasSystemTime& time)
 {
 	json_object* l = 0;
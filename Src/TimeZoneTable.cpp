@@ -0,0 +1,429 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <json_util.h>
+
+#include "TimeZoneTable.h"
+#include "Logging.h"
+
+// bump whenever the payload layout changes
+static const guint32 s_snapshotVersion = 1;
+static const char s_snapshotMagic[4] = { 'T', 'Z', 'T', 'B' };
+
+struct SnapshotHeader
+{
+	char magic[4];
+	guint32 version;
+	guint64 sourceSize;
+	guint64 sourceHash;
+	guint64 payloadHash;
+	guint32 payloadSize;
+	guint32 reserved;
+};
+
+enum {
+	ZoneFlagPreferred = 1,
+	ZoneFlagComplete = 1 << 1
+};
+
+// FNV-1a; only has to notice changed files, not resist anyone
+static guint64 hashBytes(const char* data, size_t size)
+{
+	guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= G_GUINT64_CONSTANT(1099511628211);
+	}
+	return hash;
+}
+
+static bool hashFile(const char* path, off_t& r_size, guint64& r_hash)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat stBuf;
+	if (fstat(fd, &stBuf) != 0 || stBuf.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+
+	void* map = mmap(0, stBuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	r_size = stBuf.st_size;
+	r_hash = hashBytes(static_cast<const char*>(map), stBuf.st_size);
+
+	munmap(map, stBuf.st_size);
+	return true;
+}
+
+static void appendInt(std::string& out, gint32 value)
+{
+	out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void appendString(std::string& out, const std::string& value)
+{
+	appendInt(out, (gint32) value.size());
+	out.append(value);
+}
+
+// bounds-checked reads straight out of the mapped snapshot
+class SnapshotReader
+{
+public:
+	SnapshotReader(const char* data, size_t size) : m_pos(data), m_end(data + size), m_ok(true) {}
+
+	bool ok() const { return m_ok; }
+	bool atEnd() const { return m_pos == m_end; }
+
+	gint32 readInt() {
+		gint32 value = 0;
+		if (!m_ok || (size_t) (m_end - m_pos) < sizeof(value)) {
+			m_ok = false;
+			return 0;
+		}
+		memcpy(&value, m_pos, sizeof(value));
+		m_pos += sizeof(value);
+		return value;
+	}
+
+	void readString(std::string& r_value) {
+		gint32 len = readInt();
+		if (!m_ok || len < 0 || (size_t) (m_end - m_pos) < (size_t) len) {
+			m_ok = false;
+			return;
+		}
+		r_value.assign(m_pos, len);
+		m_pos += len;
+	}
+
+private:
+	const char* m_pos;
+	const char* m_end;
+	bool m_ok;
+};
+
+static void appendZones(std::string& out, const TimeZoneTable::ZoneList& zones)
+{
+	appendInt(out, (gint32) zones.size());
+	for (TimeZoneTable::ZoneList::const_iterator it = zones.begin(); it != zones.end(); ++it) {
+		appendInt(out, it->offsetFromUTC);
+		appendInt(out, it->supportsDST);
+		appendInt(out, it->mcc);
+		appendInt(out, (it->preferred ? ZoneFlagPreferred : 0) | (it->complete ? ZoneFlagComplete : 0));
+		appendString(out, it->zoneId);
+		appendString(out, it->countryCode);
+		appendString(out, it->json);
+	}
+}
+
+static bool readZones(SnapshotReader& reader, TimeZoneTable::ZoneList& zones)
+{
+	gint32 count = reader.readInt();
+	if (!reader.ok() || count < 0)
+		return false;
+
+	zones.resize(count);
+	for (gint32 i = 0; i < count && reader.ok(); i++) {
+		TimeZoneTable::Zone& zone = zones[i];
+		zone.offsetFromUTC = reader.readInt();
+		zone.supportsDST = reader.readInt();
+		zone.mcc = reader.readInt();
+		gint32 flags = reader.readInt();
+		zone.preferred = (flags & ZoneFlagPreferred);
+		zone.complete = (flags & ZoneFlagComplete);
+		reader.readString(zone.zoneId);
+		reader.readString(zone.countryCode);
+		reader.readString(zone.json);
+	}
+
+	return reader.ok();
+}
+
+TimeZoneTable::TimeZoneTable()
+	: defaultZone(-1)
+{
+}
+
+void TimeZoneTable::clear()
+{
+	zones.clear();
+	sysZones.clear();
+	mccZones.clear();
+	defaultZone = -1;
+	defaultCountryCode.clear();
+}
+
+bool TimeZoneTable::load(const char* jsonPath, const char* snapshotPath, json_object** r_json)
+{
+	off_t sourceSize = 0;
+	guint64 sourceHash = 0;
+
+	if (!hashFile(jsonPath, sourceSize, sourceHash)) {
+		qWarning("cannot read zone json [%s]", jsonPath);
+		clear();
+		return false;
+	}
+
+	if (loadSnapshot(snapshotPath, sourceSize, sourceHash)) {
+		qDebug("zone table loaded from snapshot [%s]", snapshotPath);
+		return true;
+	}
+
+	json_object* root = json_object_from_file(const_cast<char*>(jsonPath));
+	if (!root) {
+		qWarning("cannot parse zone json [%s]", jsonPath);
+		clear();
+		return false;
+	}
+
+	bool ok = loadFromJson(root);
+	if (ok && !saveSnapshot(snapshotPath, sourceSize, sourceHash))
+		qWarning("failed to write zone snapshot [%s]", snapshotPath);
+
+	if (r_json)
+		*r_json = root;
+	else
+		json_object_put(root);
+
+	return ok;
+}
+
+//the same rules scanTimeZoneJson() used to apply to the tree; a missing array ends the scan there
+bool TimeZoneTable::loadFromJson(json_object* root)
+{
+	clear();
+
+	if (!root)
+		return false;
+
+	json_object* label = json_object_object_get(root, "timeZone");
+	if (!label || !json_object_is_type(label, json_type_array)) {
+		qWarning() << "invalid json; missing timeZone array";
+		return false;
+	}
+
+	bool defaultSeen = false;
+	for (int i = 0; i < json_object_array_length(label); i++) {
+		json_object* obj = json_object_array_get_idx(label, i);
+		if (!obj)
+			continue;
+
+		json_object* l = json_object_object_get(obj, "default");
+		bool isDefault = (l != 0 && !defaultSeen);
+		if (l)
+			defaultSeen = true;
+
+		l = json_object_object_get(obj, "ZoneID");
+		if (!l)
+			continue;
+
+		Zone zone;
+		zone.zoneId = json_object_get_string(l);
+		zone.json = json_object_to_json_string(obj);
+
+		json_object* offset = json_object_object_get(obj, "offsetFromUTC");
+		json_object* dst = json_object_object_get(obj, "supportsDST");
+		zone.complete = (offset && dst);
+		if (offset)
+			zone.offsetFromUTC = json_object_get_int(offset);
+		if (dst)
+			zone.supportsDST = json_object_get_int(dst);
+
+		l = json_object_object_get(obj, "preferred");
+		zone.preferred = l ? json_object_get_boolean(l) : false;
+
+		l = json_object_object_get(obj, "CountryCode");
+		if (l)
+			zone.countryCode = json_object_get_string(l);
+
+		if (isDefault && zone.complete) {
+			defaultZone = zones.size();
+			l = json_object_object_get(obj, "countryCode");
+			if (l)
+				defaultCountryCode = json_object_get_string(l);
+		}
+
+		zones.push_back(zone);
+	}
+
+	label = json_object_object_get(root, "syszones");
+	if (!label || !json_object_is_type(label, json_type_array)) {
+		qWarning() << "invalid json; missing syszones array";
+		return true;
+	}
+
+	for (int i = 0; i < json_object_array_length(label); i++) {
+		json_object* obj = json_object_array_get_idx(label, i);
+		if (!obj)
+			continue;
+
+		json_object* l = json_object_object_get(obj, "ZoneID");
+		if (!l)
+			continue;
+
+		Zone zone;
+		zone.zoneId = json_object_get_string(l);
+		zone.json = json_object_to_json_string(obj);
+
+		l = json_object_object_get(obj, "offsetFromUTC");
+		zone.complete = (l != 0);
+		if (l)
+			zone.offsetFromUTC = json_object_get_int(l);
+
+		sysZones.push_back(zone);
+	}
+
+	label = json_object_object_get(root, "mccInfo");
+	if (!label || !json_object_is_type(label, json_type_array)) {
+		qWarning() << "invalid json; missing mccInfo array";
+		return true;
+	}
+
+	for (int i = 0; i < json_object_array_length(label); i++) {
+		json_object* obj = json_object_array_get_idx(label, i);
+		if (!obj)
+			continue;
+
+		json_object* offset = json_object_object_get(obj, "offsetFromUTC");
+		json_object* dst = json_object_object_get(obj, "supportsDST");
+		json_object* mcc = json_object_object_get(obj, "mcc");
+		if (!offset || !dst || !mcc)
+			continue;
+
+		Zone zone;
+		zone.complete = true;
+		zone.offsetFromUTC = json_object_get_int(offset);
+		zone.supportsDST = json_object_get_int(dst);
+		zone.mcc = json_object_get_int(mcc);
+
+		json_object* l = json_object_object_get(obj, "ZoneID");
+		if (l)
+			zone.zoneId = json_object_get_string(l);
+		if (zone.zoneId.size())
+			zone.json = json_object_to_json_string(obj);
+
+		l = json_object_object_get(obj, "CountryCode");
+		if (l)
+			zone.countryCode = json_object_get_string(l);
+
+		mccZones.push_back(zone);
+	}
+
+	return true;
+}
+
+bool TimeZoneTable::loadSnapshot(const char* snapshotPath, off_t sourceSize, guint64 sourceHash)
+{
+	int fd = open(snapshotPath, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat stBuf;
+	if (fstat(fd, &stBuf) != 0 || (size_t) stBuf.st_size < sizeof(SnapshotHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void* map = mmap(0, stBuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	const char* data = static_cast<const char*>(map);
+	const char* payload = data + sizeof(SnapshotHeader);
+	bool ok = false;
+
+	SnapshotHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, s_snapshotMagic, sizeof(header.magic)) != 0 ||
+		header.version != s_snapshotVersion ||
+		header.sourceSize != (guint64) sourceSize ||
+		header.sourceHash != sourceHash ||
+		header.payloadSize != (guint64) stBuf.st_size - sizeof(SnapshotHeader) ||
+		header.payloadHash != hashBytes(payload, header.payloadSize))
+		goto Done;
+
+	{
+		SnapshotReader reader(payload, header.payloadSize);
+
+		clear();
+		defaultZone = reader.readInt();
+		reader.readString(defaultCountryCode);
+
+		ok = readZones(reader, zones) && readZones(reader, sysZones) && readZones(reader, mccZones)
+			 && reader.atEnd() && defaultZone >= -1 && defaultZone < (int) zones.size();
+		if (!ok) {
+			qWarning("zone snapshot [%s] is corrupt, ignoring it", snapshotPath);
+			clear();
+		}
+	}
+
+Done:
+
+	munmap(map, stBuf.st_size);
+	return ok;
+}
+
+bool TimeZoneTable::saveSnapshot(const char* snapshotPath, off_t sourceSize, guint64 sourceHash) const
+{
+	std::string payload;
+	appendInt(payload, defaultZone);
+	appendString(payload, defaultCountryCode);
+	appendZones(payload, zones);
+	appendZones(payload, sysZones);
+	appendZones(payload, mccZones);
+
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, s_snapshotMagic, sizeof(header.magic));
+	header.version = s_snapshotVersion;
+	header.sourceSize = sourceSize;
+	header.sourceHash = sourceHash;
+	header.payloadHash = hashBytes(payload.data(), payload.size());
+	header.payloadSize = payload.size();
+
+	std::string contents(reinterpret_cast<const char*>(&header), sizeof(header));
+	contents.append(payload);
+
+	// g_file_set_contents() writes a temp file and renames it over, so a crash never leaves half a snapshot
+	GError* error = 0;
+	if (!g_file_set_contents(snapshotPath, contents.data(), contents.size(), &error)) {
+		qWarning("%s", error ? error->message : "unknown error");
+		if (error)
+			g_error_free(error);
+		return false;
+	}
+
+	return true;
+}
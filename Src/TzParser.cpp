@@ -27,15 +27,20 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
 
 #include <stdio.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "TzParser.h"
 
@@ -52,6 +57,11 @@
 #define TZ_ABBR_CHAR_SET "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 :+-._"
 #define TZ_ABBR_ERR_CHAR  '_'
 
+// how far decodeTzData() fills the table out from the footer rule; zic's fat files stop there as well
+#define TZ_RULE_EXTEND_YEAR	2037
+
+#define SECS_PER_DAY	86400L
+
 #define TYPE_SIGNED(type) (((type) -1) < 0)
 #define TYPE_INTEGRAL(type) (((type) 0.5) != 0.5)
 
@@ -106,61 +116,159 @@ detzcode64(const char* codep)
 	return result;
 }
 
-TzTransitionList parseTimeZone(const char* tzName)
+// parsed zones stay around for the life of the process; the file identity is re-checked on every lookup
+// so a tzdata update replaces the entry
+struct CachedTz {
+	std::string      filePath;
+	dev_t            dev;
+	ino_t            ino;
+	time_t           mtime;
+	off_t            size;
+	TzZonePtr        zone;
+};
+
+typedef std::map<std::string, CachedTz> CachedTzMap;
+
+static CachedTzMap s_tzCache;
+static TzParserStats s_stats;
+
+static long long monotonicUsecs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+const TzParserStats& tzParserStats()
+{
+	return s_stats;
+}
+
+void resetTzParserStats()
+{
+	memset(&s_stats, 0, sizeof(s_stats));
+}
+
+static bool decodeTzData(const char* buf, size_t bufSize, const std::string& filePath, TzTransitionList& result,
+						 TzRule& rule);
+static bool parseTzRule(const char* p, const char* end, TzRule& rule);
+static void ruleTransitionsForYear(const TzRule& rule, int year, TzTransition r_trans[2]);
+static time_t ruleOffsetAt(const TzRule& rule, time_t t);
+
+static bool statTzFile(const char* tzName, std::string& filePath, struct stat& stBuf)
 {
 	static const char* zoneInfoDir = "/usr/share/zoneinfo/";
 	static const char* etcZoneInfoDir = "/usr/share/zoneinfo/Etc/";
-	std::string filePath = zoneInfoDir;
+
+	filePath = zoneInfoDir;
 	filePath += tzName;
-	
-	struct stat stBuf;
-	FILE* fp = fopen(filePath.c_str(), "r");
-	if (!fp && errno == ENOENT)
-	{
-		// if file not found - try alternative filePath
-		printf("Failed to find file: %s\n", filePath.c_str());
-
-		filePath = etcZoneInfoDir;
-		filePath += tzName;
-
-		fp = fopen(filePath.c_str(), "r");
-		if (!fp && errno == ENOENT)
-		{
-			printf("Failed to find second try file: %s\n", filePath.c_str());
-			return TzTransitionList();
-		}
+	if (stat(filePath.c_str(), &stBuf) == 0)
+		return true;
+
+	if (errno != ENOENT) {
+		printf("Failed to stat file: %s\n", filePath.c_str());
+		return false;
 	}
-	if (fp)
-	{
-		if (fstat(fileno(fp), &stBuf) != 0)
-		{
-			printf("Failed to stat opened file: %s\n", filePath.c_str());
-			fclose(fp);
-			return TzTransitionList();
-		}
 
-		if (stBuf.st_size <= (int) sizeof(tzhead)) {
-			printf("file too short to be a tz file: %s\n", filePath.c_str());
-			fclose(fp);
-			return TzTransitionList();
+	// if file not found - try alternative filePath
+	printf("Failed to find file: %s\n", filePath.c_str());
+
+	filePath = etcZoneInfoDir;
+	filePath += tzName;
+	if (stat(filePath.c_str(), &stBuf) == 0)
+		return true;
+
+	printf("Failed to find second try file: %s\n", filePath.c_str());
+	return false;
+}
+
+TzTransitionList parseTimeZone(const char* tzName)
+{
+	TzZonePtr zone = loadTimeZone(tzName);
+	if (!zone)
+		return TzTransitionList();
+
+	return zone->transitions();
+}
+
+TzZonePtr loadTimeZone(const char* tzName)
+{
+	if (!tzName || !tzName[0])
+		return TzZonePtr();
+
+	std::string filePath;
+	struct stat stBuf;
+	if (!statTzFile(tzName, filePath, stBuf))
+		return TzZonePtr();
+
+	++s_stats.loads;
+	CachedTzMap::const_iterator cached = s_tzCache.find(tzName);
+	if (cached != s_tzCache.end()) {
+		const CachedTz& entry = cached->second;
+		if (entry.filePath == filePath && entry.dev == stBuf.st_dev && entry.ino == stBuf.st_ino &&
+			entry.mtime == stBuf.st_mtime && entry.size == stBuf.st_size) {
+			++s_stats.cacheHits;
+			return entry.zone;
 		}
 	}
-	else
-	{
+
+	long long decodeStart = monotonicUsecs();
+
+	int fd = open(filePath.c_str(), O_RDONLY);
+	if (fd < 0) {
 		printf("Failed to open file: %s\n", filePath.c_str());
-		return TzTransitionList();
-	}	
+		return TzZonePtr();
+	}
+
+	// re-stat the descriptor; the path may have been swapped since the lookup above
+	if (fstat(fd, &stBuf) != 0) {
+		printf("Failed to stat opened file: %s\n", filePath.c_str());
+		close(fd);
+		return TzZonePtr();
+	}
 
-	char* buf = (char*) malloc(stBuf.st_size);
-	size_t size = fread(buf, 1, stBuf.st_size, fp);
-	fclose(fp);
+	if (stBuf.st_size <= (int) sizeof(tzhead)) {
+		printf("file too short to be a tz file: %s\n", filePath.c_str());
+		close(fd);
+		return TzZonePtr();
+	}
 
-	if (size != (size_t) stBuf.st_size) {
-		printf("Short read on file: %s\n", filePath.c_str());
-		free(buf);
-		return TzTransitionList();
+	void* map = mmap(NULL, stBuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		printf("Failed to map file: %s\n", filePath.c_str());
+		return TzZonePtr();
 	}
 
+	TzTransitionList result;
+	TzRule rule;
+	bool ok = decodeTzData((const char*) map, stBuf.st_size, filePath, result, rule);
+	munmap(map, stBuf.st_size);
+
+	++s_stats.decodes;
+	s_stats.decodeUsecs += monotonicUsecs() - decodeStart;
+	if (!ok)
+		return TzZonePtr();
+
+	s_stats.transitions += result.size();
+
+	TzZonePtr zone(new TzZone(result, rule));
+
+	CachedTz& entry = s_tzCache[tzName];
+	entry.filePath    = filePath;
+	entry.dev         = stBuf.st_dev;
+	entry.ino         = stBuf.st_ino;
+	entry.mtime       = stBuf.st_mtime;
+	entry.size        = stBuf.st_size;
+	entry.zone        = zone;
+
+	return zone;
+}
+
+static bool decodeTzData(const char* buf, size_t bufSize, const std::string& filePath, TzTransitionList& result,
+						 TzRule& rule)
+{
 	ttentrylist       ttEntryList;
 	ttinfolist        ttInfoList;
 	std::vector<char> ttAbbrList;
@@ -202,23 +310,41 @@ TzTransitionList parseTimeZone(const char* tzName)
 	(void) typeCnt;
 	(void) charCnt;
 	
+	memset(&rule, 0, sizeof(rule));
+
 	int index = 0;
+	bool readV2 = false;
 	for (int stored = 4; stored <= 8; stored *= 2) {
 
 		DBG("-----------------------------------------------------\n");
 
-		if (memcmp(buf, TZ_MAGIC, 4) != 0) {
+		if ((size_t) index + sizeof(struct tzhead) > bufSize ||
+			memcmp(buf + index, TZ_MAGIC, 4) != 0) {
 			printf("Not a tz file. Header signature mismatch: %s\n", filePath.c_str());
-			free(buf);
-			return TzTransitionList();
+			return false;
 		}
 		
-		struct tzhead* head = (struct tzhead*) (buf + index);
+		const struct tzhead* head = (const struct tzhead*) (buf + index);
 
 		leapCnt = detzcode(head->tzh_leapcnt);
 		timeCnt = detzcode(head->tzh_timecnt);
 		typeCnt = detzcode(head->tzh_typecnt);
 		charCnt = detzcode(head->tzh_charcnt);
+		long isStdCnt = detzcode(head->tzh_ttisstdcnt);
+		long isGmtCnt = detzcode(head->tzh_ttisgmtcnt);
+
+		if (leapCnt < 0 || timeCnt < 0 || typeCnt <= 0 || charCnt < 0 || isStdCnt < 0 || isGmtCnt < 0) {
+			printf("Corrupt tz header: %s\n", filePath.c_str());
+			return false;
+		}
+
+		// everything below reads straight out of the mapping, so make sure the whole block is there
+		size_t blockSize = sizeof(struct tzhead) + timeCnt * stored + timeCnt + typeCnt * 6 + charCnt
+						   + leapCnt * (stored + 4) + isStdCnt + isGmtCnt;
+		if ((size_t) index + blockSize > bufSize) {
+			printf("Truncated tz file: %s\n", filePath.c_str());
+			return false;
+		}
 
 		ttInfoList.clear();
 		ttInfoList.reserve(timeCnt);
@@ -262,6 +388,10 @@ TzTransitionList parseTimeZone(const char* tzName)
 			unsigned char indexToLocalTime = (unsigned char) buf[index];
 			index++;
 
+			if (indexToLocalTime >= typeCnt) {
+				printf("Corrupt tz transition type: %s\n", filePath.c_str());
+				return false;
+			}
 			ttEntryList[i].indexToLocalTime = indexToLocalTime;
 			
 			DBG("tzh_timecnt: Index: %d\n", indexToLocalTime);			
@@ -338,7 +468,7 @@ TzTransitionList parseTimeZone(const char* tzName)
 		  time or wall clock time, and are used when a time zone file is
 		  used in handling POSIX-style time zone environment variables.
 		*/
-		for (long i = 0; i < typeCnt; i++) {
+		for (long i = 0; i < isStdCnt; i++) {
 
 			int standardOrWallClock = (unsigned char) buf[index];
 			index++;
@@ -355,7 +485,7 @@ TzTransitionList parseTimeZone(const char* tzName)
 		  specified as UTC or local time, and are used when a time zone
 		  file is used in handling POSIX-style time zone environment variables.
 		*/
-		for (long i = 0; i < typeCnt; i++) {
+		for (long i = 0; i < isGmtCnt; i++) {
 
 			int utcOrLocalTime = (unsigned char) buf[index];
 			index++;
@@ -395,6 +525,8 @@ TzTransitionList parseTimeZone(const char* tzName)
 			}
 		}
 
+		readV2 = (stored == 8);
+
 		/*
 		 * If this is an old file, we're done.
 		 */
@@ -413,20 +545,31 @@ TzTransitionList parseTimeZone(const char* tzName)
 	}
 	
 	DBG("Total Buffer size parsed: %d\n", index);
-	
-	free(buf);
+
+	/*
+	  A version 2+ file ends with a POSIX TZ string between newlines, for
+	  the times after the last transition. Empty if there is no rule.
+	*/
+	if (readV2 && (size_t) index < bufSize && buf[index] == '\n') {
+		const char* ruleStart = buf + index + 1;
+		const char* ruleEnd = (const char*) memchr(ruleStart, '\n', bufSize - index - 1);
+		if (ruleEnd && ruleEnd != ruleStart && !parseTzRule(ruleStart, ruleEnd, rule)) {
+			printf("Ignoring unparsable tz rule '%.*s': %s\n", (int) (ruleEnd - ruleStart), ruleStart,
+				   filePath.c_str());
+		}
+	}
 
 	// Dummy entry for standardized timezones which never had
 	// a transition time
 	if (ttEntryList.empty() && !ttInfoList.empty()) {
 		ttentry e;
 		timeCnt = 1;
-		e.time = -2147483648UL;
+		e.time = (time_t) INT32_MIN;
 		e.indexToLocalTime = 0;
 		ttEntryList.push_back(e);		
 	}
 
-	TzTransitionList result;
+	result.clear();
 	for (int i = 0; i < timeCnt; i++) {
 		const ttentry& entry = ttEntryList[i];
 		const ttinfo& info   = ttInfoList[entry.indexToLocalTime];
@@ -452,7 +595,469 @@ TzTransitionList parseTimeZone(const char* tzName)
 		result.push_back(trans);
 	}
 
-	return result;
+	// slim files stop at the point the rule takes over; spell it out up to where fat ones end, so the per-year
+	// lookups see the same table either way
+	if (rule.valid && rule.hasDst && !result.empty()) {
+		for (int year = std::max(result.back().year, 1970); year <= TZ_RULE_EXTEND_YEAR; ++year) {
+			TzTransition ruleTrans[2];
+			ruleTransitionsForYear(rule, year, ruleTrans);
+			for (int i = 0; i < 2; ++i) {
+				if (ruleTrans[i].time > result.back().time)
+					result.push_back(ruleTrans[i]);
+			}
+		}
+	}
+
+	return true;
+}
+
+// days since 1970-01-01 of a proleptic gregorian date, month 1-12
+static long daysFromCivil(int year, int month, int day)
+{
+	year -= (month <= 2);
+	long era = (year >= 0 ? year : year - 399) / 400;
+	long yearOfEra = year - era * 400;
+	long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + dayOfEra - 719468;
+}
+
+static bool isLeapYear(int year)
+{
+	return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// seconds since the epoch of local midnight on the rule's day in year, as if local time were utc
+static time_t ruleDayStart(const TzRuleDate& date, int year)
+{
+	static const int monthDays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	long days;
+	if (date.kind == 'J') {
+		days = daysFromCivil(year, 1, 1) + date.day - 1;
+		if (isLeapYear(year) && date.day >= 60)
+			++days;
+	}
+	else if (date.kind == 'D') {
+		days = daysFromCivil(year, 1, 1) + date.day;
+	}
+	else {
+		long first = daysFromCivil(year, date.month, 1);
+		// 1970-01-01 was a Thursday
+		int firstWeekDay = (int) (((first + 4) % 7 + 7) % 7);
+		int monthDay = 1 + (date.day - firstWeekDay + 7) % 7 + 7 * (date.week - 1);
+		int monthLen = monthDays[date.month - 1] + (date.month == 2 && isLeapYear(year));
+		while (monthDay > monthLen)
+			monthDay -= 7;
+		days = first + monthDay - 1;
+	}
+
+	return (time_t) days * SECS_PER_DAY;
+}
+
+static void setRuleTransition(TzTransition& trans, time_t time, time_t utcOffset, bool isDst, const char* abbr)
+{
+	struct tm gmTime;
+
+	trans.time      = time;
+	trans.utcOffset = utcOffset;
+	trans.isDst     = isDst;
+	trans.year      = gmtime_r(&time, &gmTime) ? gmTime.tm_year + 1900 : 0;
+	strncpy(trans.abbrName, abbr, TZ_ABBR_MAX_LEN);
+	trans.abbrName[TZ_ABBR_MAX_LEN-1] = 0;
+}
+
+// the rule's two transitions of year, in time order
+static void ruleTransitionsForYear(const TzRule& rule, int year, TzTransition r_trans[2])
+{
+	// the start is given in standard time, the end in dst
+	time_t start = ruleDayStart(rule.start, year) + rule.start.time - rule.stdOffset;
+	time_t end = ruleDayStart(rule.end, year) + rule.end.time - rule.dstOffset;
+
+	setRuleTransition(r_trans[0], start, rule.dstOffset, true, rule.dstAbbr);
+	setRuleTransition(r_trans[1], end, rule.stdOffset, false, rule.stdAbbr);
+	if (end < start)
+		std::swap(r_trans[0], r_trans[1]);
+}
+
+static int utcYear(time_t t)
+{
+	struct tm gmTime;
+	return gmtime_r(&t, &gmTime) ? gmTime.tm_year + 1900 : 1970;
+}
+
+static time_t ruleOffsetAt(const TzRule& rule, time_t t)
+{
+	if (!rule.hasDst)
+		return rule.stdOffset;
+
+	// a local year's transitions can land in the utc years either side, so look at those too; the
+	// latest one at or before t wins
+	int year = utcYear(t);
+	time_t offset = rule.stdOffset;
+	time_t latest = 0;
+	bool found = false;
+	for (int y = year - 1; y <= year + 1; ++y) {
+		TzTransition ruleTrans[2];
+		ruleTransitionsForYear(rule, y, ruleTrans);
+		for (int i = 0; i < 2; ++i) {
+			if (ruleTrans[i].time <= t && (!found || ruleTrans[i].time >= latest)) {
+				latest = ruleTrans[i].time;
+				offset = ruleTrans[i].utcOffset;
+				found = true;
+			}
+		}
+	}
+
+	return offset;
+}
+
+// alphabetic, or anything but '>' when quoted in <>; truncated to fit
+static const char* parseTzAbbr(const char* p, const char* end, char* r_abbr)
+{
+	const char* begin;
+	const char* stop;
+
+	if (p < end && *p == '<') {
+		begin = ++p;
+		while (p < end && *p != '>')
+			++p;
+		if (p == end || p == begin)
+			return 0;
+		stop = p++;
+	}
+	else {
+		begin = p;
+		while (p < end && ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')))
+			++p;
+		if (p - begin < 3)
+			return 0;
+		stop = p;
+	}
+
+	size_t len = std::min((size_t) (stop - begin), (size_t) TZ_ABBR_MAX_LEN - 1);
+	memcpy(r_abbr, begin, len);
+	r_abbr[len] = 0;
+	return p;
+}
+
+static const char* parseTzNumber(const char* p, const char* end, long maxValue, long& r_value)
+{
+	if (p == end || *p < '0' || *p > '9')
+		return 0;
+
+	r_value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		r_value = r_value * 10 + (*p - '0');
+		if (r_value > maxValue)
+			return 0;
+		++p;
+	}
+	return p;
+}
+
+// [+|-]hh[:mm[:ss]]; hours go up to 167 for the rule times of version 3 files
+static const char* parseTzTime(const char* p, const char* end, long& r_secs)
+{
+	long sign = 1;
+	if (p < end && (*p == '+' || *p == '-')) {
+		if (*p == '-')
+			sign = -1;
+		++p;
+	}
+
+	long hours, minutes = 0, seconds = 0;
+	if (!(p = parseTzNumber(p, end, 167, hours)))
+		return 0;
+	if (p < end && *p == ':') {
+		if (!(p = parseTzNumber(p + 1, end, 59, minutes)))
+			return 0;
+		if (p < end && *p == ':') {
+			if (!(p = parseTzNumber(p + 1, end, 59, seconds)))
+				return 0;
+		}
+	}
+
+	r_secs = sign * (hours * 3600 + minutes * 60 + seconds);
+	return p;
+}
+
+// ,date[/time] with date one of Jn, n or Mm.w.d
+static const char* parseTzDate(const char* p, const char* end, TzRuleDate& r_date)
+{
+	if (p == end || *p != ',')
+		return 0;
+	++p;
+
+	long value;
+	if (p < end && *p == 'J') {
+		r_date.kind = 'J';
+		if (!(p = parseTzNumber(p + 1, end, 365, value)) || value < 1)
+			return 0;
+		r_date.day = value;
+	}
+	else if (p < end && *p == 'M') {
+		r_date.kind = 'M';
+		if (!(p = parseTzNumber(p + 1, end, 12, value)) || value < 1)
+			return 0;
+		r_date.month = value;
+		if (p == end || *p != '.' || !(p = parseTzNumber(p + 1, end, 5, value)) || value < 1)
+			return 0;
+		r_date.week = value;
+		if (p == end || *p != '.' || !(p = parseTzNumber(p + 1, end, 6, value)))
+			return 0;
+		r_date.day = value;
+	}
+	else {
+		r_date.kind = 'D';
+		if (!(p = parseTzNumber(p, end, 365, value)))
+			return 0;
+		r_date.day = value;
+	}
+
+	r_date.time = 2 * 3600;
+	if (p < end && *p == '/') {
+		if (!(p = parseTzTime(p + 1, end, r_date.time)))
+			return 0;
+	}
+	return p;
+}
+
+/*
+  std offset [dst [offset] [,start[/time],end[/time]]], e.g. "EST5EDT,M3.2.0,M11.1.0".
+  Offsets are hours west of utc, the other way round from the file's own.
+*/
+static bool parseTzRule(const char* p, const char* end, TzRule& rule)
+{
+	long secs;
+
+	memset(&rule, 0, sizeof(rule));
+
+	if (!(p = parseTzAbbr(p, end, rule.stdAbbr)) || !(p = parseTzTime(p, end, secs)))
+		return false;
+	rule.stdOffset = -secs;
+
+	if (p == end) {
+		rule.valid = true;
+		return true;
+	}
+
+	if (!(p = parseTzAbbr(p, end, rule.dstAbbr)))
+		return false;
+
+	rule.dstOffset = rule.stdOffset + 3600;
+	if (p < end && *p != ',') {
+		if (!(p = parseTzTime(p, end, secs)))
+			return false;
+		rule.dstOffset = -secs;
+	}
+
+	// zic always writes the dates out; without them the switch days would be up to the library
+	if (!(p = parseTzDate(p, end, rule.start)) || !(p = parseTzDate(p, end, rule.end)) || p != end)
+		return false;
+
+	// dst all year round ("EST5EDT,0/0,J365/25") is just a fixed offset
+	if (rule.start.kind != 'M' && rule.start.day == (rule.start.kind == 'J' ? 1 : 0) && rule.start.time == 0 &&
+		rule.end.kind == 'J' && rule.end.day == 365 &&
+		rule.end.time >= SECS_PER_DAY + (rule.dstOffset - rule.stdOffset)) {
+		rule.stdOffset = rule.dstOffset;
+		memcpy(rule.stdAbbr, rule.dstAbbr, sizeof(rule.stdAbbr));
+		rule.valid = true;
+		return true;
+	}
+
+	rule.hasDst = true;
+	rule.valid = true;
+	return true;
+}
+
+TzZone::TzZone(const TzTransitionList& transitions, const TzRule& rule)
+	: m_transitions(transitions)
+	, m_firstYear(0)
+	, m_fixedOffset(false)
+	, m_rule(rule)
+{
+	if (m_transitions.empty())
+		return;
+
+	// the dummy entry decodeTzData() adds for files without transitions
+	m_fixedOffset = (m_transitions.size() == 1 && m_transitions[0].time == (time_t) INT32_MIN);
+
+	m_firstYear = m_transitions.front().year;
+	int lastYear = m_transitions.back().year;
+	if (lastYear < m_firstYear)
+		return;
+
+	m_yearStart.resize(lastYear - m_firstYear + 2, 0);
+
+	unsigned int i = 0;
+	for (int year = m_firstYear; year <= lastYear + 1; ++year) {
+		while (i < m_transitions.size() && m_transitions[i].year < year)
+			++i;
+		m_yearStart[year - m_firstYear] = i;
+	}
+
+	// gmtime() failing on an odd transition time can put a year out of order; don't trust the index then
+	if (i != m_transitions.size()) {
+		m_yearStart.clear();
+		return;
+	}
+	for (unsigned int j = 1; j < m_transitions.size(); ++j) {
+		if (m_transitions[j].year < m_transitions[j-1].year) {
+			m_yearStart.clear();
+			return;
+		}
+	}
+}
+
+bool TzZone::transitionsForYear(int year, const TzTransition*& r_first, const TzTransition*& r_last) const
+{
+	r_first = r_last = 0;
+
+	if (m_transitions.empty())
+		return false;
+
+	if (m_yearStart.empty()) {
+		for (unsigned int i = 0; i < m_transitions.size(); ++i) {
+			if (m_transitions[i].year != year)
+				continue;
+			if (!r_first)
+				r_first = &m_transitions[i];
+			r_last = &m_transitions[i] + 1;
+		}
+		return r_first != 0;
+	}
+
+	int k = year - m_firstYear;
+	if (k < 0 || k + 1 >= (int) m_yearStart.size())
+		return false;
+
+	unsigned int begin = m_yearStart[k];
+	unsigned int end = m_yearStart[k + 1];
+	if (begin == end)
+		return false;
+
+	r_first = &m_transitions[0] + begin;
+	r_last = &m_transitions[0] + end;
+	return true;
+}
+
+const TzTransition* TzZone::lastTransitionUpToYear(int year) const
+{
+	if (m_transitions.empty())
+		return 0;
+
+	if (m_yearStart.empty()) {
+		for (unsigned int i = m_transitions.size(); i > 0; --i) {
+			if (m_transitions[i-1].year <= year)
+				return &m_transitions[i-1];
+		}
+		return 0;
+	}
+
+	int k = year - m_firstYear;
+	if (k < 0)
+		return 0;
+	if (k + 1 >= (int) m_yearStart.size())
+		return &m_transitions.back();
+
+	// everything before the start of the next year
+	unsigned int end = m_yearStart[k + 1];
+	return end ? &m_transitions[end - 1] : 0;
+}
+
+static bool transitionTimeLess(time_t t, const TzTransition& trans)
+{
+	return t < trans.time;
+}
+
+bool TzZone::utcOffsetAt(time_t t, time_t& r_offset) const
+{
+	if (m_transitions.empty())
+		return false;
+
+	if (m_fixedOffset) {
+		r_offset = m_transitions[0].utcOffset;
+		return true;
+	}
+
+	// the last transition at or before t; past the end of the table only the footer rule can say
+	TzTransitionList::const_iterator next = std::upper_bound(m_transitions.begin(), m_transitions.end(),
+															 t, transitionTimeLess);
+	if (next == m_transitions.begin())
+		return false;
+
+	if (next == m_transitions.end()) {
+		if (!m_rule.valid)
+			return false;
+		r_offset = ruleOffsetAt(m_rule, t);
+		return true;
+	}
+
+	r_offset = (next - 1)->utcOffset;
+	return true;
+}
+
+bool TzZone::utcFromLocal(time_t local, time_t& r_utc) const
+{
+	time_t offset;
+	if (!utcOffsetAt(local, offset))
+		return false;
+
+	// guess with the offset at the same number as utc, then settle on the offset in effect at the guess
+	time_t utc = local - offset;
+	if (!utcOffsetAt(utc, offset))
+		return false;
+
+	utc = local - offset;
+
+	time_t check;
+	if (!utcOffsetAt(utc, check))
+		return false;
+
+	// in a gap the offset differs on either side; move past the transition
+	if (check != offset)
+		utc = local - check;
+
+	r_utc = utc;
+	return true;
+}
+
+bool TzZone::nextOffsetChangeAfter(time_t t, TzTransition& r_next) const
+{
+	TzTransitionList::const_iterator it = std::upper_bound(m_transitions.begin(), m_transitions.end(),
+														   t, transitionTimeLess);
+	for (; it != m_transitions.end(); ++it) {
+		if (it == m_transitions.begin() || it->utcOffset != (it - 1)->utcOffset) {
+			r_next = *it;
+			return true;
+		}
+	}
+
+	if (!m_rule.valid || !m_rule.hasDst || m_transitions.empty())
+		return false;
+
+	// past the table; the rule takes over from its last entry, so don't look at the rule before that. At
+	// that entry the table has the say: a rule transition on (or about) it, as in Antarctica/Troll, has
+	// already happened
+	const TzTransition& last = m_transitions.back();
+	time_t from = std::max(t, last.time);
+	time_t offset = (from == last.time) ? last.utcOffset : ruleOffsetAt(m_rule, from);
+	int year = utcYear(from);
+	for (int y = year - 1; y <= year + 2; ++y) {
+		TzTransition ruleTrans[2];
+		ruleTransitionsForYear(m_rule, y, ruleTrans);
+		for (int i = 0; i < 2; ++i) {
+			if (ruleTrans[i].time <= last.time)
+				continue;
+			if (ruleTrans[i].time > from && ruleTrans[i].utcOffset != offset) {
+				r_next = ruleTrans[i];
+				return true;
+			}
+		}
+	}
+
+	return false;
 }
 
 /*
@@ -18,10 +18,18 @@
 #include <uriparser/Uri.h> 
 #include "UrlRep.h"
 
-#define URI_TEXT_RANGE_TO_STRING(textRange)			   					  \
-	textRange.first ? std::string(textRange.first,						  \
-								  textRange.afterLast - textRange.first)  \
-	: std::string()
+#define URI_TEXT_RANGE_APPEND(str,textRange)									  \
+	if ((textRange).first)													  \
+		(str).append((textRange).first,(textRange).afterLast - (textRange).first)
+
+//unescape() without the copies; the unescaped text is never longer than the original
+static void unescapeInPlace(std::string& str)
+{
+	if (str.empty())
+		return;
+	uriUnescapeInPlaceA(&str[0]);
+	str.resize(strlen(str.c_str()));
+}
 
 UrlRep UrlRep::fromUrl(const char* uri)
 {
@@ -40,24 +48,24 @@ UrlRep UrlRep::fromUrl(const char* uri)
 
 	urlRep.query.clear();
 	
-	urlRep.scheme = URI_TEXT_RANGE_TO_STRING(uriA.scheme);
-	urlRep.userInfo = URI_TEXT_RANGE_TO_STRING(uriA.userInfo);
-	urlRep.host = URI_TEXT_RANGE_TO_STRING(uriA.hostText);
-	urlRep.port = URI_TEXT_RANGE_TO_STRING(uriA.portText);
-	urlRep.fragment = URI_TEXT_RANGE_TO_STRING(uriA.fragment);
+	URI_TEXT_RANGE_APPEND(urlRep.scheme,uriA.scheme);
+	URI_TEXT_RANGE_APPEND(urlRep.userInfo,uriA.userInfo);
+	URI_TEXT_RANGE_APPEND(urlRep.host,uriA.hostText);
+	URI_TEXT_RANGE_APPEND(urlRep.port,uriA.portText);
+	URI_TEXT_RANGE_APPEND(urlRep.fragment,uriA.fragment);
 
 	UriPathSegmentA* tmpPath = uriA.pathHead;
 	while (tmpPath) {
 		if (tmpPath == uriA.pathTail) {
 			urlRep.pathOnly = urlRep.path;
 		}
-		urlRep.path += "/";
-		urlRep.path += URI_TEXT_RANGE_TO_STRING(tmpPath->text);
+		urlRep.path += '/';
+		URI_TEXT_RANGE_APPEND(urlRep.path,tmpPath->text);
 		tmpPath = tmpPath->next;
 	}
 
 	if (uriA.pathTail) {
-		urlRep.resource = URI_TEXT_RANGE_TO_STRING((uriA.pathTail)->text);
+		URI_TEXT_RANGE_APPEND(urlRep.resource,(uriA.pathTail)->text);
 	}
 	
 	if (uriA.query.first) {
@@ -79,9 +87,9 @@ UrlRep UrlRep::fromUrl(const char* uri)
 	
 	uriFreeUriMembersA(&uriA);	       
 
-	urlRep.resource = unescape(urlRep.resource);
-	urlRep.path = unescape(urlRep.path);
-	urlRep.pathOnly = unescape(urlRep.pathOnly);
+	unescapeInPlace(urlRep.resource);
+	unescapeInPlace(urlRep.path);
+	unescapeInPlace(urlRep.pathOnly);
 	
 	//TODO: maybe a more stringent check on validity???
 	urlRep.valid = true;
@@ -236,6 +236,58 @@ void trimWhitespace_inplace(std::string& s_mod,const std::string& drop)
 	 s_mod = s_mod.substr( first, last - first + 1 );
 }
 
+bool trimWhitespace(const char* str,Substring& r_range,const char* drop)
+{
+	size_t first = r_range.start;
+	size_t last = r_range.start + r_range.length;
+	while (first < last && strchr(drop,str[first]) && str[first])
+		++first;
+	while (last > first && strchr(drop,str[last-1]) && str[last-1])
+		--last;
+	r_range.start = first;
+	r_range.length = last - first;
+	return (r_range.length > 0);
+}
+
+//the start and end of the next run of non-delims at or after pos; false if there is none
+static bool nextSubstring(const char* str,size_t len,const char* delims,size_t& pos,Substring& r_substring)
+{
+	while (pos < len && str[pos] && strchr(delims,str[pos]))
+		++pos;
+	if (pos >= len)
+		return false;
+	r_substring.start = pos;
+	while (pos < len && !(str[pos] && strchr(delims,str[pos])))
+		++pos;
+	r_substring.length = pos - r_substring.start;
+	return true;
+}
+
+bool getNthSubstring(unsigned int n,Substring& r_target,const char* str,size_t len,const char* delims)
+{
+	if (n == 0)
+		n=1;
+	size_t pos = 0;
+	for (unsigned int i=1;nextSubstring(str,len,delims,pos,r_target);i++) {
+		if (i == n)
+			return true;
+	}
+	return false;
+}
+
+int splitStringOnKey(Substring* r_splits,int maxSplits,const char* str,size_t len,const char* delims)
+{
+	size_t pos = 0;
+	Substring sub;
+	int i=0;
+	while (nextSubstring(str,len,delims,pos,sub)) {
+		if (i < maxSplits)
+			r_splits[i] = sub;
+		++i;
+	}
+	return i;
+}
+
 int splitStringOnKey(std::list<std::string>& returnSplitSubstrings,const std::string& baseStr,const std::string& delims) {
 
 	std::string base = trimWhitespace(baseStr);
@@ -365,96 +417,82 @@ int urlEncodeFilename(std::string& encodedName,const std::string& decodedName)
 	return 1;
 }
 
-static const std::string base64_chars = 
+static const char base64_chars[] =
              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
              "abcdefghijklmnopqrstuvwxyz"
              "0123456789+/";
 
+//base64_chars reversed: the 6 bit value of each char, -1 for chars that aren't base64
+struct Base64DecodeTable {
+	signed char value[256];
+	Base64DecodeTable() {
+		memset(value,-1,sizeof(value));
+		for (int i=0;i<64;i++)
+			value[(unsigned char)base64_chars[i]] = i;
+	}
+};
+static const Base64DecodeTable base64_values;
+
+size_t base64_encode(char* r_out,const unsigned char* bytes,size_t len)
+{
+	char* out = r_out;
+	for (;len >= 3;len -= 3,bytes += 3) {
+		unsigned int triple = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+		*out++ = base64_chars[(triple >> 18) & 0x3f];
+		*out++ = base64_chars[(triple >> 12) & 0x3f];
+		*out++ = base64_chars[(triple >> 6) & 0x3f];
+		*out++ = base64_chars[triple & 0x3f];
+	}
+	if (len) {
+		unsigned int triple = (bytes[0] << 16) | ((len == 2 ? bytes[1] : 0) << 8);
+		*out++ = base64_chars[(triple >> 18) & 0x3f];
+		*out++ = base64_chars[(triple >> 12) & 0x3f];
+		*out++ = (len == 2 ? base64_chars[(triple >> 6) & 0x3f] : '=');
+		*out++ = '=';
+	}
+	return out - r_out;
+}
 
-static inline bool is_base64(unsigned char c) {
-  return (isalnum(c) || (c == '+') || (c == '/'));
+//stops at the first '=' or anything else that isn't base64, like it always has
+size_t base64_decode(unsigned char* r_out,const char* encoded,size_t len)
+{
+	unsigned char* out = r_out;
+	unsigned int quad = 0;
+	int n = 0;
+	for (size_t i=0;i<len;i++) {
+		int v = base64_values.value[(unsigned char)encoded[i]];
+		if (v < 0)
+			break;
+		quad = (quad << 6) | v;
+		if (++n == 4) {
+			*out++ = (quad >> 16) & 0xff;
+			*out++ = (quad >> 8) & 0xff;
+			*out++ = quad & 0xff;
+			quad = 0;
+			n = 0;
+		}
+	}
+	//a partial group of n chars still carries n-1 whole bytes
+	if (n > 1) {
+		quad <<= 6 * (4 - n);
+		*out++ = (quad >> 16) & 0xff;
+		if (n == 3)
+			*out++ = (quad >> 8) & 0xff;
+	}
+	return out - r_out;
 }
 
 std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-  std::string ret;
-  int i = 0;
-  unsigned char char_array_3[3];
-  unsigned char char_array_4[4];
-
-  while (in_len--) {
-    char_array_3[i++] = *(bytes_to_encode++);
-    if (i == 3) {
-      char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-      char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-      char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-      char_array_4[3] = char_array_3[2] & 0x3f;
-
-      for(i = 0; (i <4) ; i++)
-        ret += base64_chars[char_array_4[i]];
-      i = 0;
-    }
-  }
-
-  if (i)
-  {
-    for(int j = i; j < 3; j++)
-      char_array_3[j] = '\0';
-
-    char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-    char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-    char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-    char_array_4[3] = char_array_3[2] & 0x3f;
-
-    for (int j = 0; (j < i + 1); j++)
-      ret += base64_chars[char_array_4[j]];
-
-    while((i++ < 3))
-      ret += '=';
-
-  }
-
-  return ret;
-
+	std::string ret(base64_encoded_size(in_len),'\0');
+	if (in_len)
+		ret.resize(base64_encode(&ret[0],bytes_to_encode,in_len));
+	return ret;
 }
 
 std::string base64_decode(std::string const& encoded_string) {
-  int in_len = encoded_string.size();
-  int i = 0;
-  int in_ = 0;
-  unsigned char char_array_4[4], char_array_3[3];
-  std::string ret;
-
-  while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-    char_array_4[i++] = encoded_string[in_]; in_++;
-    if (i ==4) {
-      for (i = 0; i <4; i++)
-        char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-      char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-      char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-      char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-      for (i = 0; (i < 3); i++)
-        ret += char_array_3[i];
-      i = 0;
-    }
-  }
-
-  if (i) {
-    for (int j = i; j <4; j++)
-      char_array_4[j] = 0;
-
-    for (int j = 0; j <4; j++)
-      char_array_4[j] = base64_chars.find(char_array_4[j]);
-
-    char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-    char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-    char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-    for (int j = 0; (j < i - 1); j++) ret += char_array_3[j];
-  }
-
-  return ret;
+	std::string ret(base64_decoded_size(encoded_string.size()),'\0');
+	ret.resize(base64_decode((unsigned char*)&ret[0],encoded_string.data(),encoded_string.size()));
+	return ret;
 }
 
 bool extractFromJson(const std::string& jsonString,const std::string& key,std::string& r_value)
@@ -553,18 +591,17 @@ void string_to_lower(std::string& str)
 	std::transform(str.begin(), str.end(), str.begin(), tolower);	
 }
 
-std::string string_printf(const char *format, ...)
+static void vappend_format(std::string & str, const char * format, va_list args)
 {
-    if (format == 0)
-        return "";
-    va_list args;
-    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
     char stackBuffer[1024];
-    int result = vsnprintf(stackBuffer, G_N_ELEMENTS(stackBuffer), format, args);
+    int result = vsnprintf(stackBuffer, G_N_ELEMENTS(stackBuffer), format, copy);
+    va_end(copy);
     if (result > -1 && result < (int) G_N_ELEMENTS(stackBuffer))
     {   // stack buffer was sufficiently large. Common case with no temporary dynamic buffer.
-        va_end(args);
-        return std::string(stackBuffer, result);
+        str.append(stackBuffer, result);
+        return;
     }
 
     int length = result > -1 ? result + 1 : G_N_ELEMENTS(stackBuffer) * 3;
@@ -577,11 +614,24 @@ std::string string_printf(const char *format, ...)
             length *= 3;
         }
         buffer = new char[length];
-        result = vsnprintf(buffer, length, format, args);
-    } while (result == -1 && result < length);
-    va_end(args);
-    std::string str(buffer, result);
+        // each attempt needs its own copy; a va_list can't be walked twice
+        va_copy(copy, args);
+        result = vsnprintf(buffer, length, format, copy);
+        va_end(copy);
+    } while (result == -1 || result >= length);
+    str.append(buffer, result);
     delete[] buffer;
+}
+
+std::string string_printf(const char *format, ...)
+{
+    std::string str;
+    if (format == 0)
+        return str;
+    va_list args;
+    va_start(args, format);
+    vappend_format(str, format, args);
+    va_end(args);
     return str;
 }
 
@@ -591,30 +641,20 @@ std::string & append_format(std::string & str, const char * format, ...)
         return str;
     va_list args;
     va_start(args, format);
-    char stackBuffer[1024];
-    int result = vsnprintf(stackBuffer, G_N_ELEMENTS(stackBuffer), format, args);
-    if (result > -1 && result < (int) G_N_ELEMENTS(stackBuffer))
-    {   // stack buffer was sufficiently large. Common case with no temporary dynamic buffer.
-        va_end(args);
-        str.append(stackBuffer, result);
-        return str;
-    }
+    vappend_format(str, format, args);
+    va_end(args);
+    return str;
+}
 
-    int length = result > -1 ? result + 1 : G_N_ELEMENTS(stackBuffer) * 3;
-    char * buffer = 0;
-    do
-    {
-        if (buffer)
-        {
-            delete[] buffer;
-            length *= 3;
-        }
-        buffer = new char[length];
-        result = vsnprintf(buffer, length, format, args);
-    } while (result == -1 && result < length);
+std::string & assign_format(std::string & str, const char * format, ...)
+{
+    str.clear();
+    if (format == 0)
+        return str;
+    va_list args;
+    va_start(args, format);
+    vappend_format(str, format, args);
     va_end(args);
-    str.append(buffer, result);
-    delete[] buffer;
     return str;
 }
 
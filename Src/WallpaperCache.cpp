@@ -0,0 +1,323 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "WallpaperCache.h"
+#include "Utils.h"
+#include "Logging.h"
+
+static const char* s_thumbSuffix = ".thumb";
+static const char* s_variantSuffix = ".v";
+static const char* s_tempSuffix = ".tmp";
+
+static bool hasSuffix(const std::string& s, const char* suffix)
+{
+	size_t n = strlen(suffix);
+	return s.size() > n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+//copies rather than links: SystemRestore rewrites wallpapers in place, which would reach into a linked cache entry
+static bool copyInto(const std::string& src, const std::string& dest)
+{
+	std::string temp = dest + s_tempSuffix;
+	if (Utils::fileCopy(src.c_str(), temp.c_str()) <= 0 || rename(temp.c_str(), dest.c_str()) != 0) {
+		(void) unlink(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+static off_t fileSize(const std::string& path)
+{
+	struct stat stBuf;
+	if (stat(path.c_str(), &stBuf) != 0)
+		return -1;
+	return stBuf.st_size;
+}
+
+WallpaperCache::WallpaperCache()
+	: m_maxSize(0)
+	, m_totalSize(0)
+{
+}
+
+void WallpaperCache::init(const std::string& cacheDir, off_t maxBytes)
+{
+	m_dir = cacheDir;
+	m_maxSize = maxBytes;
+	m_entries.clear();
+	m_totalSize = 0;
+
+	if (!enabled())
+		return;
+
+	if (g_mkdir_with_parents(m_dir.c_str(), 0766) < 0) {
+		qWarning("can't create the wallpaper cache dir [%s]", m_dir.c_str());
+		m_dir.clear();
+		return;
+	}
+
+	scan();
+	evict();
+	qDebug("wallpaper cache: %zu entries, %lld bytes", m_entries.size(), (long long) m_totalSize);
+}
+
+std::string WallpaperCache::keyFor(const std::string& sourcePathAndFile, const std::string& parameters) const
+{
+	if (!enabled())
+		return std::string();
+
+	FILE* fp = fopen(sourcePathAndFile.c_str(), "rb");
+	if (!fp)
+		return std::string();
+
+	GChecksum* checksum = g_checksum_new(G_CHECKSUM_MD5);
+	guchar buffer[65536];
+	size_t r;
+	while ((r = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		g_checksum_update(checksum, buffer, r);
+
+	bool ok = !ferror(fp);
+	fclose(fp);
+
+	std::string key;
+	if (ok) {
+		// the parameters go after the contents so that the key changes with either
+		g_checksum_update(checksum, (const guchar*) parameters.data(), parameters.size());
+		key = g_checksum_get_string(checksum);
+	}
+	g_checksum_free(checksum);
+	return key;
+}
+
+bool WallpaperCache::fetch(const std::string& key, const std::string& destPathAndFile, const std::string& destThumbPathAndFile)
+{
+	if (key.empty())
+		return false;
+
+	std::map<std::string, Entry>::iterator it = m_entries.find(key);
+	if (it == m_entries.end())
+		return false;
+
+	std::string wallpaper = wallpaperPath(key);
+	std::string thumb = thumbPath(key);
+	if (!copyInto(wallpaper, destPathAndFile) || !copyInto(thumb, destThumbPathAndFile)) {
+		qWarning("wallpaper cache: entry %s unusable, dropping it", key.c_str());
+		(void) unlink(destPathAndFile.c_str());
+		(void) unlink(destThumbPathAndFile.c_str());
+		removeEntry(key);
+		return false;
+	}
+
+	// the mtime is what orders entries after a restart
+	it->second.lastUsed = time(0);
+	(void) utime(wallpaper.c_str(), 0);
+	(void) utime(thumb.c_str(), 0);
+	return true;
+}
+
+void WallpaperCache::store(const std::string& key, const std::string& wallpaperPathAndFile, const std::string& thumbPathAndFile)
+{
+	if (key.empty() || !enabled())
+		return;
+
+	std::string wallpaper = wallpaperPath(key);
+	std::string thumb = thumbPath(key);
+	Entry& entry = m_entries[key];
+	m_totalSize -= entry.size;
+	entry.size = 0;
+	if (!copyInto(wallpaperPathAndFile, wallpaper) || !copyInto(thumbPathAndFile, thumb)) {
+		qWarning("wallpaper cache: couldn't store %s", wallpaperPathAndFile.c_str());
+		removeEntry(key);
+		return;
+	}
+
+	entry.size = fileSize(wallpaper) + fileSize(thumb);
+	for (std::set<std::string>::const_iterator it = entry.variants.begin(); it != entry.variants.end(); ++it)
+		entry.size += fileSize(variantPath(key, *it));
+	entry.lastUsed = time(0);
+	m_totalSize += entry.size;
+
+	evict();
+}
+
+bool WallpaperCache::fetchVariant(const std::string& key, const std::string& tag, const std::string& destPathAndFile)
+{
+	if (key.empty())
+		return false;
+
+	std::map<std::string, Entry>::iterator it = m_entries.find(key);
+	if (it == m_entries.end() || it->second.variants.find(tag) == it->second.variants.end())
+		return false;
+
+	std::string variant = variantPath(key, tag);
+	if (!copyInto(variant, destPathAndFile)) {
+		qWarning("wallpaper cache: variant %s of %s unusable, dropping it", tag.c_str(), key.c_str());
+		(void) unlink(destPathAndFile.c_str());
+		off_t size = fileSize(variant);
+		if (size > 0) {
+			it->second.size -= size;
+			m_totalSize -= size;
+		}
+		(void) unlink(variant.c_str());
+		it->second.variants.erase(tag);
+		return false;
+	}
+
+	(void) utime(variant.c_str(), 0);
+	return true;
+}
+
+void WallpaperCache::storeVariant(const std::string& key, const std::string& tag, const std::string& pathAndFile)
+{
+	if (key.empty() || !enabled())
+		return;
+
+	//an entry may get its variants before its wallpaper is stored; until it is, it only lives in memory
+	std::string variant = variantPath(key, tag);
+	Entry& entry = m_entries[key];
+	if (entry.variants.erase(tag)) {
+		off_t size = fileSize(variant);
+		if (size > 0) {
+			entry.size -= size;
+			m_totalSize -= size;
+		}
+	}
+
+	if (!copyInto(pathAndFile, variant)) {
+		qWarning("wallpaper cache: couldn't store variant %s", pathAndFile.c_str());
+		(void) unlink(variant.c_str());
+		return;
+	}
+
+	off_t size = fileSize(variant);
+	entry.variants.insert(tag);
+	entry.size += size;
+	entry.lastUsed = time(0);
+	m_totalSize += size;
+
+	evict();
+}
+
+void WallpaperCache::scan()
+{
+	DIR* dir = opendir(m_dir.c_str());
+	if (!dir)
+		return;
+
+	struct dirent* ent;
+	while ((ent = readdir(dir)) != 0) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		std::string name = ent->d_name;
+		std::string path = m_dir + "/" + name;
+
+		// left over from a copy that didn't finish
+		if (hasSuffix(name, s_tempSuffix)) {
+			(void) unlink(path.c_str());
+			continue;
+		}
+
+		struct stat stBuf;
+		if (stat(path.c_str(), &stBuf) != 0 || !S_ISREG(stBuf.st_mode))
+			continue;
+
+		// key, key.thumb or key.v<tag>; keys have no dots
+		size_t dot = name.find('.');
+		std::string key = name.substr(0, dot);
+		Entry& entry = m_entries[key];
+		if (dot != std::string::npos && name.compare(dot, strlen(s_variantSuffix), s_variantSuffix) == 0)
+			entry.variants.insert(name.substr(dot + strlen(s_variantSuffix)));
+		entry.size += stBuf.st_size;
+		if (stBuf.st_mtime > entry.lastUsed)
+			entry.lastUsed = stBuf.st_mtime;
+	}
+	closedir(dir);
+
+	// an entry needs both halves to be of any use
+	std::map<std::string, Entry>::iterator it = m_entries.begin();
+	while (it != m_entries.end()) {
+		if (access(wallpaperPath(it->first).c_str(), F_OK) != 0 || access(thumbPath(it->first).c_str(), F_OK) != 0) {
+			(void) unlink(wallpaperPath(it->first).c_str());
+			(void) unlink(thumbPath(it->first).c_str());
+			for (std::set<std::string>::const_iterator v = it->second.variants.begin(); v != it->second.variants.end(); ++v)
+				(void) unlink(variantPath(it->first, *v).c_str());
+			m_entries.erase(it++);
+		}
+		else {
+			m_totalSize += it->second.size;
+			++it;
+		}
+	}
+}
+
+void WallpaperCache::evict()
+{
+	while (m_totalSize > m_maxSize && !m_entries.empty()) {
+		std::map<std::string, Entry>::iterator oldest = m_entries.begin();
+		for (std::map<std::string, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+			if (it->second.lastUsed < oldest->second.lastUsed)
+				oldest = it;
+		}
+
+		qDebug("wallpaper cache: evicting %s", oldest->first.c_str());
+		removeEntry(oldest->first);
+	}
+}
+
+void WallpaperCache::removeEntry(const std::string& key)
+{
+	(void) unlink(wallpaperPath(key).c_str());
+	(void) unlink(thumbPath(key).c_str());
+
+	std::map<std::string, Entry>::iterator it = m_entries.find(key);
+	if (it == m_entries.end())
+		return;
+
+	for (std::set<std::string>::const_iterator v = it->second.variants.begin(); v != it->second.variants.end(); ++v)
+		(void) unlink(variantPath(key, *v).c_str());
+
+	m_totalSize -= it->second.size;
+	m_entries.erase(it);
+}
+
+std::string WallpaperCache::wallpaperPath(const std::string& key) const
+{
+	return m_dir + "/" + key;
+}
+
+std::string WallpaperCache::thumbPath(const std::string& key) const
+{
+	return m_dir + "/" + key + s_thumbSuffix;
+}
+
+std::string WallpaperCache::variantPath(const std::string& key, const std::string& tag) const
+{
+	return m_dir + "/" + key + s_variantSuffix + tag;
+}
@@ -19,8 +19,10 @@
 #include "PrefsDb.h"
 #include "Utils.h"
 #include <errno.h>
+#include <stdio.h>
 #include <dirent.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <linux/fb.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
@@ -28,6 +30,9 @@
 #include "ImageServices.h"
 #include "SystemRestore.h"
 #include "Settings.h"
+#include "PrefsFactory.h"
+#include "DirectoryWatcher.h"
+#include "StartupProfile.h"
 
 #include <json.h>
 #include <glib.h>
@@ -43,6 +48,7 @@
 #include <QtCore/QtGlobal>
 
 #include "ImageHelpers.h"
+#include "ImageKernels.h"
 
 #include "WallpaperPrefsHandler.h"
 
@@ -50,6 +56,8 @@ static const char* s_logChannel = "WallpaperPrefsHandler";
 
 std::string WallpaperPrefsHandler::s_wallpaperDir;
 std::string WallpaperPrefsHandler::s_wallpaperThumbsDir;
+std::string WallpaperPrefsHandler::s_wallpaperIndexFile;
+std::vector<WallpaperPrefsHandler::Variant> WallpaperPrefsHandler::s_variants;
 
 
 #define		THUMBS_WIDTH			64
@@ -58,6 +66,11 @@ std::string WallpaperPrefsHandler::s_wallpaperThumbsDir;
 static int SCREEN_WIDTH = 0;
 static int SCREEN_HEIGHT = 0;
 
+static const char* s_wallpaperCacheDir = "/.cache";
+static const char* s_wallpaperVariantsDir = "/.variants";
+static const char* s_wallpaperIndexFilename = "/wallpaperindex.json";
+static const int s_wallpaperIndexVersion = 2;
+
 static bool cbImportWallpaper(LSHandle* lsHandle, LSMessage *message,
 							void *user_data);
 
@@ -157,9 +170,9 @@ bool WallpaperPrefsHandler::validate(const std::string& key, json_object* value)
 
 	wallpaperName = json_object_get_string(label);
 	
-	//refresh the wallpapers from the directory
+	//refresh the wallpapers from the directory (only rescans if something outside of us changed it)
 	//WARNING: small chance for a race condition here. The file could be deleted after the scan
-	scanForWallpapers();
+	refreshWallpapers();
 	
 	//try to match the given wallpaper to one of the ones found in the scan
 	for (std::list<std::string>::iterator it = m_wallpapers.begin();it != m_wallpapers.end();++it) {
@@ -188,8 +201,8 @@ void WallpaperPrefsHandler::valueChanged(const std::string& key, json_object* va
 
 json_object* WallpaperPrefsHandler::valuesForKey(const std::string& key)
 {
-	//scan the wallpapers dir
-	std::list<std::string> wallpaperFilenames = scanForWallpapers();
+	//rescans the wallpapers dir only if it changed since the index was last written
+	std::list<std::string> wallpaperFilenames = refreshWallpapers();
 	
 	json_object* json = json_object_new_object();
 	json_object* arrayObj = json_object_new_array();
@@ -203,6 +216,7 @@ json_object* WallpaperPrefsHandler::valuesForKey(const std::string& key)
 		json_object_object_add(element,(char *)"wallpaperFile",json_object_new_string(filename_cstr));
 		filename_cstr = const_cast<char*>(wpThumbFile.c_str());
 		json_object_object_add(element,(char *)"wallpaperThumbFile",json_object_new_string(filename_cstr));
+		addVariantsToJson(element, *it);
 		json_object_array_add(arrayObj,element);
 	}
 	
@@ -232,6 +246,14 @@ void WallpaperPrefsHandler::init()
 	if (exit_status < 0) {
         qWarning("can't seem to create the wallpaper thumbs dir (currently [%s])",s_wallpaperThumbsDir.c_str());
 	}
+	m_cache.init(s_wallpaperThumbsDir + std::string(s_wallpaperCacheDir),
+			(off_t) Settings::settings()->m_wallpaperCacheSize * 1024);
+	parseVariants(Settings::settings()->m_wallpaperVariants);
+
+	//the index lives outside of the wallpaper dirs so that writing it doesn't change their mtimes
+	std::string sysserviceDir = std::string(PrefsDb::s_mediaPartitionPath) + std::string(PrefsDb::s_sysserviceDir);
+	(void) g_mkdir_with_parents(sysserviceDir.c_str(), 0766);
+	s_wallpaperIndexFile = sysserviceDir + std::string(s_wallpaperIndexFilename);
 	
 	result = LSPalmServiceRegisterCategory( m_service, "/wallpaper", s_methods, NULL,
 			NULL, this, &lsError);
@@ -263,6 +285,15 @@ void WallpaperPrefsHandler::init()
 	}
 
 
+	//from here on the watch keeps the index up to date
+	DirectoryWatcher::instance()->watch(s_wallpaperDir, cbWallpaperDirChanged, this);
+
+	StartupProfile::Phase phase("wallpaperIndex");
+	if (loadIndex() && indexIsCurrent()) {
+		qDebug("wallpaper index is current, %zu wallpapers", m_wallpapers.size());
+		return;
+	}
+
 	int n=0;
 	this->buildIndexFromExisting(&n);
 	if (n)
@@ -363,7 +394,7 @@ static std::string runImage2Binary(json_object * p_jsonRequestObject)
 }
 
 
-bool WallpaperPrefsHandler::importWallpaperViaImage2(const std::string& imageFilepath,double focusX,double focusY,double scaleFactor,json_object ** r_p_responseObject)
+bool WallpaperPrefsHandler::importWallpaperViaImage2(std::string& ret_wallpaperName,const std::string& imageFilepath,double focusX,double focusY,double scaleFactor,json_object ** r_p_responseObject)
 {
 	if (!r_p_responseObject)
 	{
@@ -392,6 +423,7 @@ bool WallpaperPrefsHandler::importWallpaperViaImage2(const std::string& imageFil
 
 	// destroy if already exists
 	(void) unlink(destPathAndFile.c_str());
+	removeVariants(file);
 
 	std::list<std::string>::iterator iter=m_wallpapers.begin();
 	while (iter != m_wallpapers.end()) {
@@ -416,8 +448,48 @@ bool WallpaperPrefsHandler::importWallpaperViaImage2(const std::string& imageFil
 
 	//g_message("%s: result: %s",__FUNCTION__,(result.empty() ? "(NO OUTPUT)" : result.c_str()));
 	qDebug("result: %s", (result.empty() ? "(NO OUTPUT)" : result.c_str()));
+	json_object_put(requestObject);
 
-	return false;
+	//the helper only writes the wallpaper; the thumbnail is ours to make
+	QImageReader reader(QString::fromStdString(destPathAndFile));
+	if (!reader.canRead())
+		return false;
+
+	std::string destThumbPathAndFile = s_wallpaperThumbsDir + std::string("/")+file;
+	if (resizeImage(destPathAndFile, destThumbPathAndFile, THUMBS_WIDTH, THUMBS_HEIGHT, reader.format().data()) != 0) {
+		unlink(destPathAndFile.c_str());
+		return false;
+	}
+	renderVariants(imageFilepath, focusX, focusY, scaleFactor, file, std::string());
+
+	m_index.erase(file);
+	addToIndex(file);
+	ret_wallpaperName = file;
+	return true;
+}
+
+//what the com.palm.image2 helper's wallpaperConvert does (scale, re-center on the focus point, crop to the
+//screen and convert), done here with the Qt code instead of spawning a process for it
+bool WallpaperPrefsHandler::importWallpaperInProcess(std::string& ret_wallpaperName,const std::string& imageFilepath,
+		double focusX,double focusY,double scaleFactor,std::string& errorText)
+{
+	gchar* fileName = g_path_get_basename(imageFilepath.c_str());
+	gchar* folderPath = g_path_get_dirname(imageFilepath.c_str());
+
+	if (!fileName || !folderPath) {
+        errorText = (fileName ? "Path is missing" : (!folderPath ? "Both path and file name are missing" : "filename is missing"));
+		g_free(fileName);
+		g_free(folderPath);
+		return false;
+	}
+
+	std::string file = fileName;
+	std::string path = folderPath;
+
+	g_free(fileName);
+	g_free(folderPath);
+
+	return importWallpaper(ret_wallpaperName, path, file, false, focusX, focusY, scaleFactor, errorText);
 }
 
 bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName,const std::string& sourcePathAndFile,
@@ -466,6 +538,7 @@ bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName, cons
 	// destroy both files (including thumbnail) if they exists
 	(void) unlink(destPathAndFile.c_str());
 	(void) unlink(destThumbPathAndFile.c_str());
+	removeVariants(sourceFile);
 
     std::list<std::string>::iterator iter=m_wallpapers.begin();
     while (iter != m_wallpapers.end()) {
@@ -474,6 +547,7 @@ bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName, cons
         else
             ++iter;
     }
+    m_index.erase(sourceFile);
 
     //fix scale factor just in case it's negative
     if (scale < 0.0)
@@ -493,22 +567,44 @@ bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName, cons
 
     qDebug("importWallpaper(): parameters: scale = %lf , centerX = %lf , centerY = %lf , toScreenSize? = %s\n",
             scale,centerX,centerY,(toScreenSize ? "True" : "False"));
+
+    std::string cacheKey = cacheKeyFor(pathAndFile, "full", toScreenSize, centerX, centerY, scale);
+    if (m_cache.fetch(cacheKey, destPathAndFile, destThumbPathAndFile)) {
+        renderVariants(pathAndFile, centerX, centerY, toScreenSize ? 0.0 : scale, sourceFile, cacheKey);
+        addToIndex(sourceFile);
+        ret_wallpaperName = sourceFile;
+        qDebug("importWallpaper(): complete (cached)\n");
+        return true;
+    }
+
     //create a resized version of the image to screen res in the wallpapers dir
 
+    bool variantsDone = false;
     if (toScreenSize) {
         if (resizeImage(pathAndFile, destPathAndFile, SCREEN_WIDTH, SCREEN_HEIGHT, reader.format().data()) != 0)
             return false;
     }
+    else if (readWallpaperClipped(pathAndFile, reader, false, centerX, centerY, scale, destPathAndFile, errorText)) {
+        qDebug("importWallpaper(): wrote final image to file (clipped decode)\n");
+    }
+    else if (!errorText.empty()) {
+        return false;
+    }
     else {
         double prescale;
         QImage image;
         if(!readImageWithPrescale(reader, image, prescale)) {
             errorText=reader.errorString().toStdString();
+            return false;
         }
         scale /= prescale;
 
+        // the other sizes come out of the same decode
+        writeVariants(image, centerX, centerY, scale, sourceFile, cacheKey);
+        variantsDone = true;
+
         if(scale != 1.0)
-            image = image.scaled(image.width() * scale, image.height() * scale);
+            image = ImageKernels::scaled(image, (int) (image.width() * scale), (int) (image.height() * scale));
 
         // now refocus as requested
         qDebug("importWallpaper(): calling clipImageBufferToScreenSizeWithFocus...\n");
@@ -528,7 +624,12 @@ bool WallpaperPrefsHandler::importWallpaper(std::string& ret_wallpaperName, cons
         return false;
     }
 
-    m_wallpapers.push_back(sourceFile);
+    if (!variantsDone)
+        renderVariants(pathAndFile, centerX, centerY, toScreenSize ? 0.0 : scale, sourceFile, cacheKey);
+
+    m_cache.store(cacheKey, destPathAndFile, destThumbPathAndFile);
+
+    addToIndex(sourceFile);
     ret_wallpaperName = sourceFile;
     //all good...
     qDebug("importWallpaper(): complete\n");
@@ -558,6 +659,7 @@ bool WallpaperPrefsHandler::importWallpaper_lowMem(std::string& ret_wallpaperNam
 	// destroy both files (including thumbnail) if they exists
 	(void) unlink(destPathAndFile.c_str());
 	(void) unlink(destThumbPathAndFile.c_str());
+	removeVariants(sourceFile);
 
     std::list<std::string>::iterator iter=m_wallpapers.begin();
     while (iter != m_wallpapers.end()) {
@@ -566,6 +668,7 @@ bool WallpaperPrefsHandler::importWallpaper_lowMem(std::string& ret_wallpaperNam
         else
             ++iter;
     }
+    m_index.erase(sourceFile);
 
     //fix scale factor just in case it's negative
     if (scale < 0.0)
@@ -588,6 +691,15 @@ bool WallpaperPrefsHandler::importWallpaper_lowMem(std::string& ret_wallpaperNam
 	qDebug("importWallpaper(): parameters: scale = %lf , centerX = %lf , centerY = %lf , toScreenSize? = %s\n",
 			scale,centerX,centerY,(toScreenSize ? "True" : "False"));
 
+	std::string cacheKey = cacheKeyFor(pathAndFile, "lowMem", toScreenSize, centerX, centerY, scale);
+	if (m_cache.fetch(cacheKey, destPathAndFile, destThumbPathAndFile)) {
+		renderVariants(pathAndFile, centerX, centerY, 0.0, sourceFile, cacheKey);
+		addToIndex(sourceFile);
+		ret_wallpaperName = sourceFile;
+		qDebug("importWallpaper(): complete (cached): %s", destPathAndFile.c_str());
+		return true;
+	}
+
 	int maxDim = (SCREEN_WIDTH > SCREEN_HEIGHT) ? SCREEN_WIDTH : SCREEN_HEIGHT;
 	bool result;
 	if((srcWidth > maxDim) || (srcHeight > maxDim)) {
@@ -646,7 +758,13 @@ bool WallpaperPrefsHandler::importWallpaper_lowMem(std::string& ret_wallpaperNam
 		return false;
 	}
 	
-	m_wallpapers.push_back(sourceFile);
+	if (result) {
+		// lowMem fits the screen rather than following scale, so the variants are filled the same way
+		renderVariants(pathAndFile, centerX, centerY, 0.0, sourceFile, cacheKey);
+		m_cache.store(cacheKey, destPathAndFile, destThumbPathAndFile);
+	}
+
+	addToIndex(sourceFile);
 	ret_wallpaperName = sourceFile;
 	//all good...
     if (result) qDebug("importWallpaper(): complete: %s", destPathAndFile.c_str());
@@ -681,6 +799,11 @@ bool WallpaperPrefsHandler::convertImage(const std::string& pathToSourceFile,
 
     qDebug("convertImage parameters: scale = %lf , centerX = %lf , centerY = %lf\n", scale,centerX,centerY);
 
+    if (readWallpaperClipped(pathToSourceFile, reader, justConvert, centerX, centerY, scale, pathToDestFile, r_errorText, format))
+        return true;
+    if (!r_errorText.empty())
+        return false;
+
     // used to scale the file before it is actually read to memory
     double prescale = 1.0;
     QImage image;
@@ -694,7 +817,7 @@ bool WallpaperPrefsHandler::convertImage(const std::string& pathToSourceFile,
 
     if (scale != 1.0) {
         qDebug("convertImage(): scaling image\n");
-        image = image.scaled(scale * image.width(), scale * image.height());
+        image = ImageKernels::scaled(image, (int) (scale * image.width()), (int) (scale * image.height()));
     }
 
     if (!justConvert) {
@@ -711,6 +834,21 @@ bool WallpaperPrefsHandler::convertImage(const std::string& pathToSourceFile,
     return true;
 }
 
+//everything besides the source contents that goes into an imported wallpaper and its thumbnail
+std::string WallpaperPrefsHandler::cacheKeyFor(const std::string& sourcePathAndFile, const char* method,
+                                               bool toScreenSize, double centerX, double centerY, double scale) const
+{
+    if (!m_cache.enabled())
+        return std::string();
+
+    gchar* parameters = g_strdup_printf("%s %dx%d %dx%d %d %.4f %.4f %.4f", method,
+            SCREEN_WIDTH, SCREEN_HEIGHT, THUMBS_WIDTH, THUMBS_HEIGHT,
+            toScreenSize ? 1 : 0, centerX, centerY, scale);
+    std::string key = m_cache.keyFor(sourcePathAndFile, parameters);
+    g_free(parameters);
+    return key;
+}
+
 bool WallpaperPrefsHandler::deleteWallpaper(std::string wallpaperName) {
 	
 	//does it exist in the wallpaper dir?
@@ -732,6 +870,7 @@ bool WallpaperPrefsHandler::deleteWallpaper(std::string wallpaperName) {
 	// destroy both files (including thumbnail) if they exists
 	(void) unlink(destPathAndFile.c_str());
 	(void) unlink(destThumbPathAndFile.c_str());
+	removeVariants(wallpaperName);
 
 	// note that if we were not been able to remove wallpaper file we'll remove
 	// reference to it from internal list anyway effectively hiding it/making
@@ -747,6 +886,11 @@ bool WallpaperPrefsHandler::deleteWallpaper(std::string wallpaperName) {
 			++iter;
 	}
 
+	if (m_index.erase(wallpaperName))
+		found = true;
+	saveIndex();
+	PrefsFactory::instance()->postPrefValues("wallpaper");
+
 	return found;
 }
 
@@ -767,12 +911,18 @@ QImage WallpaperPrefsHandler::clipImageToScreenSize(QImage& image, bool center)
 {
     if (image.width() == SCREEN_WIDTH && image.height() == SCREEN_HEIGHT)
         return image;
-    QImage result(SCREEN_WIDTH, SCREEN_HEIGHT, image.format());
 
-    result.fill(Qt::black);
     int halfScreenW = SCREEN_WIDTH>>1;
     int halfScreenH = SCREEN_HEIGHT>>1;
 
+    QImage result = center ? ImageKernels::crop(image, SCREEN_WIDTH, SCREEN_HEIGHT, image.width()/2 - halfScreenW, image.height() - halfScreenH)
+                           : ImageKernels::crop(image, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+    if (!result.isNull())
+        return result;
+
+    result = QImage(SCREEN_WIDTH, SCREEN_HEIGHT, image.format());
+    result.fill(Qt::black);
+
     QPainter p(&result);
     p.setRenderHint(QPainter::SmoothPixmapTransform);
     if(center) {
@@ -796,6 +946,12 @@ QImage WallpaperPrefsHandler::clipImageToScreenSize(QImage& image, bool center)
  */
 
 QImage WallpaperPrefsHandler::clipImageToScreenSizeWithFocus(QImage& image, int focus_x,int focus_y)
+{
+    return clipImageToSizeWithFocus(image, SCREEN_WIDTH, SCREEN_HEIGHT, focus_x, focus_y);
+}
+
+//same, for a width x height result
+QImage WallpaperPrefsHandler::clipImageToSizeWithFocus(QImage& image, int width, int height, int focus_x, int focus_y)
 {
     if (focus_x < 0)
         focus_x = 0;
@@ -808,11 +964,16 @@ QImage WallpaperPrefsHandler::clipImageToScreenSizeWithFocus(QImage& image, int
 
     qDebug("clipImageToScreenSizeWithFocus(): srcImg is ( %d , %d ), focus is ( %d , %d )", image.width(),image.height() ,focus_x,focus_y);
 
-    QImage result(SCREEN_WIDTH, SCREEN_HEIGHT, image.format());
+    int halfScreenW = width>>1;
+    int halfScreenH = height>>1;
+
+    // opaque images are copied row by row; the painter is only needed to matte alpha onto black
+    QImage result = ImageKernels::crop(image, width, height, focus_x - halfScreenW, focus_y - halfScreenH);
+    if (!result.isNull())
+        return result;
 
+    result = QImage(width, height, image.format());
     result.fill(Qt::black);
-    int halfScreenW = SCREEN_WIDTH>>1;
-    int halfScreenH = SCREEN_HEIGHT>>1;
 
     QPainter p(&result);
     p.setRenderHint(QPainter::SmoothPixmapTransform);
@@ -823,6 +984,42 @@ QImage WallpaperPrefsHandler::clipImageToScreenSizeWithFocus(QImage& image, int
     return result;
 }
 
+//what importWallpaper()/convertImage() make from the source (scaled, then cropped to the screen around the
+//focus point unless justScale), decoding only that part, at its final size, when all of the source at once
+//would go over the clipped decode size. False with r_errorText empty if that isn't needed or the format can't be clipped;
+//the caller then goes the usual way
+bool WallpaperPrefsHandler::readWallpaperClipped(const std::string& sourceFile, QImageReader& reader, bool justScale,
+                                                 double centerX, double centerY, double scale,
+                                                 const std::string& destFile, std::string& r_errorText,
+                                                 const char* format)
+{
+    size_t threshold = (size_t) Settings::settings()->m_imageClippedDecodeSize * 1024;
+    if (!exceedsClippedDecodeSize(reader, threshold))
+        return false;
+
+    QSize scaledSize(qMax(1, qRound(reader.size().width() * scale)), qMax(1, qRound(reader.size().height() * scale)));
+    QRect region(QPoint(0, 0), scaledSize);
+    if (!justScale) {
+        // same placement as clipImageToScreenSizeWithFocus(): the focus point, kept on the image, lands mid-screen
+        int focusX = qBound(0, qRound(scaledSize.width() * centerX), scaledSize.width());
+        int focusY = qBound(0, qRound(scaledSize.height() * centerY), scaledSize.height());
+        region = QRect(focusX - (SCREEN_WIDTH>>1), focusY - (SCREEN_HEIGHT>>1), SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+
+    QImage image;
+    QString error;
+    if (!readScaledRegion(QString::fromStdString(sourceFile), scaledSize, region, image, error)) {
+        r_errorText = error.toStdString();
+        return false;
+    }
+
+    if (!image.save(QString::fromStdString(destFile), format, 100)) {
+        r_errorText = std::string("failed to save destination file");
+        return false;
+    }
+    return true;
+}
+
 int WallpaperPrefsHandler::resizeImage(const std::string& sourceFile,
                                        const std::string& destFile,
                                        int destImgW, int destImgH,
@@ -831,6 +1028,25 @@ int WallpaperPrefsHandler::resizeImage(const std::string& sourceFile,
     if ((destImgW <= 0) || (destImgH <= 0))
         return -1;
 
+    {
+        // a big source is decoded straight at the destination size
+        size_t threshold = (size_t) Settings::settings()->m_imageClippedDecodeSize * 1024;
+        QImageReader reader(QString::fromStdString(sourceFile));
+        QImage clipped;
+        QString error;
+        QSize destSize(destImgW, destImgH);
+        if (exceedsClippedDecodeSize(reader, threshold)
+            && readScaledRegion(QString::fromStdString(sourceFile), destSize, QRect(QPoint(0, 0), destSize), clipped, error)) {
+            QImageWriter w(QString::fromStdString(destFile), format);
+            w.setQuality(100);
+            if (!w.write(clipped)) {
+                qCritical()<<"writer:"<<w.errorString();
+                return -1;
+            }
+            return 0;
+        }
+    }
+
     QImage image;
     if(!image.load(QString::fromStdString(sourceFile)))
         return -1;
@@ -842,13 +1058,9 @@ int WallpaperPrefsHandler::resizeImage(const std::string& sourceFile,
             qDebug()<<"error copying to"<<QString::fromStdString(destFile);
             return EIO;
         }
+        return 0;
     }
-    QImage result(destImgW, destImgH, image.format());
-
-    QPainter p(&result);
-    p.setRenderHint(QPainter::SmoothPixmapTransform);
-    p.drawImage(QRect(0,0,destImgW, destImgH), image);
-    p.end();
+    QImage result = ImageKernels::scaled(image, destImgW, destImgH);
 
     QImageWriter w(QString::fromStdString(destFile), format);
     w.setQuality(100);
@@ -978,6 +1190,7 @@ const std::list<std::string>& WallpaperPrefsHandler::buildIndexFromExisting(int
 	if (nInvalid)
 		*nInvalid = n;
 	
+	syncIndex();
 	return m_wallpapers;
 		
 }
@@ -1063,9 +1276,10 @@ const std::list<std::string>& WallpaperPrefsHandler::scanForWallpapers(bool rebu
 
             if (reader.format() == "png") {
                 rc = WallpaperPrefsHandler::resizeImage(p, thumbpath+(entries[i]->d_name), THUMBS_WIDTH, THUMBS_HEIGHT, reader.format());
-                if (rc == 0) {
-                    //success...
+                if (rc == 0 && m_index.find(entries[i]->d_name) == m_index.end()) {
+                    //success...(a rebuild regenerates thumbs of ones already listed; don't list those twice)
                     m_wallpapers.push_back(std::string(entries[i]->d_name));
+                    indexWallpaper(entries[i]->d_name);
                 }
             }
             else if (reader.format() == "jpg") {
@@ -1081,9 +1295,277 @@ const std::list<std::string>& WallpaperPrefsHandler::scanForWallpapers(bool rebu
 
 	free(entries);	
 
+	saveIndex();
+	return m_wallpapers;
+}
+
+const std::list<std::string>& WallpaperPrefsHandler::refreshWallpapers()
+{
+	//the watch only gets a rescan going early; a remount, a usb mass storage session or an erase changes the
+	//dirs without it seeing anything, so the index is checked against them every time
+	if (indexIsCurrent())
+		return m_wallpapers;
+
+	qDebug("wallpaper dirs changed since the index was written, rescanning");
+	int n=0;
+	buildIndexFromExisting(&n);
+	if (n)
+		scanForWallpapers();
 	return m_wallpapers;
 }
 
+//static
+WallpaperPrefsHandler::DirStamp WallpaperPrefsHandler::dirStamp(const std::string& path)
+{
+	DirStamp stamp;
+	struct stat stBuf;
+	if (stat(path.c_str(), &stBuf) != 0)
+		return stamp;
+	stamp.sec = stBuf.st_mtim.tv_sec;
+	stamp.nsec = stBuf.st_mtim.tv_nsec;
+
+	//names only, no stat per entry
+	GDir* dir = g_dir_open(path.c_str(), 0, NULL);
+	if (dir) {
+		stamp.entries = 0;
+		while (g_dir_read_name(dir))
+			++stamp.entries;
+		g_dir_close(dir);
+	}
+	return stamp;
+}
+
+bool WallpaperPrefsHandler::indexIsCurrent() const
+{
+	if (m_indexWallpaperDir.sec == 0 || m_indexThumbsDir.sec == 0)
+		return false;
+
+	return dirStamp(s_wallpaperDir) == m_indexWallpaperDir
+		&& dirStamp(s_wallpaperThumbsDir) == m_indexThumbsDir;
+}
+
+//static
+void WallpaperPrefsHandler::putDirStamp(json_object* root, const char* name, const DirStamp& stamp)
+{
+	json_object* element = json_object_new_object();
+	json_object_object_add(element, "sec", json_object_new_int((int) stamp.sec));
+	json_object_object_add(element, "nsec", json_object_new_int((int) stamp.nsec));
+	json_object_object_add(element, "entries", json_object_new_int(stamp.entries));
+	json_object_object_add(root, name, element);
+}
+
+//static
+WallpaperPrefsHandler::DirStamp WallpaperPrefsHandler::getDirStamp(json_object* root, const char* name)
+{
+	DirStamp stamp;
+	json_object* element = json_object_object_get(root, name);
+	json_object* label;
+	if (!element || json_object_get_type(element) != json_type_object)
+		return stamp;
+	if ((label = json_object_object_get(element, "sec")))
+		stamp.sec = json_object_get_int(label);
+	if ((label = json_object_object_get(element, "nsec")))
+		stamp.nsec = json_object_get_int(label);
+	if ((label = json_object_object_get(element, "entries")))
+		stamp.entries = json_object_get_int(label);
+	return stamp;
+}
+
+void WallpaperPrefsHandler::indexWallpaper(const std::string& wallpaperName)
+{
+	std::string pathAndFile = s_wallpaperDir + std::string("/") + wallpaperName;
+
+	IndexEntry entry;
+	struct stat stBuf;
+	if (stat(pathAndFile.c_str(), &stBuf) == 0)
+		entry.mtime = stBuf.st_mtime;
+
+	//header only, no decode
+	QSize size = QImageReader(QString::fromStdString(pathAndFile)).size();
+	if (size.isValid()) {
+		entry.width = size.width();
+		entry.height = size.height();
+	}
+
+	m_index[wallpaperName] = entry;
+}
+
+void WallpaperPrefsHandler::addToIndex(const std::string& wallpaperName)
+{
+	m_wallpapers.push_back(wallpaperName);
+	indexWallpaper(wallpaperName);
+	saveIndex();
+	PrefsFactory::instance()->postPrefValues("wallpaper");
+}
+
+void WallpaperPrefsHandler::cbWallpaperDirChanged(const std::string& name, bool present, void* data)
+{
+	static_cast<WallpaperPrefsHandler*>(data)->wallpaperFileChanged(name, present);
+}
+
+//a file in the wallpaper dir appeared or went away without going through us (or is one of our own imports,
+//which are indexed already)
+void WallpaperPrefsHandler::wallpaperFileChanged(const std::string& name, bool present)
+{
+	if (name.empty()) {
+		int n=0;
+		buildIndexFromExisting(&n);
+		if (n)
+			scanForWallpapers();
+		PrefsFactory::instance()->postPrefValues("wallpaper");
+		PrefsFactory::instance()->recheckPrefConsistency(this);
+		return;
+	}
+
+	bool listed = m_index.find(name) != m_index.end();
+
+	if (!present) {
+		removeVariants(name);
+		if (listed) {
+			m_wallpapers.remove(name);
+			m_index.erase(name);
+			PrefsFactory::instance()->postPrefValues("wallpaper");
+		}
+		saveIndex();
+		if (name == m_currentWallpaperName)
+			PrefsFactory::instance()->recheckPrefConsistency(this);
+		return;
+	}
+
+	if (listed) {
+		// rewritten in place
+		indexWallpaper(name);
+		saveIndex();
+		return;
+	}
+
+	std::string pathAndFile = s_wallpaperDir + std::string("/") + name;
+	std::string thumbPathAndFile = s_wallpaperThumbsDir + std::string("/") + name;
+	if (access(thumbPathAndFile.c_str(), F_OK) != 0) {
+		// same rules as scanForWallpapers(): only pngs get a thumbnail made for them
+		QImageReader reader(QString::fromStdString(pathAndFile));
+		if (!reader.canRead() || reader.format() != "png"
+			|| resizeImage(pathAndFile, thumbPathAndFile, THUMBS_WIDTH, THUMBS_HEIGHT, reader.format()) != 0) {
+			saveIndex();
+			return;
+		}
+	}
+	else if (!QImageReader(QString::fromStdString(pathAndFile)).canRead()) {
+		saveIndex();
+		return;
+	}
+
+	addToIndex(name);
+}
+
+//makes m_index match m_wallpapers, re-reading only the files whose mtime has changed
+void WallpaperPrefsHandler::syncIndex()
+{
+	std::map<std::string, IndexEntry> previous;
+	previous.swap(m_index);
+
+	for (std::list<std::string>::const_iterator it = m_wallpapers.begin(); it != m_wallpapers.end(); ++it) {
+		std::map<std::string, IndexEntry>::const_iterator found = previous.find(*it);
+		struct stat stBuf;
+		if (found != previous.end()
+			&& stat((s_wallpaperDir + std::string("/") + (*it)).c_str(), &stBuf) == 0
+			&& stBuf.st_mtime == found->second.mtime)
+			m_index[*it] = found->second;
+		else
+			indexWallpaper(*it);
+	}
+
+	saveIndex();
+}
+
+bool WallpaperPrefsHandler::loadIndex()
+{
+	if (s_wallpaperIndexFile.empty())
+		return false;
+
+	gchar* contents = 0;
+	if (!g_file_get_contents(s_wallpaperIndexFile.c_str(), &contents, NULL, NULL))
+		return false;
+
+	json_object* root = json_tokener_parse(contents);
+	g_free(contents);
+	if (!root)
+		return false;
+
+	bool ok = false;
+	json_object* label = json_object_object_get(root, "version");
+	json_object* wallpapers = json_object_object_get(root, "wallpapers");
+	if (label && json_object_get_int(label) == s_wallpaperIndexVersion
+		&& wallpapers && json_object_get_type(wallpapers) == json_type_array) {
+
+		m_wallpapers.clear();
+		m_index.clear();
+		for (int i = 0; i < json_object_array_length(wallpapers); ++i) {
+			json_object* element = json_object_array_get_idx(wallpapers, i);
+			json_object* name = json_object_object_get(element, "wallpaperName");
+			if (!name)
+				continue;
+
+			IndexEntry entry;
+			if ((label = json_object_object_get(element, "mtime")))
+				entry.mtime = json_object_get_int(label);
+			if ((label = json_object_object_get(element, "width")))
+				entry.width = json_object_get_int(label);
+			if ((label = json_object_object_get(element, "height")))
+				entry.height = json_object_get_int(label);
+
+			m_wallpapers.push_back(json_object_get_string(name));
+			m_index[m_wallpapers.back()] = entry;
+		}
+
+		m_indexWallpaperDir = getDirStamp(root, "wallpaperDir");
+		m_indexThumbsDir = getDirStamp(root, "thumbsDir");
+		ok = true;
+	}
+
+	json_object_put(root);
+	return ok;
+}
+
+void WallpaperPrefsHandler::saveIndex()
+{
+	if (s_wallpaperIndexFile.empty())
+		return;
+
+	//taken after our own changes to the dirs, so only someone else touching them invalidates the index
+	m_indexWallpaperDir = dirStamp(s_wallpaperDir);
+	m_indexThumbsDir = dirStamp(s_wallpaperThumbsDir);
+
+	json_object* root = json_object_new_object();
+	json_object_object_add(root, "version", json_object_new_int(s_wallpaperIndexVersion));
+	putDirStamp(root, "wallpaperDir", m_indexWallpaperDir);
+	putDirStamp(root, "thumbsDir", m_indexThumbsDir);
+
+	json_object* wallpapers = json_object_new_array();
+	for (std::list<std::string>::const_iterator it = m_wallpapers.begin(); it != m_wallpapers.end(); ++it) {
+		const IndexEntry& entry = m_index[*it];
+		json_object* element = json_object_new_object();
+		json_object_object_add(element, "wallpaperName", json_object_new_string(it->c_str()));
+		json_object_object_add(element, "wallpaperFile", json_object_new_string((s_wallpaperDir + std::string("/") + (*it)).c_str()));
+		json_object_object_add(element, "wallpaperThumbFile", json_object_new_string((s_wallpaperThumbsDir + std::string("/") + (*it)).c_str()));
+		json_object_object_add(element, "mtime", json_object_new_int((int) entry.mtime));
+		json_object_object_add(element, "width", json_object_new_int(entry.width));
+		json_object_object_add(element, "height", json_object_new_int(entry.height));
+		json_object_array_add(wallpapers, element);
+	}
+	json_object_object_add(root, "wallpapers", wallpapers);
+
+	// g_file_set_contents() writes a temp file and renames it over it
+	const char* str = json_object_to_json_string(root);
+	GError* error = NULL;
+	if (!g_file_set_contents(s_wallpaperIndexFile.c_str(), str, -1, &error)) {
+		qWarning("couldn't write the wallpaper index %s: %s", s_wallpaperIndexFile.c_str(), error ? error->message : "");
+		if (error)
+			g_error_free(error);
+	}
+	json_object_put(root);
+}
+
 bool WallpaperPrefsHandler::makeLocalUrlsFromWallpaperName(std::string& wallpaperUrl,std::string& wallpaperThumbUrl,const std::string& wallpaperName) {
 	
 	if (wallpaperName.length() > 0) {
@@ -1182,7 +1664,8 @@ Once the image has been converted, the wallpaper is stored in the internal list
     "wallpaper": {
         "wallpaperName": string,
         "wallpaperFile": string,
-        "wallpaperThumbFile": string
+        "wallpaperThumbFile": string,
+        "variants": [ { "width": int, "height": int, "wallpaperFile": string } ]
     },
     "errorText": string
 }
@@ -1193,6 +1676,7 @@ Once the image has been converted, the wallpaper is stored in the internal list
 \param wallpaperName Name of wallpaper file.
 \param wallpaperFile Path to wallpaper file.
 \param wallpaperThumbFile Path to wallpaper thumb file.
+\param variants The wallpaper rendered at the other sizes configured for the device (the variants setting), if any, so they can be shown without scaling.
 \param errorText Description of the error if call was not succesful.
 
 \subsection com_palm_systemservice_wallpaper_import_wallpaper_examples Examples:
@@ -1223,6 +1707,9 @@ Example response for a failed call:
 static bool cbImportWallpaper(LSHandle* lsHandle, LSMessage *message,
 							void *user_data)
 {
+    if (SystemRestore::deferUntilReady(lsHandle, message, cbImportWallpaper, user_data))
+        return true;
+
     // {"target": string, "focusX": double, "focusY": double, "scale": double}
     VALIDATE_SCHEMA_AND_RETURN(lsHandle,
                                message,
@@ -1332,12 +1819,18 @@ static bool cbImportWallpaper(LSHandle* lsHandle, LSMessage *message,
 
 	//delegate to a class member function from here on in
 	
-	//is com.palm.image2 available?
-	if (Settings::settings()->m_image2svcAvailable && Settings::settings()->m_useComPalmImage2)
+	//the external com.palm.image2 helper is only spawned if it was asked for by name
+	if (Settings::settings()->m_wallpaperImportBackend == "image2" && Settings::settings()->m_image2svcAvailable)
 	{
         qDebug()<<"using Image2 for import.";
-		//yes. Use it for wallpaper import
-		success = wh->importWallpaperViaImage2(input,fx,fy,scaleFactor,&jsonReplyObject);
+		success = wh->importWallpaperViaImage2(wallpaperName,input,fx,fy,scaleFactor,&jsonReplyObject);
+		if (!success)
+			errorText = std::string("image2 wallpaper conversion failed");
+	}
+	else if (Settings::settings()->m_wallpaperImportBackend == "pipeline" || Settings::settings()->m_useComPalmImage2)
+	{
+        qDebug()<<"in-process pipeline import.";
+		success = wh->importWallpaperInProcess(wallpaperName,input,fx,fy,scaleFactor,errorText);
 	}
 	else
 	{
@@ -1371,6 +1864,7 @@ Done:
 		json_object_object_add(inner_json,(char*) "wallpaperName",json_object_new_string(const_cast<char*>(wallpaperName.c_str())));
 		json_object_object_add(inner_json,(char*) "wallpaperFile",json_object_new_string(const_cast<char*>(wallpaperFile.c_str())));
 		json_object_object_add(inner_json,(char*) "wallpaperThumbFile",json_object_new_string(const_cast<char*>(wallpaperThumbFile.c_str())));
+		WallpaperPrefsHandler::addVariantsToJson(inner_json, wallpaperName);
 		json_object_object_add(json,(char*) "wallpaper",inner_json);
 	}
 
@@ -1709,6 +2203,9 @@ Example response for a succesful call:
 static bool cbRefreshWallpaperIndex(LSHandle* lsHandle, LSMessage *message,
 							void *user_data) 
 {
+    if (SystemRestore::deferUntilReady(lsHandle, message, cbRefreshWallpaperIndex, user_data))
+        return true;
+
     EMPTY_SCHEMA_RETURN(lsHandle,message);
 
 	LSError     lsError;
@@ -1765,7 +2262,8 @@ Retrieves a wallpaper object using either the wallpaperName or wallpaperFile par
    "wallpaper"   : {
       "wallpaperName"      : string,
       "wallpaperFile"      : string,
-      "wallpaperThumbFile" : string
+      "wallpaperThumbFile" : string,
+      "variants"           : [ { "width": int, "height": int, "wallpaperFile": string } ]
    }
    "errorText" : string
 }
@@ -1776,6 +2274,7 @@ Retrieves a wallpaper object using either the wallpaperName or wallpaperFile par
 \param wallpaperName Name of wallpaper file.
 \param wallpaperFile Path to wallpaper file.
 \param wallpaperThumbFile Path to wallpaper thumb file.
+\param variants The wallpaper rendered at the other configured sizes, if any. See importWallpaper.
 \param errorText Description of the error if call was not succesful.
 
 \subsection com_palm_systemservice_wallpaper_info_examples Examples:
@@ -1885,6 +2384,7 @@ Done:
 		json_object_object_add(inner_json,(char *)"wallpaperName",json_object_new_string((char*) wallpaperName.c_str()));
 		json_object_object_add(inner_json,(char *)"wallpaperFile",json_object_new_string((char*) wallpaperFile.c_str()));
 		json_object_object_add(inner_json,(char *)"wallpaperThumbFile",json_object_new_string((char*) wallpaperThumbFile.c_str()));
+		WallpaperPrefsHandler::addVariantsToJson(inner_json, wallpaperName);
 		json_object_object_add(json,(char *)"wallpaper",inner_json);
 		qDebug("Wallpaper specifications are: Name: %s, file: %s, thumbfile: %s", wallpaperName.c_str(), wallpaperFile.c_str(), wallpaperThumbFile.c_str());
 	}
@@ -1965,6 +2465,9 @@ Example response for a failed call:
 static bool cbDeleteWallpaper(LSHandle* lsHandle, LSMessage *message,
 		void *user_data)
 {
+	if (SystemRestore::deferUntilReady(lsHandle, message, cbDeleteWallpaper, user_data))
+		return true;
+
 	bool        retVal;
 	LSError     lsError;
 	const char* reply = 0;
@@ -2101,3 +2604,140 @@ void WallpaperPrefsHandler::getScreenDimensions()
 	}
 
 }
+
+//"1024x768,768x1024" -> s_variants. Sizes equal to the screen's are left out; that's the wallpaper itself
+void WallpaperPrefsHandler::parseVariants(const std::string& spec)
+{
+	s_variants.clear();
+
+	gchar** sizes = g_strsplit(spec.c_str(), ",", -1);
+	for (int i = 0; sizes && sizes[i]; ++i) {
+		Variant variant;
+		if (sscanf(g_strstrip(sizes[i]), "%dx%d", &variant.width, &variant.height) != 2
+			|| variant.width <= 0 || variant.height <= 0 || variant.width > 65536 || variant.height > 65536) {
+			if (sizes[i][0])
+				qWarning("ignoring wallpaper variant [%s]", sizes[i]);
+			continue;
+		}
+		if (variant.width == SCREEN_WIDTH && variant.height == SCREEN_HEIGHT)
+			continue;
+
+		gchar* dir = g_strdup_printf("%s%s/%dx%d", s_wallpaperThumbsDir.c_str(), s_wallpaperVariantsDir,
+				variant.width, variant.height);
+		variant.dir = dir;
+		g_free(dir);
+		if (g_mkdir_with_parents(variant.dir.c_str(), 0766) < 0) {
+			qWarning("can't create the wallpaper variant dir [%s]", variant.dir.c_str());
+			continue;
+		}
+		s_variants.push_back(variant);
+	}
+	g_strfreev(sizes);
+}
+
+//how much of a source pixel a variant's pixel is. With scale (relative to the source, as importWallpaper() takes
+//it) the variant has the screen wallpaper's framing at its own density; without (0) the source just covers it
+static double variantScale(int width, int height, const QSize& sourceSize, double scale)
+{
+	if (scale > 0.0)
+		return scale * qMax(width, height) / qMax(1, qMax(SCREEN_WIDTH, SCREEN_HEIGHT));
+	return qMax((double) width / sourceSize.width(), (double) height / sourceSize.height());
+}
+
+static std::string variantTag(int width, int height)
+{
+	gchar* tag = g_strdup_printf("%dx%d", width, height);
+	std::string r(tag);
+	g_free(tag);
+	return r;
+}
+
+//renders the s_variants that aren't there yet from image, already decoded; scale is relative to image
+void WallpaperPrefsHandler::writeVariants(const QImage& image, double centerX, double centerY, double scale,
+										  const std::string& wallpaperName, const std::string& cacheKey)
+{
+	for (std::vector<Variant>::const_iterator it = s_variants.begin(); it != s_variants.end(); ++it) {
+		std::string pathAndFile = it->dir + std::string("/") + wallpaperName;
+		if (access(pathAndFile.c_str(), F_OK) == 0)
+			continue;
+
+		double s = variantScale(it->width, it->height, image.size(), scale);
+		QImage scaled = ImageKernels::scaled(image, qMax(1, qRound(image.width() * s)), qMax(1, qRound(image.height() * s)));
+		QImage variant = clipImageToSizeWithFocus(scaled, it->width, it->height,
+				scaled.width() * centerX, scaled.height() * centerY);
+
+		if (!variant.save(QString::fromStdString(pathAndFile), 0, 100)) {
+			qWarning("couldn't write wallpaper variant %s", pathAndFile.c_str());
+			(void) unlink(pathAndFile.c_str());
+			continue;
+		}
+		m_cache.storeVariant(cacheKey, variantTag(it->width, it->height), pathAndFile);
+	}
+}
+
+//for the import paths that don't decode the source themselves: variants the cache has are copied from it,
+//and only if some are still missing is the source decoded, once, at no more than the largest of them needs
+void WallpaperPrefsHandler::renderVariants(const std::string& sourcePathAndFile, double centerX, double centerY,
+										   double scale, const std::string& wallpaperName, const std::string& cacheKey)
+{
+	std::vector<const Variant*> missing;
+	for (std::vector<Variant>::const_iterator it = s_variants.begin(); it != s_variants.end(); ++it) {
+		std::string pathAndFile = it->dir + std::string("/") + wallpaperName;
+		if (access(pathAndFile.c_str(), F_OK) == 0
+			|| m_cache.fetchVariant(cacheKey, variantTag(it->width, it->height), pathAndFile))
+			continue;
+		missing.push_back(&*it);
+	}
+	if (missing.empty())
+		return;
+
+	QImageReader reader(QString::fromStdString(sourcePathAndFile));
+	QSize size = reader.size();
+	if (!size.isValid() || size.isEmpty()) {
+		qWarning("can't render wallpaper variants of %s: %s", sourcePathAndFile.c_str(), reader.errorString().toStdString().c_str());
+		return;
+	}
+
+	double decodeScale = 0.0;
+	for (std::vector<const Variant*>::const_iterator it = missing.begin(); it != missing.end(); ++it)
+		decodeScale = qMax(decodeScale, variantScale((*it)->width, (*it)->height, size, scale));
+	if (decodeScale < 1.0)
+		reader.setScaledSize(QSize(qMax(1, qRound(size.width() * decodeScale)), qMax(1, qRound(size.height() * decodeScale))));
+	else
+		decodeScale = 1.0;
+
+	QImage image;
+	if (!reader.read(&image)) {
+		qWarning("can't render wallpaper variants of %s: %s", sourcePathAndFile.c_str(), reader.errorString().toStdString().c_str());
+		return;
+	}
+
+	writeVariants(image, centerX, centerY, (scale > 0.0) ? scale / decodeScale : 0.0, wallpaperName, cacheKey);
+}
+
+void WallpaperPrefsHandler::removeVariants(const std::string& wallpaperName)
+{
+	for (std::vector<Variant>::const_iterator it = s_variants.begin(); it != s_variants.end(); ++it)
+		(void) unlink((it->dir + std::string("/") + wallpaperName).c_str());
+}
+
+void WallpaperPrefsHandler::addVariantsToJson(json_object* wallpaper, const std::string& wallpaperName)
+{
+	json_object* variants = 0;
+	for (std::vector<Variant>::const_iterator it = s_variants.begin(); it != s_variants.end(); ++it) {
+		std::string pathAndFile = it->dir + std::string("/") + wallpaperName;
+		if (access(pathAndFile.c_str(), F_OK) != 0)
+			continue;
+
+		if (!variants)
+			variants = json_object_new_array();
+		json_object* variant = json_object_new_object();
+		json_object_object_add(variant, (char*) "width", json_object_new_int(it->width));
+		json_object_object_add(variant, (char*) "height", json_object_new_int(it->height));
+		json_object_object_add(variant, (char*) "wallpaperFile", json_object_new_string(pathAndFile.c_str()));
+		json_object_array_add(variants, variant);
+	}
+
+	if (variants)
+		json_object_object_add(wallpaper, (char*) "variants", variants);
+}
@@ -0,0 +1,398 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#include <string.h>
+#include <json.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "LunaServiceStub.h"
+
+struct LSHandle
+{
+	LSPalmService* service;
+	bool isPublic;
+	LSCancelFunction cancelFunction;
+	void* cancelData;
+};
+
+struct LSPalmService
+{
+	std::string name;
+	LSHandle publicHandle;
+	LSHandle privateHandle;
+};
+
+struct LSMessage
+{
+	int refs;
+	LSHandle* handle;
+	std::string payload;
+	std::string category;
+	std::string method;
+	std::string reply;
+	unsigned int replies;
+};
+
+struct LSSubscriptionIter
+{
+	std::vector<LSMessage*> messages;
+	size_t next;
+};
+
+typedef std::pair<LSHandle*, std::string> HandleKey;
+
+// keyed by service name and path, public handle first
+struct StubMethod
+{
+	LSHandle* handle;
+	std::string category;
+	std::string method;
+	LSMethodFunction function;
+};
+
+typedef std::map<std::string, StubMethod> StubMethodMap;
+typedef std::map<HandleKey, void*> CategoryDataMap;
+typedef std::map<HandleKey, std::vector<LSMessage*> > SubscriptionMap;
+
+static StubMethodMap s_methods;
+static CategoryDataMap s_categoryData;
+static SubscriptionMap s_subscriptions;
+static LSMessageToken s_lastToken = 0;
+
+static std::string methodKey(LSHandle* sh, const std::string& category, const char* method)
+{
+	std::string key = sh->service->name + (sh->isPublic ? "#public" : "#private") + category;
+	if (category.empty() || category[category.size() - 1] != '/')
+		key += '/';
+	return key + method;
+}
+
+static void addMethods(LSHandle* sh, const char* category, LSMethod* methods)
+{
+	for (LSMethod* m = methods; m && m->name; ++m) {
+		StubMethod& entry = s_methods[methodKey(sh, category, m->name)];
+		entry.handle = sh;
+		entry.category = category;
+		entry.method = m->name;
+		entry.function = m->function;
+	}
+}
+
+static LSMessage* dispatch(const char* serviceName, const char* path, const char* payload, std::string& r_reply)
+{
+	r_reply.clear();
+
+	StubMethodMap::const_iterator it = s_methods.end();
+	std::string prefix(serviceName);
+	const char* handles[] = { "#public", "#private" };
+	for (int i = 0; i < 2 && it == s_methods.end(); ++i)
+		it = s_methods.find(prefix + handles[i] + path);
+	if (it == s_methods.end())
+		return 0;
+
+	const StubMethod& entry = it->second;
+	LSMessage* message = new LSMessage;
+	message->refs = 1;
+	message->handle = entry.handle;
+	message->payload = payload;
+	message->category = entry.category;
+	message->method = entry.method;
+	message->replies = 0;
+
+	CategoryDataMap::const_iterator data = s_categoryData.find(HandleKey(entry.handle, entry.category));
+	(void) entry.function(entry.handle, message, data != s_categoryData.end() ? data->second : 0);
+
+	r_reply = message->reply;
+	return message;
+}
+
+bool lsStubCall(const char* serviceName, const char* path, const char* payload, std::string& r_reply)
+{
+	LSMessage* message = dispatch(serviceName, path, payload, r_reply);
+	if (!message)
+		return false;
+
+	LSMessageUnref(message);
+	return true;
+}
+
+LSMessage* lsStubSubscribe(const char* serviceName, const char* path, const char* payload, std::string& r_reply)
+{
+	return dispatch(serviceName, path, payload, r_reply);
+}
+
+unsigned int lsStubReplyCount(LSMessage* message)
+{
+	return message->replies;
+}
+
+void lsStubCancel(LSMessage* message)
+{
+	for (SubscriptionMap::iterator it = s_subscriptions.begin(); it != s_subscriptions.end(); ++it) {
+		std::vector<LSMessage*>& messages = it->second;
+		std::vector<LSMessage*>::iterator found = std::find(messages.begin(), messages.end(), message);
+		if (found == messages.end())
+			continue;
+		messages.erase(found);
+		LSMessageUnref(message);
+	}
+
+	LSHandle* sh = message->handle;
+	if (sh->cancelFunction)
+		(void) sh->cancelFunction(sh, message, sh->cancelData);
+	LSMessageUnref(message);
+}
+
+bool LSErrorInit(LSError* lserror)
+{
+	memset(lserror, 0, sizeof(*lserror));
+	return true;
+}
+
+void LSErrorFree(LSError* lserror)
+{
+	memset(lserror, 0, sizeof(*lserror));
+}
+
+bool LSErrorIsSet(LSError* lserror)
+{
+	return false;
+}
+
+void LSErrorPrint(LSError* lserror, FILE* out)
+{
+}
+
+bool LSRegisterPalmService(const char* name, LSPalmService** ret_palm_service, LSError* lserror)
+{
+	LSPalmService* psh = new LSPalmService;
+	psh->name = name;
+	psh->publicHandle.service = psh;
+	psh->publicHandle.isPublic = true;
+	psh->publicHandle.cancelFunction = 0;
+	psh->publicHandle.cancelData = 0;
+	psh->privateHandle = psh->publicHandle;
+	psh->privateHandle.isPublic = false;
+
+	*ret_palm_service = psh;
+	return true;
+}
+
+bool LSUnregisterPalmService(LSPalmService* psh, LSError* lserror)
+{
+	return true;
+}
+
+bool LSGmainAttachPalmService(LSPalmService* psh, GMainLoop* mainLoop, LSError* lserror)
+{
+	return true;
+}
+
+LSHandle* LSPalmServiceGetPublicConnection(LSPalmService* psh)
+{
+	return &psh->publicHandle;
+}
+
+LSHandle* LSPalmServiceGetPrivateConnection(LSPalmService* psh)
+{
+	return &psh->privateHandle;
+}
+
+bool LSPalmServiceRegisterCategory(LSPalmService* psh, const char* category, LSMethod* methods_public,
+								   LSMethod* methods_private, LSSignal* signals, void* category_user_data,
+								   LSError* lserror)
+{
+	// the public methods can be called on the private bus as well
+	addMethods(&psh->publicHandle, category, methods_public);
+	addMethods(&psh->privateHandle, category, methods_public);
+	addMethods(&psh->privateHandle, category, methods_private);
+
+	s_categoryData[HandleKey(&psh->publicHandle, category)] = category_user_data;
+	s_categoryData[HandleKey(&psh->privateHandle, category)] = category_user_data;
+	return true;
+}
+
+bool LSRegisterCategory(LSHandle* sh, const char* category, LSMethod* methods, LSSignal* signals,
+						LSProperty* properties, LSError* lserror)
+{
+	addMethods(sh, category, methods);
+	return true;
+}
+
+bool LSCategorySetData(LSHandle* sh, const char* category, void* user_data, LSError* lserror)
+{
+	s_categoryData[HandleKey(sh, category)] = user_data;
+	return true;
+}
+
+void LSMessageRef(LSMessage* message)
+{
+	++message->refs;
+}
+
+void LSMessageUnref(LSMessage* message)
+{
+	if (--message->refs == 0)
+		delete message;
+}
+
+const char* LSMessageGetPayload(LSMessage* message)
+{
+	return message->payload.c_str();
+}
+
+const char* LSMessageGetSender(LSMessage* message)
+{
+	return ":1.bench";
+}
+
+const char* LSMessageGetSenderServiceName(LSMessage* message)
+{
+	return "com.palm.sysservice.bench";
+}
+
+const char* LSMessageGetApplicationID(LSMessage* message)
+{
+	return 0;
+}
+
+const char* LSMessageGetCategory(LSMessage* message)
+{
+	return message->category.c_str();
+}
+
+const char* LSMessageGetMethod(LSMessage* message)
+{
+	return message->method.c_str();
+}
+
+bool LSMessageIsHubErrorMessage(LSMessage* message)
+{
+	return false;
+}
+
+bool LSMessageIsSubscription(LSMessage* message)
+{
+	json_object* root = json_tokener_parse(message->payload.c_str());
+	if (!root)
+		return false;
+
+	json_object* subscribe = json_object_object_get(root, "subscribe");
+	bool subscription = subscribe && json_object_is_type(subscribe, json_type_boolean) &&
+						json_object_get_boolean(subscribe);
+	json_object_put(root);
+	return subscription;
+}
+
+bool LSMessageReply(LSHandle* sh, LSMessage* lsmsg, const char* replyPayload, LSError* lserror)
+{
+	lsmsg->reply = replyPayload;
+	++lsmsg->replies;
+	return true;
+}
+
+bool LSMessageRespond(LSMessage* message, const char* reply_payload, LSError* lserror)
+{
+	return LSMessageReply(message->handle, message, reply_payload, lserror);
+}
+
+bool LSCall(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback, void* user_data,
+			LSMessageToken* ret_token, LSError* lserror)
+{
+	if (ret_token)
+		*ret_token = ++s_lastToken;
+	return true;
+}
+
+bool LSCallOneReply(LSHandle* sh, const char* uri, const char* payload, LSFilterFunc callback, void* user_data,
+					LSMessageToken* ret_token, LSError* lserror)
+{
+	return LSCall(sh, uri, payload, callback, user_data, ret_token, lserror);
+}
+
+bool LSCallCancel(LSHandle* sh, LSMessageToken token, LSError* lserror)
+{
+	return true;
+}
+
+LSMessageToken LSMessageGetResponseToken(LSMessage* reply)
+{
+	return LSMESSAGE_TOKEN_INVALID;
+}
+
+bool LSSubscriptionAdd(LSHandle* sh, const char* key, LSMessage* message, LSError* lserror)
+{
+	LSMessageRef(message);
+	s_subscriptions[HandleKey(sh, key)].push_back(message);
+	return true;
+}
+
+bool LSSubscriptionAcquire(LSHandle* sh, const char* key, LSSubscriptionIter** ret_iter, LSError* lserror)
+{
+	LSSubscriptionIter* iter = new LSSubscriptionIter;
+	SubscriptionMap::const_iterator it = s_subscriptions.find(HandleKey(sh, key));
+	if (it != s_subscriptions.end())
+		iter->messages = it->second;
+	iter->next = 0;
+
+	*ret_iter = iter;
+	return true;
+}
+
+void LSSubscriptionRelease(LSSubscriptionIter* subscription_iter)
+{
+	delete subscription_iter;
+}
+
+bool LSSubscriptionHasNext(LSSubscriptionIter* iter)
+{
+	return iter->next < iter->messages.size();
+}
+
+LSMessage* LSSubscriptionNext(LSSubscriptionIter* iter)
+{
+	return iter->messages[iter->next++];
+}
+
+bool LSSubscriptionRespond(LSPalmService* psh, const char* key, const char* payload, LSError* lserror)
+{
+	LSHandle* handles[] = { &psh->publicHandle, &psh->privateHandle };
+	for (int i = 0; i < 2; ++i) {
+		SubscriptionMap::const_iterator it = s_subscriptions.find(HandleKey(handles[i], key));
+		if (it == s_subscriptions.end())
+			continue;
+		for (size_t j = 0; j < it->second.size(); ++j)
+			(void) LSMessageReply(handles[i], it->second[j], payload, lserror);
+	}
+	return true;
+}
+
+bool LSSubscriptionSetCancelFunction(LSHandle* sh, LSCancelFunction cancelFunction, void* ctx, LSError* lserror)
+{
+	sh->cancelFunction = cancelFunction;
+	sh->cancelData = ctx;
+	return true;
+}
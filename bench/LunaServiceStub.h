@@ -0,0 +1,49 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+#ifndef LUNASERVICESTUB_H
+#define LUNASERVICESTUB_H
+
+#include <string>
+
+#include <luna-service2/lunaservice.h>
+
+/*
+ * Stands in for luna-service2 in sysservice-bench. Categories registered on a handle are kept in process, and
+ * lsStubCall() hands a method a message the way the hub would deliver it. There is no bus: LSCall() succeeds
+ * but never gets an answer, and the stub itself never fails a call. "subscribe":true in a payload makes the
+ * message a subscription, as with the real library
+ */
+
+// calls path ("/category/method") on the service's public handle, or else its private one. False if no such
+// method is registered; r_reply is the last reply the method sent (empty if it didn't reply before returning)
+bool lsStubCall(const char* serviceName, const char* path, const char* payload, std::string& r_reply);
+
+// as lsStubCall(), but the message is kept, so the replies that follow can be counted. Null if the method
+// doesn't exist
+LSMessage* lsStubSubscribe(const char* serviceName, const char* path, const char* payload, std::string& r_reply);
+// replies made to message so far, including the first
+unsigned int lsStubReplyCount(LSMessage* message);
+// the client went away: drops the message from its subscriptions, runs the handle's cancel function and
+// releases it
+void lsStubCancel(LSMessage* message);
+
+#endif /* LUNASERVICESTUB_H */
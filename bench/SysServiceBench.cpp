@@ -0,0 +1,493 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+/*
+ * sysservice-bench: the service's request paths run in process, without a bus. The handlers are registered
+ * on the luna-service stub (LunaServiceStub.cpp) as Main.cpp would register them and called directly with
+ * messages, against a scratch prefs db in a temporary directory. Reported per call: mean, p50 and p99 in ns
+ * and allocations (operator new) per call.
+ *
+ *  - PrefsDb::setPref/getPref, sqlite and the in-memory cache on their own
+ *  - /setPreferences and /getPreferences through the handler entry points
+ *  - /setPreferences with subscribers on the key, up to the point the change is delivered to all of them
+ *  - /timezone/getTimeZoneRules, full and compact, for a few zones over ten years
+ *  - /time/convertDate for one date and a batch of them
+ *  - ImageServices::ezResize of a wallpaper-sized jpeg (generated in the scratch dir) down to a thumbnail
+ *
+ * Before timing anything it checks a few behaviours the fast paths must not lose (a failed check fails the
+ * run like a failed call does):
+ *
+ *  - a stepped restore from a backup that lacks a default key puts that key back
+ *  - a value with trailing garbage after its json ("1 abc") is not handed out as json
+ *
+ * Usage: sysservice-bench [iterations] [subscribers]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <glib.h>
+#include <json.h>
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QtGui/QImage>
+
+#include "ImageServices.h"
+#include "LunaServiceStub.h"
+#include "PrefsDb.h"
+#include "PrefsFactory.h"
+#include "TimeZoneService.h"
+
+// Main.cpp isn't linked in
+GMainLoop* g_gmainLoop = NULL;
+
+static const char* s_serviceName = "com.palm.systemservice";
+
+static unsigned long s_allocs = 0;
+
+void* operator new(size_t size)
+{
+	++s_allocs;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		abort();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
+
+static long long monotonicNsecs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// whatever the handlers left for the main loop (notification flushes, mostly)
+static void runIdle()
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+static bool replySucceeded(const std::string& reply)
+{
+	json_object* root = json_tokener_parse(reply.c_str());
+	if (!root)
+		return false;
+
+	json_object* label = json_object_object_get(root, "returnValue");
+	bool ok = label && json_object_get_boolean(label);
+	json_object_put(root);
+	return ok;
+}
+
+static bool s_failed = false;
+
+// one line of results; samples are sorted in place
+static void report(const char* name, std::vector<long long>& samples, unsigned long allocs)
+{
+	if (samples.empty())
+		return;
+
+	long long total = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+		total += samples[i];
+	std::sort(samples.begin(), samples.end());
+
+	printf("%-34s %7zu calls %10.0f ns mean %10lld p50 %10lld p99 %8.2f allocs\n", name, samples.size(),
+		   (double) total / samples.size(), samples[samples.size() / 2], samples[(samples.size() * 99) / 100],
+		   (double) allocs / samples.size());
+}
+
+// each payload in turn, iterations times; the first reply has to be a success
+static void benchCall(const char* name, const char* path, const std::vector<std::string>& payloads,
+					  int iterations, bool drainIdle = false)
+{
+	std::vector<long long> samples;
+	samples.reserve(iterations);
+	std::string reply;
+	reply.reserve(4096);
+
+	if (!lsStubCall(s_serviceName, path, payloads[0].c_str(), reply) || !replySucceeded(reply)) {
+		printf("%-34s FAILED: %s\n", name, reply.c_str());
+		s_failed = true;
+		return;
+	}
+	runIdle();
+
+	unsigned long allocs = s_allocs;
+	for (int i = 0; i < iterations; ++i) {
+		long long start = monotonicNsecs();
+		(void) lsStubCall(s_serviceName, path, payloads[i % payloads.size()].c_str(), reply);
+		if (drainIdle)
+			runIdle();
+		samples.push_back(monotonicNsecs() - start);
+	}
+
+	report(name, samples, s_allocs - allocs);
+}
+
+static void check(const char* name, bool ok)
+{
+	printf("%-34s %s\n", name, ok ? "ok" : "FAILED");
+	if (!ok)
+		s_failed = true;
+}
+
+static void cbCheckMergeDone(bool ok, int merged, void* data)
+{
+	*static_cast<int*>(data) = ok ? 1 : -1;
+}
+
+// the first key of the defaults file, "" if there is no such file here
+static std::string firstDefaultKey()
+{
+	std::string key;
+	json_object* root = json_object_from_file(const_cast<char*>(PrefsDb::s_defaultPrefsFile));
+	if (!root)
+		return key;
+
+	json_object* prefs = json_object_object_get(root, "preferences");
+	if (prefs && json_object_is_type(prefs, json_type_object)) {
+		json_object_object_foreach(prefs, name, value) {
+			(void) value;
+			key = name;
+			break;
+		}
+	}
+	json_object_put(root);
+	return key;
+}
+
+static bool runSql(const std::string& dbPath, const char* sql)
+{
+	sqlite3* db = NULL;
+	bool ok = (sqlite3_open(dbPath.c_str(), &db) == SQLITE_OK) && (sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK);
+	sqlite3_close(db);
+	return ok;
+}
+
+// a backup from an older build may not have every default key; the restore has to leave the db with all of them
+static void checkRestoreKeepsDefaults(const std::string& dir, const std::string& dbPath)
+{
+	const char* name = "restore keeps default keys";
+	std::string key = firstDefaultKey();
+	if (key.empty()) {
+		printf("%-34s skipped: no %s\n", name, PrefsDb::s_defaultPrefsFile);
+		return;
+	}
+
+	// take the key out behind PrefsDb's back, as an older db would be missing it, and write a backup without it
+	std::string backupPath = dir + "/backup.db";
+	char* remove = sqlite3_mprintf("DELETE FROM Preferences WHERE key=%Q", key.c_str());
+	bool ok = runSql(dbPath, remove) &&
+			  runSql(backupPath, "CREATE TABLE Preferences (key TEXT NOT NULL ON CONFLICT FAIL UNIQUE ON CONFLICT REPLACE, value TEXT);"
+								 "INSERT INTO Preferences VALUES ('databaseVersion', '1.0');"
+								 "INSERT INTO Preferences VALUES ('bench.restored', 'true');");
+	sqlite3_free(remove);
+	PrefsDb::instance()->refreshCache();
+
+	int done = 0;
+	if (!ok || !PrefsDb::instance()->mergeInSteps(backupPath, NULL, cbCheckMergeDone, &done)) {
+		check(name, false);
+		(void) unlink(backupPath.c_str());
+		return;
+	}
+	while (!done)
+		g_main_context_iteration(NULL, TRUE);
+	(void) unlink(backupPath.c_str());
+
+	std::string value;
+	check(name, done > 0 && PrefsDb::instance()->getPref(key, value) && PrefsDb::instance()->getPref("bench.restored", value));
+}
+
+// getPreferences splices values into its reply as they are, so only a value that is json as a whole may go in
+static void checkTrailingGarbage()
+{
+	PrefsDb* db = PrefsDb::instance();
+	(void) db->setPref("bench.json", "1");
+	(void) db->setPref("bench.garbage", "1 abc");
+
+	std::list<std::string> keys;
+	keys.push_back("bench.json");
+	keys.push_back("bench.garbage");
+	std::list<std::string> invalidKeys;
+	std::map<std::string, std::string> values = db->getJsonPrefs(keys, invalidKeys);
+
+	check("trailing garbage is not json", values.size() == 1 && values.count("bench.json") == 1 &&
+		  invalidKeys.size() == 1 && invalidKeys.front() == "bench.garbage");
+}
+
+static void benchPrefsDb(int iterations)
+{
+	PrefsDb* db = PrefsDb::instance();
+	std::vector<std::string> keys;
+	std::vector<std::string> values;
+	for (int i = 0; i < 64; ++i) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "bench.db.%d", i);
+		keys.push_back(buf);
+		snprintf(buf, sizeof(buf), "\"value %d\"", i);
+		values.push_back(buf);
+	}
+
+	std::vector<long long> samples;
+	samples.reserve(iterations);
+
+	unsigned long allocs = s_allocs;
+	for (int i = 0; i < iterations; ++i) {
+		long long start = monotonicNsecs();
+		(void) db->setPref(keys[i % keys.size()], values[i % values.size()]);
+		samples.push_back(monotonicNsecs() - start);
+	}
+	report("PrefsDb::setPref", samples, s_allocs - allocs);
+
+	std::string value;
+	value.reserve(64);
+	samples.clear();
+	allocs = s_allocs;
+	for (int i = 0; i < iterations; ++i) {
+		long long start = monotonicNsecs();
+		(void) db->getPref(keys[i % keys.size()], value);
+		samples.push_back(monotonicNsecs() - start);
+	}
+	report("PrefsDb::getPref", samples, s_allocs - allocs);
+}
+
+static void benchPreferences(int iterations, int subscribers)
+{
+	std::vector<std::string> sets;
+	for (int i = 0; i < 64; ++i) {
+		char buf[128];
+		snprintf(buf, sizeof(buf), "{\"bench.pref.%d\": {\"value\": %d, \"name\": \"bench %d\"}}", i % 8, i, i);
+		sets.push_back(buf);
+	}
+	benchCall("/setPreferences", "/setPreferences", sets, iterations, true);
+
+	std::vector<std::string> gets;
+	gets.push_back("{\"keys\": [\"bench.pref.0\"]}");
+	gets.push_back("{\"keys\": [\"bench.pref.1\", \"bench.pref.2\", \"bench.pref.3\", \"bench.pref.4\"]}");
+	benchCall("/getPreferences", "/getPreferences", gets, iterations);
+
+	// everyone watches bench.pref.0; half of them get one reply per key
+	std::vector<LSMessage*> watchers;
+	std::string reply;
+	for (int i = 0; i < subscribers; ++i) {
+		const char* payload = (i % 2) ? "{\"subscribe\": true, \"keys\": [\"bench.pref.0\"], \"mergeNotifications\": false}"
+									  : "{\"subscribe\": true, \"keys\": [\"bench.pref.0\", \"bench.pref.1\"]}";
+		LSMessage* message = lsStubSubscribe(s_serviceName, "/getPreferences", payload, reply);
+		if (message)
+			watchers.push_back(message);
+	}
+
+	std::vector<std::string> changes;
+	for (int i = 0; i < 16; ++i) {
+		char buf[96];
+		snprintf(buf, sizeof(buf), "{\"bench.pref.0\": %d, \"bench.pref.1\": \"v%d\"}", i, i);
+		changes.push_back(buf);
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "/setPreferences (%zu subscribers)", watchers.size());
+	benchCall(name, "/setPreferences", changes, iterations, true);
+
+	unsigned long delivered = 0;
+	for (size_t i = 0; i < watchers.size(); ++i)
+		delivered += lsStubReplyCount(watchers[i]) - 1;
+	printf("%-34s %lu notifications delivered\n", "", delivered);
+
+	for (size_t i = 0; i < watchers.size(); ++i)
+		lsStubCancel(watchers[i]);
+}
+
+static void benchTimeZones(int iterations)
+{
+	static const char* zones[] = { "America/New_York", "Europe/Helsinki", "Australia/Sydney", "Asia/Tokyo" };
+
+	std::string entries;
+	for (size_t i = 0; i < sizeof(zones) / sizeof(zones[0]); ++i) {
+		entries += i ? ", " : "";
+		entries += std::string("{\"tz\": \"") + zones[i] + "\", \"years\": [";
+		for (int year = 2010; year < 2020; ++year) {
+			char buf[16];
+			snprintf(buf, sizeof(buf), "%s%d", year > 2010 ? ", " : "", year);
+			entries += buf;
+		}
+		entries += "]}";
+	}
+
+	std::vector<std::string> rules(1, "{\"entries\": [" + entries + "]}");
+	benchCall("/timezone/getTimeZoneRules", "/timezone/getTimeZoneRules", rules, iterations);
+
+	std::vector<std::string> compact(1, "{\"compact\": true, \"entries\": [" + entries + "]}");
+	benchCall("/timezone/getTimeZoneRules compact", "/timezone/getTimeZoneRules", compact, iterations);
+
+	std::vector<std::string> dates;
+	dates.push_back("{\"date\": \"1982-12-06 17:25:33\", \"source_tz\": \"America/Los_Angeles\", \"dest_tz\": \"America/New_York\"}");
+	dates.push_back("{\"date\": \"2015-07-01 09:00:00\", \"source_tz\": \"Europe/Helsinki\", \"dest_tz\": \"Australia/Sydney\"}");
+	benchCall("/time/convertDate", "/time/convertDate", dates, iterations);
+
+	std::string batch = "{\"dates\": [";
+	for (int i = 0; i < 16; ++i) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%s\"20%02d-03-%02d 02:30:00\"", i ? ", " : "", 10 + i, 1 + i);
+		batch += buf;
+	}
+	batch += "], \"source_tz\": \"America/Los_Angeles\", \"dest_tz\": \"Europe/London\"}";
+	std::vector<std::string> batches(1, batch);
+	benchCall("/time/convertDate (16 dates)", "/time/convertDate", batches, iterations);
+}
+
+class BenchMainLoop : public MainLoopProvider
+{
+public:
+	virtual GMainLoop* getMainLoopPtr() { return g_gmainLoop; }
+};
+
+// a decode and an encode per call, so far fewer of them than of the other calls
+static void benchImages(const std::string& dir, int iterations)
+{
+	const char* name = "ImageServices::ezResize";
+	static BenchMainLoop mainLoop;
+	ImageServices* images = ImageServices::instance(&mainLoop);
+
+	// photo-like rather than flat, or the jpeg decodes unrealistically fast
+	QImage photo(1920, 1080, QImage::Format_RGB32);
+	for (int y = 0; y < photo.height(); ++y) {
+		QRgb* line = reinterpret_cast<QRgb*>(photo.scanLine(y));
+		for (int x = 0; x < photo.width(); ++x) {
+			int noise = (x * 7919 + y * 104729) % 32;
+			line[x] = qRgb((x * 255 / photo.width() + noise) & 0xff, (y * 255 / photo.height() + noise) & 0xff,
+						   ((x + y) / 8 + noise) & 0xff);
+		}
+	}
+	std::string src = dir + "/bench.jpg";
+	std::string dest = dir + "/bench-thumb.jpg";
+	if (!images || !images->isValid() || !photo.save(QString::fromStdString(src), "JPEG", 90)) {
+		check(name, false);
+		return;
+	}
+
+	int calls = std::max(iterations / 100, 10);
+	std::vector<long long> samples;
+	samples.reserve(calls);
+	std::string errorText;
+
+	unsigned long allocs = s_allocs;
+	for (int i = 0; i < calls; ++i) {
+		long long start = monotonicNsecs();
+		bool ok = images->ezResize(src, dest, "jpg", 320, 320, errorText);
+		samples.push_back(monotonicNsecs() - start);
+		if (!ok) {
+			printf("%-34s FAILED: %s\n", name, errorText.c_str());
+			s_failed = true;
+			break;
+		}
+	}
+	report(name, samples, s_allocs - allocs);
+}
+
+int main(int argc, char** argv)
+{
+	int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+	int subscribers = (argc > 2) ? atoi(argv[2]) : 32;
+
+	if (iterations < 1 || subscribers < 0) {
+		printf("Usage: sysservice-bench [iterations] [subscribers]\n");
+		return 1;
+	}
+
+	// as in Main.cpp; the image format plugins are found through it
+	QCoreApplication app(argc, argv);
+
+	// a scratch db, so the run neither needs nor touches the real one
+	gchar* dir = g_strdup("/tmp/sysservice-bench-XXXXXX");
+	if (!g_mkdtemp(dir)) {
+		printf("Failed to create a scratch directory\n");
+		return 1;
+	}
+	std::string dbPath = std::string(dir) + "/systemprefs.db";
+	PrefsDb::s_prefsPath = dir;
+	PrefsDb::s_prefsDbPath = dbPath.c_str();
+
+	g_gmainLoop = g_main_loop_new(NULL, FALSE);
+
+	LSPalmService* service = NULL;
+	LSError lsError;
+	LSErrorInit(&lsError);
+	(void) LSRegisterPalmService(s_serviceName, &service, &lsError);
+
+	long long start = monotonicNsecs();
+	(void) PrefsDb::instance();
+	PrefsFactory::instance()->setServiceHandle(service);
+	TimeZoneService::instance()->setServiceHandle(service);
+	runIdle();
+	printf("%-34s %10.2f ms\n", "startup (db, handlers)", (monotonicNsecs() - start) / 1e6);
+
+	checkRestoreKeepsDefaults(dir, dbPath);
+	checkTrailingGarbage();
+
+	benchPrefsDb(iterations);
+	benchPreferences(iterations, subscribers);
+	benchTimeZones(iterations);
+	benchImages(dir, iterations);
+
+	// the db, its wal and the markers PrefsDb keeps next to it
+	PrefsDb::instance()->shutdown();
+	GDir* scratch = g_dir_open(dir, 0, NULL);
+	if (scratch) {
+		const gchar* file;
+		while ((file = g_dir_read_name(scratch)) != NULL) {
+			gchar* path = g_build_filename(dir, file, NULL);
+			(void) unlink(path);
+			g_free(path);
+		}
+		g_dir_close(scratch);
+	}
+	(void) rmdir(dir);
+	g_free(dir);
+
+	return s_failed ? 1 : 0;
+}
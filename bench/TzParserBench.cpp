@@ -0,0 +1,208 @@
+/****************************************************************
+ * @@@LICENSE
+ *
+ *  Copyright (c) 2013-2014 LG Electronics, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * LICENSE@@@
+ ****************************************************************/
+
+
+/*
+ * tzparser-bench: loads every zone under /usr/share/zoneinfo through loadTimeZone() and reports
+ *
+ *  - cold: the first load of each zone, which maps and decodes the file (the page cache may well be warm;
+ *    it's the parser's own cache that is empty)
+ *  - warm: the loads after that, which only stat the file and hit the parser's cache
+ *  - rules: the per-year lookups getTimeZoneRules makes for each zone (transitionsForYear(), falling back
+ *    to lastTransitionUpToYear()), over a range of years
+ *
+ * as ns and heap allocations per zone. Allocations are counted by replacing the global operator new.
+ *
+ * Usage: tzparser-bench [warm passes] [first year] [last year]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <time.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include "TzParser.h"
+
+static const char* s_zoneInfoDir = "/usr/share/zoneinfo";
+
+static unsigned long s_allocs = 0;
+
+void* operator new(size_t size)
+{
+	++s_allocs;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		abort();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
+
+static std::vector<std::string> s_zones;
+
+static long long monotonicNsecs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool isTzFile(const char* path)
+{
+	char magic[4];
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	bool ok = (read(fd, magic, sizeof(magic)) == (ssize_t) sizeof(magic) && memcmp(magic, "TZif", 4) == 0);
+	close(fd);
+	return ok;
+}
+
+static int cbZoneFile(const char* path, const struct stat*, int type, struct FTW*)
+{
+	if (type != FTW_F)
+		return 0;
+
+	// the zone name, as getTimeZoneRules would be given it; the posix/ and right/ trees are copies
+	const char* name = path + strlen(s_zoneInfoDir) + 1;
+	if (strncmp(name, "posix/", 6) == 0 || strncmp(name, "right/", 6) == 0)
+		return 0;
+
+	if (isTzFile(path))
+		s_zones.push_back(name);
+	return 0;
+}
+
+static void report(const char* what, unsigned long count, long long nsecs, unsigned long allocs)
+{
+	if (!count)
+		count = 1;
+	printf("%-6s %8.2f ms  %10.0f ns/zone  %8.2f allocs/zone\n", what, nsecs / 1e6,
+		   (double) nsecs / count, (double) allocs / count);
+}
+
+// what TimeZoneService::getTimeZoneRule() reads for one year
+static bool expandYear(const TzZone& zone, int year, time_t& r_dstStart)
+{
+	const TzTransition* first = 0;
+	const TzTransition* last = 0;
+
+	r_dstStart = -1;
+	if (zone.transitionsForYear(year, first, last)) {
+		for (const TzTransition* trans = first; trans != last; ++trans) {
+			if (trans->isDst)
+				r_dstStart = trans->time;
+		}
+		return true;
+	}
+
+	return zone.lastTransitionUpToYear(year) != 0;
+}
+
+int main(int argc, char** argv)
+{
+	int warmPasses = (argc > 1) ? atoi(argv[1]) : 10;
+	int firstYear = (argc > 2) ? atoi(argv[2]) : 1970;
+	int lastYear = (argc > 3) ? atoi(argv[3]) : 2037;
+
+	if (warmPasses < 1 || lastYear < firstYear) {
+		printf("Usage: tzparser-bench [warm passes] [first year] [last year]\n");
+		return 1;
+	}
+
+	if (nftw(s_zoneInfoDir, cbZoneFile, 16, FTW_PHYS) != 0 || s_zones.empty()) {
+		printf("no zones found under %s\n", s_zoneInfoDir);
+		return 1;
+	}
+
+	std::vector<TzZonePtr> zones;
+	zones.reserve(s_zones.size());
+
+	unsigned long allocs = s_allocs;
+	long long start = monotonicNsecs();
+	for (size_t i = 0; i < s_zones.size(); ++i)
+		zones.push_back(loadTimeZone(s_zones[i].c_str()));
+	long long coldNsecs = monotonicNsecs() - start;
+	unsigned long coldAllocs = s_allocs - allocs;
+
+	unsigned long loaded = 0;
+	for (size_t i = 0; i < zones.size(); ++i) {
+		if (zones[i])
+			++loaded;
+	}
+
+	const TzParserStats& stats = tzParserStats();
+	printf("%lu of %zu zones loaded, %lu transitions (%.1f per zone)\n", loaded, s_zones.size(),
+		   stats.transitions, (double) stats.transitions / (loaded ? loaded : 1));
+	report("cold", s_zones.size(), coldNsecs, coldAllocs);
+
+	allocs = s_allocs;
+	start = monotonicNsecs();
+	for (int pass = 0; pass < warmPasses; ++pass) {
+		for (size_t i = 0; i < s_zones.size(); ++i)
+			(void) loadTimeZone(s_zones[i].c_str());
+	}
+	report("warm", s_zones.size() * warmPasses, monotonicNsecs() - start, s_allocs - allocs);
+
+	// the years are a per-zone batch, like one getTimeZoneRules entry asking for all of them
+	unsigned long found = 0;
+	time_t checksum = 0;
+	allocs = s_allocs;
+	start = monotonicNsecs();
+	for (size_t i = 0; i < zones.size(); ++i) {
+		if (!zones[i])
+			continue;
+		for (int year = firstYear; year <= lastYear; ++year) {
+			time_t dstStart;
+			if (expandYear(*zones[i], year, dstStart)) {
+				++found;
+				checksum += dstStart;
+			}
+		}
+	}
+	long long rulesNsecs = monotonicNsecs() - start;
+	report("rules", loaded, rulesNsecs, s_allocs - allocs);
+	printf("       %d-%d: %lu zone years found, %.1f ns/zone year (checksum %lld)\n", firstYear, lastYear,
+		   found, (double) rulesNsecs / ((unsigned long) (lastYear - firstYear + 1) * (loaded ? loaded : 1)),
+		   (long long) checksum);
+
+	return 0;
+}